@@ -0,0 +1,24 @@
+#include "avatarimage.h"
+#include <QBuffer>
+
+QImage AvatarImage::cropToSquare(const QImage &image) {
+    if (image.isNull()) return image;
+
+    int size = qMin(image.width(), image.height());
+    int x = (image.width() - size) / 2;
+    int y = (image.height() - size) / 2;
+
+    return image.copy(x, y, size, size);
+}
+
+QByteArray AvatarImage::encodePng(const QImage &image, int edge) {
+    QByteArray png;
+    if (image.isNull()) {
+        return png;
+    }
+    QImage scaled = cropToSquare(image).scaled(edge, edge, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+    scaled.save(&buffer, "PNG");
+    return png;
+}
@@ -0,0 +1,19 @@
+#ifndef AVATARIMAGE_H
+#define AVATARIMAGE_H
+
+#include <QImage>
+#include <QByteArray>
+
+// 头像处理：居中裁成正方形，缩放后编码为 PNG 放进消息。
+// 只使用 QImage，不依赖 GUI 线程。
+class AvatarImage {
+public:
+    static constexpr int messageEdge = 32;
+
+    static QImage cropToSquare(const QImage &image);
+
+    // 裁剪、缩放到 edge 像素并编码为 PNG；图片为空时返回空
+    static QByteArray encodePng(const QImage &image, int edge = messageEdge);
+};
+
+#endif // AVATARIMAGE_H
@@ -0,0 +1,401 @@
+#include "base64codec.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BASE64CODEC_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define BASE64CODEC_TARGET_SSSE3
+#define BASE64CODEC_TARGET_AVX2
+#else
+#define BASE64CODEC_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define BASE64CODEC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+// 编码：返回消耗的输入字节数（3 的倍数），dst 写入其 4/3 个字符。
+// 解码：返回消耗的字符数（4 的倍数），遇到含非 base64 字符的块就停下；
+// dst 写入其 3/4 个字节，向量实现会在后面多写最多 decodeSlack 个字节
+using EncodeFn = qsizetype (*)(const uchar *src, qsizetype len, char16_t *dst);
+using DecodeFn = qsizetype (*)(const char16_t *src, qsizetype len, uchar *dst);
+
+const int decodeSlack = 8;
+
+const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+constexpr std::array<qint8, 128> makeDecodeTable() {
+    std::array<qint8, 128> table{};
+    for (qint8 &value : table) {
+        value = -1;
+    }
+    for (int i = 0; i < 64; ++i) {
+        table[size_t(alphabet[i])] = qint8(i);
+    }
+    return table;
+}
+
+constexpr std::array<qint8, 128> decodeTable = makeDecodeTable();
+
+qsizetype encodeScalar(const uchar *src, qsizetype len, char16_t *dst) {
+    qsizetype i = 0;
+    for (; i + 3 <= len; i += 3) {
+        quint32 value = quint32(src[i]) << 16 | quint32(src[i + 1]) << 8 | src[i + 2];
+        dst[0] = char16_t(alphabet[value >> 18]);
+        dst[1] = char16_t(alphabet[(value >> 12) & 0x3f]);
+        dst[2] = char16_t(alphabet[(value >> 6) & 0x3f]);
+        dst[3] = char16_t(alphabet[value & 0x3f]);
+        dst += 4;
+    }
+    return i;
+}
+
+qsizetype decodeScalar(const char16_t *, qsizetype, uchar *) {
+    return 0;    // 全部交给 Decoder 里逐字符的循环
+}
+
+#ifdef BASE64CODEC_X86
+
+// 向量算法见 Wojciech Muła 和 Daniel Lemire 的 "Faster Base64 Encoding and Decoding Using AVX2 Instructions"。
+// 编码：每 3 字节重排成 4 个 6 位的索引，再按区间加偏移得到字符
+
+// 12 字节（每个 32 位单元 3 字节）拆成 16 个 6 位索引
+BASE64CODEC_TARGET_SSSE3 inline __m128i encodeIndices128(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// 索引 0..25 -> 'A'，26..51 -> 'a' - 26，52..61 -> '0' - 52，62 -> '+'，63 -> '/'
+BASE64CODEC_TARGET_SSSE3 inline __m128i encodeChars128(__m128i indices) {
+    __m128i offsets = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    offsets = _mm_or_si128(offsets, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    const __m128i shiftLut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(shiftLut, offsets), indices);
+}
+
+// 每次读 16 字节、用 12 字节，最后不足 16 字节的部分交给标量
+BASE64CODEC_TARGET_SSSE3 qsizetype encodeSsse3(const uchar *src, qsizetype len, char16_t *dst) {
+    const __m128i zero = _mm_setzero_si128();
+    qsizetype i = 0;
+    while (i + 16 <= len) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i chars = encodeChars128(encodeIndices128(in));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi8(chars, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8), _mm_unpackhi_epi8(chars, zero));
+        i += 12;
+        dst += 16;
+    }
+    return i + encodeScalar(src + i, len - i, dst);
+}
+
+// 解码：按高低半字节查表判断合法性，按高半字节（'/' 单独处理）加偏移还原 6 位值，再拼成字节。
+// 16 个字符 -> 12 字节（存在低 12 字节）；含非法字符时返回 false
+BASE64CODEC_TARGET_SSSE3 inline bool decodeBlock128(__m128i in, __m128i *out) {
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+    __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibbleMask);
+    __m128i loNibbles = _mm_and_si128(in, nibbleMask);
+    __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+    __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff) {
+        return false;
+    }
+    __m128i isSlash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(isSlash, hiNibbles));
+    __m128i values = _mm_add_epi8(in, roll);
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    *out = _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return true;
+}
+
+// UTF-16 先饱和压成字节：大于 255 的变成 255 或 0，都是非法字符
+BASE64CODEC_TARGET_SSSE3 qsizetype decodeSsse3(const char16_t *src, qsizetype len, uchar *dst) {
+    qsizetype i = 0;
+    while (i + 16 <= len) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+        __m128i bytes;
+        if (!decodeBlock128(_mm_packus_epi16(a, b), &bytes)) {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), bytes);
+        i += 16;
+        dst += 12;
+    }
+    return i;
+}
+
+// AVX2 每条 128 位通道各处理 12 字节：两次 16 字节读入分别放进高低通道
+BASE64CODEC_TARGET_AVX2 qsizetype encodeAvx2(const uchar *src, qsizetype len, char16_t *dst) {
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                             1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shiftLut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                              'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    qsizetype i = 0;
+    while (i + 28 <= len) {
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 12));
+        __m256i in = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1), shuffle);
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i offsets = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        offsets = _mm256_or_si256(offsets, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+        __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(shiftLut, offsets), indices);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(chars)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 16),
+                            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(chars, 1)));
+        i += 24;
+        dst += 32;
+    }
+    return i + encodeSsse3(src + i, len - i, dst);
+}
+
+BASE64CODEC_TARGET_AVX2 qsizetype decodeAvx2(const char16_t *src, qsizetype len, uchar *dst) {
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+
+    qsizetype i = 0;
+    while (i + 32 <= len) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 16));
+        // packus 按通道交错，再把 64 位段换回原来的顺序
+        __m256i in = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+
+        __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibbleMask);
+        __m256i loNibbles = _mm256_and_si256(in, nibbleMask);
+        __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        __m256i isSlash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(isSlash, hiNibbles));
+        __m256i values = _mm256_add_epi8(in, roll);
+        __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+        __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(words, pack),
+                                                    _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), bytes);
+        i += 32;
+        dst += 24;
+    }
+    return i + decodeSsse3(src + i, len - i, dst);
+}
+
+#endif
+
+struct Kernels {
+    Base64Codec::Isa isa;
+    EncodeFn encode;
+    DecodeFn decode;
+};
+
+bool cpuHasAvx2() {
+#if defined(BASE64CODEC_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(BASE64CODEC_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = info[2] & (1 << 27);
+    bool avx = info[2] & (1 << 28);
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return false;
+#endif
+}
+
+bool cpuHasSsse3() {
+#if defined(BASE64CODEC_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+#elif defined(BASE64CODEC_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return info[2] & (1 << 9);
+#else
+    return false;
+#endif
+}
+
+Kernels kernelsFor(Base64Codec::Isa isa) {
+#ifdef BASE64CODEC_X86
+    if (isa == Base64Codec::Isa::Avx2 && cpuHasAvx2()) {
+        return {Base64Codec::Isa::Avx2, encodeAvx2, decodeAvx2};
+    }
+    if (isa != Base64Codec::Isa::Scalar && cpuHasSsse3()) {
+        return {Base64Codec::Isa::Ssse3, encodeSsse3, decodeSsse3};
+    }
+#else
+    Q_UNUSED(isa);
+#endif
+    return {Base64Codec::Isa::Scalar, encodeScalar, decodeScalar};
+}
+
+// 首次使用时按 CPU 选择一次
+Kernels &activeKernels() {
+    static Kernels kernels = kernelsFor(Base64Codec::Isa::Avx2);
+    return kernels;
+}
+
+}
+
+Base64Codec::Isa Base64Codec::activeIsa() {
+    return activeKernels().isa;
+}
+
+const char *Base64Codec::isaName(Isa isa) {
+    switch (isa) {
+    case Isa::Avx2:
+        return "AVX2";
+    case Isa::Ssse3:
+        return "SSSE3";
+    default:
+        return "Scalar";
+    }
+}
+
+void Base64Codec::setIsa(Isa isa) {
+    activeKernels() = kernelsFor(isa);
+}
+
+QString Base64Codec::encode(QByteArrayView data) {
+    QString result;
+    result.reserve(encodedLength(data.size()));
+    Encoder encoder(&result);
+    encoder.append(data);
+    encoder.finish();
+    return result;
+}
+
+QByteArray Base64Codec::decode(QStringView base64) {
+    QByteArray result;
+    result.reserve(base64.size() / 4 * 3 + 3 + decodeSlack);
+    Decoder decoder(&result);
+    decoder.append(base64);
+    return result;
+}
+
+void Base64Codec::Encoder::append(QByteArrayView data) {
+    const uchar *src = reinterpret_cast<const uchar *>(data.data());
+    qsizetype len = data.size();
+    if (pendingLength + len < 3) {
+        std::memcpy(pending + pendingLength, src, size_t(len));
+        pendingLength += int(len);
+        return;
+    }
+
+    // 按上限扩容后直接写进 QString 的缓冲区
+    qsizetype start = out->size();
+    out->resize(start + (pendingLength + len) / 3 * 4);
+    char16_t *begin = reinterpret_cast<char16_t *>(out->data()) + start;
+    char16_t *dst = begin;
+
+    if (pendingLength > 0) {
+        uchar triple[3] = {pending[0], pending[1], 0};
+        int take = 3 - pendingLength;
+        std::memcpy(triple + pendingLength, src, size_t(take));
+        encodeScalar(triple, 3, dst);
+        dst += 4;
+        src += take;
+        len -= take;
+        pendingLength = 0;
+    }
+
+    qsizetype consumed = activeKernels().encode(src, len, dst);
+    dst += consumed / 3 * 4;
+    std::memcpy(pending, src + consumed, size_t(len - consumed));
+    pendingLength = int(len - consumed);
+    out->resize(start + (dst - begin));
+}
+
+void Base64Codec::Encoder::finish() {
+    if (pendingLength == 0) {
+        return;
+    }
+    quint32 value = quint32(pending[0]) << 16 | (pendingLength == 2 ? quint32(pending[1]) << 8 : 0);
+    out->append(QChar(alphabet[value >> 18]));
+    out->append(QChar(alphabet[(value >> 12) & 0x3f]));
+    out->append(pendingLength == 2 ? QChar(alphabet[(value >> 6) & 0x3f]) : QChar('='));
+    out->append(QChar('='));
+    pendingLength = 0;
+}
+
+void Base64Codec::Decoder::append(QStringView base64) {
+    const char16_t *src = base64.utf16();
+    qsizetype len = base64.size();
+    qsizetype start = out->size();
+    out->resize(start + len / 4 * 3 + 3 + decodeSlack);
+    uchar *begin = reinterpret_cast<uchar *>(out->data()) + start;
+    uchar *dst = begin;
+    DecodeFn decodeBlocks = activeKernels().decode;
+
+    // 和 Qt 一样逐个累积 6 位，跳过非 base64 字符（包括 '=' 和空白）；
+    // 正好在 4 字符边界上时尝试整块解码
+    while (len > 0) {
+        if (bitCount == 0) {
+            qsizetype consumed = decodeBlocks(src, len, dst);
+            src += consumed;
+            len -= consumed;
+            dst += consumed / 4 * 3;
+            if (len == 0) {
+                break;
+            }
+        }
+        char16_t c = *src++;
+        --len;
+        int value = c < 128 ? decodeTable[c] : -1;
+        if (value < 0) {
+            continue;
+        }
+        bits = (bits << 6) | quint32(value);
+        bitCount += 6;
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            *dst++ = uchar(bits >> bitCount);
+            bits &= (1u << bitCount) - 1;
+        }
+    }
+    out->resize(start + (dst - begin));
+}
@@ -0,0 +1,55 @@
+#ifndef BASE64CODEC_H
+#define BASE64CODEC_H
+
+#include <QString>
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QStringView>
+
+// base64 编解码，结果与 QByteArray::toBase64() / fromBase64() 相同。
+// 整块数据用 SSSE3/AVX2 处理（运行时按 CPU 选择）：编码每次 12/24 字节，解码每次 16/32 个字符，
+// 块内有非 base64 字符（填充、空白等）时该块退回标量路径，和 Qt 一样跳过这些字符。
+// 编码直接写 UTF-16、解码直接读 UTF-16，旧版文本协议的消息不必先转成 Latin-1 副本；
+// Encoder/Decoder 可以分段输入，固定大小的缓冲区就能处理任意大的文件。
+class Base64Codec {
+public:
+    enum class Isa { Scalar, Ssse3, Avx2 };
+
+    static Isa activeIsa();
+    static const char *isaName(Isa isa);
+
+    // 强制使用某一实现（基准测试对比用）；CPU 不支持时退到可用的最高级别
+    static void setIsa(Isa isa);
+
+    static constexpr qsizetype encodedLength(qsizetype bytes) { return (bytes + 2) / 3 * 4; }
+
+    static QString encode(QByteArrayView data);
+    static QByteArray decode(QStringView base64);
+
+    // 分段编码，追加到 out 末尾。输入不必按 3 字节对齐，余下的字节留到下一次
+    class Encoder {
+    public:
+        explicit Encoder(QString *out) : out(out) {}
+        void append(QByteArrayView data);
+        void finish();      // 写出剩余字节和 '=' 填充
+
+    private:
+        QString *out;
+        uchar pending[2] = {};
+        int pendingLength = 0;
+    };
+
+    // 分段解码，追加到 out 末尾。字符可以在任意位置切开
+    class Decoder {
+    public:
+        explicit Decoder(QByteArray *out) : out(out) {}
+        void append(QStringView base64);
+
+    private:
+        QByteArray *out;
+        quint32 bits = 0;
+        int bitCount = 0;
+    };
+};
+
+#endif // BASE64CODEC_H
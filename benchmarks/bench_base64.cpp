@@ -0,0 +1,158 @@
+#include "base64codec.h"
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <cstdlib>
+
+// 旧版文件消息的 base64：Qt 的 toBase64/fromBase64（加上与 QString 之间的 Latin-1 转换）
+// 与 Base64Codec 各指令集对比。
+// 测量前先在 CPU 支持的每个指令集上与 Qt 的结果逐一比对，不一致时直接中止：编码错了文件就坏了，速度没有意义。
+
+namespace {
+
+QByteArray binaryPayload(qsizetype size) {
+    QByteArray data(size, Qt::Uninitialized);
+    quint32 state = 0x9e3779b9;
+    for (qsizetype i = 0; i < size; ++i) {
+        state = state * 1664525 + 1013904223;
+        data[i] = char(state >> 24);
+    }
+    return data;
+}
+
+template <typename T>
+void requireEqual(const char *what, Base64Codec::Isa isa, qsizetype length, const T &actual, const T &expected) {
+    if (actual != expected) {
+        std::fprintf(stderr, "Base64Codec %s 结果与 Qt 不一致（%s，输入 %lld 个单元）\n", what,
+                     Base64Codec::isaName(isa), qlonglong(length));
+        std::abort();
+    }
+}
+
+// 长度覆盖各实现的整块大小（编码 12/24 字节、解码 16/32 个字符）前后和余下 1、2 字节的情况；
+// 解码还在每个位置插入非 base64 字符，包括低字节恰好是合法字符的 UTF-16 单元
+void verifyIsa(Base64Codec::Isa isa) {
+    QList<qsizetype> lengths;
+    for (qsizetype length = 0; length <= 160; ++length) {
+        lengths.append(length);
+    }
+    lengths << 4096 << 4097 << 4098 << (64 << 10) + 1;
+
+    for (qsizetype length : std::as_const(lengths)) {
+        QByteArray data = binaryPayload(length);
+        QString expected = QString::fromLatin1(data.toBase64());
+        requireEqual("编码", isa, length, Base64Codec::encode(data), expected);
+        requireEqual("解码", isa, expected.size(), Base64Codec::decode(expected), data);
+
+        // 分段输入：编码按不对齐 3 字节的长度切开，解码在任意字符处切开
+        for (qsizetype step : {1, 5, 17, 100}) {
+            QString encoded;
+            Base64Codec::Encoder encoder(&encoded);
+            for (qsizetype offset = 0; offset < data.size(); offset += step) {
+                encoder.append(QByteArrayView(data).sliced(offset, qMin(step, data.size() - offset)));
+            }
+            encoder.finish();
+            requireEqual("分段编码", isa, length, encoded, expected);
+
+            QByteArray decoded;
+            Base64Codec::Decoder decoder(&decoded);
+            for (qsizetype offset = 0; offset < expected.size(); offset += step) {
+                decoder.append(QStringView(expected).sliced(offset, qMin(step, expected.size() - offset)));
+            }
+            requireEqual("分段解码", isa, expected.size(), decoded, data);
+        }
+    }
+
+    const QString text = QString::fromLatin1(binaryPayload(120).toBase64());
+    const char16_t junk[] = {u' ', u'\n', u'=', u'-', u'_', u'\0', u'\x7f', u'\xe9', u'\u0141', u'\uff2f'};
+    for (char16_t c : junk) {
+        for (qsizetype position = 0; position <= text.size(); ++position) {
+            QString damaged = text;
+            damaged.insert(position, QChar(c));
+            requireEqual("解码（含非法字符）", isa, damaged.size(), Base64Codec::decode(damaged),
+                         QByteArray::fromBase64(damaged.toLatin1()));
+        }
+    }
+}
+
+void verifyAgainstQt() {
+    for (Base64Codec::Isa isa : {Base64Codec::Isa::Scalar, Base64Codec::Isa::Ssse3, Base64Codec::Isa::Avx2}) {
+        Base64Codec::setIsa(isa);
+        if (Base64Codec::activeIsa() == isa) {
+            verifyIsa(isa);
+        }
+    }
+    Base64Codec::setIsa(Base64Codec::Isa::Avx2);
+}
+
+void ensureVerified() {
+    static const bool verified = (verifyAgainstQt(), true);
+    Q_UNUSED(verified);
+}
+
+void BM_Base64EncodeQt(benchmark::State &state) {
+    QByteArray data = binaryPayload(state.range(0));
+    for (auto _ : state) {
+        QString text = QString::fromLatin1(data.toBase64());
+        benchmark::DoNotOptimize(text.data());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void BM_Base64EncodeCodec(benchmark::State &state, Base64Codec::Isa isa) {
+    ensureVerified();
+    Base64Codec::setIsa(isa);
+    if (Base64Codec::activeIsa() != isa) {
+        state.SkipWithError("CPU 不支持该指令集");
+        return;
+    }
+    QByteArray data = binaryPayload(state.range(0));
+    for (auto _ : state) {
+        QString text = Base64Codec::encode(data);
+        benchmark::DoNotOptimize(text.data());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void BM_Base64DecodeQt(benchmark::State &state) {
+    QByteArray data = binaryPayload(state.range(0));
+    QString text = QString::fromLatin1(data.toBase64());
+    for (auto _ : state) {
+        QByteArray decoded = QByteArray::fromBase64(text.toLatin1());
+        benchmark::DoNotOptimize(decoded.data());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void BM_Base64DecodeCodec(benchmark::State &state, Base64Codec::Isa isa) {
+    ensureVerified();
+    Base64Codec::setIsa(isa);
+    if (Base64Codec::activeIsa() != isa) {
+        state.SkipWithError("CPU 不支持该指令集");
+        return;
+    }
+    QByteArray data = binaryPayload(state.range(0));
+    QString text = QString::fromLatin1(data.toBase64());
+    for (auto _ : state) {
+        QByteArray decoded = Base64Codec::decode(text);
+        benchmark::DoNotOptimize(decoded.data());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void sizeArgs(benchmark::internal::Benchmark *bench) {
+    bench->ArgName("bytes");
+    for (int size : {4096, 256 << 10, 16 << 20}) {
+        bench->Arg(size);
+    }
+}
+
+}
+
+BENCHMARK(BM_Base64EncodeQt)->Apply(sizeArgs);
+BENCHMARK_CAPTURE(BM_Base64EncodeCodec, scalar, Base64Codec::Isa::Scalar)->Apply(sizeArgs);
+BENCHMARK_CAPTURE(BM_Base64EncodeCodec, ssse3, Base64Codec::Isa::Ssse3)->Apply(sizeArgs);
+BENCHMARK_CAPTURE(BM_Base64EncodeCodec, avx2, Base64Codec::Isa::Avx2)->Apply(sizeArgs);
+BENCHMARK(BM_Base64DecodeQt)->Apply(sizeArgs);
+BENCHMARK_CAPTURE(BM_Base64DecodeCodec, scalar, Base64Codec::Isa::Scalar)->Apply(sizeArgs);
+BENCHMARK_CAPTURE(BM_Base64DecodeCodec, ssse3, Base64Codec::Isa::Ssse3)->Apply(sizeArgs);
+BENCHMARK_CAPTURE(BM_Base64DecodeCodec, avx2, Base64Codec::Isa::Avx2)->Apply(sizeArgs);
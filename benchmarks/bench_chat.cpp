@@ -0,0 +1,250 @@
+#include "emojitext.h"
+#include "legacyprotocol.h"
+#include "avatarimage.h"
+#include "messageenvelope.h"
+#include "tcpserver.h"
+#include "logger.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTcpSocket>
+#include <QImage>
+#include <benchmark/benchmark.h>
+#include <functional>
+
+// 聊天窗口热点路径：表情替换、旧版协议与信封解析、头像编码、文件 base64 编码、
+// 本机回环 TCPServer 收消息。ChatWindow 中对应的函数都委托给这里测到的实现。
+// 结果用 --benchmark_out=结果.json --benchmark_out_format=json 输出，
+// 或直接构建 run_benchmarks 目标，不同构建之间用 Google Benchmark 的 compare.py 对比。
+
+namespace {
+
+QString chatLine(qsizetype size, bool withCodes) {
+    const QString plain = QStringLiteral("今天下午三点开会，文件在共享目录里 see you there ");
+    const QString codes = QStringLiteral("好的 :) 没问题 :D 辛苦了 :coffee: (y) ");
+    QString text;
+    while (text.size() < size) {
+        text.append(withCodes ? codes : plain);
+    }
+    return text.left(size);
+}
+
+QByteArray fileBytes(qsizetype size) {
+    QByteArray data(size, Qt::Uninitialized);
+    quint32 state = 0x12345678;
+    for (qsizetype i = 0; i < size; ++i) {
+        state = state * 1664525u + 1013904223u;
+        data[i] = char(state >> 24);
+    }
+    return data;
+}
+
+// 头像源图：渐变加中间一块浅色圆形，PNG 压缩率接近真实头像。
+// 逐像素填充，不需要 QGuiApplication
+QImage avatarSource(int width, int height) {
+    QImage image(width, height, QImage::Format_ARGB32);
+    const int radius = qMin(width, height) / 4;
+    for (int y = 0; y < height; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            int t = (x + y) * 255 / (width + height);
+            int dx = x - width / 2;
+            int dy = y - height / 2;
+            bool inside = dx * dx + dy * dy < radius * radius;
+            line[x] = inside ? qRgb(230, 240, 250) : qRgb(76 - t / 6, 175 - t / 10, 80 + t * 2 / 3);
+        }
+    }
+    return image;
+}
+
+QByteArray textFrame(const QString &text, const QByteArray &avatarPng) {
+    EnvelopeWriter writer(MessageType::Text, text.size() * 3 + avatarPng.size() + 64);
+    writer.string16(QStringLiteral("bench"));
+    writer.string32(text);
+    writer.bytes32(avatarPng);
+    return writer.finish(1, 1, 0);
+}
+
+bool waitUntil(const std::function<bool()> &done, int timeoutMs = 10000) {
+    QElapsedTimer timer;
+    timer.start();
+    while (!done()) {
+        if (timer.hasExpired(timeoutMs)) {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 10);
+    }
+    return true;
+}
+
+// processMessageWithEmojis：Arg(0) 消息长度，Arg(1) 是否带表情代码
+void BM_EmojiReplace(benchmark::State &state) {
+    QString message = chatLine(state.range(0), state.range(1) != 0);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(EmojiText::replaceCodes(message));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * message.size() * qsizetype(sizeof(QChar)));
+}
+
+// onMessageReceived 的旧版文本消息，带 32 像素头像
+void BM_LegacyTextParse(benchmark::State &state) {
+    QString message = LegacyProtocol::formatText(QStringLiteral("bench"), chatLine(state.range(0), false),
+                                                 AvatarImage::encodePng(avatarSource(256, 256)));
+    for (auto _ : state) {
+        LegacyProtocol::TextMessage parsed = LegacyProtocol::parseText(message);
+        benchmark::DoNotOptimize(parsed.avatarPng.data());
+    }
+    state.SetBytesProcessed(state.iterations() * message.size() * qsizetype(sizeof(QChar)));
+}
+
+// handleFileMessage 的旧版文件消息：Arg(0) 文件大小
+void BM_LegacyFileParse(benchmark::State &state) {
+    QString message = LegacyProtocol::formatFile(QStringLiteral("bench"), QStringLiteral("data.bin"),
+                                                 QStringLiteral("bin"), QStringLiteral("other"),
+                                                 fileBytes(state.range(0)), QByteArray());
+    for (auto _ : state) {
+        LegacyProtocol::FileMessage parsed;
+        LegacyProtocol::parseFile(message, &parsed);
+        benchmark::DoNotOptimize(parsed.data.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+// 二进制信封的文本消息：切帧、解析头部、读出负载字段
+void BM_EnvelopeTextParse(benchmark::State &state) {
+    QByteArray frame = textFrame(chatLine(state.range(0), false), AvatarImage::encodePng(avatarSource(256, 256)));
+    for (auto _ : state) {
+        Envelope envelope;
+        if (MessageEnvelope::frameSize(frame) != frame.size() || !MessageEnvelope::parse(frame, &envelope)) {
+            state.SkipWithError("信封解析失败");
+            return;
+        }
+        PayloadReader reader(envelope.payload);
+        QString sender = reader.string16();
+        QString text = reader.string32();
+        QByteArrayView avatar = reader.bytes32();
+        benchmark::DoNotOptimize(sender.data());
+        benchmark::DoNotOptimize(text.data());
+        benchmark::DoNotOptimize(avatar.data());
+    }
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+
+// 头像居中裁剪、缩放到 32 像素并编码为 PNG：Arg(0) 源图边长
+void BM_AvatarEncode(benchmark::State &state) {
+    int edge = int(state.range(0));
+    QImage source = avatarSource(edge, edge * 3 / 4);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(AvatarImage::encodePng(source).data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// onSendFile 的旧版文件消息：base64 编码并拼接：Arg(0) 文件大小
+void BM_LegacyFileFormat(benchmark::State &state) {
+    QByteArray data = fileBytes(state.range(0));
+    for (auto _ : state) {
+        QString message = LegacyProtocol::formatFile(QStringLiteral("bench"), QStringLiteral("data.bin"),
+                                                     QStringLiteral("bin"), QStringLiteral("other"), data,
+                                                     QByteArray());
+        benchmark::DoNotOptimize(message.data());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+const int framesPerBatch = 64;
+
+// 本机回环 TCPServer：一个长连接上连续发送文本消息帧，接收端切帧并解析：Arg(0) 正文长度
+void BM_TcpServerFramed(benchmark::State &state) {
+    TCPServer server;
+    qint64 received = 0;
+    QObject::connect(&server, &TCPServer::frameReceived, [&](const QByteArray &frame) {
+        Envelope envelope;
+        if (MessageEnvelope::parse(frame, &envelope)) {
+            ++received;
+        }
+    });
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    if (!socket.waitForConnected(5000)) {
+        state.SkipWithError("无法连接");
+        return;
+    }
+
+    QByteArray frame = textFrame(chatLine(state.range(0), false), QByteArray());
+    qint64 expected = 0;
+    for (auto _ : state) {
+        for (int i = 0; i < framesPerBatch; ++i) {
+            socket.write(frame);
+        }
+        expected += framesPerBatch;
+        if (!waitUntil([&]() { return received >= expected; })) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * framesPerBatch);
+    state.SetBytesProcessed(state.iterations() * framesPerBatch * frame.size());
+}
+
+// 本机回环 TCPServer 的旧版协议：每条消息新建连接，断开后整体交付：Arg(0) 正文长度
+void BM_TcpServerLegacy(benchmark::State &state) {
+    TCPServer server;
+    qint64 received = 0;
+    QObject::connect(&server, &TCPServer::legacyMessageReceived, [&](const QString &message) {
+        benchmark::DoNotOptimize(LegacyProtocol::parseText(message).text.data());
+        ++received;
+    });
+
+    QByteArray message = LegacyProtocol::formatText(QStringLiteral("bench"), chatLine(state.range(0), false),
+                                                    QByteArray()).toUtf8();
+    qint64 expected = 0;
+    for (auto _ : state) {
+        QTcpSocket socket;
+        socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+        if (!socket.waitForConnected(5000)) {
+            state.SkipWithError("无法连接");
+            return;
+        }
+        socket.write(message);
+        socket.disconnectFromHost();
+        ++expected;
+        if (!waitUntil([&]() { return received >= expected; })) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * message.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_EmojiReplace)->Args({64, 0})->Args({64, 1})->Args({1024, 0})->Args({1024, 1});
+BENCHMARK(BM_LegacyTextParse)->Arg(64)->Arg(1024);
+BENCHMARK(BM_LegacyFileParse)->Arg(16 << 10)->Arg(1 << 20)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_EnvelopeTextParse)->Arg(64)->Arg(1024);
+BENCHMARK(BM_AvatarEncode)->Arg(256)->Arg(1024)->Arg(4096)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_LegacyFileFormat)->Arg(16 << 10)->Arg(1 << 20)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_TcpServerFramed)->Arg(64)->Arg(1024)->UseRealTime();
+BENCHMARK(BM_TcpServerLegacy)->Arg(64)->Arg(1024)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+// 网络对象需要事件循环，不能用 benchmark_main
+int main(int argc, char **argv) {
+    QCoreApplication app(argc, argv);
+    Logger::setLevel(LogLevel::Warning);
+
+    // 写进 JSON 的 context，对比不同构建的结果时用来区分
+    benchmark::AddCustomContext("qt_version", qVersion());
+    benchmark::AddCustomContext("build_type", BENCH_BUILD_TYPE);
+    benchmark::AddCustomContext("git_revision", BENCH_GIT_REVISION);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
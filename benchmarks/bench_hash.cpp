@@ -0,0 +1,104 @@
+#include "blake3.h"
+#include "filehasher.h"
+#include <QtConcurrent>
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+
+// 文件校验值：单线程顺序计算与 FileHasher 的分段并行方式对比，输入在内存中，不含读盘。
+// 测量前先用官方测试向量和分段/顺序结果比对校验实现，不一致时直接中止：摘要错了速度没有意义。
+
+namespace {
+
+QByteArray hashInput(qsizetype size) {
+    QByteArray data(size, Qt::Uninitialized);
+    for (qsizetype i = 0; i < size; ++i) {
+        data[i] = char(i * 31 + (i >> 10));
+    }
+    return data;
+}
+
+// 与 FileHasher 相同：除最后一段外各段在线程池中算子树，再顺序合并
+QByteArray segmentedHash(const QByteArray &data) {
+    const qint64 segmentBytes = FileHasher::segmentBytes;
+    qint64 fullSegments = data.isEmpty() ? 0 : (data.size() - 1) / segmentBytes;
+    QList<qint64> segments(fullSegments);
+    std::iota(segments.begin(), segments.end(), qint64(0));
+
+    QList<Blake3::ChainingValue> subtrees = QtConcurrent::blockingMapped(segments, [&data, segmentBytes](qint64 index) {
+        return Blake3::subtree(QByteArrayView(data).sliced(index * segmentBytes, segmentBytes),
+                               quint64(index * segmentBytes / Blake3::chunkBytes));
+    });
+    Blake3 hasher;
+    for (const Blake3::ChainingValue &cv : subtrees) {
+        hasher.appendSubtree(cv, segmentBytes / Blake3::chunkBytes);
+    }
+    hasher.update(QByteArrayView(data).sliced(fullSegments * segmentBytes));
+    return hasher.finalize();
+}
+
+void requireDigest(const char *what, qsizetype length, const QByteArray &actual, const QByteArray &expectedHex) {
+    if (actual.toHex() != expectedHex) {
+        std::fprintf(stderr, "BLAKE3 %s 结果错误（%lld 字节）：%s，应为 %s\n", what, qlonglong(length),
+                     actual.toHex().constData(), expectedHex.constData());
+        std::abort();
+    }
+}
+
+// 官方测试向量（test_vectors.json）：输入第 i 字节为 i % 251，取前 32 字节输出。
+// segmentBytes + 1（1048577 字节）不在官方文件中，值由官方 blake3 实现算出，覆盖刚过 FileHasher 分段边界的情况
+void verifyKnownAnswers() {
+    static const struct {
+        qsizetype length;
+        const char *digest;
+    } vectors[] = {
+        {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+        {1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+        {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+        {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+        {8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+        {FileHasher::segmentBytes + 1, "2f053cd7472cf0cd2f9adaf45c1180255b91b9a865404a63671a0ee5f792ed33"},
+    };
+    for (const auto &vector : vectors) {
+        QByteArray data(vector.length, Qt::Uninitialized);
+        for (qsizetype i = 0; i < data.size(); ++i) {
+            data[i] = char(i % 251);
+        }
+        requireDigest("顺序计算", vector.length, Blake3::hash(data), vector.digest);
+        requireDigest("分段计算", vector.length, segmentedHash(data), vector.digest);
+    }
+}
+
+void ensureVerified() {
+    static const bool verified = (verifyKnownAnswers(), true);
+    Q_UNUSED(verified);
+}
+
+void BM_Blake3Sequential(benchmark::State &state) {
+    ensureVerified();
+    QByteArray data = hashInput(state.range(0));
+    for (auto _ : state) {
+        QByteArray digest = Blake3::hash(data);
+        benchmark::DoNotOptimize(digest);
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void BM_Blake3Segments(benchmark::State &state) {
+    ensureVerified();
+    QByteArray data = hashInput(state.range(0));
+    // 本轮输入先与顺序计算比对一次
+    requireDigest("分段计算", data.size(), segmentedHash(data), Blake3::hash(data).toHex());
+
+    for (auto _ : state) {
+        QByteArray digest = segmentedHash(data);
+        benchmark::DoNotOptimize(digest);
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+}
+
+BENCHMARK(BM_Blake3Sequential)->Arg(64 << 10)->Arg(16 << 20)->Arg(256 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Blake3Segments)->Arg(16 << 20)->Arg(256 << 20)->UseRealTime()->Unit(benchmark::kMillisecond);
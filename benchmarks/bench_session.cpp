@@ -0,0 +1,287 @@
+#include "securesession.h"
+#include "fanout.h"
+#include "tcpserver.h"
+#include "messageenvelope.h"
+#include "logger.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTcpSocket>
+#include <QThread>
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// 加密会话相对明文的开销，全部走本机回环：
+//   吞吐：长连接上连续发送一批帧，直到接收端全部解出；
+//   延迟：单条小消息从发出到接收端解出，分别测每条新建明文连接（当前明文路径的做法）、
+//         TLS 完整握手、会话票据恢复握手、复用长连接；
+//   扇出：同一条消息发给多个节点，逐个在本线程加密与经 FanOut 在工作线程上并行。
+
+namespace {
+
+const QByteArray groupKey = SessionCrypto::deriveKey(QStringLiteral("benchmark"));
+
+QByteArray makeFrame(qsizetype payloadSize) {
+    EnvelopeWriter writer(MessageType::Text, payloadSize);
+    writer.raw(QByteArray(payloadSize, 'x'));
+    return writer.finish(1, 1, 0);
+}
+
+bool waitUntil(const std::function<bool()> &done, int timeoutMs = 10000) {
+    QElapsedTimer timer;
+    timer.start();
+    while (!done()) {
+        if (timer.hasExpired(timeoutMs)) {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 10);
+    }
+    return true;
+}
+
+// 接收端：统计解出的帧数
+template <typename Server>
+struct Receiver {
+    Server server;
+    qint64 frames = 0;
+
+    template <typename... Args>
+    explicit Receiver(Args &&...args) : server(std::forward<Args>(args)...) {
+        QObject::connect(&server, &Server::frameReceived, [this](const QByteArray &) { ++frames; });
+    }
+
+    bool waitFrames(qint64 expected) {
+        return waitUntil([&]() { return frames >= expected; });
+    }
+};
+
+const int framesPerBatch = 64;
+
+void BM_PlainThroughput(benchmark::State &state) {
+    Receiver<TCPServer> receiver;
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, receiver.server.serverPort());
+    if (!socket.waitForConnected(5000)) {
+        state.SkipWithError("无法连接");
+        return;
+    }
+
+    QByteArray frame = makeFrame(state.range(0));
+    qint64 expected = 0;
+    for (auto _ : state) {
+        for (int i = 0; i < framesPerBatch; ++i) {
+            socket.write(frame);
+        }
+        expected += framesPerBatch;
+        if (!receiver.waitFrames(expected)) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * framesPerBatch * frame.size());
+}
+
+void BM_SecureThroughput(benchmark::State &state) {
+    Receiver<SecureServer> receiver(groupKey);
+    PeerSession session(QStringLiteral("127.0.0.1"), receiver.server.serverPort(), groupKey);
+
+    QByteArray frame = makeFrame(state.range(0));
+    qint64 expected = 0;
+    for (auto _ : state) {
+        for (int i = 0; i < framesPerBatch; ++i) {
+            session.send(frame);
+        }
+        expected += framesPerBatch;
+        if (!receiver.waitFrames(expected)) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * framesPerBatch * frame.size());
+    state.SetLabel(SessionCrypto::hasAesHardware() ? "AES-NI" : "no AES-NI");
+}
+
+void BM_PlainConnectPerMessage(benchmark::State &state) {
+    Receiver<TCPServer> receiver;
+    QByteArray frame = makeFrame(256);
+    qint64 expected = 0;
+    for (auto _ : state) {
+        QTcpSocket socket;
+        socket.connectToHost(QHostAddress::LocalHost, receiver.server.serverPort());
+        socket.write(frame);
+        if (!receiver.waitFrames(++expected)) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+        socket.disconnectFromHost();
+    }
+}
+
+void BM_SecureFullHandshake(benchmark::State &state) {
+    Receiver<SecureServer> receiver(groupKey);
+    QByteArray frame = makeFrame(256);
+    qint64 expected = 0;
+    for (auto _ : state) {
+        // 每次新建会话对象，没有可用的票据
+        auto session = std::make_unique<PeerSession>(QStringLiteral("127.0.0.1"), receiver.server.serverPort(),
+                                                     groupKey);
+        session->send(frame);
+        if (!receiver.waitFrames(++expected)) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+    }
+}
+
+void BM_SecureResumed(benchmark::State &state) {
+    Receiver<SecureServer> receiver(groupKey);
+    PeerSession session(QStringLiteral("127.0.0.1"), receiver.server.serverPort(), groupKey);
+    QByteArray frame = makeFrame(256);
+    qint64 expected = 0;
+
+    session.send(frame);
+    if (!receiver.waitFrames(++expected) || !waitUntil([&]() { return session.hasSessionTicket(); })) {
+        state.SkipWithError("未拿到会话票据");
+        return;
+    }
+
+    for (auto _ : state) {
+        session.disconnectFromPeer();
+        session.send(frame);
+        if (!receiver.waitFrames(++expected)) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+    }
+}
+
+void BM_SecureLongLived(benchmark::State &state) {
+    Receiver<SecureServer> receiver(groupKey);
+    PeerSession session(QStringLiteral("127.0.0.1"), receiver.server.serverPort(), groupKey);
+    QByteArray frame = makeFrame(256);
+    qint64 expected = 0;
+
+    session.send(frame);
+    if (!receiver.waitFrames(++expected)) {
+        state.SkipWithError("握手失败");
+        return;
+    }
+
+    for (auto _ : state) {
+        session.send(frame);
+        if (!receiver.waitFrames(++expected)) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+    }
+}
+
+// 扇出测试的接收端：各自在自己的线程里解密，接收端不成为瓶颈
+struct ThreadedReceiver {
+    QThread thread;
+    QObject context;
+    SecureServer *server = nullptr;
+    std::atomic<qint64> frames{0};
+
+    ThreadedReceiver() {
+        context.moveToThread(&thread);
+        thread.start();
+        QMetaObject::invokeMethod(&context, [this]() {
+            server = new SecureServer(groupKey);
+            QObject::connect(server, &SecureServer::frameReceived, server, [this](const QByteArray &) { ++frames; });
+        }, Qt::BlockingQueuedConnection);
+    }
+
+    ~ThreadedReceiver() {
+        QMetaObject::invokeMethod(&context, [this]() { delete server; }, Qt::BlockingQueuedConnection);
+        thread.quit();
+        thread.wait();
+    }
+};
+
+void BM_SecureFanOut(benchmark::State &state) {
+    int peerCount = int(state.range(0));
+    bool parallel = state.range(1) != 0;
+
+    // 每个接收端用不同的回环地址，FanOut 按地址区分节点
+    auto address = [](int i) { return QStringLiteral("127.0.0.%1").arg(i + 1); };
+    std::vector<std::unique_ptr<ThreadedReceiver>> receivers;
+    std::vector<std::unique_ptr<PeerSession>> sessions;
+    FanOut fanOut;
+    for (int i = 0; i < peerCount; ++i) {
+        receivers.push_back(std::make_unique<ThreadedReceiver>());
+        if (!parallel) {
+            sessions.push_back(std::make_unique<PeerSession>(address(i), receivers[i]->server->serverPort(),
+                                                             groupKey));
+        }
+    }
+
+    QByteArray frame = makeFrame(64 << 10);
+    auto sendAll = [&]() {
+        for (int i = 0; i < peerCount; ++i) {
+            if (parallel) {
+                fanOut.sendSecure(address(i), receivers[i]->server->serverPort(), groupKey, frame);
+            } else {
+                sessions[i]->send(frame);
+            }
+        }
+    };
+    auto receivedAll = [&](qint64 expected) {
+        return waitUntil([&]() {
+            for (const auto &receiver : receivers) {
+                if (receiver->frames < expected) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    };
+
+    // 先完成握手，只测已建立的会话
+    sendAll();
+    qint64 expected = 1;
+    if (!receivedAll(expected)) {
+        state.SkipWithError("握手失败");
+        return;
+    }
+
+    for (auto _ : state) {
+        for (int k = 0; k < framesPerBatch; ++k) {
+            sendAll();
+        }
+        expected += framesPerBatch;
+        if (!receivedAll(expected)) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * framesPerBatch * peerCount * frame.size());
+    state.SetLabel(parallel ? QString("FanOut %1 线程").arg(fanOut.threadCount()).toStdString() : "逐个发送");
+}
+
+} // namespace
+
+BENCHMARK(BM_PlainThroughput)->Arg(256)->Arg(16 << 10)->Arg(1 << 20)->UseRealTime();
+BENCHMARK(BM_SecureThroughput)->Arg(256)->Arg(16 << 10)->Arg(1 << 20)->UseRealTime();
+BENCHMARK(BM_PlainConnectPerMessage)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SecureFullHandshake)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SecureResumed)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SecureLongLived)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SecureFanOut)->ArgsProduct({{1, 4, 8}, {0, 1}})->UseRealTime();
+
+// 网络对象需要事件循环，不能用 benchmark_main
+int main(int argc, char **argv) {
+    QCoreApplication app(argc, argv);
+    Logger::setLevel(LogLevel::Warning);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include "uringserver.h"
+#include "tcpserver.h"
+#include "messageenvelope.h"
+#include "logger.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <benchmark/benchmark.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// 明文端口接收端随连接数的扩展性：TCPServer（Qt 套接字，每个连接一个 QTcpSocket，
+// 在自己的线程上跑事件循环）对 UringServer（io_uring 多发 accept / recv）。
+// N 个长连接每轮各发一帧，测到接收端全部解出为止的时间；客户端用阻塞的原生套接字，
+// 两边的发送开销相同。连接数多时要调高文件描述符上限，main 里会尝试调到硬上限。
+
+namespace {
+
+QByteArray makeFrame(qsizetype payloadSize) {
+    EnvelopeWriter writer(MessageType::Text, payloadSize);
+    writer.raw(QByteArray(payloadSize, 'x'));
+    return writer.finish(1, 1, 0);
+}
+
+bool waitFrames(const std::atomic<qint64> &frames, qint64 expected) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (frames.load(std::memory_order_acquire) < expected) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+// Qt 接收端在自己的线程上，计数在该线程里直接累加
+struct QtReceiver {
+    QThread thread;
+    QObject context;
+    TCPServer *server = nullptr;
+    std::atomic<qint64> frames{0};
+
+    QtReceiver() {
+        context.moveToThread(&thread);
+        thread.start();
+        QMetaObject::invokeMethod(&context, [this]() {
+            server = new TCPServer(nullptr, 0, QHostAddress::LocalHost);
+            QObject::connect(server, &TCPServer::frameReceived, server, [this](const QByteArray &) {
+                frames.fetch_add(1, std::memory_order_release);
+            });
+        }, Qt::BlockingQueuedConnection);
+    }
+
+    ~QtReceiver() {
+        QMetaObject::invokeMethod(&context, [this]() { delete server; }, Qt::BlockingQueuedConnection);
+        thread.quit();
+        thread.wait();
+    }
+
+    quint16 port() const { return server->serverPort(); }
+};
+
+// io_uring 接收端自带线程，信号直接在该线程上处理
+struct UringReceiver {
+    UringServer server{nullptr, 0, QHostAddress::LocalHost};
+    std::atomic<qint64> frames{0};
+
+    UringReceiver() {
+        QObject::connect(&server, &UringServer::frameReceived, [this](const QByteArray &) {
+            frames.fetch_add(1, std::memory_order_release);
+        });
+    }
+
+    quint16 port() const { return server.serverPort(); }
+};
+
+struct Clients {
+    std::vector<int> sockets;
+
+    ~Clients() {
+        for (int fd : sockets) {
+            ::close(fd);
+        }
+    }
+
+    bool connect(quint16 port, int count) {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        for (int i = 0; i < count; ++i) {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                return false;
+            }
+            sockets.push_back(fd);
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool sendAll(const QByteArray &frame) {
+        for (int fd : sockets) {
+            if (send(fd, frame.constData(), size_t(frame.size()), MSG_NOSIGNAL) != frame.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+template <typename Receiver>
+void BM_ReceiveScaling(benchmark::State &state) {
+    if constexpr (std::is_same_v<Receiver, UringReceiver>) {
+        if (!UringServer::isSupported()) {
+            state.SkipWithError("内核不支持 io_uring 多发接收");
+            return;
+        }
+    }
+    int connections = int(state.range(0));
+    Receiver receiver;
+    Clients clients;
+    if (!clients.connect(receiver.port(), connections)) {
+        state.SkipWithError("无法建立连接，检查文件描述符上限（ulimit -n）");
+        return;
+    }
+
+    QByteArray frame = makeFrame(state.range(1));
+    qint64 expected = 0;
+    for (auto _ : state) {
+        if (!clients.sendAll(frame)) {
+            state.SkipWithError("发送失败");
+            return;
+        }
+        expected += connections;
+        if (!waitFrames(receiver.frames, expected)) {
+            state.SkipWithError("接收超时");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * connections);
+    state.SetBytesProcessed(state.iterations() * connections * frame.size());
+}
+
+void raiseFileLimit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_ReceiveScaling<QtReceiver>)
+        ->ArgsProduct({{16, 256, 1024, 4096}, {256, 16 << 10}})->UseRealTime();
+BENCHMARK(BM_ReceiveScaling<UringReceiver>)
+        ->ArgsProduct({{16, 256, 1024, 4096}, {256, 16 << 10}})->UseRealTime();
+
+// 网络对象需要事件循环，不能用 benchmark_main
+int main(int argc, char **argv) {
+    QCoreApplication app(argc, argv);
+    Logger::setLevel(LogLevel::Warning);
+    raiseFileLimit();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include "utf8codec.h"
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <cstdlib>
+
+// 接收路径的 UTF-8 转换：Qt 自带实现与 Utf8Codec 各指令集对比。
+// 负载按聊天消息的典型形态构造：英文为主（夹少量中文）和中文为主（夹少量英文）。
+// 测量前先在 CPU 支持的每个指令集上与 Qt 的结果逐一比对，不一致时直接中止。
+
+namespace {
+
+QByteArray asciiHeavyPayload(qsizetype size) {
+    const QByteArray line = QStringLiteral("Meeting moved to 3pm, see the shared doc for details. 好的\n").toUtf8();
+    QByteArray data;
+    while (data.size() < size) {
+        data.append(line);
+    }
+    return data;
+}
+
+QByteArray cjkHeavyPayload(qsizetype size) {
+    const QByteArray line = QStringLiteral("今天下午三点开会，文件在共享目录 docs/plan.md 里，请提前看一下。\n").toUtf8();
+    QByteArray data;
+    while (data.size() < size) {
+        data.append(line);
+    }
+    return data;
+}
+
+QByteArray payloadFor(int kind, qsizetype size) {
+    return kind == 0 ? asciiHeavyPayload(size) : cjkHeavyPayload(size);
+}
+
+template <typename T>
+void requireEqual(const char *what, Utf8Codec::Isa isa, qsizetype offset, const T &actual, const T &expected) {
+    if (actual != expected) {
+        std::fprintf(stderr, "Utf8Codec %s 结果与 Qt 不一致（%s，插入位置 %lld）\n", what, Utf8Codec::isaName(isa),
+                     qlonglong(offset));
+        std::abort();
+    }
+}
+
+// 合法时 Qt 解码再编码得到原样的字节，非法序列会被替换掉
+void checkDecode(Utf8Codec::Isa isa, qsizetype offset, const QByteArray &utf8) {
+    QString expected = QString::fromUtf8(utf8);
+    requireEqual("解码", isa, offset, Utf8Codec::decode(utf8), expected);
+    requireEqual("校验", isa, offset, Utf8Codec::validate(utf8), expected.toUtf8() == utf8);
+}
+
+void checkEncode(Utf8Codec::Isa isa, qsizetype offset, const QString &utf16) {
+    requireEqual("编码", isa, offset, Utf8Codec::encode(utf16), utf16.toUtf8());
+}
+
+// 把一段多字节序列（合法或非法）插在 ASCII 或中文串的每个位置上，
+// 覆盖向量实现 16/32 单元整块的边界、块内和收尾的标量部分
+void verifyIsa(Utf8Codec::Isa isa) {
+    const QByteArray ascii(96, 'a');
+    const QByteArray cjk = QStringLiteral("中文为主的聊天消息，夹一点 ASCII 和标点。中文为主的聊天消息").toUtf8();
+    const QByteArray sequences[] = {
+        "\xc3\xa9",               // 2 字节
+        "\xe4\xb8\xad",           // 3 字节
+        "\xf0\x9f\x98\x80",       // 4 字节（UTF-16 代理对）
+        "\x80",                   // 孤立的后续字节
+        "\xc0\xaf",               // 过长编码
+        "\xed\xa0\x80",           // 编码了代理项
+        "\xf4\x90\x80\x80",       // 超出 U+10FFFF
+        "\xe4\xb8",               // 截断
+        "\xff",
+    };
+    for (const QByteArray &base : {ascii, cjk}) {
+        for (qsizetype offset = 0; offset <= base.size(); ++offset) {
+            for (const QByteArray &sequence : sequences) {
+                QByteArray utf8 = base;
+                utf8.insert(offset, sequence);
+                checkDecode(isa, offset, utf8);
+            }
+        }
+    }
+
+    // 代理对、孤立代理项和顺序颠倒的代理对
+    const QString ascii16 = QString::fromLatin1(ascii);
+    const QString cjk16 = QString::fromUtf8(cjk);
+    const char16_t *units[] = {u"\u00e9", u"\u4e2d", u"\U0001f600", u"\xd83d", u"\xde00", u"\xde00\xd83d"};
+    for (const QString &base : {ascii16, cjk16}) {
+        for (qsizetype offset = 0; offset <= base.size(); ++offset) {
+            for (const char16_t *unit : units) {
+                QString utf16 = base;
+                utf16.insert(offset, QString::fromUtf16(unit));
+                checkEncode(isa, offset, utf16);
+            }
+        }
+    }
+
+    for (int kind : {0, 1}) {
+        QByteArray payload = payloadFor(kind, 65536);
+        checkDecode(isa, -1, payload);
+        checkEncode(isa, -1, QString::fromUtf8(payload));
+    }
+}
+
+void verifyAgainstQt() {
+    for (Utf8Codec::Isa isa : {Utf8Codec::Isa::Scalar, Utf8Codec::Isa::Sse2, Utf8Codec::Isa::Avx2}) {
+        Utf8Codec::setIsa(isa);
+        if (Utf8Codec::activeIsa() == isa) {
+            verifyIsa(isa);
+        }
+    }
+    Utf8Codec::setIsa(Utf8Codec::Isa::Avx2);
+}
+
+void ensureVerified() {
+    static const bool verified = (verifyAgainstQt(), true);
+    Q_UNUSED(verified);
+}
+
+void BM_DecodeQt(benchmark::State &state) {
+    QByteArray data = payloadFor(int(state.range(0)), state.range(1));
+    for (auto _ : state) {
+        QString text = QString::fromUtf8(data);
+        benchmark::DoNotOptimize(text);
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void BM_DecodeCodec(benchmark::State &state, Utf8Codec::Isa isa) {
+    ensureVerified();
+    Utf8Codec::setIsa(isa);
+    if (Utf8Codec::activeIsa() != isa) {
+        state.SkipWithError("CPU 不支持该指令集");
+        return;
+    }
+    QByteArray data = payloadFor(int(state.range(0)), state.range(1));
+    for (auto _ : state) {
+        QString text = Utf8Codec::decode(data);
+        benchmark::DoNotOptimize(text);
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void BM_ValidateCodec(benchmark::State &state, Utf8Codec::Isa isa) {
+    ensureVerified();
+    Utf8Codec::setIsa(isa);
+    if (Utf8Codec::activeIsa() != isa) {
+        state.SkipWithError("CPU 不支持该指令集");
+        return;
+    }
+    QByteArray data = payloadFor(int(state.range(0)), state.range(1));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Utf8Codec::validate(data));
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+void BM_EncodeQt(benchmark::State &state) {
+    QString text = QString::fromUtf8(payloadFor(int(state.range(0)), state.range(1)));
+    qsizetype bytes = text.toUtf8().size();
+    for (auto _ : state) {
+        QByteArray data = text.toUtf8();
+        benchmark::DoNotOptimize(data);
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+void BM_EncodeCodec(benchmark::State &state, Utf8Codec::Isa isa) {
+    ensureVerified();
+    Utf8Codec::setIsa(isa);
+    if (Utf8Codec::activeIsa() != isa) {
+        state.SkipWithError("CPU 不支持该指令集");
+        return;
+    }
+    QString text = QString::fromUtf8(payloadFor(int(state.range(0)), state.range(1)));
+    qsizetype bytes = text.toUtf8().size();
+    for (auto _ : state) {
+        QByteArray data = Utf8Codec::encode(text);
+        benchmark::DoNotOptimize(data);
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+// 参数：{负载类型 0=英文为主 1=中文为主, 字节数}
+void payloadArgs(benchmark::internal::Benchmark *bench) {
+    bench->ArgNames({"cjk", "bytes"});
+    for (int kind : {0, 1}) {
+        for (int size : {256, 4096, 65536, 1 << 20}) {
+            bench->Args({kind, size});
+        }
+    }
+}
+
+}
+
+BENCHMARK(BM_DecodeQt)->Apply(payloadArgs);
+BENCHMARK_CAPTURE(BM_DecodeCodec, scalar, Utf8Codec::Isa::Scalar)->Apply(payloadArgs);
+BENCHMARK_CAPTURE(BM_DecodeCodec, sse2, Utf8Codec::Isa::Sse2)->Apply(payloadArgs);
+BENCHMARK_CAPTURE(BM_DecodeCodec, avx2, Utf8Codec::Isa::Avx2)->Apply(payloadArgs);
+BENCHMARK_CAPTURE(BM_ValidateCodec, scalar, Utf8Codec::Isa::Scalar)->Apply(payloadArgs);
+BENCHMARK_CAPTURE(BM_ValidateCodec, avx2, Utf8Codec::Isa::Avx2)->Apply(payloadArgs);
+BENCHMARK(BM_EncodeQt)->Apply(payloadArgs);
+BENCHMARK_CAPTURE(BM_EncodeCodec, scalar, Utf8Codec::Isa::Scalar)->Apply(payloadArgs);
+BENCHMARK_CAPTURE(BM_EncodeCodec, sse2, Utf8Codec::Isa::Sse2)->Apply(payloadArgs);
+BENCHMARK_CAPTURE(BM_EncodeCodec, avx2, Utf8Codec::Isa::Avx2)->Apply(payloadArgs);
@@ -0,0 +1,382 @@
+#include "blake3.h"
+#include <QtEndian>
+#include <bit>
+#include <cstring>
+
+namespace {
+
+constexpr quint32 iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+constexpr quint8 schedule[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+constexpr quint32 ChunkStart = 1;
+constexpr quint32 ChunkEnd = 2;
+constexpr quint32 Parent = 4;
+constexpr quint32 Root = 8;
+
+inline quint32 rotr(quint32 x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+inline void g(quint32 *v, int a, int b, int c, int d, quint32 x, quint32 y) {
+    v[a] = v[a] + v[b] + x;
+    v[d] = rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = rotr(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 7);
+}
+
+void compress(const quint32 cv[8], const quint32 block[16], quint64 counter, quint32 blockLength, quint32 flags,
+              quint32 out[16]) {
+    quint32 v[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        iv[0], iv[1], iv[2], iv[3], quint32(counter), quint32(counter >> 32), blockLength, flags,
+    };
+    for (const quint8 *s : schedule) {
+        g(v, 0, 4, 8, 12, block[s[0]], block[s[1]]);
+        g(v, 1, 5, 9, 13, block[s[2]], block[s[3]]);
+        g(v, 2, 6, 10, 14, block[s[4]], block[s[5]]);
+        g(v, 3, 7, 11, 15, block[s[6]], block[s[7]]);
+        g(v, 0, 5, 10, 15, block[s[8]], block[s[9]]);
+        g(v, 1, 6, 11, 12, block[s[10]], block[s[11]]);
+        g(v, 2, 7, 8, 13, block[s[12]], block[s[13]]);
+        g(v, 3, 4, 9, 14, block[s[14]], block[s[15]]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        out[i] = v[i] ^ v[i + 8];
+        out[i + 8] = v[i + 8] ^ cv[i];
+    }
+}
+
+void loadBlock(const uchar *bytes, quint32 block[16]) {
+    for (int i = 0; i < 16; ++i) {
+        block[i] = qFromLittleEndian<quint32>(bytes + 4 * i);
+    }
+}
+
+Blake3::ChainingValue parentCv(const Blake3::ChainingValue &left, const Blake3::ChainingValue &right) {
+    quint32 block[16];
+    std::memcpy(block, left.data(), 32);
+    std::memcpy(block + 8, right.data(), 32);
+    quint32 out[16];
+    compress(iv, block, 0, 64, Parent, out);
+    Blake3::ChainingValue cv;
+    std::memcpy(cv.data(), out, 32);
+    return cv;
+}
+
+// lanes 个相邻的完整块同时压缩：每个状态字是一个 lanes 宽的数组，
+// 每一步都是对各列做同样的运算，循环可以直接向量化（SSE2 下 4 路，AVX2 下 8 路）
+using Lane = quint32[Blake3::lanes];
+
+inline void gLanes(Lane *v, int a, int b, int c, int d, const Lane &x, const Lane &y) {
+    // GCC -O3 会先把这个循环完全展开成标量代码，再也向量化不回来，比 -O2 慢一半多
+#ifdef __GNUC__
+#pragma GCC unroll 1
+#endif
+    for (int l = 0; l < Blake3::lanes; ++l) {
+        quint32 va = v[a][l], vb = v[b][l], vc = v[c][l], vd = v[d][l];
+        va = va + vb + x[l];
+        vd = rotr(vd ^ va, 16);
+        vc = vc + vd;
+        vb = rotr(vb ^ vc, 12);
+        va = va + vb + y[l];
+        vd = rotr(vd ^ va, 8);
+        vc = vc + vd;
+        vb = rotr(vb ^ vc, 7);
+        v[a][l] = va;
+        v[b][l] = vb;
+        v[c][l] = vc;
+        v[d][l] = vd;
+    }
+}
+
+void hashChunkLanes(const uchar *input, quint64 counter, Blake3::ChainingValue *out) {
+    Lane cv[8];
+    for (int i = 0; i < 8; ++i) {
+        for (int l = 0; l < Blake3::lanes; ++l) {
+            cv[i][l] = iv[i];
+        }
+    }
+
+    for (int blockIndex = 0; blockIndex < Blake3::chunkBytes / 64; ++blockIndex) {
+        Lane m[16];
+        for (int l = 0; l < Blake3::lanes; ++l) {
+            const uchar *block = input + qsizetype(l) * Blake3::chunkBytes + blockIndex * 64;
+            for (int i = 0; i < 16; ++i) {
+                m[i][l] = qFromLittleEndian<quint32>(block + 4 * i);
+            }
+        }
+        quint32 flags = (blockIndex == 0 ? ChunkStart : 0u) | (blockIndex == Blake3::chunkBytes / 64 - 1 ? ChunkEnd : 0u);
+
+        Lane v[16];
+        for (int l = 0; l < Blake3::lanes; ++l) {
+            for (int i = 0; i < 8; ++i) {
+                v[i][l] = cv[i][l];
+            }
+            v[8][l] = iv[0];
+            v[9][l] = iv[1];
+            v[10][l] = iv[2];
+            v[11][l] = iv[3];
+            v[12][l] = quint32(counter + quint64(l));
+            v[13][l] = quint32((counter + quint64(l)) >> 32);
+            v[14][l] = 64;
+            v[15][l] = flags;
+        }
+        for (const quint8 *s : schedule) {
+            gLanes(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            gLanes(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            gLanes(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            gLanes(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            gLanes(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            gLanes(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            gLanes(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            gLanes(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+        for (int i = 0; i < 8; ++i) {
+            for (int l = 0; l < Blake3::lanes; ++l) {
+                cv[i][l] = v[i][l] ^ v[i + 8][l];
+            }
+        }
+    }
+
+    for (int l = 0; l < Blake3::lanes; ++l) {
+        for (int i = 0; i < 8; ++i) {
+            out[l][i] = cv[i][l];
+        }
+    }
+}
+
+// 单个完整块（非根）
+Blake3::ChainingValue hashChunk(const uchar *input, quint64 counter) {
+    quint32 cv[16];
+    std::memcpy(cv, iv, 32);
+    for (int blockIndex = 0; blockIndex < Blake3::chunkBytes / 64; ++blockIndex) {
+        quint32 block[16];
+        loadBlock(input + blockIndex * 64, block);
+        quint32 flags = (blockIndex == 0 ? ChunkStart : 0u) | (blockIndex == Blake3::chunkBytes / 64 - 1 ? ChunkEnd : 0u);
+        compress(cv, block, counter, 64, flags, cv);
+    }
+    Blake3::ChainingValue result;
+    std::memcpy(result.data(), cv, 32);
+    return result;
+}
+
+}
+
+// 最后一次压缩的输入：取链接值时不带 Root 标志，作为整个哈希的结果时带上
+struct Blake3::Output {
+    quint32 cv[8];
+    quint32 block[16];
+    quint64 counter;
+    quint32 blockLength;
+    quint32 flags;
+
+    ChainingValue chainingValue() const {
+        quint32 out[16];
+        compress(cv, block, counter, blockLength, flags, out);
+        ChainingValue result;
+        std::memcpy(result.data(), out, 32);
+        return result;
+    }
+
+    QByteArray rootBytes() const {
+        quint32 out[16];
+        compress(cv, block, 0, blockLength, flags | Root, out);
+        QByteArray digest(digestBytes, Qt::Uninitialized);
+        for (int i = 0; i < 8; ++i) {
+            qToLittleEndian(out[i], digest.data() + 4 * i);
+        }
+        return digest;
+    }
+};
+
+Blake3::Blake3() {
+    resetChunk(0);
+}
+
+void Blake3::resetChunk(quint64 counter) {
+    std::memcpy(chunkCv.data(), iv, 32);
+    chunkCounter = counter;
+    std::memset(buffer, 0, sizeof(buffer));
+    bufferLength = 0;
+    blocksCompressed = 0;
+}
+
+void Blake3::chunkUpdate(const uchar *input, qsizetype length) {
+    auto startFlag = [this]() { return blocksCompressed == 0 ? ChunkStart : 0u; };
+
+    if (bufferLength > 0) {
+        int take = int(qMin<qsizetype>(64 - bufferLength, length));
+        std::memcpy(buffer + bufferLength, input, size_t(take));
+        bufferLength += take;
+        input += take;
+        length -= take;
+        if (length > 0) {
+            quint32 block[16];
+            loadBlock(buffer, block);
+            quint32 out[16];
+            compress(chunkCv.data(), block, chunkCounter, 64, startFlag(), out);
+            std::memcpy(chunkCv.data(), out, 32);
+            ++blocksCompressed;
+            bufferLength = 0;
+            std::memset(buffer, 0, sizeof(buffer));
+        }
+    }
+
+    // 块的最后一个 64 字节分组要等知道是不是结尾后再压缩，这里总留一组在缓冲区
+    while (length > 64) {
+        quint32 block[16];
+        loadBlock(input, block);
+        quint32 out[16];
+        compress(chunkCv.data(), block, chunkCounter, 64, startFlag(), out);
+        std::memcpy(chunkCv.data(), out, 32);
+        ++blocksCompressed;
+        input += 64;
+        length -= 64;
+    }
+
+    std::memcpy(buffer + bufferLength, input, size_t(length));
+    bufferLength += int(length);
+}
+
+Blake3::Output Blake3::chunkOutput() const {
+    Output output;
+    std::memcpy(output.cv, chunkCv.data(), 32);
+    loadBlock(buffer, output.block);
+    output.counter = chunkCounter;
+    output.blockLength = quint32(bufferLength);
+    output.flags = (blocksCompressed == 0 ? ChunkStart : 0u) | ChunkEnd;
+    return output;
+}
+
+void Blake3::mergeStack(quint64 totalChunks) {
+    // 前 totalChunks 块恰好组成 popcount(totalChunks) 棵完整子树，多出来的合并掉
+    int keep = std::popcount(totalChunks);
+    while (stackLength > keep) {
+        stack[stackLength - 2] = parentCv(stack[stackLength - 2], stack[stackLength - 1]);
+        --stackLength;
+    }
+}
+
+void Blake3::pushChainingValue(const ChainingValue &cv, quint64 counter) {
+    // 惰性合并：刚压入的一项不合并，因为没有后续输入时它可能是根
+    mergeStack(counter);
+    stack[stackLength++] = cv;
+}
+
+void Blake3::update(QByteArrayView data) {
+    const uchar *input = reinterpret_cast<const uchar *>(data.data());
+    qsizetype length = data.size();
+
+    while (length > 0) {
+        // 后面还有输入，缓冲区中的整块不是最后一块
+        if (chunkLength() == chunkBytes) {
+            pushChainingValue(chunkOutput().chainingValue(), chunkCounter);
+            resetChunk(chunkCounter + 1);
+        }
+
+        // 从块边界开始的整组完整块并行压缩，同样至少留下一个字节给最后一块
+        while (chunkLength() == 0 && length > qsizetype(lanes) * chunkBytes) {
+            ChainingValue cvs[lanes];
+            hashChunkLanes(input, chunkCounter, cvs);
+            for (const ChainingValue &cv : cvs) {
+                pushChainingValue(cv, chunkCounter);
+                ++chunkCounter;
+            }
+            input += qsizetype(lanes) * chunkBytes;
+            length -= qsizetype(lanes) * chunkBytes;
+        }
+
+        qsizetype take = qMin<qsizetype>(chunkBytes - chunkLength(), length);
+        chunkUpdate(input, take);
+        input += take;
+        length -= take;
+    }
+    // 当前块已有数据，栈里的子树都不是根了，合并好供 finalize() 从栈顶往下收
+    if (chunkLength() > 0) {
+        mergeStack(chunkCounter);
+    }
+}
+
+void Blake3::appendSubtree(const ChainingValue &cv, quint64 chunks) {
+    Q_ASSERT(chunkLength() == 0 && chunks > 0 && chunkCounter % chunks == 0);
+    pushChainingValue(cv, chunkCounter);
+    resetChunk(chunkCounter + chunks);
+}
+
+QByteArray Blake3::finalize() const {
+    if (stackLength == 0) {
+        return chunkOutput().rootBytes();
+    }
+
+    Output output;
+    int remaining;
+    if (chunkLength() > 0) {
+        output = chunkOutput();
+        remaining = stackLength;
+    } else {
+        // 以子树结尾（调用方违反了 appendSubtree 的约定）时，栈顶两项组成根
+        Q_ASSERT(stackLength >= 2);
+        std::memcpy(output.cv, iv, 32);
+        std::memcpy(output.block, stack[stackLength - 2].data(), 32);
+        std::memcpy(output.block + 8, stack[stackLength - 1].data(), 32);
+        output.counter = 0;
+        output.blockLength = 64;
+        output.flags = Parent;
+        remaining = stackLength - 2;
+    }
+    while (remaining > 0) {
+        --remaining;
+        ChainingValue right = output.chainingValue();
+        std::memcpy(output.cv, iv, 32);
+        std::memcpy(output.block, stack[remaining].data(), 32);
+        std::memcpy(output.block + 8, right.data(), 32);
+        output.counter = 0;
+        output.blockLength = 64;
+        output.flags = Parent;
+    }
+    return output.rootBytes();
+}
+
+QByteArray Blake3::hash(QByteArrayView data) {
+    Blake3 hasher;
+    hasher.update(data);
+    return hasher.finalize();
+}
+
+Blake3::ChainingValue Blake3::subtree(QByteArrayView data, quint64 firstChunk) {
+    const uchar *input = reinterpret_cast<const uchar *>(data.data());
+    qsizetype chunks = data.size() / chunkBytes;
+    Q_ASSERT(chunks > 0 && (chunks & (chunks - 1)) == 0 && data.size() == chunks * chunkBytes);
+
+    QList<ChainingValue> level(chunks);
+    qsizetype i = 0;
+    for (; i + lanes <= chunks; i += lanes) {
+        hashChunkLanes(input + i * chunkBytes, firstChunk + quint64(i), level.data() + i);
+    }
+    for (; i < chunks; ++i) {
+        level[i] = hashChunk(input + i * chunkBytes, firstChunk + quint64(i));
+    }
+
+    while (level.size() > 1) {
+        for (qsizetype j = 0; j < level.size() / 2; ++j) {
+            level[j] = parentCv(level[2 * j], level[2 * j + 1]);
+        }
+        level.resize(level.size() / 2);
+    }
+    return level.first();
+}
@@ -0,0 +1,58 @@
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <array>
+
+// BLAKE3 哈希（无密钥，32 字节输出），结果与官方实现一致。
+// 输入按 1 KiB 分块，各块独立压缩后两两合并成二叉树，所以：
+//   - 连续的完整块按 lanes 个一组同时压缩，数据按列排布，编译器可以生成 SIMD 指令；
+//   - 2 的幂个块组成的对齐子树可以在别的线程算好，再用 appendSubtree() 接上，见 FileHasher。
+class Blake3 {
+public:
+    static constexpr int chunkBytes = 1024;
+    static constexpr int digestBytes = 32;
+    static constexpr int lanes = 8;
+
+    using ChainingValue = std::array<quint32, 8>;
+
+    Blake3();
+
+    void update(QByteArrayView data);
+
+    // 接上一棵已算好的子树。当前位置必须在块边界上、与子树大小对齐，
+    // 且之后至少还有一次 update()，最后一段必须经 update() 输入
+    void appendSubtree(const ChainingValue &cv, quint64 chunks);
+
+    QByteArray finalize() const;
+
+    static QByteArray hash(QByteArrayView data);
+
+    // 从 firstChunk 块开始、chunks（2 的幂）个完整块组成的子树的链接值（非根）。
+    // data 必须恰好为 chunks * chunkBytes 字节，可以在任意线程调用
+    static ChainingValue subtree(QByteArrayView data, quint64 firstChunk);
+
+private:
+    struct Output;
+
+    qsizetype chunkLength() const { return qsizetype(blocksCompressed) * 64 + bufferLength; }
+    void chunkUpdate(const uchar *input, qsizetype length);
+    Output chunkOutput() const;
+    void resetChunk(quint64 counter);
+    void mergeStack(quint64 totalChunks);
+    void pushChainingValue(const ChainingValue &cv, quint64 chunkCounter);
+
+    // 当前块
+    ChainingValue chunkCv;
+    quint64 chunkCounter = 0;
+    uchar buffer[64];
+    int bufferLength = 0;
+    int blocksCompressed = 0;
+
+    // 尚未合并的子树，深度不超过 54（2^64 字节）
+    ChainingValue stack[54];
+    int stackLength = 0;
+};
+
+#endif // BLAKE3_H
@@ -0,0 +1,160 @@
+#include "chathistory.h"
+#include "hybridclock.h"
+#include "logger.h"
+#include <QDataStream>
+#include <QDir>
+#include <QStandardPaths>
+#include <QRegularExpression>
+#include <QtEndian>
+
+namespace {
+
+// 早期记录以 timestamp 开头；之后的格式先写一个不可能是时间的负数标记
+const qint64 clockRecordTag = -2;           // + clock
+const qint64 conversationRecordTag = -3;    // + clock、conversation
+const qint64 messageIdRecordTag = -4;       // + clock、conversation、senderId、messageId
+
+void writeRecord(QDataStream &out, const ChatRecord &record) {
+    out << messageIdRecordTag << record.clock << record.conversation << record.senderId << record.messageId;
+    out << record.timestamp << record.sender << record.text << record.outgoing;
+}
+
+void readRecord(QDataStream &in, ChatRecord *record) {
+    qint64 first = 0;
+    in >> first;
+    if (first == messageIdRecordTag) {
+        in >> record->clock >> record->conversation >> record->senderId >> record->messageId >> record->timestamp;
+    } else if (first == conversationRecordTag) {
+        in >> record->clock >> record->conversation >> record->timestamp;
+    } else if (first == clockRecordTag) {
+        in >> record->clock >> record->timestamp;
+    } else {
+        record->timestamp = first;
+        record->clock = HybridClock::pack(first);
+    }
+    in >> record->sender >> record->text >> record->outgoing;
+}
+
+bool readOffset(QFile &indexFile, quint32 id, quint64 *offset) {
+    uchar raw[sizeof(quint64)];
+    if (!indexFile.seek(qint64(id) * sizeof(quint64)) ||
+        indexFile.read(reinterpret_cast<char *>(raw), sizeof(raw)) != sizeof(raw)) {
+        return false;
+    }
+    *offset = qFromLittleEndian<quint64>(raw);
+    return true;
+}
+
+}
+
+ChatHistory::ChatHistory(const QString &directory)
+    : historyDir(directory) {
+    QDir dir(historyDir);
+    if (!dir.exists()) {
+        dir.mkpath(".");
+    }
+
+    dataPath = dir.filePath("history.dat");
+    indexPath = dir.filePath("history.idx");
+    dataFile.setFileName(dataPath);
+    indexFile.setFileName(indexPath);
+
+    if (!dataFile.open(QIODevice::ReadWrite) || !indexFile.open(QIODevice::ReadWrite)) {
+        LOG_WARNING(Storage) << "无法打开聊天历史:" << historyDir;
+        return;
+    }
+
+    // 丢弃上次异常退出时写了一半的偏移
+    qint64 indexSize = indexFile.size();
+    if (indexSize % sizeof(quint64) != 0) {
+        indexSize -= indexSize % sizeof(quint64);
+        indexFile.resize(indexSize);
+    }
+    recordCount = quint32(indexSize / sizeof(quint64));
+}
+
+ChatHistory::~ChatHistory() {
+    dataFile.close();
+    indexFile.close();
+}
+
+quint32 ChatHistory::append(const ChatRecord &record) {
+    if (!dataFile.isOpen() || !indexFile.isOpen()) {
+        return recordCount;
+    }
+
+    quint64 offset = quint64(dataFile.size());
+    dataFile.seek(qint64(offset));
+    QDataStream out(&dataFile);
+    out.setVersion(QDataStream::Qt_6_0);
+    writeRecord(out, record);
+    dataFile.flush();
+
+    // 数据落盘后再写偏移，保证索引里的记录总是完整的
+    uchar raw[sizeof(quint64)];
+    qToLittleEndian<quint64>(offset, raw);
+    indexFile.seek(qint64(recordCount) * sizeof(quint64));
+    indexFile.write(reinterpret_cast<const char *>(raw), sizeof(raw));
+    indexFile.flush();
+
+    return recordCount++;
+}
+
+quint32 ChatHistory::count() const {
+    return recordCount;
+}
+
+bool ChatHistory::record(quint32 id, ChatRecord *out) const {
+    QList<ChatRecord> result = records(id, 1);
+    if (result.isEmpty()) {
+        return false;
+    }
+    *out = result.first();
+    return true;
+}
+
+QList<ChatRecord> ChatHistory::records(quint32 first, int count) const {
+    QList<ChatRecord> result;
+    if (count <= 0) {
+        return result;
+    }
+
+    QFile index(indexPath);
+    QFile data(dataPath);
+    if (!index.open(QIODevice::ReadOnly) || !data.open(QIODevice::ReadOnly)) {
+        return result;
+    }
+
+    // 以磁盘上的索引为准，后台线程读取时不依赖 recordCount
+    quint32 available = quint32(index.size() / sizeof(quint64));
+    if (first >= available) {
+        return result;
+    }
+    count = int(qMin<quint32>(quint32(count), available - first));
+
+    quint64 offset = 0;
+    if (!readOffset(index, first, &offset) || !data.seek(qint64(offset))) {
+        return result;
+    }
+
+    // 同一页的记录在数据文件中是连续的，定位一次后顺序读取
+    QDataStream in(&data);
+    in.setVersion(QDataStream::Qt_6_0);
+    result.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        ChatRecord record;
+        readRecord(in, &record);
+        if (in.status() != QDataStream::Ok) {
+            break;
+        }
+        result.append(record);
+    }
+    return result;
+}
+
+QString ChatHistory::storagePath(const QString &username) {
+    QString configPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QString safeName = username;
+    safeName.replace(QRegularExpression("[\\\\/:*?\"<>|]"), "_");
+    return QDir(configPath).filePath("history/" + safeName);
+}
@@ -0,0 +1,51 @@
+#ifndef CHATHISTORY_H
+#define CHATHISTORY_H
+
+#include <QString>
+#include <QList>
+#include <QFile>
+
+// 一条持久化的聊天记录
+struct ChatRecord {
+    QString sender;
+    QString text;
+    qint64 timestamp = 0;   // 毫秒，自 epoch 起
+    bool outgoing = false;
+    quint64 clock = 0;      // HLC 时间戳，视图按它排列
+    QString conversation;   // 所属会话，见 Conversation；空为大厅
+    quint64 senderId = 0;   // 消息标识，只有信封格式的文本消息有，历史同步按它比对
+    quint64 messageId = 0;
+};
+
+// 追加写入的聊天历史存储：
+//   history.dat  记录数据（QDataStream 顺序写入）
+//   history.idx  每条记录在 history.dat 中的偏移（quint64，小端）
+// 记录编号即其在 history.idx 中的序号，读取时按偏移随机访问，无需加载全部历史。
+// 编号按到达顺序分配（搜索索引依赖它不变），因果顺序由记录里的 clock 决定。
+class ChatHistory {
+public:
+    explicit ChatHistory(const QString &directory);
+    ~ChatHistory();
+
+    // 追加一条记录，返回记录编号
+    quint32 append(const ChatRecord &record);
+
+    quint32 count() const;
+    QString directory() const { return historyDir; }
+
+    // 读取接口每次打开独立的只读句柄，可在后台线程调用
+    bool record(quint32 id, ChatRecord *out) const;
+    QList<ChatRecord> records(quint32 first, int count) const;
+
+    static QString storagePath(const QString &username);
+
+private:
+    QString historyDir;
+    QString dataPath;
+    QString indexPath;
+    QFile dataFile;
+    QFile indexFile;
+    quint32 recordCount = 0;
+};
+
+#endif // CHATHISTORY_H
@@ -15,8 +15,94 @@
 #include <QPixmap>
 #include <QBuffer>
 #include <QPainter>
-#include <QTime>
 #include <QPainterPath>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QtConcurrent>
+#include <QFutureWatcher>
+#include <QDesktopServices>
+#include <QMouseEvent>
+#include <QKeyEvent>
+#include <QContextMenuEvent>
+#include <QClipboard>
+#include <QMimeData>
+#include <QUrl>
+#include "searchdialog.h"
+#include "diagnosticsdialog.h"
+#include "metrics.h"
+#include "metricsexporter.h"
+#include "messagetracer.h"
+#include "startupprofiler.h"
+#include "hybridclock.h"
+#include "conversation.h"
+#include "emojitext.h"
+#include "legacyprotocol.h"
+#include "base64codec.h"
+#include "avatarimage.h"
+#include "logger.h"
+#include "memorybudget.h"
+#include "stallwatchdog.h"
+#include "filehasher.h"
+
+namespace {
+
+// 消息显示的时间取自它的 HLC 时间戳（发送方时间），而不是本地收到的时间
+QString clockTimeText(quint64 clock) {
+    return QDateTime::fromMSecsSinceEpoch(HybridClock::physicalMs(clock)).toString("hh:mm:ss");
+}
+
+// 文件消息下方的操作链接，点击由 ChatWindow::eventFilter 处理
+QString fileActionLinks(const QString &sender, const QString &fileName, const QString &openLabel,
+                        const QString &saveLabel) {
+    QString target = QString::fromLatin1(QUrl::toPercentEncoding(sender) + "/" + QUrl::toPercentEncoding(fileName));
+    QString style = "color: #2e7d32; font-size: 12px; font-weight: bold; text-decoration: none;";
+    return QString("<div style='margin-top: 8px;'>"
+                   "<a href='file-open:%1' style='%2'>%3</a>&nbsp;&nbsp;&nbsp;"
+                   "<a href='file-save:%1' style='%2'>%4</a>"
+                   "</div>")
+        .arg(target, style, openLabel, saveLabel);
+}
+
+// 文件夹消息的保存链接，按 offerId 找回清单
+QString folderActionLink(quint64 offerId) {
+    return QString("<div style='margin-top: 8px;'>"
+                   "<a href='folder-save:%1' style='color: #2e7d32; font-size: 12px; font-weight: bold; "
+                   "text-decoration: none;'>💾 保存文件夹</a>"
+                   "</div>")
+        .arg(offerId);
+}
+
+bool parseFolderAction(const QString &anchor, quint64 *offerId) {
+    if (!anchor.startsWith("folder-save:")) {
+        return false;
+    }
+    bool ok = false;
+    *offerId = anchor.mid(12).toULongLong(&ok);
+    return ok;
+}
+
+bool parseFileAction(const QString &anchor, bool *save, QString *sender, QString *fileName) {
+    QString target;
+    if (anchor.startsWith("file-open:")) {
+        *save = false;
+        target = anchor.mid(10);
+    } else if (anchor.startsWith("file-save:")) {
+        *save = true;
+        target = anchor.mid(10);
+    } else {
+        return false;
+    }
+    int slash = target.indexOf('/');
+    if (slash < 0) {
+        return false;
+    }
+    *sender = QUrl::fromPercentEncoding(target.left(slash).toLatin1());
+    *fileName = QUrl::fromPercentEncoding(target.mid(slash + 1).toLatin1());
+    return true;
+}
+
+}
 
 ChatWindow::ChatWindow(const QString &username, const QString &avatarPath, QWidget *parent)
     : QWidget(parent), username(username), avatarPath(avatarPath)
@@ -32,43 +118,93 @@ ChatWindow::ChatWindow(const QString &username, const QString &avatarPath, QWidg
     setupUI();
     setupConnections();
     createEmojiMenu();
+    StartupProfiler::mark("聊天界面构建");
 
-    // 加载用户头像
+    // 加载用户头像（后台解码）
     loadUserAvatar();
 
+    // 打开本地聊天历史；搜索索引在后台加载，完成后补上期间新增的记录
+    historyStore = new ChatHistory(ChatHistory::storagePath(this->username));
+    searchIndex = new SearchIndex(historyStore);
+    auto *indexWatcher = new QFutureWatcher<void>(this);
+    connect(indexWatcher, &QFutureWatcher<void>::finished, this, [this, indexWatcher]() {
+        searchIndex->catchUp();
+        StartupProfiler::mark("搜索索引加载");
+        indexWatcher->deleteLater();
+    });
+    indexWatcher->setFuture(searchIndex->loading());
+
+    // 只显示最近一页历史，向上滚动时再分页加载
+    historyPager = new HistoryPager(chatHistory, historyStore, this);
+    connect(historyPager, &HistoryPager::newMessagesHidden, this, [this]() {
+        statusLabel->setText("有新消息 - 滚动到底部查看");
+    });
+    historyPager->loadLatest();
+    StartupProfiler::mark("历史加载");
+
+    // 网络在窗口第一帧绘制完成后再启动，接口枚举和端口绑定不占用首帧时间
     networkManager = new NetworkManager(this, this->username);
-    connect(networkManager, &NetworkManager::messageReceived, this, &ChatWindow::onMessageReceived);
+    loadRooms();
+    networkManager->setRooms(joinedRooms);
+    networkManager->setGroupKey(loadGroupKey());
+    historySync = new HistorySync(historyStore, networkManager, this->username, this);
+    connect(networkManager, &NetworkManager::legacyMessageReceived, this, &ChatWindow::onMessageReceived);
+    networkManager->setHandler(MessageType::Text, [this](const Envelope &envelope) {
+        onTextEnvelope(envelope);
+    });
+    networkManager->setHandler(MessageType::File, [this](const Envelope &envelope) {
+        onFileEnvelope(envelope);
+    });
+    networkManager->setHandler(MessageType::FileOffer, [this](const Envelope &envelope) {
+        onFileOfferEnvelope(envelope);
+    });
+    networkManager->setHandler(MessageType::FolderOffer, [this](const Envelope &envelope) {
+        onFolderOfferEnvelope(envelope);
+    });
+    fileShare = new FileShare(networkManager, this->username, this);
+    connect(fileShare, &FileShare::downloadProgress, this, &ChatWindow::onDownloadProgress);
+    connect(fileShare, &FileShare::downloadVerifying, this, &ChatWindow::onDownloadVerifying);
+    connect(fileShare, &FileShare::downloadFinished, this, &ChatWindow::onDownloadFinished);
+    connect(fileShare, &FileShare::downloadFailed, this, &ChatWindow::onDownloadFailed);
+    imageLadder = ImageTranscoder::loadLadder(QDir(historyStore->directory()).filePath("image_ladder.txt"));
+    MemoryBudget memoryBudget = MemoryBudget::load(QDir(historyStore->directory()).filePath("memory_budget.txt"));
+    userAvatars.setBudget(memoryBudget.avatarBytes);
+    receivedFiles.setBudget(memoryBudget.fileBytes);
+    historyPager->setMemoryBudget(memoryBudget.chatViewBytes);
+    // 默认每 15 秒把指标写到历史目录下的 metrics.prom，不开端口
+    MetricsExporter::Settings metricsDefaults;
+    metricsDefaults.filePath = QDir(historyStore->directory()).filePath("metrics.prom");
+    metricsExporter = new MetricsExporter(
+        MetricsExporter::loadSettings(QDir(historyStore->directory()).filePath("metrics_export.txt"), metricsDefaults),
+        this);
+    messageTracer = new MessageTracer(networkManager, this->username, this);
     connect(networkManager, &NetworkManager::peerDiscovered, this, &ChatWindow::onPeerDiscovered);
+    StartupProfiler::markAfterFirstPaint(this, "聊天窗口首帧", [this]() {
+        networkManager->start();
+        StartupProfiler::mark("网络启动");
+        StartupProfiler::report();
+    });
     // 连接头像按钮点击信号
     connect(avatarButton, &QPushButton::clicked, this, &ChatWindow::onAvatarButtonClicked);
 
     statusLabel->setText(QString("就绪 - 用户名: %1 - 点击😊按钮发送表情").arg(this->username));
+    if (networkManager->isEncryptionEnabled()) {
+        encryptionButton->setText("🔒");
+    }
 }
 
 
 ChatWindow::~ChatWindow() {
+    delete historySync;
+    delete fileShare;
     delete networkManager;
+    delete historyPager;
+    delete searchIndex;
+    delete historyStore;
 }
 
 
 void ChatWindow::initEmojiMap() {
-    // 初始化表情映射表
-    emojiMap = {
-        {":)", "😊"}, {":-)", "😊"}, {":D", "😄"}, {":-D", "😄"},
-        {":(", "😞"}, {":-(", "😞"}, {":'(", "😢"}, {":O", "😲"},
-        {":-O", "😲"}, {":P", "😛"}, {":-P", "😛"}, {";)", "😉"},
-        {";-)", "😉"}, {"<3", "❤️"}, {"</3", "💔"}, {":*", "😘"},
-        {":-*", "😘"}, {":|", "😐"}, {":-|", "😐"}, {"XD", "😆"},
-        {"xD", "😆"}, {"xDD", "😂"}, {"^^", "😊"}, {">:(", "😠"},
-        {">:-(", "😠"}, {"O:)", "😇"}, {"O:-)", "😇"}, {"3:)", "😈"},
-        {"3:-)", "😈"}, {"o.O", "😳"}, {"O.o", "😳"}, {":/", "😕"},
-        {":-/", "😕"}, {":\\", "😕"}, {":-\\", "😕"}, {":$", "😳"},
-        {":-$", "😳"}, {"B)", "😎"}, {"B-)", "😎"}, {"8)", "😎"},
-        {"8-)", "😎"}, {"':(", "😥"}, {"':-)", "😥"}, {"'):", "😥"},
-        {"'-):", "😥"}, {"</3", "💔"}, {"(y)", "👍"}, {"(n)", "👎"},
-        {"(Y)", "👍"}, {"(N)", "👎"}, {"(ok)", "👌"}, {"(OK)", "👌"}
-    };
-
     // 常用表情列表（用于表情按钮菜单）
     commonEmojis = {
         "😊", "😄", "😂", "😍", "😘",
@@ -106,6 +242,9 @@ void ChatWindow::setupUI() {
     // 聊天历史区域
     chatHistory = new QTextEdit(this);
     chatHistory->setReadOnly(true);
+    // 文件消息里的链接：悬停显示手形光标，点击在 eventFilter 中处理
+    chatHistory->setTextInteractionFlags(Qt::TextSelectableByMouse | Qt::LinksAccessibleByMouse);
+    chatHistory->viewport()->installEventFilter(this);
     chatHistory->setFont(QFont("Microsoft YaHei", 11));
     chatHistory->setStyleSheet("QTextEdit { "
                               "background-color: #f9f9f9; "
@@ -122,6 +261,42 @@ void ChatWindow::setupUI() {
     userListLayout->setContentsMargins(5, 5, 5, 5);
     userListLayout->setSpacing(5);
 
+    QLabel *conversationTitle = new QLabel("💬 会话", this);
+    conversationTitle->setStyleSheet("font-weight: bold; font-size: 14px; padding: 8px; color: #333;");
+    userListLayout->addWidget(conversationTitle);
+
+    // 大厅发给所有人；房间只发给加入的人；双击在线用户开始私聊
+    conversationList = new QListWidget(this);
+    conversationList->setMaximumHeight(160);
+    conversationList->setContextMenuPolicy(Qt::CustomContextMenu);
+    conversationList->setStyleSheet("QListWidget { "
+                                   "border: 1px solid #ccc; "
+                                   "border-radius: 8px; "
+                                   "background-color: white; "
+                                   "}"
+                                   "QListWidget::item { "
+                                   "padding: 6px; "
+                                   "}"
+                                   "QListWidget::item:selected { "
+                                   "background-color: #e8f5e9; "
+                                   "color: #2e7d32; "
+                                   "}");
+    userListLayout->addWidget(conversationList);
+    conversationItem(QString(), true)->setSelected(true);
+
+    joinRoomButton = new QPushButton("➕ 加入房间", this);
+    joinRoomButton->setStyleSheet("QPushButton { "
+                                 "padding: 6px; "
+                                 "border: 1px solid #ccc; "
+                                 "border-radius: 6px; "
+                                 "background-color: #f0f0f0; "
+                                 "}"
+                                 "QPushButton:hover { "
+                                 "background-color: #e0e0e0; "
+                                 "border-color: #4CAF50; "
+                                 "}");
+    userListLayout->addWidget(joinRoomButton);
+
     QLabel *userListTitle = new QLabel("👥 在线用户", this);
     userListTitle->setStyleSheet("font-weight: bold; font-size: 14px; padding: 8px; color: #333;");
     userListLayout->addWidget(userListTitle);
@@ -187,6 +362,12 @@ void ChatWindow::setupUI() {
                              "}");
     fileButton->setToolTip("发送文件");
 
+    // 文件夹发送按钮
+    folderButton = new QPushButton("🗂", this);
+    folderButton->setFixedSize(50, 50);
+    folderButton->setStyleSheet(fileButton->styleSheet());
+    folderButton->setToolTip("发送文件夹");
+
     // 表情按钮
     emojiButton = new QToolButton(this);
     emojiButton->setText("😊");
@@ -206,8 +387,43 @@ void ChatWindow::setupUI() {
                               "background-color: #fff59d; "
                               "}");
 
+    // 搜索按钮
+    searchButton = new QToolButton(this);
+    searchButton->setText("🔍");
+    searchButton->setToolTip("搜索聊天记录");
+    searchButton->setFixedSize(50, 50);
+    searchButton->setStyleSheet("QToolButton { "
+                               "font-size: 22px; "
+                               "border: 1px solid #ccc; "
+                               "border-radius: 8px; "
+                               "background-color: #f0f0f0; "
+                               "}"
+                               "QToolButton:hover { "
+                               "background-color: #e0e0e0; "
+                               "border-color: #4CAF50; "
+                               "}"
+                               "QToolButton:pressed { "
+                               "background-color: #d0d0d0; "
+                               "}");
+
+    // 加密按钮
+    encryptionButton = new QToolButton(this);
+    encryptionButton->setText("🔓");
+    encryptionButton->setToolTip("设置群组口令，启用端到端加密");
+    encryptionButton->setFixedSize(50, 50);
+    encryptionButton->setStyleSheet(searchButton->styleSheet());
+
+    // 网络诊断按钮
+    diagnosticsButton = new QToolButton(this);
+    diagnosticsButton->setText("📊");
+    diagnosticsButton->setToolTip("网络诊断：各节点收发量、失败次数、队列和延迟");
+    diagnosticsButton->setFixedSize(50, 50);
+    diagnosticsButton->setStyleSheet(searchButton->styleSheet());
+
     // 消息输入框
     messageInput = new QLineEdit(this);
+    // 粘贴的截图直接发送，快捷键和右键菜单都在 eventFilter 中拦截
+    messageInput->installEventFilter(this);
     messageInput->setPlaceholderText("输入消息... (支持表情代码如 :) :D <3 等，点击😊按钮选择表情)");
     messageInput->setStyleSheet("QLineEdit { "
                                "padding: 12px; "
@@ -246,7 +462,11 @@ void ChatWindow::setupUI() {
 
     inputLayout->addWidget(avatarButton);
     inputLayout->addWidget(fileButton);
+    inputLayout->addWidget(folderButton);
     inputLayout->addWidget(emojiButton);
+    inputLayout->addWidget(searchButton);
+    inputLayout->addWidget(encryptionButton);
+    inputLayout->addWidget(diagnosticsButton);
     inputLayout->addWidget(messageInput, 1);
     inputLayout->addWidget(sendButton);
     mainLayout->addLayout(inputLayout);
@@ -265,6 +485,14 @@ void ChatWindow::setupUI() {
     connect(messageInput, &QLineEdit::returnPressed, this, &ChatWindow::onSendMessage);
     connect(sendButton, &QPushButton::clicked, this, &ChatWindow::onSendMessage);
     connect(fileButton, &QPushButton::clicked, this, &ChatWindow::onSendFile);
+    connect(folderButton, &QPushButton::clicked, this, &ChatWindow::onSendFolder);
+    connect(conversationList, &QListWidget::itemSelectionChanged, this, &ChatWindow::onConversationSelected);
+    connect(conversationList, &QListWidget::customContextMenuRequested, this, &ChatWindow::onConversationContextMenu);
+    connect(joinRoomButton, &QPushButton::clicked, this, &ChatWindow::onJoinRoomClicked);
+    connect(onlineUsersList, &QListWidget::itemDoubleClicked, this, &ChatWindow::onOnlineUserDoubleClicked);
+    connect(searchButton, &QToolButton::clicked, this, &ChatWindow::onSearchClicked);
+    connect(encryptionButton, &QToolButton::clicked, this, &ChatWindow::onEncryptionClicked);
+    connect(diagnosticsButton, &QToolButton::clicked, this, &ChatWindow::onDiagnosticsClicked);
 
     // 显示欢迎消息
     QTimer::singleShot(100, this, [this]() {
@@ -272,7 +500,7 @@ void ChatWindow::setupUI() {
                                         "欢迎 <b>%1</b> 加入P2P聊天室！"
                                         "<br><small>现在可以开始与在线用户聊天了</small>"
                                         "</div>").arg(username);
-        chatHistory->append(welcomeMessage);
+        historyPager->appendHtml(welcomeMessage);
     });
 }
 
@@ -292,21 +520,23 @@ void ChatWindow::createEmojiMenu() {
                             "background-color: #e8f5e9; "
                             "}");
 
-    // 创建表情选择区域
-    QWidget *emojiWidget = new QWidget(this);
-    QGridLayout *gridLayout = new QGridLayout(emojiWidget);
-    gridLayout->setSpacing(4);
-    gridLayout->setContentsMargins(8, 8, 8, 8);
+    // 表情面板在第一次打开菜单时才创建
+    connect(emojiMenu, &QMenu::aboutToShow, this, &ChatWindow::buildEmojiPalette);
 
-    // 添加常用表情
-    int columns = 10;
-    int rows = (commonEmojis.size() + columns - 1) / columns;
+    emojiButton->setMenu(emojiMenu);
+    emojiButton->setPopupMode(QToolButton::InstantPopup);
+}
 
-    for (int i = 0; i < commonEmojis.size(); i++) {
-        QPushButton *emojiBtn = new QPushButton(commonEmojis[i]);
-        emojiBtn->setFixedSize(36, 36);
-        emojiBtn->setFont(QFont("Segoe UI Emoji", 18));
-        emojiBtn->setStyleSheet("QPushButton { "
+void ChatWindow::buildEmojiPalette() {
+    if (emojiPaletteBuilt) {
+        return;
+    }
+    emojiPaletteBuilt = true;
+
+    // 创建表情选择区域；按钮样式和字体设置在容器上，所有按钮共享同一份样式表
+    QWidget *emojiWidget = new QWidget(this);
+    emojiWidget->setFont(QFont("Segoe UI Emoji", 18));
+    emojiWidget->setStyleSheet("QPushButton { "
                                "border: none; "
                                "background-color: transparent; "
                                "border-radius: 6px; "
@@ -318,6 +548,16 @@ void ChatWindow::createEmojiMenu() {
                                "QPushButton:pressed { "
                                "background-color: #e0e0e0; "
                                "}");
+    QGridLayout *gridLayout = new QGridLayout(emojiWidget);
+    gridLayout->setSpacing(4);
+    gridLayout->setContentsMargins(8, 8, 8, 8);
+
+    // 添加常用表情
+    int columns = 10;
+
+    for (int i = 0; i < commonEmojis.size(); i++) {
+        QPushButton *emojiBtn = new QPushButton(commonEmojis[i], emojiWidget);
+        emojiBtn->setFixedSize(36, 36);
 
         QString emoji = commonEmojis[i];
         connect(emojiBtn, &QPushButton::clicked, this, [this, emoji]() {
@@ -356,9 +596,6 @@ void ChatWindow::createEmojiMenu() {
     QWidgetAction *widgetAction = new QWidgetAction(emojiMenu);
     widgetAction->setDefaultWidget(containerWidget);
     emojiMenu->addAction(widgetAction);
-
-    emojiButton->setMenu(emojiMenu);
-    emojiButton->setPopupMode(QToolButton::InstantPopup);
 }
 
 void ChatWindow::setupConnections() {
@@ -366,35 +603,11 @@ void ChatWindow::setupConnections() {
 }
 
 QString ChatWindow::processMessageWithEmojis(const QString &message) {
-    QString result = message;
-
-    // 先处理特殊的长代码
-    QMap<QString, QString> specialEmojis = {
-        {":coffee:", "☕"}, {":pizza:", "🍕"}, {":beer:", "🍺"},
-        {":cake:", "🎂"}, {":gift:", "🎁"}, {":star:", "⭐"},
-        {":fire:", "🔥"}, {":+1:", "👍"}, {":-1:", "👎"},
-        {":ok:", "👌"}, {":100:", "💯"}, {":heart:", "❤️"},
-        {":thumbsup:", "👍"}, {":thumbsdown:", "👎"}, {":clap:", "👏"},
-        {":pray:", "🙏"}, {":handshake:", "🤝"}
-    };
-
-    for (auto it = specialEmojis.begin(); it != specialEmojis.end(); ++it) {
-        result.replace(it.key(), it.value());
-    }
-
-    // 然后处理短代码
-    for (auto it = emojiMap.begin(); it != emojiMap.end(); ++it) {
-        // 使用正则表达式确保只替换完整的代码
-        // 注意：这里可能需要包含头文件 #include <QRegularExpression>
-        QString pattern = "\\b" + QRegularExpression::escape(it.key()) + "\\b";
-        QRegularExpression rx(pattern);
-        result.replace(rx, it.value());
-    }
-
-    return result;
+    return EmojiText::replaceCodes(message);
 }
 
 void ChatWindow::onSendMessage() {
+    STALL_OPERATION("onSendMessage");
     QString message = messageInput->text().trimmed();
     if (message.isEmpty()) return;
 
@@ -402,32 +615,31 @@ void ChatWindow::onSendMessage() {
     QString processedMessage = processMessageWithEmojis(message);
 
     // 将头像信息编码到消息中
-    QString avatarData = "";
+    QByteArray avatarPng;
     if (!avatarPath.isEmpty()) {
-        QPixmap avatarPixmap(avatarPath);
-        if (!avatarPixmap.isNull()) {
-            avatarPixmap = cropToSquare(avatarPixmap);
-            avatarPixmap = avatarPixmap.scaled(32, 32, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            QByteArray byteArray;
-            QBuffer buffer(&byteArray);
-            buffer.open(QIODevice::WriteOnly);
-            avatarPixmap.save(&buffer, "PNG");
-            avatarData = QString::fromLatin1(byteArray.toBase64().data());
-        }
-    }
-
-    // 构造带头像信息的消息
-    QString fullMessage = QString("[%1]: %2").arg(username).arg(message);
-    if (!avatarData.isEmpty()) {
-        fullMessage += QString("|AVATAR:%1").arg(avatarData);
+        STALL_OPERATION("头像编码");
+        avatarPng = AvatarImage::encodePng(QImage(avatarPath));
     }
+    QString avatarData = Base64Codec::encode(avatarPng);
+
+    // 发送带头像信息的消息：负载为发送者、正文和头像 PNG 原始字节
+    QString conversation = currentConversation;
+    EnvelopeWriter writer(MessageType::Text, message.size() * 3 + avatarPng.size() + 64, conversation);
+    writer.string16(username);
+    writer.string32(message);
+    writer.bytes32(avatarPng);
+    quint64 clock = networkManager->send(writer, [&]() {
+        // 旧版文本协议（只会用于大厅和私聊，旧版节点不会加入房间）
+        QString text = Conversation::isDirect(conversation) ? "(私聊) " + message : message;
+        return LegacyProtocol::formatText(username, text, avatarPng);
+    });
 
     // 显示在聊天历史中（带头像）
     QTextCursor cursor = chatHistory->textCursor();
     cursor.movePosition(QTextCursor::End);
 
     // 添加时间戳
-    QString timestamp = QTime::currentTime().toString("hh:mm:ss");
+    QString timestamp = clockTimeText(clock);
 
     // 获取当前用户头像
     QString avatarHtml = "";
@@ -460,56 +672,54 @@ void ChatWindow::onSendMessage() {
                                    .arg(timestamp)
                                    .arg(processedMessage.toHtmlEscaped().replace("\n", "<br>"));
 
-    chatHistory->append(displayMessage);
-    chatHistory->moveCursor(QTextCursor::End);
-
     messageInput->clear();
 
-    // 发送带头像信息的消息
-    networkManager->sendMessageToAllPeers(fullMessage);
+    appendMessage(username, processedMessage, true, displayMessage, clock, conversation,
+                  writer.senderId(), writer.messageId());
 }
 
-void ChatWindow::onMessageReceived(const QString &message) {
-    // 检查是否是文件消息
-    if (message.contains("[FILE]") && message.contains("[FILENAME]")) {
-        handleFileMessage(message);
+void ChatWindow::onMessageReceived(const QString &message, quint64 clock) {
+    STALL_OPERATION("onMessageReceived");
+    // 旧版文本协议：检查是否是文件消息
+    if (LegacyProtocol::isFileMessage(message)) {
+        handleFileMessage(message, clock);
         return;
     }
 
     // 处理普通文本消息
-    QString displayMessage;
-    QString senderUsername = "未知用户";
-    QString avatarData = "";
-
-    QString actualMessage = message;
+    LegacyProtocol::TextMessage text = LegacyProtocol::parseText(message);
+    showIncomingText(text.sender, text.text, text.avatarPng, clock, QString());
+}
 
-    // 检查是否有头像数据
-    if (message.contains("|AVATAR:")) {
-        int avatarPos = message.lastIndexOf("|AVATAR:");
-        actualMessage = message.left(avatarPos);
-        avatarData = message.mid(avatarPos + 8); // 跳过 "|AVATAR:" 前缀
+void ChatWindow::onTextEnvelope(const Envelope &envelope) {
+    STALL_OPERATION("onTextEnvelope");
+    PayloadReader reader(envelope.payload);
+    QString senderUsername = reader.string16();
+    QString text = reader.string32();
+    QByteArrayView avatarPng = reader.bytes32();
+    if (!reader.ok()) {
+        LOG_WARNING(Ui) << "文本消息负载不完整";
+        return;
     }
 
-    if (actualMessage.startsWith("[") && actualMessage.contains("]: ")) {
-        int bracketEnd = actualMessage.indexOf("]: ");
-        QString usernamePart = actualMessage.mid(1, bracketEnd - 1);  // 提取用户名
-        senderUsername = usernamePart;
-        QString messagePart = actualMessage.mid(bracketEnd + 3);
+    showIncomingText(senderUsername, text, avatarPng, quint64(envelope.timestamp),
+                     incomingConversation(envelope, senderUsername), envelope.senderId, envelope.messageId);
+}
 
-        // 处理表情代码
-        QString processedContent = processMessageWithEmojis(messagePart);
-        displayMessage = processedContent;
-    } else {
-        displayMessage = processMessageWithEmojis(actualMessage);
-    }
+void ChatWindow::showIncomingText(const QString &senderUsername, const QString &text, QByteArrayView avatarPng,
+                                  quint64 clock, const QString &conversation, quint64 senderId, quint64 messageId) {
+    // 处理表情代码
+    QString displayMessage = processMessageWithEmojis(text);
+    QString avatarData = "";
 
     // 如果有头像数据，存储到用户头像缓存中
-    if (!avatarData.isEmpty() && !senderUsername.isEmpty()) {
+    if (!avatarPng.isEmpty() && !senderUsername.isEmpty()) {
+        STALL_OPERATION("头像解码");
         QPixmap avatarPixmap;
-        QByteArray avatarBytes = QByteArray::fromBase64(avatarData.toLatin1());
-        avatarPixmap.loadFromData(avatarBytes);
+        avatarPixmap.loadFromData(reinterpret_cast<const uchar *>(avatarPng.data()), uint(avatarPng.size()));
         if (!avatarPixmap.isNull()) {
-            userAvatars[senderUsername] = avatarPixmap;
+            userAvatars.insert(senderUsername, avatarPixmap);
+            avatarData = Base64Codec::encode(avatarPng);
 
             // 更新在线用户列表中的头像
             updateOnlineUserAvatar(senderUsername, avatarPixmap);
@@ -517,7 +727,7 @@ void ChatWindow::onMessageReceived(const QString &message) {
     }
 
     // 添加时间戳
-    QString timestamp = QTime::currentTime().toString("hh:mm:ss");
+    QString timestamp = clockTimeText(clock);
 
     // 获取发送者头像
     QString avatarHtml = "";
@@ -535,7 +745,7 @@ void ChatWindow::onMessageReceived(const QString &message) {
             QBuffer buffer(&byteArray);
             buffer.open(QIODevice::WriteOnly);
             senderAvatar.save(&buffer, "PNG");
-            QString base64Image = QString::fromLatin1(byteArray.toBase64().data());
+            QString base64Image = Base64Codec::encode(byteArray);
             avatarHtml = QString("<img src='data:image/png;base64,%1' width='32' height='32' "
                                 "style='vertical-align: middle; margin-right: 8px; border-radius: 16px; "
                                 "border: 1px solid #4CAF50; box-shadow: 0 2px 4px rgba(0,0,0,0.1);' />").arg(base64Image);
@@ -565,201 +775,264 @@ void ChatWindow::onMessageReceived(const QString &message) {
                                  .arg(timestamp)
                                  .arg(displayMessage.toHtmlEscaped().replace("\n", "<br>"));
 
-    chatHistory->append(fullMessage);
-    chatHistory->moveCursor(QTextCursor::End);
+    appendMessage(senderUsername, displayMessage, false, fullMessage, clock, conversation, senderId, messageId);
 }
 
-void ChatWindow::handleFileMessage(const QString &message) {
-    // 解析文件消息
-    int startBracket = message.indexOf('[');
-    int endBracket = message.indexOf(']');
-    QString senderUsername = message.mid(startBracket + 1, endBracket - startBracket - 1);
+void ChatWindow::handleFileMessage(const QString &message, quint64 clock) {
+    STALL_OPERATION("handleFileMessage");
+    // 解析旧版文本协议的文件消息
+    LegacyProtocol::FileMessage parsed;
+    if (!LegacyProtocol::parseFile(message, &parsed)) {
+        return;
+    }
 
-    int fileStart = message.indexOf("[FILE]") + 6;
-    int filenameStart = message.indexOf("[FILENAME]");
-    int extensionStart = message.indexOf("[FILEEXTENSION]");
-    int filetypeStart = message.indexOf("[FILETYPE]");
-    int filesizeStart = message.indexOf("[FILESIZE]");
-    int filedataStart = message.indexOf("[FILEDATA]");
-    int fileEnd = message.indexOf("[/FILE]");
+    // 解码后的原始字节直接保存，不再重新编码
+    ReceivedFile file;
+    file.storage = parsed.data;
+    file.size = file.storage.size();
 
-    if (fileStart >= 6 && filenameStart > fileStart && extensionStart > filenameStart &&
-        filetypeStart > extensionStart && filesizeStart > filetypeStart && filedataStart > filesizeStart && fileEnd > filedataStart) {
+    showIncomingFile(parsed.sender, parsed.fileName, parsed.fileType, parsed.fileSize, parsed.thumbnailBase64, file,
+                     clock, QString());
+}
 
-        QString fileName = message.mid(fileStart, filenameStart - fileStart);
-        QString fileExtension = message.mid(filenameStart + 10, extensionStart - filenameStart - 10);
-        QString fileType = message.mid(extensionStart + 15, filetypeStart - extensionStart - 15);
-        QString fileSizeStr = message.mid(filetypeStart + 10, filesizeStart - filetypeStart - 10);
+void ChatWindow::onFileEnvelope(const Envelope &envelope) {
+    STALL_OPERATION("onFileEnvelope");
+    PayloadReader reader(envelope.payload);
+    QString senderUsername = reader.string16();
+    QString fileName = reader.string16();
+    quint8 kind = reader.u8();
+    quint64 fileSize = reader.u64();
+    QByteArrayView thumbnail = reader.bytes32();
+    QByteArrayView fileData = reader.rest();
+    if (!reader.ok()) {
+        LOG_WARNING(Ui) << "文件消息负载不完整";
+        return;
+    }
 
-        // 提取文件数据部分
-        QString filePart = message.mid(filedataStart + 10, fileEnd - filedataStart - 10);
-        int thumbnailPos = filePart.indexOf("[THUMBNAIL]");
-        QString fileDataBase64, thumbnailBase64;
+    // 文件内容留在消息帧里，只记录它在帧中的位置
+    ReceivedFile file;
+    file.storage = envelope.frame;
+    file.offset = fileData.data() - envelope.frame.constData();
+    file.size = fileData.size();
 
-        if (thumbnailPos != -1) {
-            fileDataBase64 = filePart.left(thumbnailPos);
-            thumbnailBase64 = filePart.mid(thumbnailPos + 11);
-        } else {
-            fileDataBase64 = filePart;
-        }
+    QString fileType = kind == FileKindImage ? "image" : (kind == FileKindVideo ? "video" : "other");
+    QString thumbnailBase64 = Base64Codec::encode(thumbnail);
+    showIncomingFile(senderUsername, fileName, fileType, qint64(fileSize), thumbnailBase64, file,
+                     quint64(envelope.timestamp), incomingConversation(envelope, senderUsername));
+}
 
-        // 解码文件数据
-        QByteArray fileData = QByteArray::fromBase64(fileDataBase64.toUtf8());
-        qint64 fileSize = fileSizeStr.toLongLong();
+void ChatWindow::onFileOfferEnvelope(const Envelope &envelope) {
+    STALL_OPERATION("onFileOfferEnvelope");
+    PayloadReader reader(envelope.payload);
+    QString senderUsername = reader.string16();
+    QString fileName = reader.string16();
+    quint8 kind = reader.u8();
+    quint64 fileSize = reader.u64();
+    QByteArrayView preview = reader.bytes32();
+    quint64 offerId = reader.u64();
+    // 之后是可选的 32 字节 BLAKE3 摘要，旧版本不发
+    QByteArrayView digest = reader.rest();
+    if (!reader.ok() || offerId == 0) {
+        LOG_WARNING(Ui) << "文件预告负载不完整";
+        return;
+    }
 
-        bool isImage = (fileType == "image");
-        bool isVideo = (fileType == "video");
+    // 只有预览，原文件在对方那里，打开或保存时再拉取
+    ReceivedFile file;
+    file.size = qsizetype(fileSize);
+    file.owner = senderUsername;
+    file.offerId = offerId;
+    if (digest.size() == Blake3::digestBytes) {
+        file.digest = digest.toByteArray();
+    }
 
-        // 添加时间戳
-        QString timestamp = QTime::currentTime().toString("hh:mm:ss");
+    QString fileType = kind == FileKindImage ? "image" : (kind == FileKindVideo ? "video" : "other");
+    QString previewBase64 = Base64Codec::encode(preview);
+    showIncomingFile(senderUsername, fileName, fileType, qint64(fileSize), previewBase64, file,
+                     quint64(envelope.timestamp), incomingConversation(envelope, senderUsername));
+}
 
-        // 获取发送者头像
-        QString avatarHtml = "";
-        QPixmap senderAvatar = getUserAvatar(senderUsername);
-        if (!senderAvatar.isNull()) {
-            senderAvatar = cropToSquare(senderAvatar);
-            senderAvatar = senderAvatar.scaled(32, 32, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            QByteArray byteArray;
-            QBuffer buffer(&byteArray);
-            buffer.open(QIODevice::WriteOnly);
-            senderAvatar.save(&buffer, "PNG");
-            QString base64Image = QString::fromLatin1(byteArray.toBase64().data());
-            avatarHtml = QString("<img src='data:image/png;base64,%1' width='32' height='32' "
-                                "style='vertical-align: middle; margin-right: 8px; border-radius: 16px; "
-                                "border: 1px solid #4CAF50; box-shadow: 0 2px 4px rgba(0,0,0,0.1);' />").arg(base64Image);
-        } else {
-            avatarHtml = "<div style='width: 32px; height: 32px; background: linear-gradient(135deg, #4CAF50, #45a049); "
-                        "border-radius: 16px; margin-right: 8px; display: flex; align-items: center; "
-                        "justify-content: center; font-size: 16px; color: white; box-shadow: 0 2px 4px rgba(0,0,0,0.1);'>👤</div>";
-        }
+void ChatWindow::onFolderOfferEnvelope(const Envelope &envelope) {
+    STALL_OPERATION("onFolderOfferEnvelope");
+    PayloadReader reader(envelope.payload);
+    QString senderUsername = reader.string16();
+    quint64 offerId = reader.u64();
+    FolderManifest manifest;
+    if (!FolderManifest::read(reader, &manifest) || !reader.ok() || offerId == 0) {
+        LOG_WARNING(Ui) << "文件夹清单不完整或路径不安全，已忽略";
+        return;
+    }
+    showIncomingFolder(senderUsername, offerId, manifest, quint64(envelope.timestamp),
+                       incomingConversation(envelope, senderUsername));
+}
 
-        // 根据文件类型显示不同内容
-        QString fileMessage;
-        if (isImage) {
-            QString thumbnailHtml = "";
-            if (!thumbnailBase64.isEmpty()) {
-                thumbnailHtml = QString("<img src='data:image/jpeg;base64,%1' "
-                                       "style='max-width: 120px; max-height: 120px; margin-top: 8px; "
-                                       "border-radius: 8px; border: 1px solid #ddd; "
-                                       "box-shadow: 0 2px 8px rgba(0,0,0,0.1); cursor: pointer;' "
-                                       "onclick='this.style.maxWidth=\"none\"; this.style.maxHeight=\"none\"'/>")
-                                       .arg(thumbnailBase64);
-            }
+void ChatWindow::showIncomingFolder(const QString &senderUsername, quint64 offerId, const FolderManifest &manifest,
+                                    quint64 clock, const QString &conversation) {
+    QString fileMessage = QString("<div style='margin: 12px 0; display: flex; align-items: flex-start;'>"
+                                  "<div style='flex: 1;'>"
+                                  "<div style='display: flex; align-items: center; margin-bottom: 4px;'>"
+                                  "<span style='color: #4CAF50; font-weight: bold; font-size: 14px;'>%1</span>"
+                                  "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%2</span>"
+                                  "</div>"
+                                  "<div style='background: #f9f9f9; padding: 12px; border-radius: 12px; "
+                                  "border: 1px dashed #4CAF50;'>"
+                                  "<div style='color: #666; margin-bottom: 8px;'>"
+                                  "🗂 发送了文件夹：<b>%3</b>（%4 个文件，%5 KB）"
+                                  "</div>"
+                                  "%6"
+                                  "</div>"
+                                  "</div>"
+                                  "</div>")
+                              .arg(senderUsername.toHtmlEscaped())
+                              .arg(clockTimeText(clock))
+                              .arg(manifest.name.toHtmlEscaped())
+                              .arg(manifest.fileCount())
+                              .arg(manifest.totalBytes() / 1024)
+                              .arg(folderActionLink(offerId));
+
+    appendMessage(senderUsername, QString("[文件夹] %1").arg(manifest.name), false, fileMessage, clock, conversation);
+    receivedFolders.insert(offerId, ReceivedFolder{senderUsername, manifest});
+}
 
-            fileMessage = QString("<div style='margin: 12px 0; display: flex; align-items: flex-start;'>"
-                                 "%1"
-                                 "<div style='flex: 1;'>"
-                                 "<div style='display: flex; align-items: center; margin-bottom: 4px;'>"
-                                 "<span style='color: #4CAF50; font-weight: bold; font-size: 14px;'>%2</span>"
-                                 "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%3</span>"
-                                 "</div>"
-                                 "<div style='background: #f9f9f9; padding: 12px; border-radius: 12px; "
-                                 "border: 1px dashed #4CAF50;'>"
-                                 "<div style='color: #666; margin-bottom: 8px;'>"
-                                 "📸 发送了图片：<b>%4</b> (%5 KB)"
-                                 "</div>"
-                                 "%6"
-                                 "<br>"
-                                 "<button onclick='saveReceivedFile(\"%2\", \"%4\")' "
-                                 "style='margin-top: 8px; padding: 6px 12px; "
-                                 "background: linear-gradient(135deg, #4CAF50, #45a049); "
-                                 "color: white; border: none; border-radius: 6px; "
-                                 "font-size: 12px; cursor: pointer;'>"
-                                 "💾 保存图片"
-                                 "</button>"
-                                 "</div>"
-                                 "</div>"
-                                 "</div>")
-                                 .arg(avatarHtml)
-                                 .arg(senderUsername)
-                                 .arg(timestamp)
-                                 .arg(fileName)
-                                 .arg(fileSize / 1024)
-                                 .arg(thumbnailHtml);
-        } else if (isVideo) {
-            fileMessage = QString("<div style='margin: 12px 0; display: flex; align-items: flex-start;'>"
-                                 "%1"
-                                 "<div style='flex: 1;'>"
-                                 "<div style='display: flex; align-items: center; margin-bottom: 4px;'>"
-                                 "<span style='color: #4CAF50; font-weight: bold; font-size: 14px;'>%2</span>"
-                                 "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%3</span>"
-                                 "</div>"
-                                 "<div style='background: #f9f9f9; padding: 12px; border-radius: 12px; "
-                                 "border: 1px dashed #4CAF50;'>"
-                                 "<div style='color: #666; margin-bottom: 8px;'>"
-                                 "🎬 发送了视频：<b>%4</b> (%5 KB)"
-                                 "</div>"
-                                 "<div style='width: 120px; height: 120px; "
-                                 "background: linear-gradient(135deg, #333, #555); "
-                                 "border-radius: 8px; margin-top: 8px; display: flex; "
-                                 "align-items: center; justify-content: center; color: white; "
-                                 "font-size: 24px;'>"
-                                 "🎬"
-                                 "</div>"
-                                 "<br>"
-                                 "<button onclick='saveReceivedFile(\"%2\", \"%4\")' "
-                                 "style='margin-top: 8px; padding: 6px 12px; "
-                                 "background: linear-gradient(135deg, #4CAF50, #45a049); "
-                                 "color: white; border: none; border-radius: 6px; "
-                                 "font-size: 12px; cursor: pointer;'>"
-                                 "📥 保存视频"
-                                 "</button>"
-                                 "</div>"
-                                 "</div>"
-                                 "</div>")
-                                 .arg(avatarHtml)
-                                 .arg(senderUsername)
-                                 .arg(timestamp)
-                                 .arg(fileName)
-                                 .arg(fileSize / 1024);
-        } else {
-            fileMessage = QString("<div style='margin: 12px 0; display: flex; align-items: flex-start;'>"
-                                 "%1"
-                                 "<div style='flex: 1;'>"
-                                 "<div style='display: flex; align-items: center; margin-bottom: 4px;'>"
-                                 "<span style='color: #4CAF50; font-weight: bold; font-size: 14px;'>%2</span>"
-                                 "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%3</span>"
-                                 "</div>"
-                                 "<div style='background: #f9f9f9; padding: 12px; border-radius: 12px; "
-                                 "border: 1px dashed #4CAF50;'>"
-                                 "<div style='color: #666; margin-bottom: 8px;'>"
-                                 "📁 发送了文件：<b>%4</b> (%5 KB)"
-                                 "</div>"
-                                 "<div style='width: 120px; height: 120px; "
-                                 "background: linear-gradient(135deg, #e0e0e0, #f0f0f0); "
-                                 "border-radius: 8px; margin-top: 8px; display: flex; "
-                                 "align-items: center; justify-content: center; color: #666; "
-                                 "font-size: 32px;'>"
-                                 "📁"
-                                 "</div>"
-                                 "<br>"
-                                 "<button onclick='saveReceivedFile(\"%2\", \"%4\")' "
-                                 "style='margin-top: 8px; padding: 6px 12px; "
-                                 "background: linear-gradient(135deg, #4CAF50, #45a049); "
-                                 "color: white; border: none; border-radius: 6px; "
-                                 "font-size: 12px; cursor: pointer;'>"
-                                 "💾 保存文件"
-                                 "</button>"
-                                 "</div>"
-                                 "</div>"
-                                 "</div>")
-                                 .arg(avatarHtml)
-                                 .arg(senderUsername)
-                                 .arg(timestamp)
-                                 .arg(fileName)
-                                 .arg(fileSize / 1024);
-        }
+void ChatWindow::showIncomingFile(const QString &senderUsername, const QString &fileName, const QString &fileType,
+                                  qint64 fileSize, const QString &thumbnailBase64, const ReceivedFile &file,
+                                  quint64 clock, const QString &conversation) {
+    STALL_OPERATION("showIncomingFile");
+    bool isImage = (fileType == "image");
+    bool isVideo = (fileType == "video");
 
-        chatHistory->append(fileMessage);
-        chatHistory->moveCursor(QTextCursor::End);
+    // 添加时间戳
+    QString timestamp = clockTimeText(clock);
 
-        // 临时存储文件数据，等待用户保存
-        QString fileKey = QString("%1_%2").arg(senderUsername).arg(fileName);
-        receivedFiles[fileKey] = QString::fromLatin1(fileData.toBase64().data());
+    // 获取发送者头像
+    QString avatarHtml = "";
+    QPixmap senderAvatar = getUserAvatar(senderUsername);
+    if (!senderAvatar.isNull()) {
+        senderAvatar = cropToSquare(senderAvatar);
+        senderAvatar = senderAvatar.scaled(32, 32, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        QByteArray byteArray;
+        QBuffer buffer(&byteArray);
+        buffer.open(QIODevice::WriteOnly);
+        senderAvatar.save(&buffer, "PNG");
+        QString base64Image = Base64Codec::encode(byteArray);
+        avatarHtml = QString("<img src='data:image/png;base64,%1' width='32' height='32' "
+                            "style='vertical-align: middle; margin-right: 8px; border-radius: 16px; "
+                            "border: 1px solid #4CAF50; box-shadow: 0 2px 4px rgba(0,0,0,0.1);' />").arg(base64Image);
+    } else {
+        avatarHtml = "<div style='width: 32px; height: 32px; background: linear-gradient(135deg, #4CAF50, #45a049); "
+                    "border-radius: 16px; margin-right: 8px; display: flex; align-items: center; "
+                    "justify-content: center; font-size: 16px; color: white; box-shadow: 0 2px 4px rgba(0,0,0,0.1);'>👤</div>";
+    }
+
+    // 根据文件类型显示不同内容
+    QString fileMessage;
+    if (isImage) {
+        QString thumbnailHtml = "";
+        if (!thumbnailBase64.isEmpty()) {
+            thumbnailHtml = QString("<img src='data:image/jpeg;base64,%1' "
+                                   "style='max-width: 240px; max-height: 240px; margin-top: 8px; "
+                                   "border-radius: 8px; border: 1px solid #ddd; "
+                                   "box-shadow: 0 2px 8px rgba(0,0,0,0.1); cursor: pointer;' "
+                                   "onclick='this.style.maxWidth=\"none\"; this.style.maxHeight=\"none\"'/>")
+                                   .arg(thumbnailBase64);
+        }
+
+        fileMessage = QString("<div style='margin: 12px 0; display: flex; align-items: flex-start;'>"
+                             "%1"
+                             "<div style='flex: 1;'>"
+                             "<div style='display: flex; align-items: center; margin-bottom: 4px;'>"
+                             "<span style='color: #4CAF50; font-weight: bold; font-size: 14px;'>%2</span>"
+                             "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%3</span>"
+                             "</div>"
+                             "<div style='background: #f9f9f9; padding: 12px; border-radius: 12px; "
+                             "border: 1px dashed #4CAF50;'>"
+                             "<div style='color: #666; margin-bottom: 8px;'>"
+                             "📸 发送了图片：<b>%4</b> (%5 KB)"
+                             "</div>"
+                             "%6"
+                             "%7"
+                             "</div>"
+                             "</div>"
+                             "</div>")
+                             .arg(avatarHtml)
+                             .arg(senderUsername)
+                             .arg(timestamp)
+                             .arg(fileName)
+                             .arg(fileSize / 1024)
+                             .arg(thumbnailHtml)
+                             .arg(fileActionLinks(senderUsername, fileName, "🔍 查看原图", "💾 保存图片"));
+    } else if (isVideo) {
+        fileMessage = QString("<div style='margin: 12px 0; display: flex; align-items: flex-start;'>"
+                             "%1"
+                             "<div style='flex: 1;'>"
+                             "<div style='display: flex; align-items: center; margin-bottom: 4px;'>"
+                             "<span style='color: #4CAF50; font-weight: bold; font-size: 14px;'>%2</span>"
+                             "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%3</span>"
+                             "</div>"
+                             "<div style='background: #f9f9f9; padding: 12px; border-radius: 12px; "
+                             "border: 1px dashed #4CAF50;'>"
+                             "<div style='color: #666; margin-bottom: 8px;'>"
+                             "🎬 发送了视频：<b>%4</b> (%5 KB)"
+                             "</div>"
+                             "<div style='width: 120px; height: 120px; "
+                             "background: linear-gradient(135deg, #333, #555); "
+                             "border-radius: 8px; margin-top: 8px; display: flex; "
+                             "align-items: center; justify-content: center; color: white; "
+                             "font-size: 24px;'>"
+                             "🎬"
+                             "</div>"
+                             "%6"
+                             "</div>"
+                             "</div>"
+                             "</div>")
+                             .arg(avatarHtml)
+                             .arg(senderUsername)
+                             .arg(timestamp)
+                             .arg(fileName)
+                             .arg(fileSize / 1024)
+                             .arg(fileActionLinks(senderUsername, fileName, "▶ 播放", "📥 保存视频"));
+    } else {
+        fileMessage = QString("<div style='margin: 12px 0; display: flex; align-items: flex-start;'>"
+                             "%1"
+                             "<div style='flex: 1;'>"
+                             "<div style='display: flex; align-items: center; margin-bottom: 4px;'>"
+                             "<span style='color: #4CAF50; font-weight: bold; font-size: 14px;'>%2</span>"
+                             "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%3</span>"
+                             "</div>"
+                             "<div style='background: #f9f9f9; padding: 12px; border-radius: 12px; "
+                             "border: 1px dashed #4CAF50;'>"
+                             "<div style='color: #666; margin-bottom: 8px;'>"
+                             "📁 发送了文件：<b>%4</b> (%5 KB)"
+                             "</div>"
+                             "<div style='width: 120px; height: 120px; "
+                             "background: linear-gradient(135deg, #e0e0e0, #f0f0f0); "
+                             "border-radius: 8px; margin-top: 8px; display: flex; "
+                             "align-items: center; justify-content: center; color: #666; "
+                             "font-size: 32px;'>"
+                             "📁"
+                             "</div>"
+                             "%6"
+                             "</div>"
+                             "</div>"
+                             "</div>")
+                             .arg(avatarHtml)
+                             .arg(senderUsername)
+                             .arg(timestamp)
+                             .arg(fileName)
+                             .arg(fileSize / 1024)
+                             .arg(fileActionLinks(senderUsername, fileName, "📂 打开", "💾 保存文件"));
     }
+
+    appendMessage(senderUsername, QString("[文件] %1").arg(fileName), false, fileMessage, clock, conversation);
+
+    // 临时存储文件数据，等待用户保存
+    QString fileKey = QString("%1_%2").arg(senderUsername).arg(fileName);
+    receivedFiles.insert(fileKey, file);
 }
 
 void ChatWindow::onPeerDiscovered(const QString &ip, const QString &username) {
+    historySync->peerAppeared(username);
+
     // 创建自定义的列表项widget
     QListWidgetItem *existingItem = nullptr;
     int existingRow = -1;
@@ -779,12 +1052,12 @@ void ChatWindow::onPeerDiscovered(const QString &ip, const QString &username) {
     if (existingItem) {
         // 更新现有用户
         existingItem->setText(itemText);
+        existingItem->setData(Qt::UserRole, username);
         existingItem->setForeground(QColor("#2e7d32"));
 
         // 检查是否有缓存的头像
-        if (userAvatars.contains(username)) {
-            QPixmap userAvatar = userAvatars[username];
-            userAvatar = cropToSquare(userAvatar);
+        if (const QPixmap *cached = userAvatars.find(username)) {
+            QPixmap userAvatar = cropToSquare(*cached);
             userAvatar = userAvatar.scaled(24, 24, Qt::KeepAspectRatio, Qt::SmoothTransformation);
             existingItem->setIcon(QIcon(userAvatar));
         }
@@ -793,6 +1066,8 @@ void ChatWindow::onPeerDiscovered(const QString &ip, const QString &username) {
 
     // 添加新用户
     QListWidgetItem *item = new QListWidgetItem(itemText, onlineUsersList);
+    item->setData(Qt::UserRole, username);
+    item->setToolTip("双击发起私聊");
     item->setForeground(QColor("#2e7d32"));
     item->setFont(QFont("Microsoft YaHei", 10));
 
@@ -879,73 +1154,322 @@ void ChatWindow::onAvatarButtonClicked() {
     }
 }
 
-void ChatWindow::loadUserAvatar() {
-    // 如果有从登录界面传入的头像路径，直接使用
-    if (!avatarPath.isEmpty() && QFile::exists(avatarPath)) {
-        QPixmap pixmap(avatarPath);
-        if (!pixmap.isNull()) {
-            pixmap = cropToSquare(pixmap);
-            QPixmap scaledPixmap = pixmap.scaled(46, 46, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+void ChatWindow::onSearchClicked() {
+    if (!searchIndex->isReady()) {
+        statusLabel->setText("搜索索引正在加载，请稍后再试");
+        return;
+    }
+    SearchDialog *dialog = new SearchDialog(searchIndex, this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->show();
+}
 
-            // 创建圆形头像
-            QPixmap circularPixmap(46, 46);
-            circularPixmap.fill(Qt::transparent);
-            QPainter painter(&circularPixmap);
-            painter.setRenderHint(QPainter::Antialiasing);
-            QPainterPath path;
-            path.addEllipse(0, 0, 46, 46);
-            painter.setClipPath(path);
-            painter.drawPixmap(0, 0, scaledPixmap);
-            painter.end();
+void ChatWindow::onDiagnosticsClicked() {
+    DiagnosticsDialog *dialog = new DiagnosticsDialog(messageTracer, this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->show();
+}
 
-            avatarButton->setIcon(QIcon(circularPixmap));
-            avatarButton->setIconSize(QSize(46, 46));
-            avatarButton->setText("");
+QString ChatWindow::incomingConversation(const Envelope &envelope, const QString &senderUsername) const {
+    // 私聊在线路上是发给“我”的，本地按对方归类
+    if (Conversation::isDirect(envelope.conversation)) {
+        return Conversation::direct(senderUsername);
+    }
+    return envelope.conversation;
+}
+
+QListWidgetItem *ChatWindow::conversationItem(const QString &conversation, bool create) {
+    for (int i = 0; i < conversationList->count(); ++i) {
+        QListWidgetItem *item = conversationList->item(i);
+        if (item->data(Qt::UserRole).toString() == conversation) {
+            return item;
         }
+    }
+    if (!create) {
+        return nullptr;
+    }
+
+    QListWidgetItem *item = new QListWidgetItem(Conversation::displayName(conversation), conversationList);
+    item->setData(Qt::UserRole, conversation);
+    item->setFont(QFont("Microsoft YaHei", 10));
+    return item;
+}
+
+void ChatWindow::openConversation(const QString &conversation) {
+    conversationList->clearSelection();
+    conversationItem(conversation, true)->setSelected(true);
+    messageInput->setFocus();
+}
+
+void ChatWindow::markUnread(const QString &conversation) {
+    QListWidgetItem *item = conversationItem(conversation, true);
+    QFont font = item->font();
+    font.setBold(true);
+    item->setFont(font);
+    item->setText(Conversation::displayName(conversation) + "  ●");
+}
+
+void ChatWindow::onConversationSelected() {
+    STALL_OPERATION("onConversationSelected");
+    const QList<QListWidgetItem *> selected = conversationList->selectedItems();
+    if (selected.isEmpty()) {
         return;
     }
 
-    // 否则从配置文件中加载
-    QString avatarStoragePath = getAvatarStoragePath();
+    QListWidgetItem *item = selected.first();
+    currentConversation = item->data(Qt::UserRole).toString();
+    QFont font = item->font();
+    font.setBold(false);
+    item->setFont(font);
+    item->setText(Conversation::displayName(currentConversation));
 
-    // 检查头像文件是否存在
-    if (QFile::exists(avatarStoragePath)) {
-        QFile file(avatarStoragePath);
-        if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-            QTextStream in(&file);
-            QString savedAvatarPath = in.readLine();
-
-            // 检查保存的头像文件是否存在
-            if (QFile::exists(savedAvatarPath)) {
-                avatarPath = savedAvatarPath;
-
-                // 显示头像
-                QPixmap pixmap(avatarPath);
-                if (!pixmap.isNull()) {
-                    pixmap = cropToSquare(pixmap);
-                    QPixmap scaledPixmap = pixmap.scaled(46, 46, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-
-                    // 创建圆形头像
-                    QPixmap circularPixmap(46, 46);
-                    circularPixmap.fill(Qt::transparent);
-                    QPainter painter(&circularPixmap);
-                    painter.setRenderHint(QPainter::Antialiasing);
-                    QPainterPath path;
-                    path.addEllipse(0, 0, 46, 46);
-                    painter.setClipPath(path);
-                    painter.drawPixmap(0, 0, scaledPixmap);
-                    painter.end();
-
-                    avatarButton->setIcon(QIcon(circularPixmap));
-                    avatarButton->setIconSize(QSize(46, 46));
-                    avatarButton->setText("");
-                }
+    messageInput->setPlaceholderText(QString("发送到 %1... (支持表情代码如 :) :D <3 等，点击😊按钮选择表情)")
+                                     .arg(Conversation::displayName(currentConversation)));
+}
+
+void ChatWindow::onJoinRoomClicked() {
+    bool ok = false;
+    QString name = QInputDialog::getText(this, "加入房间", "房间名称：", QLineEdit::Normal, QString(), &ok).trimmed();
+    name.remove('#');
+    if (!ok || name.isEmpty()) {
+        return;
+    }
+
+    if (!joinedRooms.contains(name)) {
+        joinedRooms.append(name);
+        saveRooms();
+        networkManager->setRooms(joinedRooms);
+    }
+    openConversation(Conversation::room(name));
+}
+
+void ChatWindow::onConversationContextMenu(const QPoint &pos) {
+    QListWidgetItem *item = conversationList->itemAt(pos);
+    if (!item) {
+        return;
+    }
+
+    QString conversation = item->data(Qt::UserRole).toString();
+    if (Conversation::isLobby(conversation)) {
+        return;
+    }
+
+    QMenu menu(this);
+    QAction *leave = menu.addAction(Conversation::isRoom(conversation) ? "离开房间" : "关闭私聊");
+    if (menu.exec(conversationList->mapToGlobal(pos)) != leave) {
+        return;
+    }
+
+    if (Conversation::isRoom(conversation)) {
+        joinedRooms.removeAll(Conversation::target(conversation));
+        saveRooms();
+        networkManager->setRooms(joinedRooms);
+    }
+    delete item;
+    if (conversationList->selectedItems().isEmpty()) {
+        openConversation(QString());
+    }
+}
+
+void ChatWindow::onOnlineUserDoubleClicked(QListWidgetItem *item) {
+    QString peerName = item->data(Qt::UserRole).toString();
+    if (!peerName.isEmpty()) {
+        openConversation(Conversation::direct(peerName));
+    }
+}
+
+void ChatWindow::loadRooms() {
+    QFile file(getRoomsStoragePath());
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream in(&file);
+        while (!in.atEnd()) {
+            QString name = in.readLine().trimmed();
+            if (!name.isEmpty() && !joinedRooms.contains(name)) {
+                joinedRooms.append(name);
             }
-            file.close();
         }
+        file.close();
+    }
+
+    for (const QString &name : std::as_const(joinedRooms)) {
+        conversationItem(Conversation::room(name), true);
     }
 }
 
+void ChatWindow::saveRooms() {
+    // 每行一个房间名
+    QFile file(getRoomsStoragePath());
+    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        QTextStream out(&file);
+        for (const QString &name : std::as_const(joinedRooms)) {
+            out << name << "\n";
+        }
+        file.close();
+    }
+}
+
+void ChatWindow::onEncryptionClicked() {
+    bool ok = false;
+    QString passphrase = QInputDialog::getText(this, "加密",
+                                               "输入群组口令（所有成员使用同一口令，留空则关闭加密）：",
+                                               QLineEdit::Password, QString(), &ok);
+    if (!ok) {
+        return;
+    }
+
+    QByteArray key = passphrase.isEmpty() ? QByteArray() : SessionCrypto::deriveKey(passphrase);
+    saveGroupKey(key);
+    networkManager->setGroupKey(key);
+    updateEncryptionStatus();
+}
+
+void ChatWindow::updateEncryptionStatus() {
+    bool enabled = networkManager->isEncryptionEnabled();
+    encryptionButton->setText(enabled ? "🔒" : "🔓");
+    if (enabled) {
+        statusLabel->setText(QString("已启用加密 (%1) - 只与使用相同口令的用户通信")
+                                 .arg(SessionCrypto::hasAesHardware() ? "AES-GCM 硬件加速" : "ChaCha20-Poly1305"));
+    } else {
+        statusLabel->setText("未启用加密");
+    }
+}
+
+QByteArray ChatWindow::loadGroupKey() {
+    // 只保存派生后的密钥，不保存口令本身
+    QFile file(getGroupKeyStoragePath());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    QByteArray key = QByteArray::fromHex(file.readAll().trimmed());
+    file.close();
+    return key;
+}
+
+void ChatWindow::saveGroupKey(const QByteArray &key) {
+    QString path = getGroupKeyStoragePath();
+    if (key.isEmpty()) {
+        QFile::remove(path);
+        return;
+    }
+    QFile file(path);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+        file.write(key.toHex());
+        file.close();
+    }
+}
+
+QString ChatWindow::getGroupKeyStoragePath() {
+    QDir dir(historyStore->directory());
+    if (!dir.exists()) {
+        dir.mkpath(".");
+    }
+    return dir.filePath("session_key.txt");
+}
+
+QString ChatWindow::getRoomsStoragePath() {
+    // 与聊天历史放在同一个按用户区分的目录下
+    QDir dir(historyStore->directory());
+    if (!dir.exists()) {
+        dir.mkpath(".");
+    }
+    return dir.filePath("rooms.txt");
+}
+
+void ChatWindow::appendMessage(const QString &sender, const QString &text, bool outgoing, const QString &html,
+                               quint64 clock, const QString &conversation, quint64 senderId, quint64 messageId) {
+    STALL_OPERATION("聊天追加");
+    QElapsedTimer appendTimer;
+    appendTimer.start();
+
+    ChatRecord record;
+    record.sender = sender;
+    record.text = text;
+    record.timestamp = HybridClock::physicalMs(clock);
+    record.outgoing = outgoing;
+    record.clock = clock;
+    record.conversation = conversation;
+    record.senderId = senderId;
+    record.messageId = messageId;
+
+    if (conversation != currentConversation) {
+        markUnread(conversation);
+    }
+
+    // 先落盘再增量更新索引，视图停在最新一页时才直接渲染
+    quint32 id = historyStore->append(record);
+    searchIndex->addDocument(id, record);
+    historySync->addRecord(id, record);
+    if (!historyPager->appendLive(id, clock, HistoryPager::conversationHtml(conversation) + html) && outgoing) {
+        // 自己发的消息总是要看到，回到最新一页
+        historyPager->loadLatest();
+    }
+    Metrics::process().guiAppend.record(appendTimer.nsecsElapsed());
+    if (messageTracer && !outgoing && messageId != 0) {
+        messageTracer->messageAppended(senderId, messageId);
+    }
+}
+
+namespace {
+
+// 解码头像并裁剪成圆形。只使用 QImage/QPainter，可以在后台线程执行
+QImage decodeCircularAvatar(const QString &path, int size) {
+    QImage image(path);
+    if (image.isNull()) {
+        return QImage();
+    }
+
+    int side = qMin(image.width(), image.height());
+    image = image.copy((image.width() - side) / 2, (image.height() - side) / 2, side, side)
+                 .scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+    QImage circular(size, size, QImage::Format_ARGB32_Premultiplied);
+    circular.fill(Qt::transparent);
+    QPainter painter(&circular);
+    painter.setRenderHint(QPainter::Antialiasing);
+    QPainterPath path;
+    path.addEllipse(0, 0, size, size);
+    painter.setClipPath(path);
+    painter.drawImage(0, 0, image);
+    painter.end();
+    return circular;
+}
+
+}
+
+void ChatWindow::loadUserAvatar() {
+    // 如果没有从登录界面传入可用的头像路径，则从配置文件中读取
+    if (avatarPath.isEmpty() || !QFile::exists(avatarPath)) {
+        QFile file(getAvatarStoragePath());
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            return;
+        }
+        QTextStream in(&file);
+        QString savedAvatarPath = in.readLine();
+        file.close();
+
+        // 检查保存的头像文件是否存在
+        if (!QFile::exists(savedAvatarPath)) {
+            return;
+        }
+        avatarPath = savedAvatarPath;
+    }
+
+    // 图片解码和缩放放到后台线程，完成后再更新按钮图标
+    QFutureWatcher<QImage> *watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher]() {
+        QImage circular = watcher->result();
+        watcher->deleteLater();
+        if (circular.isNull()) {
+            return;
+        }
+        avatarButton->setIcon(QIcon(QPixmap::fromImage(circular)));
+        avatarButton->setIconSize(QSize(46, 46));
+        avatarButton->setText("");
+    });
+    watcher->setFuture(QtConcurrent::run(decodeCircularAvatar, avatarPath, 46));
+}
+
 void ChatWindow::saveUserAvatar(const QString &avatarPath) {
     this->avatarPath = avatarPath;
 
@@ -991,8 +1515,8 @@ QPixmap ChatWindow::getUserAvatar(const QString &username) {
     }
 
     // 对于其他用户，返回默认头像或缓存的头像
-    if (userAvatars.contains(username)) {
-        return cropToSquare(userAvatars[username]);
+    if (const QPixmap *cached = userAvatars.find(username)) {
+        return cropToSquare(*cached);
     }
 
     // 返回空的pixmap表示没有特定头像
@@ -1025,10 +1549,27 @@ void ChatWindow::updateOnlineUserAvatar(const QString &username, const QPixmap &
 }
 
 void ChatWindow::onSendFile() {
+    STALL_OPERATION("onSendFile");
     // 打开文件选择对话框
     QString fileName = QFileDialog::getOpenFileName(this, tr("选择要发送的文件"), "", tr("所有文件 (*)"));
 
     if (!fileName.isEmpty()) {
+        // 获取文件名和扩展名
+        QFileInfo fileInfo(fileName);
+        QString displayName = fileInfo.fileName();
+        QString fileExtension = fileInfo.suffix().toLower();
+
+        // 判断文件类型
+        bool isImage = (fileExtension == "png" || fileExtension == "jpg" || fileExtension == "jpeg" || fileExtension == "gif" || fileExtension == "bmp");
+        bool isVideo = (fileExtension == "mp4" || fileExtension == "avi" || fileExtension == "mov" || fileExtension == "mkv" || fileExtension == "wmv");
+
+        // 图片只发预览，视频和大文件只发文件信息，内容都由接收方按需拉取
+        if (isImage || isVideo || fileInfo.size() > inlineFileLimit) {
+            sendFileOffer(fileName, isImage ? FileKindImage : (isVideo ? FileKindVideo : FileKindOther),
+                          currentConversation);
+            return;
+        }
+
         QFile file(fileName);
         if (!file.open(QIODevice::ReadOnly)) {
             QMessageBox::warning(this, "错误", "无法打开文件：" + fileName);
@@ -1039,38 +1580,187 @@ void ChatWindow::onSendFile() {
         QByteArray fileData = file.readAll();
         file.close();
 
-        // 获取文件名和扩展名
-        QFileInfo fileInfo(fileName);
-        QString displayName = fileInfo.fileName();
-        QString fileExtension = fileInfo.suffix().toLower();
+        // 构造文件消息：文件内容以原始字节放在负载末尾
+        QString conversation = currentConversation;
+        EnvelopeWriter writer(MessageType::File, fileData.size() + 256, conversation);
+        writer.string16(username);
+        writer.string16(displayName);
+        writer.u8(isVideo ? FileKindVideo : FileKindOther);
+        writer.u64(quint64(fileData.size()));
+        writer.bytes32(QByteArrayView());
+        writer.raw(fileData);
+
+        // 发送文件消息；只有存在旧版节点时才做 base64 编码
+        quint64 clock = networkManager->send(writer, [&]() {
+            return legacyFileMessage(displayName, fileExtension, isVideo ? "video" : "other", fileData, QByteArray());
+        });
 
-        // 判断文件类型
-        bool isImage = (fileExtension == "png" || fileExtension == "jpg" || fileExtension == "jpeg" || fileExtension == "gif" || fileExtension == "bmp");
-        bool isVideo = (fileExtension == "mp4" || fileExtension == "avi" || fileExtension == "mov" || fileExtension == "mkv" || fileExtension == "wmv");
+        // 在聊天历史中显示发送的文件
+        showSentFile(displayName, fileExtension, fileData.size(), false, isVideo, clock, conversation);
+    }
+}
 
-        // 将文件编码为base64
-        QByteArray base64Data = fileData.toBase64();
+void ChatWindow::onSendFolder() {
+    STALL_OPERATION("onSendFolder");
+    QString root = QFileDialog::getExistingDirectory(this, tr("选择要发送的文件夹"));
+    if (root.isEmpty()) {
+        return;
+    }
 
-        // 构造文件传输消息
-        QString fileMessage = QString("[%1]: [FILE]%2[FILENAME]%3[FILEEXTENSION]%4[FILETYPE]%5[FILESIZE]%6[FILEDATA]%7[/FILE]")
-                             .arg(username)
-                             .arg(displayName)
-                             .arg(fileExtension)
-                             .arg(isImage ? "image" : (isVideo ? "video" : "other"))
-                             .arg(fileData.size())
-                             .arg(QString::fromUtf8(base64Data))
-                             .arg(isImage ? "[THUMBNAIL]" + generateThumbnail(fileData, isImage) : "");
+    // 文件多时遍历目录要一阵子，放到后台线程
+    QString conversation = currentConversation;
+    statusLabel->setText(QString("正在整理文件夹 %1 ...").arg(QDir(root).dirName()));
+    auto *watcher = new QFutureWatcher<FolderManifest>(this);
+    connect(watcher, &QFutureWatcher<FolderManifest>::finished, this, [this, watcher, root, conversation]() {
+        watcher->deleteLater();
+        postFolderOffer(root, conversation, watcher->result());
+    });
+    watcher->setFuture(QtConcurrent::run([root]() { return FolderManifest::scan(root); }));
+}
+
+void ChatWindow::postFolderOffer(const QString &root, const QString &conversation, const FolderManifest &manifest) {
+    if (manifest.entries.isEmpty()) {
+        statusLabel->setText("文件夹是空的");
+        QMessageBox::information(this, "提示", "文件夹 " + manifest.name + " 里没有可发送的内容。");
+        return;
+    }
 
-        // 发送文件消息
-        networkManager->sendMessageToAllPeers(fileMessage);
+    EnvelopeWriter writer(MessageType::FolderOffer, manifest.entries.size() * 48 + 256, conversation);
+    writer.string16(username);
+    writer.u64(fileShare->offerFolder(root, manifest));
+    manifest.write(writer);
+    quint64 clock = networkManager->send(writer, [&]() {
+        // 旧版节点无法拉取文件夹，只告知一声
+        return LegacyProtocol::formatText(username, QString("[文件夹] %1（需要新版本才能接收）").arg(manifest.name),
+                                          QByteArray());
+    });
 
-        // 在聊天历史中显示发送的文件
-        showSentFile(displayName, fileExtension, fileData.size(), isImage, isVideo);
+    QString fileHtml = QString("<div style='margin: 12px 0; display: flex; align-items: flex-start;'>"
+                               "<div style='flex: 1;'>"
+                               "<div style='display: flex; align-items: center; margin-bottom: 4px;'>"
+                               "<span style='color: #2196F3; font-weight: bold; font-size: 14px;'>%1</span>"
+                               "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%2</span>"
+                               "</div>"
+                               "<div style='background: #e3f2fd; padding: 12px; border-radius: 12px; "
+                               "border: 1px solid #bbdefb;'>"
+                               "<div style='color: #1565C0;'>"
+                               "🗂 发送了文件夹：<b>%3</b>（%4 个文件，%5 KB）"
+                               "</div>"
+                               "</div>"
+                               "</div>"
+                               "</div>")
+                           .arg(username.toHtmlEscaped())
+                           .arg(clockTimeText(clock))
+                           .arg(manifest.name.toHtmlEscaped())
+                           .arg(manifest.fileCount())
+                           .arg(manifest.totalBytes() / 1024);
+    appendMessage(username, QString("[文件夹] %1").arg(manifest.name), true, fileHtml, clock, conversation);
+    statusLabel->setText(QString("已发送文件夹 %1").arg(manifest.name));
+}
+
+void ChatWindow::pasteImage(const QImage &image) {
+    // 压缩和计算摘要都在后台线程，大截图也不卡界面；会话按粘贴时的算
+    QString conversation = currentConversation;
+    QString directory = QDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation)).filePath("p2pchat/paste");
+    statusLabel->setText("正在压缩粘贴的图片...");
+
+    auto *watcher = new QFutureWatcher<PastedImage>(this);
+    connect(watcher, &QFutureWatcher<PastedImage>::finished, this, [this, watcher, conversation]() {
+        watcher->deleteLater();
+        PastedImage pasted = watcher->result();
+        if (pasted.path.isEmpty()) {
+            statusLabel->setText("无法压缩粘贴的图片");
+            return;
+        }
+        LOG_DEBUG(Ui) << (pasted.reused ? "重复粘贴的图片，沿用" : "粘贴的图片已保存到") << pasted.path;
+        sendFileOffer(pasted.path, FileKindImage, conversation);
+    });
+    watcher->setFuture(QtConcurrent::run([image, directory]() {
+        return ImageTranscoder::savePasted(image, directory);
+    }));
+}
+
+void ChatWindow::sendFileOffer(const QString &path, FileKind kind, const QString &conversation) {
+    // 预览在后台线程解码和转码，大图不卡界面
+    QList<ImageRung> ladder = imageLadder;
+    if (kind == FileKindImage) {
+        statusLabel->setText("正在生成图片预览...");
     }
+
+    auto *watcher = new QFutureWatcher<ImagePreview>(this);
+    connect(watcher, &QFutureWatcher<ImagePreview>::finished, this, [this, watcher, path, kind, conversation]() {
+        watcher->deleteLater();
+        ImagePreview preview = watcher->result();
+
+        // 摘要随预告发出，对方下载后据此校验，也能认出已经有的文件
+        FileHashJob *job = fileShare->hasher()->hash(path);
+        QString displayName = QFileInfo(path).fileName();
+        connect(job, &FileHashJob::progress, this, [this, displayName](qint64 hashed, qint64 total) {
+            statusLabel->setText(QString("正在计算 %1 的校验值：%2%")
+                                     .arg(displayName)
+                                     .arg(total > 0 ? hashed * 100 / total : 100));
+        });
+        connect(job, &FileHashJob::finished, this, [this, path, kind, conversation, preview](const QByteArray &digest) {
+            postFileOffer(path, kind, conversation, preview, digest);
+        });
+        connect(job, &FileHashJob::failed, this, [this, path, kind, conversation, preview]() {
+            postFileOffer(path, kind, conversation, preview, QByteArray());
+        });
+    });
+    watcher->setFuture(QtConcurrent::run([path, kind, ladder]() {
+        return kind == FileKindImage ? ImageTranscoder::preview(path, ladder) : ImagePreview();
+    }));
+}
+
+void ChatWindow::postFileOffer(const QString &path, FileKind kind, const QString &conversation,
+                               const ImagePreview &preview, const QByteArray &digest) {
+    QFileInfo fileInfo(path);
+    QString displayName = fileInfo.fileName();
+    QString fileExtension = fileInfo.suffix().toLower();
+    qint64 fileSize = fileInfo.size();
+
+    EnvelopeWriter writer(MessageType::FileOffer, preview.jpeg.size() + 256, conversation);
+    writer.string16(username);
+    writer.string16(displayName);
+    writer.u8(kind);
+    writer.u64(quint64(fileSize));
+    writer.bytes32(preview.jpeg);
+    writer.u64(fileShare->offer(path, digest));
+    writer.raw(digest);
+
+    QString fileType = kind == FileKindImage ? "image" : (kind == FileKindVideo ? "video" : "other");
+    quint64 clock = networkManager->send(writer, [&]() {
+        // 旧版节点不能按需拉取，小文件仍然发送完整内容，边读边编码，不先读进整个文件。
+        // 编码在发送调用里、GUI 线程上完成，结果约为文件的 2.7 倍，大文件只告知一声
+        if (fileSize > legacyFileLimit) {
+            return LegacyProtocol::formatText(username, QString("[文件] %1（%2 KB，需要新版本才能接收）")
+                                                            .arg(displayName)
+                                                            .arg(fileSize / 1024),
+                                              QByteArray());
+        }
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return QString();
+        }
+        return LegacyProtocol::formatFile(username, displayName, fileExtension, fileType, &file, file.size(),
+                                          preview.jpeg);
+    });
+
+    showSentFile(displayName, fileExtension, fileSize, kind == FileKindImage, kind == FileKindVideo, clock,
+                 conversation);
+    statusLabel->setText(QString("已发送 %1 (%2 KB)，内容在对方打开或保存时传输")
+                             .arg(displayName)
+                             .arg(fileSize / 1024));
+}
+
+QString ChatWindow::legacyFileMessage(const QString &displayName, const QString &fileExtension, const QString &fileType,
+                                      const QByteArray &fileData, const QByteArray &thumbnail) const {
+    return LegacyProtocol::formatFile(username, displayName, fileExtension, fileType, fileData, thumbnail);
 }
 
-void ChatWindow::showSentFile(const QString &fileName, const QString &fileExtension, qint64 fileSize, bool isImage, bool isVideo) {
-    QString timestamp = QTime::currentTime().toString("hh:mm:ss");
+void ChatWindow::showSentFile(const QString &fileName, const QString &fileExtension, qint64 fileSize, bool isImage, bool isVideo,
+                              quint64 clock, const QString &conversation) {
+    QString timestamp = clockTimeText(clock);
     QString fileHtml;
 
     if (isImage) {
@@ -1168,8 +1858,7 @@ void ChatWindow::showSentFile(const QString &fileName, const QString &fileExtens
                           .arg(fileSize / 1024);
     }
 
-    chatHistory->append(fileHtml);
-    chatHistory->moveCursor(QTextCursor::End);
+    appendMessage(username, QString("[文件] %1").arg(fileName), true, fileHtml, clock, conversation);
 }
 
 void ChatWindow::onSaveFile() {
@@ -1178,56 +1867,304 @@ void ChatWindow::onSaveFile() {
 }
 
 void ChatWindow::saveReceivedFile(const QString &sender, const QString &filename) {
+    withReceivedFile(sender, filename, true);
+}
+
+void ChatWindow::openReceivedFile(const QString &sender, const QString &filename) {
+    withReceivedFile(sender, filename, false);
+}
+
+void ChatWindow::withReceivedFile(const QString &sender, const QString &filename, bool save) {
     QString fileKey = QString("%1_%2").arg(sender).arg(filename);
+    ReceivedFile *file = receivedFiles.find(fileKey);
+    if (!file) {
+        QMessageBox::information(this, "提示", "这个文件已经不可用（已保存或程序重启过）。");
+        return;
+    }
 
-    if (receivedFiles.contains(fileKey)) {
-        // 解码文件数据
-        QByteArray fileData = QByteArray::fromBase64(receivedFiles[fileKey].toLatin1());
+    // 同样内容的文件之前已经下载并校验过，直接用本地那份
+    if (!file->isLoaded() && !file->digest.isEmpty()) {
+        file->localPath = fileShare->completedFile(file->digest);
+    }
+    if (file->isLoaded()) {
+        finishFileAction(fileKey, filename, save);
+        return;
+    }
 
-        // 打开保存文件对话框
-        QString saveFileName = QFileDialog::getSaveFileName(this, tr("保存文件"), filename, tr("所有文件 (*)"));
+    // 内容还在发送方，先拉取到缓存目录，完成后再继续打开或保存。
+    // 播放视频不必等下载完，开头一段连续可用后就交给播放器
+    QString extension = QFileInfo(filename).suffix().toLower();
+    bool stream = !save && (extension == "mp4" || extension == "avi" || extension == "mov" || extension == "mkv" ||
+                            extension == "wmv");
+    pendingFileActions[file->offerId] = PendingFileAction{fileKey, filename, save, stream};
+
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::TempLocation));
+    QString path = dir.filePath(QString("p2pchat/%1-%2").arg(file->offerId).arg(QFileInfo(filename).fileName()));
+    FileDownload *download = fileShare->download(file->owner, file->offerId, file->size, path, file->digest);
+    statusLabel->setText(QString("正在从 %1 获取 %2 ...").arg(sender, filename));
+    if (stream && download->contiguousBytes() >= qMin(streamStartBytes, download->size()) && download->size() > 0) {
+        onDownloadProgress(file->offerId, download->contiguousBytes(), download->size());
+    }
+}
 
-        if (!saveFileName.isEmpty()) {
-            QFile saveFile(saveFileName);
-            if (saveFile.open(QIODevice::WriteOnly)) {
-                saveFile.write(fileData);
-                saveFile.close();
+void ChatWindow::onDownloadProgress(quint64 offerId, qint64 contiguousBytes, qint64 totalBytes) {
+    auto it = pendingFileActions.find(offerId);
+    if (it == pendingFileActions.end()) {
+        return;
+    }
+    statusLabel->setText(QString("正在获取 %1：%2%")
+                             .arg(it->fileName)
+                             .arg(totalBytes > 0 ? contiguousBytes * 100 / totalBytes : 100));
+
+    if (it->stream && contiguousBytes >= qMin(streamStartBytes, totalBytes) && contiguousBytes < totalBytes) {
+        // 播放器读的是正在写入的文件，后面的部分会按顺序补上
+        FileDownload *download = fileShare->activeDownload(offerId);
+        pendingFileActions.erase(it);
+        if (download) {
+            QDesktopServices::openUrl(QUrl::fromLocalFile(download->path()));
+        }
+    }
+}
 
-                // 显示保存成功消息
-                QMessageBox::information(this, "成功",
-                                        QString("文件已保存到：\n%1\n\n大小：%2 KB")
-                                        .arg(saveFileName)
-                                        .arg(fileData.size() / 1024.0, 0, 'f', 1));
-            } else {
-                QMessageBox::warning(this, "错误", "无法保存文件：" + saveFileName);
-            }
+void ChatWindow::onDownloadVerifying(quint64 offerId, qint64 hashedBytes, qint64 totalBytes) {
+    auto it = pendingFileActions.find(offerId);
+    if (it == pendingFileActions.end()) {
+        return;
+    }
+    statusLabel->setText(QString("正在校验 %1：%2%")
+                             .arg(it->fileName)
+                             .arg(totalBytes > 0 ? hashedBytes * 100 / totalBytes : 100));
+}
+
+void ChatWindow::onDownloadFinished(quint64 offerId, const QString &path) {
+    // 文件记录可能已被点开过多次，按 offerId 找回
+    for (const QString &fileKey : receivedFiles.keys()) {
+        ReceivedFile *file = receivedFiles.peek(fileKey);
+        if (file->offerId == offerId) {
+            file->localPath = path;
         }
+    }
 
-        // 从临时存储中移除
-        receivedFiles.remove(fileKey);
+    PendingFileAction action = pendingFileActions.take(offerId);
+    if (action.fileKey.isEmpty() || !receivedFiles.contains(action.fileKey)) {
+        statusLabel->setText("文件已下载完成");
+        return;
     }
+    statusLabel->setText(QString("已获取 %1").arg(action.fileName));
+    finishFileAction(action.fileKey, action.fileName, action.save);
 }
 
-QString ChatWindow::generateThumbnail(const QByteArray &fileData, bool isImage) {
-    if (!isImage) {
-        return ""; // 非图片文件不生成缩略图
+void ChatWindow::onDownloadFailed(quint64 offerId, const QString &reason) {
+    PendingFileAction action = pendingFileActions.take(offerId);
+    if (action.fileKey.isEmpty()) {
+        return;
+    }
+    statusLabel->setText(QString("获取 %1 失败").arg(action.fileName));
+    QMessageBox::warning(this, "错误", QString("无法获取文件 %1：%2").arg(action.fileName, reason));
+}
+
+void ChatWindow::saveReceivedFolder(quint64 offerId) {
+    auto it = receivedFolders.constFind(offerId);
+    if (it == receivedFolders.constEnd()) {
+        QMessageBox::information(this, "提示", "这个文件夹已经不可用（程序重启过）。");
+        return;
+    }
+    if (fileShare->activeFolderDownload(offerId)) {
+        statusLabel->setText("这个文件夹正在接收中");
+        return;
+    }
+    ReceivedFolder folder = it.value();
+
+    QString parent = QFileDialog::getExistingDirectory(this, tr("保存文件夹到"));
+    if (parent.isEmpty()) {
+        return;
+    }
+    // 在选中的目录下新建同名文件夹，已存在时加序号，不覆盖已有的文件
+    QString name = QFileInfo(folder.manifest.name).fileName();
+    if (name.isEmpty() || name == "." || name == "..") {
+        name = "文件夹";
+    }
+    QDir parentDir(parent);
+    QString path = parentDir.filePath(name);
+    for (int n = 2; QFileInfo::exists(path); ++n) {
+        path = parentDir.filePath(QString("%1 (%2)").arg(name).arg(n));
+    }
+
+    FolderDownload *download = fileShare->downloadFolder(folder.owner, offerId, folder.manifest, path);
+    QString displayName = folder.manifest.name;
+    statusLabel->setText(QString("正在从 %1 获取文件夹 %2 ...").arg(folder.owner, displayName));
+    connect(download, &FolderDownload::progress, this,
+            [this, displayName](qint64 receivedBytes, qint64 totalBytes, int filesDone, int fileCount) {
+                statusLabel->setText(QString("正在获取文件夹 %1：%2%（%3/%4 个文件）")
+                                         .arg(displayName)
+                                         .arg(totalBytes > 0 ? receivedBytes * 100 / totalBytes : 100)
+                                         .arg(filesDone)
+                                         .arg(fileCount));
+            });
+    connect(download, &FolderDownload::finished, this, [this, displayName, path]() {
+        statusLabel->setText(QString("已获取文件夹 %1").arg(displayName));
+        QMessageBox::information(this, "成功", QString("文件夹已保存到：\n%1").arg(path));
+    });
+    connect(download, &FolderDownload::failed, this, [this, displayName](const QString &reason) {
+        statusLabel->setText(QString("获取文件夹 %1 失败").arg(displayName));
+        QMessageBox::warning(this, "错误", QString("无法获取文件夹 %1：%2").arg(displayName, reason));
+    });
+}
+
+qint64 ChatWindow::avatarCost(const QPixmap &pixmap) {
+    return qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+}
+
+qint64 ChatWindow::receivedFileCost(const ReceivedFile &file) {
+    // 内容可能是整条消息帧，按实际持有的缓冲区计算
+    return file.storage.size();
+}
+
+bool ChatWindow::spillReceivedFile(const QString &fileKey, ReceivedFile &file) {
+    if (file.storage.isEmpty() || !file.localPath.isEmpty()) {
+        return false;
+    }
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::TempLocation));
+    dir.mkpath("p2pchat/spill");
+    QString path = dir.filePath(QString("p2pchat/spill/%1-%2")
+                                    .arg(QCoreApplication::applicationPid())
+                                    .arg(QFileInfo(fileKey).fileName()));
+    QFile spillFile(path);
+    if (!spillFile.open(QIODevice::WriteOnly) || spillFile.write(file.data().data(), file.size) != file.size) {
+        LOG_WARNING(Storage) << "无法转存文件内容:" << path;
+        spillFile.remove();
+        return false;
+    }
+    LOG_DEBUG(Storage) << "文件内容超出内存预算，转存到" << path;
+    file.localPath = path;
+    file.storage = QByteArray();
+    file.offset = 0;
+    return true;
+}
+
+void ChatWindow::finishFileAction(const QString &fileKey, const QString &filename, bool save) {
+    STALL_OPERATION("finishFileAction");
+    ReceivedFile *found = receivedFiles.find(fileKey);
+    if (!found) {
+        return;
+    }
+    // 保存对话框期间可能收到新文件，缓存中的条目会被转存或淘汰，这里拿一份副本
+    ReceivedFile file = *found;
+
+    if (!save) {
+        QString path = file.localPath;
+        if (path.isEmpty()) {
+            // 随消息收到的内容写到临时目录后交给系统默认程序打开
+            QDir dir(QStandardPaths::writableLocation(QStandardPaths::TempLocation));
+            dir.mkpath("p2pchat");
+            path = dir.filePath("p2pchat/" + QFileInfo(filename).fileName());
+            QFile tempFile(path);
+            if (!tempFile.open(QIODevice::WriteOnly)) {
+                QMessageBox::warning(this, "错误", "无法写入临时文件：" + path);
+                return;
+            }
+            tempFile.write(file.data().data(), file.data().size());
+            tempFile.close();
+        }
+        QDesktopServices::openUrl(QUrl::fromLocalFile(path));
+        return;
     }
 
-    QPixmap pixmap;
-    pixmap.loadFromData(fileData);
+    // 打开保存文件对话框
+    QString saveFileName = QFileDialog::getSaveFileName(this, tr("保存文件"), filename, tr("所有文件 (*)"));
+
+    if (!saveFileName.isEmpty()) {
+        bool saved = false;
+        if (!file.localPath.isEmpty()) {
+            // 已下载到缓存目录，直接复制；对话框已确认过覆盖
+            QFile::remove(saveFileName);
+            saved = QFile::copy(file.localPath, saveFileName);
+        } else {
+            QFile saveFile(saveFileName);
+            if (saveFile.open(QIODevice::WriteOnly)) {
+                saveFile.write(file.data().data(), file.data().size());
+                saveFile.close();
+                saved = true;
+            }
+        }
 
-    if (pixmap.isNull()) {
-        return "";
+        if (saved) {
+            // 显示保存成功消息
+            QMessageBox::information(this, "成功",
+                                    QString("文件已保存到：\n%1\n\n大小：%2 KB")
+                                    .arg(saveFileName)
+                                    .arg(file.size / 1024.0, 0, 'f', 1));
+        } else {
+            QMessageBox::warning(this, "错误", "无法保存文件：" + saveFileName);
+        }
     }
 
-    // 生成缩略图
-    QPixmap thumbnail = pixmap.scaled(100, 100, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    if (file.offerId == 0) {
+        // 从临时存储中移除；按需拉取的文件保留记录，可以再次打开
+        if (!file.localPath.isEmpty()) {
+            QFile::remove(file.localPath);    // 超出预算时转存的副本
+        }
+        receivedFiles.remove(fileKey);
+    }
+}
 
-    // 转换为base64
-    QByteArray thumbData;
-    QBuffer buffer(&thumbData);
-    buffer.open(QIODevice::WriteOnly);
-    thumbnail.save(&buffer, "JPEG", 80); // 使用JPEG格式压缩
+bool ChatWindow::pasteClipboardImage() {
+    // 剪贴板里是图片时当作图片发送，文字仍由输入框自己粘贴
+    const QMimeData *mime = QApplication::clipboard()->mimeData();
+    if (!mime || !mime->hasImage()) {
+        return false;
+    }
+    QImage image = qvariant_cast<QImage>(mime->imageData());
+    if (image.isNull()) {
+        return false;
+    }
+    pasteImage(image);
+    return true;
+}
 
-    return QString::fromLatin1(thumbData.toBase64().data());
+bool ChatWindow::eventFilter(QObject *watched, QEvent *event) {
+    if (watched == messageInput && event->type() == QEvent::KeyPress &&
+        static_cast<QKeyEvent *>(event)->matches(QKeySequence::Paste) && pasteClipboardImage()) {
+        return true;
+    }
+    if (watched == messageInput && event->type() == QEvent::ContextMenu) {
+        // 与 QLineEdit 自己的右键菜单相同，只是粘贴改走 pasteClipboardImage；
+        // 剪贴板里只有图片时 Qt 会把粘贴置灰，这里重新启用
+        QMenu *menu = messageInput->createStandardContextMenu();
+        if (QAction *paste = menu->findChild<QAction *>("edit-paste")) {
+            const QMimeData *mime = QApplication::clipboard()->mimeData();
+            paste->setEnabled(paste->isEnabled() || (!messageInput->isReadOnly() && mime && mime->hasImage()));
+            disconnect(paste, &QAction::triggered, messageInput, nullptr);
+            connect(paste, &QAction::triggered, this, [this]() {
+                if (!pasteClipboardImage()) {
+                    messageInput->paste();
+                }
+            });
+        }
+        menu->setAttribute(Qt::WA_DeleteOnClose);
+        menu->popup(static_cast<QContextMenuEvent *>(event)->globalPos());
+        return true;
+    }
+    if (watched == chatHistory->viewport() && event->type() == QEvent::MouseButtonRelease) {
+        auto *mouseEvent = static_cast<QMouseEvent *>(event);
+        bool save = false;
+        QString sender;
+        QString fileName;
+        quint64 folderOfferId = 0;
+        if (mouseEvent->button() == Qt::LeftButton &&
+            parseFolderAction(chatHistory->anchorAt(mouseEvent->position().toPoint()), &folderOfferId)) {
+            saveReceivedFolder(folderOfferId);
+            return true;
+        }
+        if (mouseEvent->button() == Qt::LeftButton &&
+            parseFileAction(chatHistory->anchorAt(mouseEvent->position().toPoint()), &save, &sender, &fileName)) {
+            if (save) {
+                saveReceivedFile(sender, fileName);
+            } else {
+                openReceivedFile(sender, fileName);
+            }
+            return true;
+        }
+    }
+    return QWidget::eventFilter(watched, event);
 }
\ No newline at end of file
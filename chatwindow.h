@@ -18,7 +18,17 @@
 #include <QFont>
 #include <QMap>
 #include "networkmanager.h"
+#include "chathistory.h"
+#include "searchindex.h"
+#include "historypager.h"
+#include "historysync.h"
+#include "fileshare.h"
+#include "foldertransfer.h"
+#include "imagetranscoder.h"
+#include "lrucache.h"
 
+class MetricsExporter;
+class MessageTracer;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class ChatWindow; }
@@ -34,23 +44,50 @@ public:
 
 private slots:
     void onSendMessage();
-    void onMessageReceived(const QString &message);
-    void handleFileMessage(const QString &message);
+    void onMessageReceived(const QString &message, quint64 clock);
+    void handleFileMessage(const QString &message, quint64 clock);
+    void onTextEnvelope(const Envelope &envelope);
+    void onFileEnvelope(const Envelope &envelope);
     void onPeerDiscovered(const QString &ip, const QString &username);
     void insertEmoji(const QString &emoji);
     void onAvatarButtonClicked();
+    void onSearchClicked();
+    void onEncryptionClicked();
+    void onDiagnosticsClicked();
+    void onConversationSelected();
+    void onJoinRoomClicked();
+    void onConversationContextMenu(const QPoint &pos);
+    void onOnlineUserDoubleClicked(QListWidgetItem *item);
     void onSendFile();
-    void showSentFile(const QString &fileName, const QString &fileExtension, qint64 fileSize, bool isImage, bool isVideo);
+    void onSendFolder();
+    void showSentFile(const QString &fileName, const QString &fileExtension, qint64 fileSize, bool isImage, bool isVideo,
+                      quint64 clock, const QString &conversation);
     void onSaveFile();
     void saveReceivedFile(const QString &sender, const QString &filename);
-    QString generateThumbnail(const QByteArray &fileData, bool isImage);
+    void openReceivedFile(const QString &sender, const QString &filename);
+    void onFileOfferEnvelope(const Envelope &envelope);
+    void onFolderOfferEnvelope(const Envelope &envelope);
+    void onDownloadProgress(quint64 offerId, qint64 contiguousBytes, qint64 totalBytes);
+    void onDownloadVerifying(quint64 offerId, qint64 hashedBytes, qint64 totalBytes);
+    void onDownloadFinished(quint64 offerId, const QString &path);
+    void onDownloadFailed(quint64 offerId, const QString &reason);
+
+protected:
+    // 聊天记录里文件链接的点击；输入框里粘贴图片
+    bool eventFilter(QObject *watched, QEvent *event) override;
 
 private:
     void setupUI();
     void setupConnections();
     void createEmojiMenu();
+    void buildEmojiPalette();
     void initEmojiMap();
     QString processMessageWithEmojis(const QString &message);
+    void showIncomingText(const QString &senderUsername, const QString &text, QByteArrayView avatarPng,
+                          quint64 clock, const QString &conversation, quint64 senderId = 0, quint64 messageId = 0);
+    void showIncomingFile(const QString &senderUsername, const QString &fileName, const QString &fileType,
+                          qint64 fileSize, const QString &thumbnailBase64, const ReceivedFile &file,
+                          quint64 clock, const QString &conversation);
     void loadUserAvatar();
     void saveUserAvatar(const QString &avatarPath);
     QString getAvatarStoragePath();
@@ -58,6 +95,45 @@ private:
     QPixmap getUserAvatar(const QString &username);
     QPixmap cropToSquare(const QPixmap &pixmap);
     void updateOnlineUserAvatar(const QString &username, const QPixmap &avatar);
+    // 文件：图片、视频和大文件只发预告并登记原文件；打开/保存时内容不在本地就先拉取
+    static const qint64 inlineFileLimit = 256 * 1024;          // 不超过这么大的普通文件随消息直接发送
+    static const qint64 streamStartBytes = 4 * 1024 * 1024;    // 视频开头连续下载这么多后开始播放
+    static const qint64 legacyFileLimit = 4 * 1024 * 1024;     // 旧版节点随消息收到完整文件的上限，更大的只收到文字通知
+    void sendFileOffer(const QString &path, FileKind kind, const QString &conversation);
+    // 粘贴的图片在后台压缩成文件，再按图片预告发送
+    void pasteImage(const QImage &image);
+    // 快捷键和右键菜单的粘贴都经过这里：剪贴板里是图片时发送并返回 true，否则由输入框粘贴文字
+    bool pasteClipboardImage();
+    void postFileOffer(const QString &path, FileKind kind, const QString &conversation, const ImagePreview &preview,
+                       const QByteArray &digest);
+    QString legacyFileMessage(const QString &displayName, const QString &fileExtension, const QString &fileType,
+                              const QByteArray &fileData, const QByteArray &thumbnail) const;
+    void withReceivedFile(const QString &sender, const QString &filename, bool save);
+    // 文件夹：清单随 FolderOffer 发出，接收方选好位置后整个拉取
+    void postFolderOffer(const QString &root, const QString &conversation, const FolderManifest &manifest);
+    void showIncomingFolder(const QString &senderUsername, quint64 offerId, const FolderManifest &manifest,
+                            quint64 clock, const QString &conversation);
+    void saveReceivedFolder(quint64 offerId);
+    void finishFileAction(const QString &fileKey, const QString &filename, bool save);
+
+    // senderId/messageId 为信封消息的标识（旧版消息和文件为 0），历史同步用
+    void appendMessage(const QString &sender, const QString &text, bool outgoing, const QString &html,
+                       quint64 clock, const QString &conversation, quint64 senderId = 0, quint64 messageId = 0);
+
+    // 会话（大厅、房间、私聊）
+    QString incomingConversation(const Envelope &envelope, const QString &senderUsername) const;
+    QListWidgetItem *conversationItem(const QString &conversation, bool create);
+    void openConversation(const QString &conversation);
+    void markUnread(const QString &conversation);
+    void loadRooms();
+    void saveRooms();
+    QString getRoomsStoragePath();
+
+    // 加密：群组密钥由口令派生，保存在本地
+    void updateEncryptionStatus();
+    QByteArray loadGroupKey();
+    void saveGroupKey(const QByteArray &key);
+    QString getGroupKeyStoragePath();
 
     // 界面控件
     QVBoxLayout *mainLayout{};
@@ -68,8 +144,15 @@ private:
     QListWidget *onlineUsersList{};
     QLabel *statusLabel{};
     QMenu *emojiMenu{};
+    bool emojiPaletteBuilt = false;
     QPushButton *avatarButton{};
     QPushButton *fileButton{};
+    QPushButton *folderButton{};
+    QToolButton *searchButton{};
+    QToolButton *encryptionButton{};
+    QToolButton *diagnosticsButton{};
+    QListWidget *conversationList{};
+    QPushButton *joinRoomButton{};
 
     // 网络和用户数据
     NetworkManager *networkManager;
@@ -77,15 +160,46 @@ private:
     QString avatarPath;
 
     // 表情相关
-    QMap<QString, QString> emojiMap;
     QStringList commonEmojis;
 
+    // 各缓存的大小估算和超出预算时的转存，预算见 MemoryBudget
+    static qint64 avatarCost(const QPixmap &pixmap);
+    static qint64 receivedFileCost(const ReceivedFile &file);
+    static bool spillReceivedFile(const QString &fileKey, ReceivedFile &file);
+
     // 用户头像缓存
-    QMap<QString, QPixmap> userAvatars;
+    LruCache<QString, QPixmap> userAvatars{&ChatWindow::avatarCost, nullptr, &Metrics::process().avatarCache};
 
     // 文件传输
     QString currentFilePath;
-    QMap<QString, QString> receivedFiles;  // 用户名_文件名 -> base64数据
+    LruCache<QString, ReceivedFile> receivedFiles{&ChatWindow::receivedFileCost, &ChatWindow::spillReceivedFile,
+                                                  &Metrics::process().fileCache};   // 用户名_文件名 -> 文件内容
+    struct PendingFileAction {
+        QString fileKey;
+        QString fileName;
+        bool save = false;
+        bool stream = false;   // 打开视频：不等下载完
+    };
+    QHash<quint64, PendingFileAction> pendingFileActions;   // 正在拉取的文件 -> 到达后的操作
+    struct ReceivedFolder {
+        QString owner;
+        FolderManifest manifest;
+    };
+    QHash<quint64, ReceivedFolder> receivedFolders;         // offerId -> 文件夹清单
+    FileShare *fileShare{};
+    QList<ImageRung> imageLadder;
+    MetricsExporter *metricsExporter{};
+    MessageTracer *messageTracer{};
+
+    // 当前会话：发送的消息发到这里；其他会话的新消息在列表中标为未读
+    QString currentConversation;
+    QStringList joinedRooms;
+
+    // 聊天历史持久化与全文检索
+    ChatHistory *historyStore{};
+    SearchIndex *searchIndex{};
+    HistoryPager *historyPager{};
+    HistorySync *historySync{};
 };
 
 #endif // CHATWINDOW_H
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef CONVERSATION_H
+#define CONVERSATION_H
+
+#include <QString>
+
+// 会话标识：
+//   ""        大厅，发给所有节点（包括旧版客户端）
+//   "#名称"   房间，只发给在发现广播中声明加入了该房间的节点
+//   "@用户名" 私聊，只发给该用户。线路上是对方的名字，收到后换成发送者的名字
+class Conversation {
+public:
+    static QString room(const QString &name) { return "#" + name; }
+    static QString direct(const QString &username) { return "@" + username; }
+
+    static bool isLobby(const QString &id) { return id.isEmpty(); }
+    static bool isRoom(const QString &id) { return id.startsWith('#'); }
+    static bool isDirect(const QString &id) { return id.startsWith('@'); }
+
+    // 房间名或私聊对象，不带前缀
+    static QString target(const QString &id) { return id.mid(1); }
+
+    static QString displayName(const QString &id) {
+        if (isRoom(id)) {
+            return id;
+        }
+        if (isDirect(id)) {
+            return "私聊 " + target(id);
+        }
+        return "大厅";
+    }
+};
+
+#endif // CONVERSATION_H
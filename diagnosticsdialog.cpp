@@ -0,0 +1,228 @@
+#include "diagnosticsdialog.h"
+#include "metrics.h"
+#include "messagetracer.h"
+#include "stallwatchdog.h"
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QPushButton>
+#include <QGuiApplication>
+#include <QClipboard>
+#include <QLocale>
+#include <QFileDialog>
+#include <QSaveFile>
+#include <QMessageBox>
+#include <QDateTime>
+
+namespace {
+
+QString latencyText(qint64 ns) {
+    if (ns < 1000000) {
+        return QString("%1 µs").arg(ns / 1000.0, 0, 'f', 0);
+    }
+    if (ns < 1000000000) {
+        return QString("%1 ms").arg(ns / 1e6, 0, 'f', 1);
+    }
+    return QString("%1 s").arg(ns / 1e9, 0, 'f', 2);
+}
+
+QString cacheText(const QString &name, const CacheMetrics &cache) {
+    QLocale locale;
+    qint64 budget = cache.budget.get();
+    QString text = QString("%1 %2 / %3（%4 项，淘汰 %5")
+                       .arg(name)
+                       .arg(locale.formattedDataSize(cache.bytes.get()))
+                       .arg(budget > 0 ? locale.formattedDataSize(budget) : QString("不限"))
+                       .arg(cache.entries.get())
+                       .arg(cache.evictions.get());
+    if (cache.spills.get() > 0) {
+        text += QString("，转存 %1").arg(cache.spills.get());
+    }
+    return text + "）";
+}
+
+QString histogramText(const LatencyHistogram &histogram) {
+    if (histogram.count() == 0) {
+        return "-";
+    }
+    return QString("%1 / %2").arg(latencyText(histogram.percentileNs(50)), latencyText(histogram.percentileNs(99)));
+}
+
+}
+
+DiagnosticsDialog::DiagnosticsDialog(MessageTracer *tracer, QWidget *parent)
+    : QDialog(parent), tracer(tracer) {
+    setWindowTitle("网络诊断");
+    resize(820, 560);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setSpacing(8);
+    layout->setContentsMargins(10, 10, 10, 10);
+
+    summaryLabel = new QLabel(this);
+    summaryLabel->setStyleSheet("color: #666; font-size: 12px;");
+    summaryLabel->setWordWrap(true);
+    layout->addWidget(summaryLabel);
+
+    memoryLabel = new QLabel(this);
+    memoryLabel->setStyleSheet("color: #666; font-size: 12px;");
+    memoryLabel->setWordWrap(true);
+    layout->addWidget(memoryLabel);
+
+    peerTable = new QTableWidget(0, 9, this);
+    peerTable->setHorizontalHeaderLabels({"节点", "发送条数", "发送字节", "接收条数", "接收字节",
+                                          "连接失败", "发件箱", "待确认", "发送延迟 p50 / p99"});
+    peerTable->verticalHeader()->setVisible(false);
+    peerTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    peerTable->setSelectionMode(QAbstractItemView::NoSelection);
+    peerTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+    peerTable->horizontalHeader()->setStretchLastSection(true);
+    layout->addWidget(peerTable, 1);
+
+    stallLabel = new QLabel(this);
+    stallLabel->setStyleSheet("color: #666; font-size: 12px;");
+    stallLabel->setWordWrap(true);
+    layout->addWidget(stallLabel);
+
+    stallTable = new QTableWidget(0, 3, this);
+    stallTable->setHorizontalHeaderLabels({"时间", "卡顿时长", "正在执行的操作"});
+    stallTable->verticalHeader()->setVisible(false);
+    stallTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    stallTable->setSelectionMode(QAbstractItemView::NoSelection);
+    stallTable->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+    stallTable->horizontalHeader()->setStretchLastSection(true);
+    layout->addWidget(stallTable, 1);
+
+    traceLabel = new QLabel(this);
+    traceLabel->setStyleSheet("color: #666; font-size: 12px;");
+    traceLabel->setWordWrap(true);
+    layout->addWidget(traceLabel);
+
+    QHBoxLayout *buttons = new QHBoxLayout();
+    traceCheckBox = new QCheckBox("消息跟踪", this);
+    traceCheckBox->setToolTip("记录收到的每条消息在发送、传输、解析和显示各段的耗时");
+    traceCheckBox->setChecked(tracer->isEnabled());
+    buttons->addWidget(traceCheckBox);
+    QPushButton *exportButton = new QPushButton("导出跟踪...", this);
+    buttons->addWidget(exportButton);
+    buttons->addStretch();
+    QPushButton *clearStallsButton = new QPushButton("清空卡顿记录", this);
+    buttons->addWidget(clearStallsButton);
+    QPushButton *copyButton = new QPushButton("复制 Prometheus 文本", this);
+    buttons->addWidget(copyButton);
+    layout->addLayout(buttons);
+    connect(copyButton, &QPushButton::clicked, this, &DiagnosticsDialog::copyPrometheusText);
+    connect(exportButton, &QPushButton::clicked, this, &DiagnosticsDialog::exportTrace);
+    connect(clearStallsButton, &QPushButton::clicked, this, [this]() {
+        StallWatchdog::clear();
+        refresh();
+    });
+    connect(traceCheckBox, &QCheckBox::toggled, this, [this](bool checked) {
+        this->tracer->setEnabled(checked);
+        refresh();
+    });
+
+    refreshTimer = new QTimer(this);
+    refreshTimer->setInterval(1000);
+    connect(refreshTimer, &QTimer::timeout, this, &DiagnosticsDialog::refresh);
+    refreshTimer->start();
+    refresh();
+}
+
+void DiagnosticsDialog::refresh() {
+    const ProcessMetrics &process = Metrics::process();
+    summaryLabel->setText(QString("发现广播 %1 条（无效 %2）　丢弃消息帧 %3　"
+                                  "消息处理 p50/p99 %4　界面追加 p50/p99 %5")
+                              .arg(process.discoveryBeacons.get())
+                              .arg(process.discoveryInvalid.get())
+                              .arg(process.framesDropped.get())
+                              .arg(histogramText(process.frameHandling))
+                              .arg(histogramText(process.guiAppend)));
+
+    memoryLabel->setText("内存：" + cacheText("头像", process.avatarCache) + "　" +
+                         cacheText("收到的文件", process.fileCache) + "　" +
+                         cacheText("聊天视图", process.chatView));
+
+    // 最长的卡顿排在最前，先修它们
+    stallLabel->setText(QString("界面卡顿 %1 次（超过 %2 ms），时长 p50/p99 %3")
+                            .arg(process.guiStalls.get())
+                            .arg(StallWatchdog::defaultThresholdMs)
+                            .arg(histogramText(process.guiStallDuration)));
+    const QList<StallWatchdog::Stall> stalls = StallWatchdog::worstStalls();
+    stallTable->setRowCount(int(stalls.size()));
+    for (int row = 0; row < stalls.size(); ++row) {
+        const StallWatchdog::Stall &stall = stalls[row];
+        const QStringList cells = {
+            QDateTime::fromMSecsSinceEpoch(stall.startedMs).toString("hh:mm:ss.zzz"),
+            latencyText(stall.durationNs),
+            stall.operation.isEmpty() ? QString("（未标记）") : stall.operation,
+        };
+        for (int column = 0; column < cells.size(); ++column) {
+            QTableWidgetItem *item = stallTable->item(row, column);
+            if (!item) {
+                item = new QTableWidgetItem();
+                stallTable->setItem(row, column, item);
+            }
+            item->setText(cells[column]);
+        }
+    }
+
+    if (tracer->isEnabled()) {
+        QStringList hops;
+        for (int hop = 0; hop < MessageTracer::HopCount; ++hop) {
+            hops.append(QString("%1 %2").arg(MessageTracer::hopName(MessageTracer::Hop(hop)),
+                                             histogramText(tracer->hopHistogram(MessageTracer::Hop(hop)))));
+        }
+        traceLabel->setText(QString("已跟踪 %1 条消息，各段 p50/p99：%2")
+                                .arg(tracer->completedTraces().size())
+                                .arg(hops.join("　")));
+    } else {
+        traceLabel->setText("消息跟踪未开启");
+    }
+
+    QLocale locale;
+    const auto peers = Metrics::peers();
+    peerTable->setRowCount(int(peers.size()));
+    for (int row = 0; row < peers.size(); ++row) {
+        const PeerMetrics *metrics = peers[row].second;
+        const QStringList cells = {
+            peers[row].first,
+            locale.toString(metrics->messagesSent.get()),
+            locale.formattedDataSize(qint64(metrics->bytesSent.get())),
+            locale.toString(metrics->messagesReceived.get()),
+            locale.formattedDataSize(qint64(metrics->bytesReceived.get())),
+            locale.toString(metrics->connectFailures.get()),
+            QString("%1 条 / %2").arg(metrics->outboxMessages.get())
+                .arg(locale.formattedDataSize(metrics->outboxBytes.get())),
+            locale.toString(metrics->sessionPending.get()),
+            histogramText(metrics->sendLatency),
+        };
+        for (int column = 0; column < cells.size(); ++column) {
+            QTableWidgetItem *item = peerTable->item(row, column);
+            if (!item) {
+                item = new QTableWidgetItem();
+                peerTable->setItem(row, column, item);
+            }
+            item->setText(cells[column]);
+        }
+    }
+}
+
+void DiagnosticsDialog::copyPrometheusText() {
+    QGuiApplication::clipboard()->setText(Metrics::prometheusText());
+}
+
+void DiagnosticsDialog::exportTrace() {
+    if (tracer->completedTraces().isEmpty()) {
+        QMessageBox::information(this, "导出跟踪", "还没有完成的消息跟踪，请先开启消息跟踪并收几条消息");
+        return;
+    }
+    QString fileName = QFileDialog::getSaveFileName(this, "导出跟踪", "message_trace.json", "Chrome trace (*.json)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(tracer->chromeTraceJson()) < 0 || !file.commit()) {
+        QMessageBox::warning(this, "导出跟踪", "无法写入文件: " + fileName);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef DIAGNOSTICSDIALOG_H
+#define DIAGNOSTICSDIALOG_H
+
+#include <QDialog>
+#include <QTableWidget>
+#include <QLabel>
+#include <QTimer>
+#include <QCheckBox>
+
+class MessageTracer;
+
+// 网络诊断面板：每秒刷新 Metrics 中各节点的收发量、失败次数、队列深度和发送延迟。
+// 另外显示进程内缓存的占用和最严重的几次界面卡顿（见 StallWatchdog）；
+// 开启消息跟踪后显示各段延迟，并可以导出 Chrome trace
+class DiagnosticsDialog : public QDialog {
+    Q_OBJECT
+
+public:
+    explicit DiagnosticsDialog(MessageTracer *tracer, QWidget *parent = nullptr);
+
+private slots:
+    void refresh();
+    void copyPrometheusText();
+    void exportTrace();
+
+private:
+    MessageTracer *tracer;
+    QLabel *summaryLabel;
+    QLabel *memoryLabel;
+    QCheckBox *traceCheckBox;
+    QLabel *traceLabel;
+    QTableWidget *peerTable;
+    QLabel *stallLabel;
+    QTableWidget *stallTable;
+    QTimer *refreshTimer;
+};
+
+#endif // DIAGNOSTICSDIALOG_H
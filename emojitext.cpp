@@ -0,0 +1,59 @@
+#include "emojitext.h"
+#include <QRegularExpression>
+#include <QList>
+#include <utility>
+
+const QMap<QString, QString> &EmojiText::shortCodes() {
+    static const QMap<QString, QString> codes = {
+        {":)", "😊"}, {":-)", "😊"}, {":D", "😄"}, {":-D", "😄"},
+        {":(", "😞"}, {":-(", "😞"}, {":'(", "😢"}, {":O", "😲"},
+        {":-O", "😲"}, {":P", "😛"}, {":-P", "😛"}, {";)", "😉"},
+        {";-)", "😉"}, {"<3", "❤️"}, {"</3", "💔"}, {":*", "😘"},
+        {":-*", "😘"}, {":|", "😐"}, {":-|", "😐"}, {"XD", "😆"},
+        {"xD", "😆"}, {"xDD", "😂"}, {"^^", "😊"}, {">:(", "😠"},
+        {">:-(", "😠"}, {"O:)", "😇"}, {"O:-)", "😇"}, {"3:)", "😈"},
+        {"3:-)", "😈"}, {"o.O", "😳"}, {"O.o", "😳"}, {":/", "😕"},
+        {":-/", "😕"}, {":\\", "😕"}, {":-\\", "😕"}, {":$", "😳"},
+        {":-$", "😳"}, {"B)", "😎"}, {"B-)", "😎"}, {"8)", "😎"},
+        {"8-)", "😎"}, {"':(", "😥"}, {"':-)", "😥"}, {"'):", "😥"},
+        {"'-):", "😥"}, {"</3", "💔"}, {"(y)", "👍"}, {"(n)", "👎"},
+        {"(Y)", "👍"}, {"(N)", "👎"}, {"(ok)", "👌"}, {"(OK)", "👌"}
+    };
+    return codes;
+}
+
+const QMap<QString, QString> &EmojiText::longCodes() {
+    static const QMap<QString, QString> codes = {
+        {":coffee:", "☕"}, {":pizza:", "🍕"}, {":beer:", "🍺"},
+        {":cake:", "🎂"}, {":gift:", "🎁"}, {":star:", "⭐"},
+        {":fire:", "🔥"}, {":+1:", "👍"}, {":-1:", "👎"},
+        {":ok:", "👌"}, {":100:", "💯"}, {":heart:", "❤️"},
+        {":thumbsup:", "👍"}, {":thumbsdown:", "👎"}, {":clap:", "👏"},
+        {":pray:", "🙏"}, {":handshake:", "🤝"}
+    };
+    return codes;
+}
+
+QString EmojiText::replaceCodes(const QString &message) {
+    // 按 QMap 的键顺序替换，与原先逐条编译正则时的结果一致
+    static const QList<std::pair<QRegularExpression, QString>> shortPatterns = []() {
+        QList<std::pair<QRegularExpression, QString>> patterns;
+        const QMap<QString, QString> &codes = shortCodes();
+        for (auto it = codes.begin(); it != codes.end(); ++it) {
+            QRegularExpression rx("\\b" + QRegularExpression::escape(it.key()) + "\\b");
+            rx.optimize();
+            patterns.append({rx, it.value()});
+        }
+        return patterns;
+    }();
+
+    QString result = message;
+    const QMap<QString, QString> &special = longCodes();
+    for (auto it = special.begin(); it != special.end(); ++it) {
+        result.replace(it.key(), it.value());
+    }
+    for (const auto &[rx, emoji] : shortPatterns) {
+        result.replace(rx, emoji);
+    }
+    return result;
+}
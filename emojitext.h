@@ -0,0 +1,17 @@
+#ifndef EMOJITEXT_H
+#define EMOJITEXT_H
+
+#include <QString>
+#include <QMap>
+
+// 表情代码替换。先替换 :coffee: 这类长代码，再按单词边界替换 :) 这类短代码。
+// 短代码的正则只在第一次使用时编译一次，之后每条消息直接复用。
+class EmojiText {
+public:
+    static const QMap<QString, QString> &shortCodes();
+    static const QMap<QString, QString> &longCodes();
+
+    static QString replaceCodes(const QString &message);
+};
+
+#endif // EMOJITEXT_H
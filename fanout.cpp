@@ -0,0 +1,84 @@
+#include "fanout.h"
+#include "securesession.h"
+#include "tcpclient.h"
+#include <QThread>
+#include <future>
+
+FanOut::FanOut(int threadCount, QObject *parent) : QObject(parent) {
+    if (threadCount <= 0) {
+        threadCount = qBound(1, QThread::idealThreadCount(), maxThreads);
+    }
+    for (int i = 0; i < threadCount; ++i) {
+        auto *thread = new QThread(this);
+        thread->setObjectName(QString("fanout-%1").arg(i));
+        // 线程标识只能在线程里取到，started 在新线程上直接调用
+        std::promise<Qt::HANDLE> id;
+        auto started = connect(thread, &QThread::started, thread, [&id]() {
+            id.set_value(QThread::currentThreadId());
+        }, Qt::DirectConnection);
+        thread->start();
+        workerIds.append(id.get_future().get());
+        disconnect(started);
+        threads.append(thread);
+    }
+}
+
+FanOut::~FanOut() {
+    // 会话在所属线程里释放；线程结束前会处理完已投递的 deleteLater
+    resetSessions();
+    for (QThread *thread : std::as_const(threads)) {
+        thread->quit();
+        thread->wait();
+    }
+}
+
+QThread *FanOut::threadFor(const QString &ip) const {
+    return threads.at(int(qHash(ip) % uint(threads.size())));
+}
+
+void FanOut::sendSecure(const QString &ip, int port, const QByteArray &groupKey, const QByteArray &data,
+                        Completion done) {
+    PeerSession *session = sessions.value(ip);
+    if (!session) {
+        session = new PeerSession(ip, port, groupKey);
+        session->moveToThread(threadFor(ip));
+        sessions.insert(ip, session);
+    }
+
+    // 会话在工作线程里写出，写完后把结果投递回本线程
+    QMetaObject::invokeMethod(session, [this, session, data, done]() {
+        session->send(data, [this, done](bool delivered) {
+            if (done) {
+                QMetaObject::invokeMethod(this, [done, delivered]() { done(delivered); }, Qt::QueuedConnection);
+            }
+        });
+    }, Qt::QueuedConnection);
+}
+
+void FanOut::sendPlain(const QString &ip, int port, const QByteArray &data, Completion done) {
+    // TCPClient 结束后自行 deleteLater，在工作线程里释放
+    auto *client = new TCPClient;
+    client->moveToThread(threadFor(ip));
+    connect(client, &TCPClient::delivered, this, [done]() {
+        if (done) {
+            done(true);
+        }
+    });
+    connect(client, &TCPClient::failed, this, [done]() {
+        if (done) {
+            done(false);
+        }
+    });
+    QMetaObject::invokeMethod(client, [client, ip, port, data]() {
+        client->sendMessage(ip, port, data);
+    }, Qt::QueuedConnection);
+}
+
+void FanOut::resetSessions() {
+    for (PeerSession *session : std::as_const(sessions)) {
+        // 先在会话所在线程报告失败，完成回调照常回到本线程，再释放
+        QMetaObject::invokeMethod(session, &PeerSession::failAll, Qt::QueuedConnection);
+        session->deleteLater();
+    }
+    sessions.clear();
+}
@@ -0,0 +1,52 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <functional>
+
+class QThread;
+class PeerSession;
+
+// 把同一条消息发给多个节点。帧由调用方序列化一次，各节点拿到的是同一个 QByteArray
+// （隐式共享，引用计数是原子的，跨线程传递不复制内容）。
+// 到各节点的连接分布在几个工作线程上，每个节点固定在其中一个线程，发给同一节点的数据仍按顺序写出；
+// TLS 加密和套接字写入因此在各线程上并行，不再在调用线程上逐个节点做完。
+// 每个节点的结果通过 Completion 回到调用 FanOut 的线程。
+class FanOut : public QObject {
+    Q_OBJECT
+
+public:
+    using Completion = std::function<void(bool delivered)>;
+
+    static const int maxThreads = 4;
+
+    // threadCount 为 0 时按 CPU 核数，最多 maxThreads 个
+    explicit FanOut(int threadCount = 0, QObject *parent = nullptr);
+    ~FanOut();
+
+    int threadCount() const { return int(threads.size()); }
+    // 各工作线程的 QThread::currentThreadId()，负载测试按线程统计 CPU 时间用
+    QList<Qt::HANDLE> threadIds() const { return workerIds; }
+
+    // 经到 ip 的加密长连接发送；会话第一次用到时按 port 和 groupKey 建立
+    void sendSecure(const QString &ip, int port, const QByteArray &groupKey, const QByteArray &data,
+                    Completion done = nullptr);
+
+    // 新建一次性明文连接发送
+    void sendPlain(const QString &ip, int port, const QByteArray &data, Completion done = nullptr);
+
+    // 丢弃所有加密会话（组密钥更换时），其上未确认的数据以失败回调
+    void resetSessions();
+
+private:
+    QThread *threadFor(const QString &ip) const;
+
+    QList<QThread *> threads;
+    QList<Qt::HANDLE> workerIds;
+    QHash<QString, PeerSession *> sessions;   // 对象属于各自的工作线程，这里只保存指针
+};
+
+#endif // FANOUT_H
@@ -0,0 +1,145 @@
+#include "filehasher.h"
+#include "logger.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+#include <QThread>
+#include <QtConcurrent>
+#include <atomic>
+#include <memory>
+#include <numeric>
+
+FileHasher::FileHasher(QObject *parent) : QObject(parent) {
+    // 独立的线程池：几 GB 的文件要算好几秒，不能占满全局线程池让图片预览等排队
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+}
+
+FileHasher::~FileHasher() {
+    for (FileHashJob *job : std::as_const(running)) {
+        if (job->watcher) {
+            job->watcher->cancel();
+        }
+    }
+    // 各段直接读映射的内存，文件要等它们都停下来才能关
+    pool.waitForDone();
+}
+
+FileHashJob *FileHasher::hash(const QString &path) {
+    QString key = QFileInfo(path).absoluteFilePath();
+    if (FileHashJob *existing = running.value(key)) {
+        return existing;
+    }
+
+    auto *job = new FileHashJob(key, this);
+    running.insert(key, job);
+    // 等调用方连上信号后再开始
+    QByteArray digest = cached(key);
+    if (!digest.isEmpty()) {
+        QTimer::singleShot(0, job, [this, job, digest]() { finish(job, digest, QString()); });
+    } else {
+        QTimer::singleShot(0, job, [this, job]() { start(job); });
+    }
+    return job;
+}
+
+QByteArray FileHasher::cached(const QString &path) const {
+    QFileInfo info(path);
+    auto it = cache.find(info.absoluteFilePath());
+    if (it == cache.end() || !info.exists() || it->size != info.size() || it->modified != info.lastModified()) {
+        return QByteArray();
+    }
+    return it->digest;
+}
+
+void FileHasher::start(FileHashJob *job) {
+    QString path = job->path();
+    auto file = std::make_shared<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly)) {
+        finish(job, QByteArray(), "无法读取文件：" + path);
+        return;
+    }
+    qint64 size = file->size();
+    QDateTime modified = QFileInfo(path).lastModified();
+    // 映射失败（空文件、部分文件系统）时各段自己按偏移读取
+    const uchar *map = size > 0 ? file->map(0, size) : nullptr;
+
+    // 最后一段可能不满一段，而且在树中的位置不固定，不并行计算
+    qint64 fullSegments = size > 0 ? (size - 1) / segmentBytes : 0;
+    QList<qint64> segments(fullSegments);
+    std::iota(segments.begin(), segments.end(), qint64(0));
+
+    auto readError = std::make_shared<std::atomic<bool>>(false);
+    auto hashSegment = [map, path, readError](qint64 index) {
+        qint64 offset = index * segmentBytes;
+        quint64 firstChunk = quint64(offset / Blake3::chunkBytes);
+        if (map) {
+            return Blake3::subtree(QByteArrayView(map + offset, segmentBytes), firstChunk);
+        }
+        QFile segment(path);
+        QByteArray data;
+        if (!segment.open(QIODevice::ReadOnly) || !segment.seek(offset) ||
+            (data = segment.read(segmentBytes)).size() != segmentBytes) {
+            readError->store(true);
+            return Blake3::ChainingValue();
+        }
+        return Blake3::subtree(data, firstChunk);
+    };
+
+    auto *watcher = new QFutureWatcher<Blake3::ChainingValue>(job);
+    job->watcher = watcher;
+    connect(watcher, &QFutureWatcherBase::progressValueChanged, job, [job, size](int segmentsDone) {
+        emit job->progress(qMin(size, segmentsDone * segmentBytes), size);
+    });
+    connect(watcher, &QFutureWatcherBase::finished, job,
+            [this, job, watcher, file, map, size, modified, fullSegments, readError]() {
+        if (watcher->isCanceled()) {
+            return;
+        }
+        if (readError->load()) {
+            finish(job, QByteArray(), "读取文件失败：" + job->path());
+            return;
+        }
+
+        Blake3 hasher;
+        const QList<Blake3::ChainingValue> subtrees = watcher->future().results();
+        for (const Blake3::ChainingValue &cv : subtrees) {
+            hasher.appendSubtree(cv, segmentBytes / Blake3::chunkBytes);
+        }
+        qint64 offset = fullSegments * segmentBytes;
+        if (map) {
+            hasher.update(QByteArrayView(map + offset, size - offset));
+        } else {
+            QByteArray tail;
+            if (!file->seek(offset) || (tail = file->read(size - offset)).size() != size - offset) {
+                finish(job, QByteArray(), "读取文件失败：" + job->path());
+                return;
+            }
+            hasher.update(tail);
+        }
+        file->close();
+
+        QFileInfo after(job->path());
+        if (after.size() != size || after.lastModified() != modified) {
+            finish(job, QByteArray(), "文件在计算校验值期间被修改：" + job->path());
+            return;
+        }
+        QByteArray digest = hasher.finalize();
+        cache.insert(job->path(), CacheEntry{size, modified, digest});
+        finish(job, digest, QString());
+    });
+
+    emit job->progress(0, size);
+    watcher->setFuture(QtConcurrent::mapped(&pool, segments, hashSegment));
+}
+
+void FileHasher::finish(FileHashJob *job, const QByteArray &digest, const QString &error) {
+    running.remove(job->path());
+    if (error.isEmpty()) {
+        LOG_DEBUG(Files) << "文件校验值:" << job->path() << digest.toHex();
+        emit job->finished(digest);
+    } else {
+        LOG_WARNING(Files) << error;
+        emit job->failed(error);
+    }
+    job->deleteLater();
+}
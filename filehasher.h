@@ -0,0 +1,66 @@
+#ifndef FILEHASHER_H
+#define FILEHASHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QDateTime>
+#include <QThreadPool>
+#include <QFutureWatcher>
+#include "blake3.h"
+
+// 一次文件哈希。在创建它的线程发信号，结束（finished 或 failed）后自行删除
+class FileHashJob : public QObject {
+    Q_OBJECT
+
+public:
+    QString path() const { return filePath; }
+
+signals:
+    void progress(qint64 hashedBytes, qint64 totalBytes);
+    void finished(const QByteArray &digest);
+    void failed(const QString &reason);
+
+private:
+    friend class FileHasher;
+    explicit FileHashJob(const QString &path, QObject *parent) : QObject(parent), filePath(path) {}
+
+    QString filePath;
+    QFutureWatcher<Blake3::ChainingValue> *watcher = nullptr;
+};
+
+// 计算文件的 BLAKE3 摘要，多核并行。文件映射到内存后按 segmentBytes 切段，
+// 除最后一段外每段是 BLAKE3 树中一棵完整子树，在独立线程池中用 QtConcurrent::mapped 并行计算；
+// 最后一段和子树的合并留在调用线程做，只有几毫秒。结果与整体顺序计算完全一致。
+// 同一文件（路径、大小、修改时间都相同）的结果会被缓存，所以发送时的完整性摘要、
+// 接收后的校验和按摘要去重可以共用一次读取。
+class FileHasher : public QObject {
+    Q_OBJECT
+
+public:
+    static constexpr qint64 segmentBytes = 1024 * Blake3::chunkBytes;    // 2 的幂个块
+
+    explicit FileHasher(QObject *parent = nullptr);
+    ~FileHasher();
+
+    // 同一路径已在计算时返回同一个任务；有缓存时任务在下一轮事件循环直接完成
+    FileHashJob *hash(const QString &path);
+
+    // 文件未改动过时返回缓存的摘要，否则为空
+    QByteArray cached(const QString &path) const;
+
+private:
+    struct CacheEntry {
+        qint64 size = 0;
+        QDateTime modified;
+        QByteArray digest;
+    };
+
+    void start(FileHashJob *job);
+    void finish(FileHashJob *job, const QByteArray &digest, const QString &error);
+
+    QThreadPool pool;
+    QHash<QString, CacheEntry> cache;         // 绝对路径 -> 摘要
+    QHash<QString, FileHashJob *> running;    // 绝对路径 -> 任务
+};
+
+#endif // FILEHASHER_H
@@ -0,0 +1,398 @@
+#include "fileshare.h"
+#include "networkmanager.h"
+#include "filehasher.h"
+#include "foldertransfer.h"
+#include "conversation.h"
+#include "logger.h"
+#include <QFileInfo>
+#include <QDir>
+#include <QTimer>
+#include <QRandomGenerator>
+#include <algorithm>
+
+FileShare::FileShare(NetworkManager *network, const QString &username, QObject *parent)
+    : QObject(parent), network(network), fileHasher(new FileHasher(this)), username(username) {
+    nextRequestId = QRandomGenerator::global()->generate64();
+    network->setHandler(MessageType::FileRequest, [this](const Envelope &envelope) {
+        onRequest(envelope);
+    });
+    network->setHandler(MessageType::FileData, [this](const Envelope &envelope) {
+        onData(envelope);
+    });
+}
+
+FileShare::~FileShare() {
+    for (Offer &offer : offers) {
+        delete offer.file;
+    }
+}
+
+quint64 FileShare::offer(const QString &path, const QByteArray &digest) {
+    // 同一内容转发到多个会话时共用一个登记，对方已下载过的也能按摘要认出
+    if (!digest.isEmpty()) {
+        quint64 existing = offersByDigest.value(digest);
+        if (existing != 0 && fileHasher->cached(offers.value(existing).path) == digest) {
+            return existing;
+        }
+    }
+
+    quint64 offerId = newOfferId();
+    Offer entry;
+    entry.path = path;
+    offers.insert(offerId, entry);
+    if (!digest.isEmpty()) {
+        offersByDigest.insert(digest, offerId);
+    }
+    return offerId;
+}
+
+quint64 FileShare::offerFolder(const QString &root, const FolderManifest &manifest) {
+    Offer entry;
+    entry.path = root;
+    entry.folder = true;
+    entry.partStarts.append(0);
+    QDir dir(root);
+    for (const FolderEntry &item : manifest.entries) {
+        if (!item.isDirectory) {
+            entry.parts.append(dir.filePath(item.path));
+            entry.partStarts.append(entry.partStarts.last() + item.size);
+        }
+    }
+    entry.size = entry.partStarts.last();
+
+    quint64 offerId = newOfferId();
+    offers.insert(offerId, entry);
+    return offerId;
+}
+
+quint64 FileShare::newOfferId() const {
+    // 编号随机生成，别人无法猜出未发给自己的文件
+    quint64 offerId = 0;
+    while (offerId == 0 || offers.contains(offerId)) {
+        offerId = QRandomGenerator::global()->generate64();
+    }
+    return offerId;
+}
+
+quint64 FileShare::requestRange(const QString &owner, quint64 offerId, qint64 offset, quint32 length) {
+    quint64 requestId = nextRequestId++;
+    pendingRanges.insert(requestId, owner);
+
+    EnvelopeWriter request(MessageType::FileRequest, 64, Conversation::direct(owner));
+    request.string16(username);
+    request.u64(offerId);
+    request.u64(requestId);
+    request.u64(quint64(offset));
+    request.u32(length);
+    // 请求和应答都不进发件箱：超过 rangeTimeoutMs 就没人等了，补发只会占住发件箱
+    network->send(request, nullptr, NetworkManager::Delivery::Transient);
+
+    QTimer::singleShot(rangeTimeoutMs, this, [this, requestId]() {
+        if (pendingRanges.remove(requestId)) {
+            emit rangeFailed(requestId, "对方没有回应，可能已经离线");
+        }
+    });
+    return requestId;
+}
+
+FileDownload *FileShare::download(const QString &owner, quint64 offerId, qint64 size, const QString &path,
+                                  const QByteArray &digest) {
+    if (FileDownload *existing = downloads.value(offerId)) {
+        return existing;
+    }
+
+    auto *download = new FileDownload(this, owner, offerId, size, path, this);
+    downloads.insert(offerId, download);
+    connect(download, &FileDownload::progress, this, [this, offerId](qint64 contiguous, qint64 total) {
+        emit downloadProgress(offerId, contiguous, total);
+    });
+    connect(download, &FileDownload::finished, this, [this, offerId, download, digest]() {
+        if (!digest.isEmpty()) {
+            verify(download, digest);
+            return;
+        }
+        downloads.remove(offerId);
+        download->deleteLater();
+        emit downloadFinished(offerId, download->path());
+    });
+    connect(download, &FileDownload::failed, this, [this, offerId, download](const QString &reason) {
+        downloads.remove(offerId);
+        download->deleteLater();
+        emit downloadFailed(offerId, reason);
+    });
+    return download;
+}
+
+void FileShare::verify(FileDownload *download, const QByteArray &digest) {
+    // 校验期间仍算作进行中的下载，重复点开不会再下一份
+    quint64 offerId = download->offerId();
+    FileHashJob *job = fileHasher->hash(download->path());
+    connect(job, &FileHashJob::progress, this, [this, offerId](qint64 hashed, qint64 total) {
+        emit downloadVerifying(offerId, hashed, total);
+    });
+    connect(job, &FileHashJob::finished, this, [this, offerId, download, digest](const QByteArray &actual) {
+        downloads.remove(offerId);
+        download->deleteLater();
+        if (actual != digest) {
+            LOG_WARNING(Files) << "下载的文件与摘要不符:" << download->path();
+            QFile::remove(download->path());
+            emit downloadFailed(offerId, "文件校验失败，收到的内容与对方的文件不一致");
+            return;
+        }
+        completedFiles.insert(digest, download->path());
+        emit downloadFinished(offerId, download->path());
+    });
+    connect(job, &FileHashJob::failed, this, [this, offerId, download](const QString &reason) {
+        downloads.remove(offerId);
+        download->deleteLater();
+        emit downloadFailed(offerId, reason);
+    });
+}
+
+FolderDownload *FileShare::downloadFolder(const QString &owner, quint64 offerId, const FolderManifest &manifest,
+                                          const QString &path) {
+    if (FolderDownload *existing = folderDownloads.value(offerId)) {
+        return existing;
+    }
+
+    auto *download = new FolderDownload(this, owner, offerId, manifest, path, this);
+    folderDownloads.insert(offerId, download);
+    connect(download, &FolderDownload::finished, this, [this, offerId, download]() {
+        folderDownloads.remove(offerId);
+        download->deleteLater();
+    });
+    connect(download, &FolderDownload::failed, this, [this, offerId, download]() {
+        folderDownloads.remove(offerId);
+        download->deleteLater();
+    });
+    return download;
+}
+
+QString FileShare::completedFile(const QByteArray &digest) const {
+    QString path = completedFiles.value(digest);
+    // 哈希缓存按大小和修改时间判断，文件被改过或删掉就不再算数
+    return !path.isEmpty() && fileHasher->cached(path) == digest ? path : QString();
+}
+
+bool FileShare::openOffer(Offer &offer) {
+    if (offer.file) {
+        return true;
+    }
+    offer.file = new QFile(offer.path);
+    if (!offer.file->open(QIODevice::ReadOnly)) {
+        LOG_WARNING(Files) << "无法读取共享文件:" << offer.path;
+        delete offer.file;
+        offer.file = nullptr;
+        return false;
+    }
+    offer.size = offer.file->size();
+    // 映射失败（例如空文件）时退回按偏移读取
+    offer.map = offer.size > 0 ? offer.file->map(0, offer.size) : nullptr;
+    return true;
+}
+
+void FileShare::onRequest(const Envelope &envelope) {
+    PayloadReader reader(envelope.payload);
+    QString requester = reader.string16();
+    quint64 offerId = reader.u64();
+    quint64 requestId = reader.u64();
+    qint64 offset = qint64(reader.u64());
+    quint32 length = reader.u32();
+    if (!reader.ok() || requester.isEmpty() || offset < 0) {
+        LOG_WARNING(Files) << "文件请求负载不完整";
+        return;
+    }
+
+    auto it = offers.find(offerId);
+    if (it == offers.end()) {
+        reply(requester, requestId, StatusNotFound);
+        return;
+    }
+    Offer &offer = it.value();
+    if (offer.folder) {
+        offset = qMin(offset, offer.size);
+        qint64 count = qMin<qint64>(qMin(length, maxRangeBytes), offer.size - offset);
+        QByteArray data;
+        if (!readFolderRange(offer, offset, count, &data)) {
+            reply(requester, requestId, StatusReadError);
+            return;
+        }
+        reply(requester, requestId, StatusOk, offset, data);
+        return;
+    }
+    if (!openOffer(offer)) {
+        reply(requester, requestId, StatusReadError);
+        return;
+    }
+
+    offset = qMin(offset, offer.size);
+    qint64 count = qMin<qint64>(qMin(length, maxRangeBytes), offer.size - offset);
+    if (offer.map) {
+        reply(requester, requestId, StatusOk, offset,
+              QByteArrayView(reinterpret_cast<const char *>(offer.map) + offset, count));
+        return;
+    }
+
+    QByteArray data;
+    if (!offer.file->seek(offset) || (data = offer.file->read(count)).size() != count) {
+        reply(requester, requestId, StatusReadError);
+        return;
+    }
+    reply(requester, requestId, StatusOk, offset, data);
+}
+
+bool FileShare::readFolderRange(const Offer &offer, qint64 offset, qint64 count, QByteArray *out) const {
+    // 一段可能覆盖很多小文件，逐个打开读出各自的部分拼在一起
+    out->resize(count);
+    char *dest = out->data();
+    qsizetype index = (std::upper_bound(offer.partStarts.begin(), offer.partStarts.end(), offset) -
+                       offer.partStarts.begin()) - 1;
+    while (count > 0 && index < offer.parts.size()) {
+        qint64 start = offer.partStarts.at(index);
+        qint64 take = qMin(count, offer.partStarts.at(index + 1) - offset);
+        if (take > 0) {
+            QFile file(offer.parts.at(index));
+            if (!file.open(QIODevice::ReadOnly) || !file.seek(offset - start) || file.read(dest, take) != take) {
+                LOG_WARNING(Files) << "无法读取共享文件夹中的文件:" << offer.parts.at(index);
+                return false;
+            }
+            dest += take;
+            offset += take;
+            count -= take;
+        }
+        ++index;
+    }
+    return count == 0;
+}
+
+void FileShare::reply(const QString &requester, quint64 requestId, Status status, qint64 offset,
+                      QByteArrayView data) {
+    EnvelopeWriter message(MessageType::FileData, data.size() + 32, Conversation::direct(requester));
+    message.u64(requestId);
+    message.u8(status);
+    message.u64(quint64(offset));
+    message.raw(data);
+    network->send(message, nullptr, NetworkManager::Delivery::Transient);
+}
+
+void FileShare::onData(const Envelope &envelope) {
+    PayloadReader reader(envelope.payload);
+    quint64 requestId = reader.u64();
+    quint8 status = reader.u8();
+    qint64 offset = qint64(reader.u64());
+    QByteArrayView data = reader.rest();
+    if (!reader.ok() || !pendingRanges.remove(requestId)) {
+        return;
+    }
+
+    if (status != StatusOk) {
+        emit rangeFailed(requestId, status == StatusNotFound ? "对方已不再提供这个文件" : "对方读取文件失败");
+        return;
+    }
+    // 内容留在消息帧里，不再复制
+    ReceivedFile chunk;
+    chunk.storage = envelope.frame;
+    chunk.offset = data.data() - envelope.frame.constData();
+    chunk.size = data.size();
+    emit rangeReceived(requestId, offset, chunk);
+}
+
+FileDownload::FileDownload(FileShare *share, const QString &owner, quint64 offerId, qint64 size,
+                           const QString &path, QObject *parent)
+    : QObject(parent), share(share), owner(owner), id(offerId), totalBytes(size), filePath(path) {
+    connect(share, &FileShare::rangeReceived, this, &FileDownload::onRangeReceived);
+    connect(share, &FileShare::rangeFailed, this, &FileDownload::onRangeFailed);
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate) || !file.resize(size)) {
+        // 等调用方连上信号后再报告
+        QTimer::singleShot(0, this, [this]() { fail("无法写入文件：" + filePath); });
+        return;
+    }
+
+    if (totalBytes == 0) {
+        file.close();
+        QTimer::singleShot(0, this, &FileDownload::finished);
+        return;
+    }
+    QTimer::singleShot(0, this, &FileDownload::requestMore);
+}
+
+void FileDownload::requestMore() {
+    while (!failedAlready && inFlight.size() < parallelRequests && nextOffset < totalBytes) {
+        Chunk chunk;
+        chunk.offset = nextOffset;
+        chunk.length = quint32(qMin<qint64>(chunkBytes, totalBytes - nextOffset));
+        nextOffset += chunk.length;
+        request(chunk);
+    }
+}
+
+void FileDownload::request(Chunk chunk) {
+    ++chunk.attempts;
+    inFlight.insert(share->requestRange(owner, id, chunk.offset, chunk.length), chunk);
+}
+
+void FileDownload::onRangeReceived(quint64 requestId, qint64 offset, const ReceivedFile &chunk) {
+    auto it = inFlight.find(requestId);
+    if (it == inFlight.end()) {
+        return;
+    }
+    Chunk expected = it.value();
+    inFlight.erase(it);
+
+    QByteArrayView data = chunk.data();
+    if (offset != expected.offset || data.size() != expected.length) {
+        // 对方截短了区间（例如文件在发送方被改动），剩下的部分无法保证一致
+        fail("对方的文件已经改变");
+        return;
+    }
+    if (!file.seek(offset) || file.write(data.data(), data.size()) != data.size()) {
+        fail("无法写入文件：" + filePath);
+        return;
+    }
+
+    // 推进连续前缀，边下边播只能读到这里
+    completed.insert(offset, offset + data.size());
+    while (!completed.isEmpty() && completed.firstKey() == contiguous) {
+        contiguous = completed.first();
+        completed.erase(completed.begin());
+    }
+    file.flush();
+    emit progress(contiguous, totalBytes);
+
+    if (isFinished()) {
+        file.close();
+        emit finished();
+        return;
+    }
+    requestMore();
+}
+
+void FileDownload::onRangeFailed(quint64 requestId, const QString &reason) {
+    auto it = inFlight.find(requestId);
+    if (it == inFlight.end()) {
+        return;
+    }
+    Chunk chunk = it.value();
+    inFlight.erase(it);
+
+    if (chunk.attempts >= maxAttempts) {
+        fail(reason);
+        return;
+    }
+    LOG_DEBUG(Files) << "文件块请求失败，重试:" << chunk.offset << reason;
+    request(chunk);
+}
+
+void FileDownload::fail(const QString &reason) {
+    if (failedAlready) {
+        return;
+    }
+    failedAlready = true;
+    inFlight.clear();
+    file.close();
+    file.remove();
+    emit failed(reason);
+}
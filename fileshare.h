@@ -0,0 +1,175 @@
+#ifndef FILESHARE_H
+#define FILESHARE_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QFile>
+#include <QString>
+#include "messageenvelope.h"
+
+class NetworkManager;
+class FileDownload;
+class FileHasher;
+class FolderManifest;
+class FolderDownload;
+
+// 收到的文件内容。data() 指向 storage 内部，storage 可以直接是整条消息帧，
+// 这样大文件不用再从帧里复制出来。
+// offerId 非 0 表示内容在发送方，需要先拉取到 localPath
+struct ReceivedFile {
+    QByteArray storage;
+    qsizetype offset = 0;
+    qsizetype size = 0;
+    QString owner;
+    quint64 offerId = 0;
+    QString localPath;      // 拉取完成后的本地副本
+    QByteArray digest;      // 发送方给出的 BLAKE3 摘要，旧版本没有
+
+    QByteArrayView data() const { return QByteArrayView(storage).sliced(offset, size); }
+    bool isLoaded() const { return offerId == 0 || !localPath.isEmpty(); }
+};
+
+// 按需拉取的文件。发送方只广播 FileOffer（文件信息和预览），登记本地路径；
+// 接收方按字节区间请求，发送方直接从映射到内存的文件中取出回复。
+// 多个区间可以同时请求，回复按 requestId 对应，顺序不限。
+// 登记只在本次运行内有效，发送方重启后旧的文件不能再拉取。
+// FileOffer 带了摘要时，下载完成后用同一个 FileHasher 校验，校验值相同的文件只登记和下载一次。
+// 文件夹（FolderOffer）登记为各文件首尾相接的虚拟文件，区间请求照常使用，见 FolderManifest。
+//   FileRequest：string16 请求方用户名，u64 offerId，u64 requestId，u64 offset，u32 length
+//   FileData：   u64 requestId，u8 状态（0 成功，1 不存在，2 读取失败），u64 offset，区间内容
+class FileShare : public QObject {
+    Q_OBJECT
+
+public:
+    static const int rangeTimeoutMs = 30 * 1000;
+    static constexpr quint32 maxRangeBytes = 4u * 1024 * 1024;   // 单次回复的上限，更长的请求会被截短
+
+    FileShare(NetworkManager *network, const QString &username, QObject *parent = nullptr);
+    ~FileShare();
+
+    FileHasher *hasher() const { return fileHasher; }
+
+    // 登记一个可被拉取的本地文件，返回写进 FileOffer 的编号。
+    // 给了摘要且同样内容的文件已登记过时，返回原来的编号
+    quint64 offer(const QString &path, const QByteArray &digest = QByteArray());
+
+    // 请求 owner 的文件中的一段，结果通过 rangeReceived / rangeFailed 返回，返回 requestId。
+    // 例如只读视频文件头判断容器格式
+    quint64 requestRange(const QString &owner, quint64 offerId, qint64 offset, quint32 length);
+
+    // 把整个文件拉取到 path：分块并行请求，按顺序写入，前缀连续可用后即可边下边播。
+    // 同一文件重复调用返回同一个下载。digest 非空时下载完先校验，不一致则删除文件并报告失败
+    FileDownload *download(const QString &owner, quint64 offerId, qint64 size, const QString &path,
+                           const QByteArray &digest = QByteArray());
+    FileDownload *activeDownload(quint64 offerId) const { return downloads.value(offerId); }
+
+    // 登记 root 下 manifest 中的文件，按清单顺序拼成一个虚拟文件供拉取
+    quint64 offerFolder(const QString &root, const FolderManifest &manifest);
+
+    // 把整个文件夹拉取到 path（原先不存在的目录）。同一文件夹重复调用返回同一个下载
+    FolderDownload *downloadFolder(const QString &owner, quint64 offerId, const FolderManifest &manifest,
+                                   const QString &path);
+    FolderDownload *activeFolderDownload(quint64 offerId) const { return folderDownloads.value(offerId); }
+
+    // 已下载并校验过、内容为 digest 的本地文件，没有或已被改动时为空
+    QString completedFile(const QByteArray &digest) const;
+
+signals:
+    void rangeReceived(quint64 requestId, qint64 offset, const ReceivedFile &chunk);
+    void rangeFailed(quint64 requestId, const QString &reason);
+
+    // 下载进度：contiguousBytes 为从文件开头起已连续写好的字节数
+    void downloadProgress(quint64 offerId, qint64 contiguousBytes, qint64 totalBytes);
+    void downloadVerifying(quint64 offerId, qint64 hashedBytes, qint64 totalBytes);
+    void downloadFinished(quint64 offerId, const QString &path);
+    void downloadFailed(quint64 offerId, const QString &reason);
+
+private:
+    enum Status : quint8 { StatusOk = 0, StatusNotFound = 1, StatusReadError = 2 };
+
+    struct Offer {
+        QString path;
+        QFile *file = nullptr;
+        const uchar *map = nullptr;   // 第一次被请求时映射
+        qint64 size = 0;
+        // 文件夹：path 为根目录，parts 为各文件的完整路径，partStarts 为各文件在虚拟文件中的起点（末尾多一项总长）
+        bool folder = false;
+        QStringList parts;
+        QList<qint64> partStarts;
+    };
+
+    quint64 newOfferId() const;
+    void onRequest(const Envelope &envelope);
+    void onData(const Envelope &envelope);
+    void verify(FileDownload *download, const QByteArray &digest);
+    bool openOffer(Offer &offer);
+    bool readFolderRange(const Offer &offer, qint64 offset, qint64 count, QByteArray *out) const;
+    void reply(const QString &requester, quint64 requestId, Status status, qint64 offset = 0,
+               QByteArrayView data = QByteArrayView());
+
+    NetworkManager *network;
+    FileHasher *fileHasher;
+    QString username;
+    QHash<quint64, Offer> offers;                 // offerId -> 本地文件
+    QHash<quint64, QString> pendingRanges;        // requestId -> 文件所有者
+    QHash<quint64, FileDownload *> downloads;     // offerId -> 下载（含校验中的）
+    QHash<quint64, FolderDownload *> folderDownloads;
+    QHash<QByteArray, quint64> offersByDigest;    // 摘要 -> offerId
+    QHash<QByteArray, QString> completedFiles;    // 摘要 -> 已校验的本地文件
+    quint64 nextRequestId;
+};
+
+// 一个文件的分块下载。固定大小的块按顺序发出请求，同时最多 parallelRequests 个，
+// 到达后写到文件的对应位置；失败的块重试，超过次数则整个下载失败。
+class FileDownload : public QObject {
+    Q_OBJECT
+
+public:
+    static constexpr quint32 chunkBytes = 1024 * 1024;
+    static const int parallelRequests = 4;
+    static const int maxAttempts = 3;
+
+    FileDownload(FileShare *share, const QString &owner, quint64 offerId, qint64 size, const QString &path,
+                 QObject *parent = nullptr);
+
+    quint64 offerId() const { return id; }
+    QString path() const { return filePath; }
+    qint64 size() const { return totalBytes; }
+    qint64 contiguousBytes() const { return contiguous; }
+    bool isFinished() const { return contiguous == totalBytes; }
+
+signals:
+    void progress(qint64 contiguousBytes, qint64 totalBytes);
+    void finished();
+    void failed(const QString &reason);
+
+private slots:
+    void onRangeReceived(quint64 requestId, qint64 offset, const ReceivedFile &chunk);
+    void onRangeFailed(quint64 requestId, const QString &reason);
+
+private:
+    struct Chunk {
+        qint64 offset = 0;
+        quint32 length = 0;
+        int attempts = 0;
+    };
+
+    void requestMore();
+    void request(Chunk chunk);
+    void fail(const QString &reason);
+
+    FileShare *share;
+    QString owner;
+    quint64 id;
+    qint64 totalBytes;
+    QString filePath;
+    QFile file;
+    qint64 nextOffset = 0;
+    qint64 contiguous = 0;
+    QHash<quint64, Chunk> inFlight;     // requestId -> 块
+    QMap<qint64, qint64> completed;     // 连续前缀之后已写好的块：offset -> 结束位置
+    bool failedAlready = false;
+};
+
+#endif // FILESHARE_H
@@ -0,0 +1,318 @@
+#include "foldertransfer.h"
+#include "logger.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSet>
+#include <QTimer>
+#include <algorithm>
+
+FolderManifest FolderManifest::scan(const QString &root) {
+    FolderManifest manifest;
+    QDir dir(root);
+    manifest.name = dir.dirName();
+
+    const QDir::Filters filters = QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System;
+    QDirIterator it(root, filters, QDirIterator::Subdirectories);
+    qint64 bytes = 2 + qint64(manifest.name.toUtf8().size()) + 4;
+    while (it.hasNext()) {
+        it.next();
+        QFileInfo info = it.fileInfo();
+        // 符号链接可能指向文件夹外面，不发送
+        if (info.isSymLink()) {
+            continue;
+        }
+        FolderEntry entry;
+        entry.path = dir.relativeFilePath(info.filePath());
+        if (info.isDir()) {
+            // 有内容的目录随其中的文件重建，只记录空目录
+            if (!QDir(info.filePath()).isEmpty(filters)) {
+                continue;
+            }
+            entry.isDirectory = true;
+        } else if (info.isFile()) {
+            entry.size = info.size();
+        } else {
+            continue;
+        }
+        // 与 write() 的格式一致：类型 u8、路径 string16、大小 u64
+        qint64 entryBytes = 1 + 2 + entry.path.toUtf8().size() + 8;
+        if (manifest.entries.size() >= maxEntries || bytes + entryBytes > maxBytes) {
+            LOG_WARNING(Files) << "文件夹清单超出上限，其余的不发送:" << root;
+            break;
+        }
+        bytes += entryBytes;
+        manifest.entries.append(entry);
+    }
+
+    std::sort(manifest.entries.begin(), manifest.entries.end(), [](const FolderEntry &a, const FolderEntry &b) {
+        return a.path < b.path;
+    });
+    return manifest;
+}
+
+void FolderManifest::write(EnvelopeWriter &writer) const {
+    writer.string16(name);
+    writer.u32(quint32(entries.size()));
+    for (const FolderEntry &entry : entries) {
+        writer.u8(entry.isDirectory ? 1 : 0);
+        writer.string16(entry.path);
+        writer.u64(quint64(entry.size));
+    }
+}
+
+bool FolderManifest::read(PayloadReader &reader, FolderManifest *out) {
+    out->name = reader.string16();
+    quint32 count = reader.u32();
+    if (!reader.ok() || count > quint32(maxEntries)) {
+        return false;
+    }
+
+    // 大小之和要能放进 qint64，路径不能重复，否则两项会写到同一个文件
+    static constexpr quint64 maxTotalBytes = quint64(1) << 60;
+    quint64 totalBytes = 0;
+    QSet<QString> paths;
+    out->entries.clear();
+    out->entries.reserve(count);
+    for (quint32 i = 0; i < count; ++i) {
+        FolderEntry entry;
+        entry.isDirectory = reader.u8() == 1;
+        entry.path = reader.string16();
+        quint64 size = reader.u64();
+        if (!reader.ok() || !isSafeRelativePath(entry.path) || paths.contains(entry.path) ||
+            size > maxTotalBytes - totalBytes) {
+            return false;
+        }
+        entry.size = entry.isDirectory ? 0 : qint64(size);
+        totalBytes += quint64(entry.size);
+        paths.insert(entry.path);
+        out->entries.append(entry);
+    }
+    return true;
+}
+
+bool FolderManifest::isSafeRelativePath(const QString &path) {
+    // 反斜杠和冒号在 Windows 上是路径分隔符和盘符
+    if (path.isEmpty() || path.startsWith('/') || path.contains('\\') || path.contains(':')) {
+        return false;
+    }
+    for (QStringView segment : QStringView(path).split(u'/')) {
+        if (segment.isEmpty() || segment == u"." || segment == u"..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+qint64 FolderManifest::totalBytes() const {
+    qint64 total = 0;
+    for (const FolderEntry &entry : entries) {
+        total += entry.size;
+    }
+    return total;
+}
+
+int FolderManifest::fileCount() const {
+    return int(std::count_if(entries.begin(), entries.end(), [](const FolderEntry &entry) {
+        return !entry.isDirectory;
+    }));
+}
+
+FolderDownload::FolderDownload(FileShare *share, const QString &owner, quint64 offerId,
+                               const FolderManifest &manifest, const QString &path, QObject *parent)
+    : QObject(parent), share(share), owner(owner), id(offerId), rootPath(path) {
+    connect(share, &FileShare::rangeReceived, this, &FolderDownload::onRangeReceived);
+    connect(share, &FileShare::rangeFailed, this, &FolderDownload::onRangeFailed);
+
+    if (!prepare(manifest)) {
+        // 等调用方连上信号后再报告
+        QTimer::singleShot(0, this, [this]() { fail("无法在 " + rootPath + " 中创建文件"); });
+        return;
+    }
+    if (planned.isEmpty()) {
+        QTimer::singleShot(0, this, &FolderDownload::finished);
+        return;
+    }
+    QTimer::singleShot(0, this, &FolderDownload::requestMore);
+}
+
+FolderDownload::~FolderDownload() {
+    for (Part &part : parts) {
+        delete part.file;
+    }
+}
+
+bool FolderDownload::prepare(const FolderManifest &manifest) {
+    QDir root(rootPath);
+    if (!root.mkpath(".")) {
+        return false;
+    }
+
+    Range batch;
+    auto flushBatch = [this, &batch]() {
+        if (batch.length > 0) {
+            planned.append(batch);
+        }
+        batch = Range();
+    };
+
+    for (const FolderEntry &entry : manifest.entries) {
+        if (entry.isDirectory) {
+            if (!root.mkpath(entry.path)) {
+                return false;
+            }
+            continue;
+        }
+        ++fileCount;
+        QString filePath = root.filePath(entry.path);
+        if (!root.mkpath(QFileInfo(entry.path).path())) {
+            return false;
+        }
+        if (entry.size == 0) {
+            // 空文件不占虚拟流，直接建好
+            QFile file(filePath);
+            if (!file.open(QIODevice::WriteOnly)) {
+                return false;
+            }
+            ++filesDone;
+            continue;
+        }
+
+        Part part;
+        part.path = filePath;
+        part.start = total;
+        part.size = entry.size;
+        part.remaining = entry.size;
+        parts.append(part);
+
+        if (entry.size >= batchBytes) {
+            // 大文件单独分块，块边界与文件开头对齐
+            flushBatch();
+            for (qint64 offset = 0; offset < entry.size; offset += batchBytes) {
+                Range range;
+                range.offset = total + offset;
+                range.length = quint32(qMin<qint64>(batchBytes, entry.size - offset));
+                planned.append(range);
+            }
+        } else {
+            // 小文件在虚拟流中相邻，拼进同一段
+            if (batch.length > 0 && batch.length + entry.size > batchBytes) {
+                flushBatch();
+            }
+            if (batch.length == 0) {
+                batch.offset = total;
+            }
+            batch.length += quint32(entry.size);
+        }
+        total += entry.size;
+    }
+    flushBatch();
+    return true;
+}
+
+void FolderDownload::requestMore() {
+    while (!failedAlready && inFlight.size() < parallelRequests && nextRange < planned.size()) {
+        request(planned.at(nextRange++));
+    }
+}
+
+void FolderDownload::request(Range range) {
+    ++range.attempts;
+    inFlight.insert(share->requestRange(owner, id, range.offset, range.length), range);
+}
+
+void FolderDownload::onRangeReceived(quint64 requestId, qint64 offset, const ReceivedFile &chunk) {
+    auto it = inFlight.find(requestId);
+    if (it == inFlight.end()) {
+        return;
+    }
+    Range expected = it.value();
+    inFlight.erase(it);
+
+    QByteArrayView data = chunk.data();
+    if (offset != expected.offset || data.size() != expected.length) {
+        fail("对方的文件夹内容已经改变");
+        return;
+    }
+    if (!write(offset, data)) {
+        fail("无法写入文件夹：" + rootPath);
+        return;
+    }
+
+    received += data.size();
+    emit progress(received, total, filesDone, fileCount);
+    if (received == total) {
+        emit finished();
+        return;
+    }
+    requestMore();
+}
+
+bool FolderDownload::write(qint64 offset, QByteArrayView data) {
+    // 区间可能跨过多个文件，从包含 offset 的那个开始依次写
+    auto it = std::upper_bound(parts.begin(), parts.end(), offset, [](qint64 value, const Part &part) {
+        return value < part.start;
+    });
+    qsizetype index = (it - parts.begin()) - 1;
+    qint64 position = offset;
+    const char *bytes = data.data();
+    qint64 left = data.size();
+
+    while (left > 0 && index >= 0 && index < parts.size()) {
+        Part &part = parts[index];
+        qint64 take = qMin(left, part.start + part.size - position);
+        if (!part.file) {
+            part.file = new QFile(part.path);
+            if (!part.file->open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+                LOG_WARNING(Files) << "无法写入文件:" << part.path;
+                return false;
+            }
+        }
+        if (!part.file->seek(position - part.start) || part.file->write(bytes, take) != take) {
+            return false;
+        }
+        part.remaining -= take;
+        if (part.remaining == 0) {
+            part.file->close();
+            delete part.file;
+            part.file = nullptr;
+            ++filesDone;
+        }
+        position += take;
+        bytes += take;
+        left -= take;
+        ++index;
+    }
+    return left == 0;
+}
+
+void FolderDownload::onRangeFailed(quint64 requestId, const QString &reason) {
+    auto it = inFlight.find(requestId);
+    if (it == inFlight.end()) {
+        return;
+    }
+    Range range = it.value();
+    inFlight.erase(it);
+
+    if (range.attempts >= maxAttempts) {
+        fail(reason);
+        return;
+    }
+    LOG_DEBUG(Files) << "文件夹区间请求失败，重试:" << range.offset << reason;
+    request(range);
+}
+
+void FolderDownload::fail(const QString &reason) {
+    if (failedAlready) {
+        return;
+    }
+    failedAlready = true;
+    inFlight.clear();
+    for (Part &part : parts) {
+        delete part.file;
+        part.file = nullptr;
+    }
+    // 目录是为这次下载新建的，整个删掉
+    QDir(rootPath).removeRecursively();
+    emit failed(reason);
+}
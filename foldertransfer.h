@@ -0,0 +1,110 @@
+#ifndef FOLDERTRANSFER_H
+#define FOLDERTRANSFER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QFile>
+#include <QString>
+#include "fileshare.h"
+
+// 文件夹中的一项。路径相对于文件夹，用 '/' 分隔；目录项只用于重建空目录
+struct FolderEntry {
+    QString path;
+    qint64 size = 0;
+    bool isDirectory = false;
+};
+
+// 文件夹清单。发送方把清单中的文件按顺序首尾相接，当成一个虚拟文件登记到 FileShare，
+// 接收方照常按字节区间拉取，再按清单把区间切回各个文件。
+//   FolderOffer：string16 发送者，string16 文件夹名，u64 offerId，u32 项数，
+//                每项 u8 类别（0 文件，1 空目录），string16 相对路径，u64 大小
+class FolderManifest {
+public:
+    static const int maxEntries = 200000;
+    static const int maxBytes = 12 * 1024 * 1024;   // 序列化后的大小上限，须小于 MessageEnvelope::maxPayloadSize
+
+    QString name;
+    QList<FolderEntry> entries;
+
+    // 遍历 root（不跟随符号链接），文件按路径排序，同一目录下的小文件在虚拟流中相邻。
+    // 会读很多目录，放在后台线程调用
+    static FolderManifest scan(const QString &root);
+
+    void write(EnvelopeWriter &writer) const;
+    // 读取并检查路径：对方给的路径不能是绝对路径，也不能用 ".." 跳出目标目录
+    static bool read(PayloadReader &reader, FolderManifest *out);
+    static bool isSafeRelativePath(const QString &path);
+
+    qint64 totalBytes() const;
+    int fileCount() const;
+};
+
+// 整个文件夹的下载。请求事先规划好：连续的小文件拼成一段（不超过 batchBytes）一次取回，
+// 大文件单独按 batchBytes 分块；同时保持 parallelRequests 个请求在路上，
+// 不会每个文件等一次往返。到达的区间按清单写进各个文件，进度按总字节数统计。
+class FolderDownload : public QObject {
+    Q_OBJECT
+
+public:
+    static constexpr quint32 batchBytes = FileDownload::chunkBytes;
+    static const int parallelRequests = 8;
+    static const int maxAttempts = FileDownload::maxAttempts;
+
+    // path 为重建出的文件夹根目录，调用方保证它原先不存在；失败时整个删除
+    FolderDownload(FileShare *share, const QString &owner, quint64 offerId, const FolderManifest &manifest,
+                   const QString &path, QObject *parent = nullptr);
+    ~FolderDownload();
+
+    quint64 offerId() const { return id; }
+    QString path() const { return rootPath; }
+    qint64 receivedBytes() const { return received; }
+    qint64 totalBytes() const { return total; }
+
+signals:
+    void progress(qint64 receivedBytes, qint64 totalBytes, int filesDone, int fileCount);
+    void finished();
+    void failed(const QString &reason);
+
+private slots:
+    void onRangeReceived(quint64 requestId, qint64 offset, const ReceivedFile &chunk);
+    void onRangeFailed(quint64 requestId, const QString &reason);
+
+private:
+    struct Range {
+        qint64 offset = 0;
+        quint32 length = 0;
+        int attempts = 0;
+    };
+
+    // 有内容的文件，在虚拟流中占 [start, start + size)
+    struct Part {
+        QString path;
+        qint64 start = 0;
+        qint64 size = 0;
+        qint64 remaining = 0;
+        QFile *file = nullptr;   // 第一次写入时打开，写满后关闭
+    };
+
+    bool prepare(const FolderManifest &manifest);
+    void requestMore();
+    void request(Range range);
+    bool write(qint64 offset, QByteArrayView data);
+    void fail(const QString &reason);
+
+    FileShare *share;
+    QString owner;
+    quint64 id;
+    QString rootPath;
+    QList<Part> parts;
+    QList<Range> planned;
+    int nextRange = 0;
+    QHash<quint64, Range> inFlight;   // requestId -> 区间
+    qint64 received = 0;
+    qint64 total = 0;
+    int filesDone = 0;
+    int fileCount = 0;
+    bool failedAlready = false;
+};
+
+#endif // FOLDERTRANSFER_H
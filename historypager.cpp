@@ -0,0 +1,327 @@
+#include "historypager.h"
+#include "conversation.h"
+#include "metrics.h"
+#include <QScrollBar>
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QDateTime>
+#include <QTimer>
+#include <QtConcurrent>
+#include <algorithm>
+
+HistoryPager::HistoryPager(QTextEdit *view, ChatHistory *history, QObject *parent)
+    : QObject(parent), view(view), history(history) {
+    watcher = new QFutureWatcher<LoadedPage>(this);
+    connect(watcher, &QFutureWatcher<LoadedPage>::finished, this, &HistoryPager::onPageLoaded);
+    connect(view->verticalScrollBar(), &QScrollBar::valueChanged, this, &HistoryPager::onScrolled);
+}
+
+HistoryPager::~HistoryPager() {
+    // 后台读取还在使用 ChatHistory，等它结束再让调用方释放存储
+    watcher->waitForFinished();
+}
+
+quint32 HistoryPager::windowFirst() const {
+    return pages.isEmpty() ? history->count() : pages.first().first;
+}
+
+quint32 HistoryPager::windowEnd() const {
+    return pages.isEmpty() ? history->count() : pages.last().first + pages.last().count;
+}
+
+bool HistoryPager::isFollowing() const {
+    return windowEnd() == history->count();
+}
+
+bool HistoryPager::isAtBottom() const {
+    QScrollBar *bar = view->verticalScrollBar();
+    return bar->value() >= bar->maximum() - edgeThreshold;
+}
+
+QString HistoryPager::conversationHtml(const QString &conversation) {
+    if (Conversation::isLobby(conversation)) {
+        return QString();
+    }
+    return QString("<div style='margin-top: 8px; color: #7e57c2; font-size: 11px; font-weight: bold;'>%1</div>")
+        .arg(Conversation::displayName(conversation).toHtmlEscaped());
+}
+
+QString HistoryPager::recordHtml(const ChatRecord &record) {
+    // 只做字符串拼接，可以在后台线程调用
+    QString time = QDateTime::fromMSecsSinceEpoch(record.timestamp).toString("MM-dd hh:mm:ss");
+    return conversationHtml(record.conversation) +
+           QString("<div style='margin: 8px 0;'>"
+                   "<span style='color: %1; font-weight: bold; font-size: 14px;'>%2</span>"
+                   "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%3</span>"
+                   "</div>"
+                   "<div style='background-color: %4; padding: 10px 12px; "
+                   "font-size: 14px; color: #333;'>%5</div>")
+        .arg(record.outgoing ? "#2196F3" : "#4CAF50")
+        .arg(record.sender.toHtmlEscaped())
+        .arg(time)
+        .arg(record.outgoing ? "#e3f2fd" : "#f1f8e9")
+        .arg(record.text.toHtmlEscaped().replace("\n", "<br>"));
+}
+
+QString HistoryPager::pageHtml(QList<ChatRecord> records) {
+    // 页内按因果顺序显示；编号是到达顺序，相差不大，稳定排序即可
+    std::stable_sort(records.begin(), records.end(), [](const ChatRecord &a, const ChatRecord &b) {
+        return a.clock < b.clock;
+    });
+    QString html;
+    for (const ChatRecord &record : records) {
+        html += recordHtml(record);
+    }
+    return html;
+}
+
+void HistoryPager::setMemoryBudget(qint64 bytes) {
+    memoryBudget = bytes;
+    reportMemory();
+}
+
+qint64 HistoryPager::memoryUsage() const {
+    return view->document()->characterCount() * qint64(sizeof(QChar)) + embeddedBytes;
+}
+
+void HistoryPager::reportMemory() {
+    CacheMetrics &metrics = Metrics::process().chatView;
+    metrics.bytes.set(memoryUsage());
+    metrics.entries.set(view->document()->blockCount());
+    metrics.budget.set(memoryBudget);
+}
+
+void HistoryPager::loadLatest() {
+    view->clear();
+    pages.clear();
+    liveTail.clear();
+    embeddedBytes = 0;
+
+    quint32 total = history->count();
+    Page page;
+    page.first = total > quint32(pageSize) ? total - pageSize : 0;
+
+    // 首屏只同步读取最近一页，更早的记录滚动时再取
+    const QList<ChatRecord> records = history->records(page.first, pageSize);
+    QString html = pageHtml(records);
+    page.count = records.size();
+    page.blocks = html.isEmpty() ? 0 : insertHtml(html);
+    pages.append(page);
+
+    view->moveCursor(QTextCursor::End);
+    view->verticalScrollBar()->setValue(view->verticalScrollBar()->maximum());
+    reportMemory();
+
+    // 第一页可能填不满视口，此时滚动条不会动，主动检查一次
+    QTimer::singleShot(0, this, [this]() {
+        onScrolled(view->verticalScrollBar()->value());
+    });
+}
+
+bool HistoryPager::appendLive(quint32 id, quint64 clock, const QString &html) {
+    if (pages.isEmpty() || id != windowEnd()) {
+        emit newMessagesHidden();
+        return false;
+    }
+
+    bool stickToBottom = isAtBottom();
+
+    if (pages.last().count >= pageSize) {
+        Page page;
+        page.first = id;
+        pages.append(page);
+        liveTail.clear();
+    }
+
+    // 从末尾往前找第一条不晚于它的消息，插在其后
+    int position = liveTail.size();
+    int blocksAfter = 0;
+    while (position > 0 && liveTail[position - 1].clock > clock) {
+        --position;
+        blocksAfter += liveTail[position].blocks;
+    }
+    int beforeBlock = blocksAfter > 0 ? view->document()->blockCount() - blocksAfter : -1;
+
+    LiveEntry entry;
+    entry.clock = clock;
+    entry.blocks = insertHtml(html, beforeBlock);
+    liveTail.insert(position, entry);
+    pages.last().blocks += entry.blocks;
+    pages.last().count += 1;
+
+    if (pages.size() > maxPages) {
+        evictPage(true);
+    }
+
+    // 超出预算时重建文档释放内嵌图片。只在停在底部时做，不打断正在往上翻看的用户
+    if (memoryBudget > 0 && stickToBottom && memoryUsage() > memoryBudget) {
+        Metrics::process().chatView.spills.add();
+        loadLatest();
+        return true;
+    }
+    reportMemory();
+
+    // 用户正在往上翻看时不强制跳到底部
+    if (stickToBottom) {
+        view->moveCursor(QTextCursor::End);
+        view->verticalScrollBar()->setValue(view->verticalScrollBar()->maximum());
+    }
+    return true;
+}
+
+void HistoryPager::appendHtml(const QString &html) {
+    if (pages.isEmpty()) {
+        Page page;
+        page.first = history->count();
+        pages.append(page);
+    }
+    pages.last().blocks += insertHtml(html);
+    liveTail.clear();
+}
+
+int HistoryPager::insertHtml(const QString &html, int beforeBlock) {
+    QTextDocument *document = view->document();
+    int before = document->isEmpty() ? 0 : document->blockCount();
+
+    if (html.contains(QLatin1String("data:image"))) {
+        embeddedBytes += html.size() * qint64(sizeof(QChar));
+    }
+
+    QTextCursor cursor(document);
+    if (document->isEmpty()) {
+        cursor.insertHtml(html);
+    } else if (beforeBlock >= 0) {
+        // 先在插入点插入一个空段落，再把新内容填进去，避免和原来的段落合并
+        int position = document->findBlockByNumber(beforeBlock).position();
+        cursor.setPosition(position);
+        cursor.insertBlock();
+        cursor.setPosition(position);
+        cursor.insertHtml(html);
+    } else {
+        cursor.movePosition(QTextCursor::End);
+        cursor.insertBlock();
+        cursor.insertHtml(html);
+    }
+
+    return document->blockCount() - before;
+}
+
+void HistoryPager::evictPage(bool fromTop) {
+    if (pages.size() <= 1) {
+        return;
+    }
+
+    QTextDocument *document = view->document();
+    QScrollBar *bar = view->verticalScrollBar();
+    QTextCursor cursor(document);
+
+    if (fromTop) {
+        Page page = pages.takeFirst();
+        int oldMax = bar->maximum();
+        int oldValue = bar->value();
+
+        QTextBlock boundary = document->findBlockByNumber(page.blocks);
+        cursor.setPosition(0);
+        cursor.setPosition(boundary.isValid() ? boundary.position() : document->characterCount() - 1,
+                           QTextCursor::KeepAnchor);
+        cursor.removeSelectedText();
+
+        // 顶部内容变少，视口内容上移同样的距离
+        bar->setValue(oldValue - (oldMax - bar->maximum()));
+    } else {
+        Page page = pages.takeLast();
+        liveTail.clear();
+        QTextBlock boundary = document->findBlockByNumber(document->blockCount() - page.blocks);
+        if (!boundary.isValid()) {
+            return;
+        }
+        // 连同前面的段落分隔符一起删除
+        cursor.setPosition(qMax(0, boundary.position() - 1));
+        cursor.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
+        cursor.removeSelectedText();
+    }
+}
+
+void HistoryPager::onScrolled(int value) {
+    if (loading || pages.isEmpty()) {
+        return;
+    }
+
+    QScrollBar *bar = view->verticalScrollBar();
+    if (value <= edgeThreshold && windowFirst() > 0) {
+        requestPage(true);
+    } else if (value >= bar->maximum() - edgeThreshold && !isFollowing()) {
+        requestPage(false);
+    }
+}
+
+void HistoryPager::requestPage(bool older) {
+    quint32 first;
+    int count = pageSize;
+    if (older) {
+        quint32 end = windowFirst();
+        first = end > quint32(pageSize) ? end - pageSize : 0;
+        count = int(end - first);
+    } else {
+        first = windowEnd();
+    }
+
+    loading = true;
+    ChatHistory *store = history;
+    watcher->setFuture(QtConcurrent::run([store, first, count, older]() {
+        LoadedPage page;
+        page.first = first;
+        page.older = older;
+        const QList<ChatRecord> records = store->records(first, count);
+        page.count = records.size();
+        page.html = pageHtml(records);
+        return page;
+    }));
+}
+
+void HistoryPager::onPageLoaded() {
+    loading = false;
+    LoadedPage loaded = watcher->result();
+
+    // 加载期间窗口可能已经变化（例如新消息追加），不再相邻的结果直接丢弃
+    bool adjacent = loaded.older ? loaded.first + loaded.count == windowFirst()
+                                 : loaded.first == windowEnd();
+    if (!adjacent || loaded.count == 0) {
+        return;
+    }
+
+    QScrollBar *bar = view->verticalScrollBar();
+    Page page;
+    page.first = loaded.first;
+    page.count = loaded.count;
+
+    if (loaded.older) {
+        int oldMax = bar->maximum();
+        int oldValue = bar->value();
+        page.blocks = insertHtml(loaded.html, 0);
+        pages.prepend(page);
+
+        // 顶部插入内容后保持视口停在原来那条消息上
+        bar->setValue(oldValue + (bar->maximum() - oldMax));
+
+        if (pages.size() > maxPages) {
+            evictPage(false);
+        }
+    } else {
+        page.blocks = insertHtml(loaded.html);
+        pages.append(page);
+        liveTail.clear();
+
+        if (pages.size() > maxPages) {
+            evictPage(true);
+        }
+    }
+
+    reportMemory();
+
+    // 用户可能仍停在边缘，继续检查是否需要下一页
+    QTimer::singleShot(0, this, [this]() {
+        onScrolled(view->verticalScrollBar()->value());
+    });
+}
@@ -0,0 +1,95 @@
+#ifndef HISTORYPAGER_H
+#define HISTORYPAGER_H
+
+#include <QObject>
+#include <QTextEdit>
+#include <QFutureWatcher>
+#include <QList>
+#include "chathistory.h"
+
+// 聊天视图的分页加载器。
+// 视图只保存历史中连续的一段记录（若干页）：打开时显示最近一页，
+// 滚动到顶部/底部附近时在后台线程读取相邻一页并插入，
+// 插入顶部时补偿滚动条位置，页数超过上限时淘汰离视口最远的一页。
+// 实时消息里的头像和缩略图以 data: URL 内嵌，文档会缓存解码结果，删掉段落也不释放，
+// 因此占用按文档中的文字加上清空以来插入过的带图片 HTML 估算；
+// 超出预算且停在底部时清空视图，从历史重新加载最近一页（历史记录只有文字）。
+class HistoryPager : public QObject {
+    Q_OBJECT
+
+public:
+    HistoryPager(QTextEdit *view, ChatHistory *history, QObject *parent = nullptr);
+    ~HistoryPager();
+
+    void loadLatest();
+
+    // 视图是否已包含最新记录（新消息可以直接追加）
+    bool isFollowing() const;
+
+    // 记录写入历史后调用；视图不在末尾时不渲染，返回 false。
+    // 乱序到达、clock 比最近几条更早的消息插到它们之间的对应位置
+    bool appendLive(quint32 id, quint64 clock, const QString &html);
+
+    // 追加不对应历史记录的内容（欢迎语等）
+    void appendHtml(const QString &html);
+
+    // 小于等于 0 表示不限
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryUsage() const;
+
+    static QString recordHtml(const ChatRecord &record);
+
+    // 非大厅消息前面的会话标签
+    static QString conversationHtml(const QString &conversation);
+
+signals:
+    void newMessagesHidden();
+
+private slots:
+    void onScrolled(int value);
+    void onPageLoaded();
+
+private:
+    struct Page {
+        quint32 first = 0;
+        int count = 0;
+        int blocks = 0;    // 该页在文档中占用的段落数
+    };
+
+    // 最后一页中实时追加的消息，用于乱序插入时定位
+    struct LiveEntry {
+        quint64 clock = 0;
+        int blocks = 0;
+    };
+
+    struct LoadedPage {
+        quint32 first = 0;
+        int count = 0;
+        QString html;
+        bool older = false;
+    };
+
+    quint32 windowFirst() const;
+    quint32 windowEnd() const;
+    void requestPage(bool older);
+    static QString pageHtml(QList<ChatRecord> records);
+    int insertHtml(const QString &html, int beforeBlock = -1);
+    void evictPage(bool fromTop);
+    void reportMemory();
+    bool isAtBottom() const;
+
+    QTextEdit *view;
+    ChatHistory *history;
+    QList<Page> pages;
+    QList<LiveEntry> liveTail;
+    QFutureWatcher<LoadedPage> *watcher;
+    bool loading = false;
+    qint64 embeddedBytes = 0;      // 上次清空以来插入的、带内嵌图片的 HTML（UTF-16）
+    qint64 memoryBudget = 0;
+
+    static const int pageSize = 50;
+    static const int maxPages = 8;
+    static const int edgeThreshold = 80;   // 距顶部/底部多少像素时预取
+};
+
+#endif // HISTORYPAGER_H
@@ -0,0 +1,405 @@
+#include "historysync.h"
+#include "networkmanager.h"
+#include "conversation.h"
+#include "hybridclock.h"
+#include "logger.h"
+#include <QTimer>
+#include <QtConcurrent>
+#include <limits>
+
+namespace {
+
+const qint64 bucketMs = 60 * 60 * 1000;
+const quint32 fullRangeEnd = std::numeric_limits<quint32>::max();
+const int splitFanout = 16;
+const int loadChunk = 1000;
+
+quint32 bucketOf(quint64 clock) {
+    return quint32(qMax<qint64>(0, HybridClock::physicalMs(clock)) / bucketMs);
+}
+
+quint64 mix64(quint64 x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+}
+
+HistorySync::HistorySync(ChatHistory *history, NetworkManager *network, const QString &username, QObject *parent)
+    : QObject(parent), history(history), network(network), username(username) {
+    network->setHandler(MessageType::Sync, [this](const Envelope &envelope) {
+        onSyncEnvelope(envelope);
+    });
+
+    joinTimer = new QTimer(this);
+    joinTimer->setSingleShot(true);
+    connect(joinTimer, &QTimer::timeout, this, &HistorySync::onJoinTimeout);
+
+    // 现有历史在后台建索引，之后写入的记录先缓存，加载完再补上
+    loader = new QFutureWatcher<Index>(this);
+    connect(loader, &QFutureWatcher<Index>::finished, this, &HistorySync::onIndexLoaded);
+    ChatHistory *store = history;
+    quint32 count = history->count();
+    loader->setFuture(QtConcurrent::run([store, count]() {
+        Index loaded;
+        for (quint32 first = 0; first < count; first += loadChunk) {
+            const QList<ChatRecord> records = store->records(first, loadChunk);
+            for (int i = 0; i < records.size(); ++i) {
+                if (isSynced(records[i])) {
+                    insert(&loaded, first + quint32(i), records[i]);
+                }
+            }
+        }
+        return loaded;
+    }));
+}
+
+HistorySync::~HistorySync() {
+    // 后台加载还在读 ChatHistory
+    loader->waitForFinished();
+}
+
+bool HistorySync::isSynced(const ChatRecord &record) {
+    return record.senderId != 0 && !Conversation::isDirect(record.conversation);
+}
+
+quint64 HistorySync::itemHash(const Key &key) {
+    return mix64(key.first ^ mix64(key.second));
+}
+
+void HistorySync::insert(Index *index, quint32 id, const ChatRecord &record) {
+    Key key(record.senderId, record.messageId);
+    Bucket &bucket = (*index)[record.conversation][bucketOf(record.clock)];
+    bucket.items.append(Item{key, id});
+    bucket.digest ^= itemHash(key);
+}
+
+void HistorySync::addRecord(quint32 id, const ChatRecord &record) {
+    if (!isSynced(record)) {
+        return;
+    }
+    if (!ready) {
+        appendedWhileLoading.append({id, record});
+        return;
+    }
+    Key key(record.senderId, record.messageId);
+    if (known.contains(key)) {
+        return;
+    }
+    known.insert(key, id);
+    insert(&index, id, record);
+}
+
+void HistorySync::onIndexLoaded() {
+    index = loader->result();
+    for (auto conversation = index.constBegin(); conversation != index.constEnd(); ++conversation) {
+        for (const Bucket &bucket : conversation.value()) {
+            for (const Item &item : bucket.items) {
+                known.insert(item.key, item.recordId);
+            }
+        }
+    }
+    ready = true;
+
+    for (const auto &[id, record] : std::as_const(appendedWhileLoading)) {
+        addRecord(id, record);
+    }
+    appendedWhileLoading.clear();
+    LOG_DEBUG(Sync) << "历史同步索引加载完成:" << known.size() << "条消息";
+
+    startNextJoin();
+}
+
+void HistorySync::peerAppeared(const QString &peer) {
+    if (peer == username || joinCandidates.contains(peer) || pendingPeers.contains(peer)) {
+        return;
+    }
+    joinCandidates.append(peer);
+    startNextJoin();
+}
+
+void HistorySync::startNextJoin() {
+    if (!ready) {
+        return;
+    }
+    while (respondedPeers + pendingPeers.size() < maxJoinSyncPeers && !joinCandidates.isEmpty()) {
+        QString peer = joinCandidates.takeFirst();
+        pendingPeers.insert(peer);
+        startSync(peer);
+        joinTimer->start(joinResponseTimeoutMs);
+    }
+}
+
+void HistorySync::onJoinTimeout() {
+    // 没回应的节点可能是旧版客户端，或者历史和我们完全一致；换下一个
+    pendingPeers.clear();
+    startNextJoin();
+}
+
+void HistorySync::startSync(const QString &peer) {
+    LOG_DEBUG(Sync) << "向" << peer << "发起历史同步";
+    QStringList conversations{QString()};
+    for (const QString &room : network->rooms()) {
+        conversations.append(Conversation::room(room));
+    }
+    for (const QString &conversation : std::as_const(conversations)) {
+        sendSummary(peer, conversation, {{0, fullRangeEnd}});
+    }
+}
+
+bool HistorySync::sharesConversation(const QString &conversation) const {
+    if (Conversation::isLobby(conversation)) {
+        return true;
+    }
+    return Conversation::isRoom(conversation) && network->rooms().contains(Conversation::target(conversation));
+}
+
+HistorySync::Fingerprint HistorySync::fingerprint(const QString &conversation, quint32 lo, quint32 hi) const {
+    Fingerprint result;
+    auto buckets = index.constFind(conversation);
+    if (buckets == index.constEnd()) {
+        return result;
+    }
+    for (auto it = buckets->lowerBound(lo); it != buckets->constEnd() && it.key() < hi; ++it) {
+        result.count += quint32(it->items.size());
+        result.digest ^= it->digest;
+    }
+    return result;
+}
+
+QList<HistorySync::Item> HistorySync::items(const QString &conversation, quint32 lo, quint32 hi) const {
+    QList<Item> result;
+    auto buckets = index.constFind(conversation);
+    if (buckets == index.constEnd()) {
+        return result;
+    }
+    for (auto it = buckets->lowerBound(lo); it != buckets->constEnd() && it.key() < hi; ++it) {
+        result.append(it->items);
+    }
+    return result;
+}
+
+EnvelopeWriter HistorySync::writer(const QString &peer, Op op, const QString &conversation, qsizetype hint) const {
+    // 同步消息按私聊路由，只发给对方；负载里带上自己的用户名，对方据此回复
+    EnvelopeWriter message(MessageType::Sync, hint + 64, Conversation::direct(peer));
+    message.string16(username);
+    message.u8(quint8(op));
+    message.string16(conversation);
+    return message;
+}
+
+void HistorySync::sendSummary(const QString &peer, const QString &conversation,
+                              const QList<std::pair<quint32, quint32>> &ranges) {
+    EnvelopeWriter message = writer(peer, Op::Summary, conversation, ranges.size() * 20);
+    message.u32(quint32(ranges.size()));
+    for (const auto &[lo, hi] : ranges) {
+        Fingerprint mine = fingerprint(conversation, lo, hi);
+        message.u32(lo);
+        message.u32(hi);
+        message.u32(mine.count);
+        message.u64(mine.digest);
+    }
+    network->send(message);
+}
+
+void HistorySync::sendKeys(const QString &peer, const QString &conversation, quint32 lo, quint32 hi) {
+    const QList<Item> mine = items(conversation, lo, hi);
+    EnvelopeWriter message = writer(peer, Op::Keys, conversation, 12 + mine.size() * 16);
+    message.u32(lo);
+    message.u32(hi);
+    message.u32(quint32(mine.size()));
+    for (const Item &item : mine) {
+        message.u64(item.key.first);
+        message.u64(item.key.second);
+    }
+    network->send(message);
+}
+
+void HistorySync::sendMessages(const QString &peer, const QString &conversation, const QList<Key> &keys) {
+    // 按历史记录重建原来的文本消息帧：标识和时间戳不变，接收方照常去重；头像不重发
+    QList<QByteArray> frames;
+    qsizetype bytes = 0;
+    auto flush = [&]() {
+        if (frames.isEmpty()) {
+            return;
+        }
+        EnvelopeWriter message = writer(peer, Op::Messages, conversation, bytes + frames.size() * 4);
+        message.u32(quint32(frames.size()));
+        for (const QByteArray &frame : std::as_const(frames)) {
+            message.bytes32(frame);
+        }
+        network->send(message);
+        frames.clear();
+        bytes = 0;
+    };
+
+    for (const Key &key : keys) {
+        auto it = known.constFind(key);
+        ChatRecord record;
+        if (it == known.constEnd() || !history->record(it.value(), &record) || record.conversation != conversation) {
+            continue;
+        }
+        EnvelopeWriter text(MessageType::Text, record.text.size() * 3 + 64, record.conversation);
+        text.string16(record.sender);
+        text.string32(record.text);
+        text.bytes32(QByteArrayView());
+        frames.append(text.finish(record.messageId, record.senderId, qint64(record.clock)));
+        bytes += frames.last().size();
+        if (bytes >= maxMessagesBytes) {
+            flush();
+        }
+    }
+    flush();
+}
+
+void HistorySync::onSyncEnvelope(const Envelope &envelope) {
+    PayloadReader reader(envelope.payload);
+    QString peer = reader.string16();
+    Op op = Op(reader.u8());
+    QString conversation = reader.string16();
+    if (!reader.ok() || peer.isEmpty() || !ready) {
+        return;
+    }
+    if (pendingPeers.remove(peer)) {
+        ++respondedPeers;
+    }
+    if (!sharesConversation(conversation)) {
+        LOG_DEBUG(Sync) << "忽略未加入会话的历史同步:" << Conversation::displayName(conversation);
+        return;
+    }
+
+    switch (op) {
+    case Op::Summary:
+        handleSummary(peer, conversation, reader);
+        break;
+    case Op::Keys:
+        handleKeys(peer, conversation, reader);
+        break;
+    case Op::Want:
+        handleWant(peer, conversation, reader);
+        break;
+    case Op::Messages:
+        handleMessages(reader);
+        break;
+    default:
+        LOG_DEBUG(Sync) << "忽略未知的历史同步操作:" << int(op);
+        break;
+    }
+}
+
+void HistorySync::handleSummary(const QString &peer, const QString &conversation, PayloadReader &reader) {
+    QList<std::pair<quint32, quint32>> split;
+    quint32 count = reader.u32();
+    for (quint32 i = 0; i < count && reader.ok(); ++i) {
+        quint32 lo = reader.u32();
+        quint32 hi = reader.u32();
+        Fingerprint theirs;
+        theirs.count = reader.u32();
+        theirs.digest = reader.u64();
+        if (!reader.ok() || lo >= hi) {
+            break;
+        }
+
+        Fingerprint mine = fingerprint(conversation, lo, hi);
+        if (mine == theirs) {
+            continue;
+        }
+        if (mine.count <= quint32(maxKeysPerRange) || hi - lo == 1) {
+            sendKeys(peer, conversation, lo, hi);
+            continue;
+        }
+
+        // 区间内两边都有不少消息，切成小段交给对方继续比较
+        quint32 step = qMax<quint32>(1, (hi - lo + splitFanout - 1) / splitFanout);
+        for (quint32 start = lo; start < hi; start += qMin(step, hi - start)) {
+            split.append({start, start + qMin(step, hi - start)});
+        }
+    }
+    if (!split.isEmpty()) {
+        sendSummary(peer, conversation, split);
+    }
+}
+
+void HistorySync::handleKeys(const QString &peer, const QString &conversation, PayloadReader &reader) {
+    quint32 lo = reader.u32();
+    quint32 hi = reader.u32();
+    quint32 count = reader.u32();
+    QSet<Key> theirs;
+    QList<Key> wanted;
+    for (quint32 i = 0; i < count && reader.ok(); ++i) {
+        Key key;
+        key.first = reader.u64();
+        key.second = reader.u64();
+        if (!reader.ok()) {
+            break;
+        }
+        theirs.insert(key);
+        if (!known.contains(key)) {
+            wanted.append(key);
+        }
+    }
+    if (!reader.ok()) {
+        return;
+    }
+
+    QList<Key> missing;
+    for (const Item &item : items(conversation, lo, hi)) {
+        if (!theirs.contains(item.key)) {
+            missing.append(item.key);
+        }
+    }
+    if (!missing.isEmpty()) {
+        LOG_DEBUG(Sync) << "向" << peer << "补发" << missing.size() << "条历史消息";
+        sendMessages(peer, conversation, missing);
+    }
+
+    if (!wanted.isEmpty()) {
+        EnvelopeWriter message = writer(peer, Op::Want, conversation, 4 + wanted.size() * 16);
+        message.u32(quint32(wanted.size()));
+        for (const Key &key : std::as_const(wanted)) {
+            message.u64(key.first);
+            message.u64(key.second);
+        }
+        network->send(message);
+    }
+}
+
+void HistorySync::handleWant(const QString &peer, const QString &conversation, PayloadReader &reader) {
+    QList<Key> keys;
+    quint32 count = reader.u32();
+    for (quint32 i = 0; i < count && reader.ok(); ++i) {
+        Key key;
+        key.first = reader.u64();
+        key.second = reader.u64();
+        if (reader.ok()) {
+            keys.append(key);
+        }
+    }
+    sendMessages(peer, conversation, keys);
+}
+
+void HistorySync::handleMessages(PayloadReader &reader) {
+    quint32 count = reader.u32();
+    int delivered = 0;
+    for (quint32 i = 0; i < count && reader.ok(); ++i) {
+        QByteArrayView data = reader.bytes32();
+        if (!reader.ok()) {
+            break;
+        }
+
+        // 只接受文本消息，已有的跳过；其余交给正常的接收流程
+        QByteArray frame = data.toByteArray();
+        Envelope envelope;
+        if (!MessageEnvelope::parse(frame, &envelope) || envelope.type != MessageType::Text ||
+            known.contains(Key(envelope.senderId, envelope.messageId))) {
+            continue;
+        }
+        network->deliverFrame(frame);
+        ++delivered;
+    }
+    LOG_DEBUG(Sync) << "历史同步收到" << delivered << "条消息";
+}
@@ -0,0 +1,115 @@
+#ifndef HISTORYSYNC_H
+#define HISTORYSYNC_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QList>
+#include <QStringList>
+#include <QFutureWatcher>
+#include <utility>
+#include "chathistory.h"
+#include "messageenvelope.h"
+
+class NetworkManager;
+class QTimer;
+
+// 晚加入节点的历史补齐（基于范围比对的集合同步）。
+// 每个会话的消息按 HLC 物理时间分到小时桶里，每个桶保存条数和消息标识哈希的异或，
+// 任意桶区间的指纹可以直接合并出来，相当于一棵按时间划分的 16 叉 Merkle 树：
+//   1. 发起方发送整个时间轴的指纹；
+//   2. 对方指纹相同则结束；不同且区间内消息不多时回复完整的标识列表，
+//      否则把区间切成 16 段，回复每一段自己的指纹，由发起方继续比较；
+//   3. 收到标识列表的一方推送对方缺少的消息，并请求自己缺少的。
+// 往返次数随时间轴深度对数增长，传输量只和两边的差异有关。
+// 只同步大厅和双方都加入的房间里的文本消息；私聊和文件不参与。
+class HistorySync : public QObject {
+    Q_OBJECT
+
+public:
+    static const int maxJoinSyncPeers = 2;               // 启动后向几个节点补齐历史
+    static const int joinResponseTimeoutMs = 10 * 1000;  // 对方不回应（例如旧版客户端）就换一个
+    static const int maxKeysPerRange = 32;               // 区间内不超过这么多条时直接交换标识
+    static const int maxMessagesBytes = 256 * 1024;      // 单个同步消息里补发消息的大致上限
+
+    HistorySync(ChatHistory *history, NetworkManager *network, const QString &username, QObject *parent = nullptr);
+    ~HistorySync();
+
+    // 新写入历史的记录，与 SearchIndex::addDocument 同步调用
+    void addRecord(quint32 id, const ChatRecord &record);
+
+    // 发现新节点：启动后的前几个节点用来补齐历史
+    void peerAppeared(const QString &username);
+
+private slots:
+    void onIndexLoaded();
+    void onJoinTimeout();
+
+private:
+    enum class Op : quint8 {
+        Summary = 1,    // 若干区间的指纹
+        Keys = 2,       // 一个区间内全部消息标识
+        Want = 3,       // 请求这些消息
+        Messages = 4,   // 补发的消息帧
+    };
+
+    using Key = std::pair<quint64, quint64>;   // (senderId, messageId)
+
+    struct Item {
+        Key key;
+        quint32 recordId = 0;
+    };
+
+    struct Bucket {
+        quint64 digest = 0;
+        QList<Item> items;
+    };
+
+    struct Fingerprint {
+        quint32 count = 0;
+        quint64 digest = 0;
+        bool operator==(const Fingerprint &other) const = default;
+    };
+
+    // 每个会话：桶编号（小时）-> 桶
+    using Index = QHash<QString, QMap<quint32, Bucket>>;
+
+    static bool isSynced(const ChatRecord &record);
+    static quint64 itemHash(const Key &key);
+    static void insert(Index *index, quint32 id, const ChatRecord &record);
+
+    void onSyncEnvelope(const Envelope &envelope);
+    void startNextJoin();
+    void startSync(const QString &peer);
+    bool sharesConversation(const QString &conversation) const;
+    Fingerprint fingerprint(const QString &conversation, quint32 lo, quint32 hi) const;
+    QList<Item> items(const QString &conversation, quint32 lo, quint32 hi) const;
+
+    EnvelopeWriter writer(const QString &peer, Op op, const QString &conversation, qsizetype hint = 0) const;
+    void sendSummary(const QString &peer, const QString &conversation, const QList<std::pair<quint32, quint32>> &ranges);
+    void sendKeys(const QString &peer, const QString &conversation, quint32 lo, quint32 hi);
+    void sendMessages(const QString &peer, const QString &conversation, const QList<Key> &keys);
+
+    void handleSummary(const QString &peer, const QString &conversation, PayloadReader &reader);
+    void handleKeys(const QString &peer, const QString &conversation, PayloadReader &reader);
+    void handleWant(const QString &peer, const QString &conversation, PayloadReader &reader);
+    void handleMessages(PayloadReader &reader);
+
+    ChatHistory *history;
+    NetworkManager *network;
+    QString username;
+
+    Index index;
+    QHash<Key, quint32> known;          // 标识 -> 记录编号
+    bool ready = false;
+    QList<std::pair<quint32, ChatRecord>> appendedWhileLoading;
+    QFutureWatcher<Index> *loader;
+
+    QStringList joinCandidates;         // 已发现、还没试过的节点
+    QSet<QString> pendingPeers;         // 已发起同步、还没有回应的节点
+    int respondedPeers = 0;
+    QTimer *joinTimer;
+};
+
+#endif // HISTORYSYNC_H
@@ -0,0 +1,20 @@
+#include "hybridclock.h"
+#include <QDateTime>
+
+quint64 HybridClock::pack(qint64 physicalMs, quint16 logical) {
+    return (quint64(physicalMs) << 16) | logical;
+}
+
+quint64 HybridClock::now() {
+    // 物理时间前进时逻辑计数归零；停滞或回拨时在上一次的基础上加一
+    last = qMax(last + 1, pack(QDateTime::currentMSecsSinceEpoch()));
+    return last;
+}
+
+void HybridClock::observe(quint64 remote) {
+    qint64 wall = QDateTime::currentMSecsSinceEpoch();
+    if (physicalMs(remote) > wall + maxForwardDriftMs) {
+        return;
+    }
+    last = qMax(qMax(last, remote) + 1, pack(wall));
+}
@@ -0,0 +1,25 @@
+#ifndef HYBRIDCLOCK_H
+#define HYBRIDCLOCK_H
+
+#include <QtGlobal>
+
+// 混合逻辑时钟（HLC）。时间戳打包成 64 位：高 48 位为物理时间（毫秒），
+// 低 16 位为同一毫秒内的逻辑计数。
+// 本地事件和发送用 now()，收到消息后用 observe() 推进，保证
+// “看到过的消息”一定排在之后发出的消息前面，同时时间戳仍接近真实时间。
+class HybridClock {
+public:
+    // 对方时钟超前本地这么多时不再跟随，避免一个错误的时钟把所有人带偏
+    static constexpr qint64 maxForwardDriftMs = 60 * 1000;
+
+    quint64 now();
+    void observe(quint64 remote);
+
+    static quint64 pack(qint64 physicalMs, quint16 logical = 0);
+    static qint64 physicalMs(quint64 stamp) { return qint64(stamp >> 16); }
+
+private:
+    quint64 last = 0;
+};
+
+#endif // HYBRIDCLOCK_H
@@ -0,0 +1,179 @@
+#include "imagetranscoder.h"
+#include "blake3.h"
+#include <QDir>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QBuffer>
+#include <QFile>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QPainter>
+#include <QtEndian>
+#include <algorithm>
+
+namespace {
+
+QByteArray encodeProgressive(const QImage &image, int quality) {
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, "jpeg");
+    writer.setQuality(quality);
+    writer.setOptimizedWrite(true);
+    writer.setProgressiveScanWrite(true);
+    if (!writer.write(image)) {
+        return QByteArray();
+    }
+    return data;
+}
+
+// JPEG 没有透明通道，透明区域铺白底
+QImage flattenAlpha(const QImage &image) {
+    QImage opaque(image.size(), QImage::Format_RGB32);
+    opaque.fill(Qt::white);
+    QPainter painter(&opaque);
+    painter.drawImage(0, 0, image);
+    painter.end();
+    return opaque;
+}
+
+}
+
+QList<ImageRung> ImageTranscoder::defaultLadder() {
+    return {{160, 60}, {320, 70}, {640, 75}};
+}
+
+QList<ImageRung> ImageTranscoder::loadLadder(const QString &path) {
+    QList<ImageRung> ladder;
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream in(&file);
+        while (!in.atEnd()) {
+            QString line = in.readLine().trimmed();
+            if (line.isEmpty() || line.startsWith('#')) {
+                continue;
+            }
+            const QStringList fields = line.split(' ', Qt::SkipEmptyParts);
+            bool edgeOk = false;
+            bool qualityOk = false;
+            ImageRung rung;
+            if (fields.size() == 2) {
+                rung.maxEdge = fields[0].toInt(&edgeOk);
+                rung.quality = fields[1].toInt(&qualityOk);
+            }
+            if (edgeOk && qualityOk && rung.maxEdge > 0 && rung.quality > 0 && rung.quality <= 100) {
+                ladder.append(rung);
+            }
+        }
+        file.close();
+    }
+
+    if (ladder.isEmpty()) {
+        return defaultLadder();
+    }
+    std::sort(ladder.begin(), ladder.end(), [](const ImageRung &a, const ImageRung &b) {
+        return a.maxEdge < b.maxEdge;
+    });
+    return ladder;
+}
+
+ImagePreview ImageTranscoder::preview(const QString &path, const QList<ImageRung> &ladder, int budgetBytes) {
+    ImagePreview result;
+    if (ladder.isEmpty()) {
+        return result;
+    }
+
+    // 按最大一级的尺寸解码，JPEG 等格式可以直接在解码时缩小，不必先解出整张原图
+    QImageReader reader(path);
+    reader.setAutoTransform(true);
+    result.originalSize = reader.size();
+    int topEdge = ladder.last().maxEdge;
+    if (result.originalSize.isValid() && qMax(result.originalSize.width(), result.originalSize.height()) > topEdge) {
+        reader.setScaledSize(result.originalSize.scaled(topEdge, topEdge, Qt::KeepAspectRatio));
+    }
+    QImage decoded = reader.read();
+    if (decoded.isNull()) {
+        return result;
+    }
+    if (!result.originalSize.isValid()) {
+        result.originalSize = decoded.size();
+    }
+    if (decoded.hasAlphaChannel()) {
+        decoded = flattenAlpha(decoded);
+    }
+
+    for (const ImageRung &rung : ladder) {
+        QImage scaled = qMax(decoded.width(), decoded.height()) > rung.maxEdge
+                            ? decoded.scaled(rung.maxEdge, rung.maxEdge, Qt::KeepAspectRatio, Qt::SmoothTransformation)
+                            : decoded;
+        QByteArray jpeg = encodeProgressive(scaled, rung.quality);
+        if (jpeg.isEmpty()) {
+            continue;
+        }
+        if (!result.jpeg.isEmpty() && jpeg.size() > budgetBytes) {
+            break;
+        }
+        result.jpeg = jpeg;
+        result.size = scaled.size();
+        if (jpeg.size() > budgetBytes || scaled.size() == decoded.size()) {
+            // 最小一级已超出预算，或者再往上已经不会更清晰
+            break;
+        }
+    }
+    return result;
+}
+
+int ImageTranscoder::pasteQuality(const QSize &size) {
+    qint64 pixels = qint64(size.width()) * size.height();
+    if (pixels <= 1024 * 1024) {
+        return 90;
+    }
+    return pixels <= 4 * 1024 * 1024 ? 82 : 75;
+}
+
+PastedImage ImageTranscoder::savePasted(const QImage &image, const QString &directory) {
+    PastedImage result;
+    if (image.isNull()) {
+        return result;
+    }
+
+    // 摘要覆盖尺寸、像素格式和每一行的像素，同一张截图得到同一个文件名。
+    // 逐行只取像素所占的字节：行尾对齐用的填充内容不确定，算进去同样的像素会得到不同的摘要
+    Blake3 hasher;
+    uchar header[12];
+    qToLittleEndian<quint32>(quint32(image.width()), header);
+    qToLittleEndian<quint32>(quint32(image.height()), header + 4);
+    qToLittleEndian<quint32>(quint32(image.format()), header + 8);
+    hasher.update(QByteArrayView(header, sizeof(header)));
+    const qsizetype rowBytes = (qsizetype(image.width()) * image.depth() + 7) / 8;
+    for (int y = 0; y < image.height(); ++y) {
+        hasher.update(QByteArrayView(image.constScanLine(y), rowBytes));
+    }
+
+    static const bool hasWebp = QImageWriter::supportedImageFormats().contains("webp");
+    const char *format = hasWebp ? "webp" : "jpeg";
+    QDir dir(directory);
+    dir.mkpath(".");
+    result.path = dir.filePath(QString("%1.%2")
+                                   .arg(QString::fromLatin1(hasher.finalize().toHex().left(32)),
+                                        hasWebp ? "webp" : "jpg"));
+    if (QFile::exists(result.path)) {
+        result.reused = true;
+        return result;
+    }
+
+    // 先写临时文件再改名，同时粘贴两次也不会读到写了一半的文件
+    QSaveFile file(result.path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        result.path.clear();
+        return result;
+    }
+    QImageWriter writer(&file, format);
+    writer.setQuality(pasteQuality(image.size()));
+    writer.setOptimizedWrite(true);
+    if (!writer.write(hasWebp || !image.hasAlphaChannel() ? image : flattenAlpha(image)) || !file.commit()) {
+        result.path.clear();
+    }
+    return result;
+}
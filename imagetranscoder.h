@@ -0,0 +1,51 @@
+#ifndef IMAGETRANSCODER_H
+#define IMAGETRANSCODER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QSize>
+
+class QImage;
+
+// 预览阶梯中的一级：长边不超过 maxEdge 像素，JPEG 质量 quality
+struct ImageRung {
+    int maxEdge = 0;
+    int quality = 0;
+};
+
+struct ImagePreview {
+    QByteArray jpeg;        // 渐进式 JPEG，为空表示无法解码
+    QSize size;
+    QSize originalSize;
+};
+
+// 粘贴的图片压缩后保存成的文件
+struct PastedImage {
+    QString path;           // 为空表示无法编码或写入
+    bool reused = false;    // 同一张图片之前粘贴过，直接用上次的文件
+};
+
+// 图片预览转码。发送图片时只立即发送预览，原图由接收方按需拉取（见 FileShare）。
+// 阶梯按边长从小到大尝试，取编码后不超过字节预算的最大一级；
+// 最小一级也超出预算时仍使用最小一级。只使用 QImage，可在后台线程调用。
+class ImageTranscoder {
+public:
+    static constexpr int defaultBudgetBytes = 48 * 1024;
+
+    static QList<ImageRung> defaultLadder();
+
+    // 配置文件每行一级：“边长 质量”，# 开头为注释；文件不存在或没有有效行时用默认阶梯
+    static QList<ImageRung> loadLadder(const QString &path);
+
+    static ImagePreview preview(const QString &path, const QList<ImageRung> &ladder,
+                                int budgetBytes = defaultBudgetBytes);
+
+    // 粘贴的图片（多为截图）存成 directory 下的文件，之后按普通图片发送。
+    // 有 WebP 插件时用 WebP（保留透明），否则用 JPEG；像素越多质量越低，小截图的文字保持清晰。
+    // 文件名取自像素内容的 BLAKE3 摘要，同一张图重复粘贴只编码一次
+    static PastedImage savePasted(const QImage &image, const QString &directory);
+    static int pasteQuality(const QSize &size);
+};
+
+#endif // IMAGETRANSCODER_H
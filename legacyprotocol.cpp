@@ -0,0 +1,147 @@
+#include "legacyprotocol.h"
+#include "base64codec.h"
+#include <QIODevice>
+
+namespace {
+
+const qint64 streamBlockBytes = 48 * 1024;    // 3 的倍数，块之间不留零头
+
+QString fileHeader(const QString &sender, const QString &displayName, const QString &fileExtension,
+                   const QString &fileType, qint64 size) {
+    return QString("[%1]: [FILE]%2[FILENAME]%3[FILEEXTENSION]%4[FILETYPE]%5[FILESIZE][FILEDATA]")
+           .arg(sender)
+           .arg(displayName)
+           .arg(fileExtension)
+           .arg(fileType)
+           .arg(size);
+}
+
+qsizetype fileTrailerLength(const QByteArray &thumbnail) {
+    return (thumbnail.isEmpty() ? 0 : 11 + Base64Codec::encodedLength(thumbnail.size())) + 7;
+}
+
+void appendFileTrailer(QString *message, const QByteArray &thumbnail) {
+    if (!thumbnail.isEmpty()) {
+        message->append(QLatin1String("[THUMBNAIL]"));
+        Base64Codec::Encoder encoder(message);
+        encoder.append(thumbnail);
+        encoder.finish();
+    }
+    message->append(QLatin1String("[/FILE]"));
+}
+
+}
+
+bool LegacyProtocol::isFileMessage(const QString &message) {
+    return message.contains("[FILE]") && message.contains("[FILENAME]");
+}
+
+LegacyProtocol::TextMessage LegacyProtocol::parseText(const QString &message) {
+    TextMessage result;
+    result.sender = "未知用户";
+
+    QString actualMessage = message;
+
+    // 检查是否有头像数据
+    if (message.contains("|AVATAR:")) {
+        int avatarPos = message.lastIndexOf("|AVATAR:");
+        actualMessage = message.left(avatarPos);
+        result.avatarPng = Base64Codec::decode(QStringView(message).mid(avatarPos + 8)); // 跳过 "|AVATAR:" 前缀
+    }
+
+    result.text = actualMessage;
+    if (actualMessage.startsWith("[") && actualMessage.contains("]: ")) {
+        int bracketEnd = actualMessage.indexOf("]: ");
+        result.sender = actualMessage.mid(1, bracketEnd - 1);  // 提取用户名
+        result.text = actualMessage.mid(bracketEnd + 3);
+    }
+    return result;
+}
+
+bool LegacyProtocol::parseFile(const QString &message, FileMessage *out) {
+    int startBracket = message.indexOf('[');
+    int endBracket = message.indexOf(']');
+
+    int fileStart = message.indexOf("[FILE]") + 6;
+    int filenameStart = message.indexOf("[FILENAME]");
+    int extensionStart = message.indexOf("[FILEEXTENSION]");
+    int filetypeStart = message.indexOf("[FILETYPE]");
+    int filesizeStart = message.indexOf("[FILESIZE]");
+    int filedataStart = message.indexOf("[FILEDATA]");
+    int fileEnd = message.indexOf("[/FILE]");
+
+    if (!(fileStart >= 6 && filenameStart > fileStart && extensionStart > filenameStart &&
+          filetypeStart > extensionStart && filesizeStart > filetypeStart && filedataStart > filesizeStart &&
+          fileEnd > filedataStart)) {
+        return false;
+    }
+
+    out->sender = message.mid(startBracket + 1, endBracket - startBracket - 1);
+    out->fileName = message.mid(fileStart, filenameStart - fileStart);
+    out->fileType = message.mid(extensionStart + 15, filetypeStart - extensionStart - 15);
+    out->fileSize = message.mid(filetypeStart + 10, filesizeStart - filetypeStart - 10).toLongLong();
+
+    // 提取文件数据部分
+    QStringView filePart = QStringView(message).mid(filedataStart + 10, fileEnd - filedataStart - 10);
+    qsizetype thumbnailPos = filePart.indexOf(QLatin1String("[THUMBNAIL]"));
+    QStringView fileDataBase64 = filePart;
+    out->thumbnailBase64.clear();
+    if (thumbnailPos != -1) {
+        fileDataBase64 = filePart.left(thumbnailPos);
+        out->thumbnailBase64 = filePart.mid(thumbnailPos + 11).toString();
+    }
+
+    // 早期版本把文件数据放在 [FILESIZE] 和 [FILEDATA] 之间
+    if (fileDataBase64.isEmpty()) {
+        fileDataBase64 = QStringView(message).mid(filesizeStart + 10, filedataStart - filesizeStart - 10);
+    }
+
+    // 直接从消息的 UTF-16 解码为原始字节，不再经过中间的 Latin-1 副本
+    out->data = Base64Codec::decode(fileDataBase64);
+    return true;
+}
+
+QString LegacyProtocol::formatText(const QString &sender, const QString &text, const QByteArray &avatarPng) {
+    QString fullMessage = QString("[%1]: %2").arg(sender).arg(text);
+    if (!avatarPng.isEmpty()) {
+        fullMessage.reserve(fullMessage.size() + 8 + Base64Codec::encodedLength(avatarPng.size()));
+        fullMessage += QLatin1String("|AVATAR:");
+        Base64Codec::Encoder encoder(&fullMessage);
+        encoder.append(avatarPng);
+        encoder.finish();
+    }
+    return fullMessage;
+}
+
+QString LegacyProtocol::formatFile(const QString &sender, const QString &displayName, const QString &fileExtension,
+                                   const QString &fileType, const QByteArray &fileData, const QByteArray &thumbnail) {
+    // 按最终长度一次分配，base64 直接写在消息里，不经过 toBase64() 和 arg() 的副本
+    QString message = fileHeader(sender, displayName, fileExtension, fileType, fileData.size());
+    message.reserve(message.size() + Base64Codec::encodedLength(fileData.size()) + fileTrailerLength(thumbnail));
+    Base64Codec::Encoder encoder(&message);
+    encoder.append(fileData);
+    encoder.finish();
+    appendFileTrailer(&message, thumbnail);
+    return message;
+}
+
+QString LegacyProtocol::formatFile(const QString &sender, const QString &displayName, const QString &fileExtension,
+                                   const QString &fileType, QIODevice *content, qint64 size,
+                                   const QByteArray &thumbnail) {
+    QString message = fileHeader(sender, displayName, fileExtension, fileType, size);
+    message.reserve(message.size() + Base64Codec::encodedLength(size) + fileTrailerLength(thumbnail));
+    Base64Codec::Encoder encoder(&message);
+    QByteArray block(streamBlockBytes, Qt::Uninitialized);
+    qint64 total = 0;
+    while (total < size) {
+        qint64 count = content->read(block.data(), qMin(streamBlockBytes, size - total));
+        if (count <= 0) {
+            return QString();
+        }
+        encoder.append(QByteArrayView(block.constData(), count));
+        total += count;
+    }
+    encoder.finish();
+    appendFileTrailer(&message, thumbnail);
+    return message;
+}
@@ -0,0 +1,49 @@
+#ifndef LEGACYPROTOCOL_H
+#define LEGACYPROTOCOL_H
+
+#include <QString>
+#include <QByteArray>
+
+class QIODevice;
+
+// 旧版文本协议，只用于和未升级的节点互通：
+//   文本：[用户名]: 正文|AVATAR:头像 PNG 的 base64
+//   文件：[用户名]: [FILE]文件名[FILENAME]扩展名[FILEEXTENSION]类型[FILETYPE]大小[FILESIZE]
+//         [FILEDATA]文件内容 base64[THUMBNAIL]缩略图 base64[/FILE]
+// 早期版本把文件内容放在 [FILESIZE] 和 [FILEDATA] 之间。
+// base64 部分用 Base64Codec 直接在 UTF-16 消息上编解码，不生成中间的 Latin-1 副本。
+class LegacyProtocol {
+public:
+    struct TextMessage {
+        QString sender;
+        QString text;
+        QByteArray avatarPng;
+    };
+
+    struct FileMessage {
+        QString sender;
+        QString fileName;
+        QString fileType;
+        qint64 fileSize = 0;
+        QByteArray data;
+        QString thumbnailBase64;
+    };
+
+    static bool isFileMessage(const QString &message);
+
+    // 没有 "[用户名]: " 前缀时发送者为“未知用户”
+    static TextMessage parseText(const QString &message);
+
+    // 标记不完整时返回 false
+    static bool parseFile(const QString &message, FileMessage *out);
+
+    static QString formatText(const QString &sender, const QString &text, const QByteArray &avatarPng);
+    static QString formatFile(const QString &sender, const QString &displayName, const QString &fileExtension,
+                              const QString &fileType, const QByteArray &fileData, const QByteArray &thumbnail);
+
+    // 文件内容从 content 按固定大小的块读出并编码，不需要整个文件在内存中；读取失败时返回空字符串
+    static QString formatFile(const QString &sender, const QString &displayName, const QString &fileExtension,
+                              const QString &fileType, QIODevice *content, qint64 size, const QByteArray &thumbnail);
+};
+
+#endif // LEGACYPROTOCOL_H
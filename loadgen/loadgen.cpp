@@ -0,0 +1,528 @@
+#include "networkmanager.h"
+#include "conversation.h"
+#include "logger.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QTimer>
+#include <QTemporaryDir>
+#include <QRandomGenerator>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QDir>
+#include <QTextStream>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+// 负载生成器：在一个进程里启动 N 个模拟节点，每个节点绑定自己的回环地址（127.0.0.x），
+// 使用真实的 NetworkManager（UDP 发现 + TCP/TLS 聊天协议），按设定的速率和大小分布
+// 向大厅或房间发送文本消息，统计投递延迟分位数、吞吐，以及每个节点的 CPU 和进程内存。
+//
+// 每个节点运行在自己的线程上，CPU 按线程 CPU 时间统计：节点线程加上它的 NetworkManager
+// 的工作线程（FanOut 的加密和写入线程，--io-uring 时还有接收线程），发送和接收的开销都算在节点上；
+// 内存无法按线程区分，只给出进程 RSS 和按节点平均的增量。
+// Linux 上整个 127.0.0.0/8 都是回环地址；macOS 需要先用 ifconfig lo0 alias 添加地址。
+
+namespace {
+
+qint64 monotonicNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 线程已用的 CPU 时间，thread 是该线程的 QThread::currentThreadId()
+qint64 threadCpuNs(Qt::HANDLE thread) {
+#if defined(Q_OS_WIN)
+    // Windows 上的线程标识是线程 ID，要先打开句柄
+    HANDLE handle = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, DWORD(quintptr(thread)));
+    if (!handle) {
+        return 0;
+    }
+    FILETIME creation, exit, kernel, user;
+    BOOL ok = GetThreadTimes(handle, &creation, &exit, &kernel, &user);
+    CloseHandle(handle);
+    if (!ok) {
+        return 0;
+    }
+    auto ticks = [](const FILETIME &time) {
+        return (qint64(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) * 100;
+#else
+    clockid_t clock;
+    timespec ts;
+    if (pthread_getcpuclockid((pthread_t)thread, &clock) != 0 || clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// 进程当前 RSS（字节），取不到时返回 0
+qint64 processRssBytes() {
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return qint64(counters.WorkingSetSize);
+    }
+    return 0;
+#elif defined(Q_OS_LINUX)
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.size() > 1 ? fields[1].toLongLong() * sysconf(_SC_PAGESIZE) : 0;
+#else
+    // 其他系统只有峰值：ru_maxrss 在 macOS 上以字节为单位
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return qint64(usage.ru_maxrss);
+#endif
+}
+
+// 消息大小分布中的一项：正文字节数和权重
+struct SizeWeight {
+    int bytes = 0;
+    int weight = 0;
+};
+
+// 解析 "64:80,1024:15,16384:5"
+QList<SizeWeight> parseSizeMix(const QString &text) {
+    QList<SizeWeight> mix;
+    for (const QString &item : text.split(',', Qt::SkipEmptyParts)) {
+        const QStringList parts = item.split(':');
+        bool bytesOk = false;
+        bool weightOk = parts.size() < 2;
+        SizeWeight entry;
+        entry.bytes = parts[0].trimmed().toInt(&bytesOk);
+        entry.weight = parts.size() < 2 ? 1 : parts[1].trimmed().toInt(&weightOk);
+        if (!bytesOk || !weightOk || entry.bytes <= 0 || entry.weight <= 0) {
+            return QList<SizeWeight>();
+        }
+        mix.append(entry);
+    }
+    return mix;
+}
+
+struct LoadProfile {
+    double messagesPerSecond = 0.2;     // 每个节点
+    QList<SizeWeight> sizeMix;
+    QString conversation;               // 空为大厅
+    QByteArray groupKey;
+};
+
+// 节点运行结束后的统计，只在节点线程停止后读取
+struct NodeStats {
+    QString ip;
+    qint64 sent = 0;
+    qint64 sentBytes = 0;
+    qint64 received = 0;
+    qint64 receivedBytes = 0;
+    qint64 cpuNs = 0;
+    std::vector<qint64> latenciesUs;
+};
+
+// 一个模拟节点，所有成员只在节点线程上访问
+class SimNode : public QObject {
+public:
+    SimNode(int index, const NetworkConfig &config, const LoadProfile &profile)
+        : index(index), config(config), profile(profile) {
+        stats.ip = config.localIP;
+    }
+
+    // 以下在节点线程上调用
+    void start() {
+        network = new NetworkManager(this, QString("node%1").arg(index, 3, 10, QChar('0')), config);
+        network->setHandler(MessageType::Text, [this](const Envelope &envelope) { onText(envelope); });
+        QObject::connect(network, &NetworkManager::peerDiscovered, this, [this]() { ++peersSeen; });
+        if (Conversation::isRoom(profile.conversation)) {
+            network->setRooms({Conversation::target(profile.conversation)});
+        }
+        network->setGroupKey(profile.groupKey);
+        network->start();
+        cpuStartNs = cpuNs();
+    }
+
+    int discoveredPeers() const { return peersSeen; }
+
+    void beginMeasuring(qint64 windowStartNs) {
+        measureFromNs = windowStartNs;
+        cpuStartNs = cpuNs();
+        scheduleNext();
+    }
+
+    // CPU 只统计测量窗口内，和吞吐使用同一个时间段
+    void stopSending(qint64 windowEndNs) {
+        sending = false;
+        measureUntilNs = windowEndNs;
+        stats.cpuNs = cpuNs() - cpuStartNs;
+    }
+
+    void shutdown() {
+        delete network;
+        network = nullptr;
+    }
+
+    NodeStats stats;
+
+private:
+    // 节点线程和替它收发的工作线程合计
+    qint64 cpuNs() const {
+        qint64 total = threadCpuNs(QThread::currentThreadId());
+        for (Qt::HANDLE thread : network->workerThreadIds()) {
+            total += threadCpuNs(thread);
+        }
+        return total;
+    }
+
+    void scheduleNext() {
+        if (!sending || profile.messagesPerSecond <= 0) {
+            return;
+        }
+        // 泊松到达：间隔服从指数分布
+        double u = 1.0 - QRandomGenerator::global()->generateDouble();
+        int delayMs = int(std::min(-std::log(u) / profile.messagesPerSecond * 1000.0, 600000.0));
+        QTimer::singleShot(delayMs, this, [this]() {
+            if (!sending) {
+                return;
+            }
+            sendOne();
+            scheduleNext();
+        });
+    }
+
+    int pickSize() const {
+        int total = 0;
+        for (const SizeWeight &entry : profile.sizeMix) {
+            total += entry.weight;
+        }
+        int pick = int(QRandomGenerator::global()->bounded(total));
+        for (const SizeWeight &entry : profile.sizeMix) {
+            if (pick < entry.weight) {
+                return entry.bytes;
+            }
+            pick -= entry.weight;
+        }
+        return profile.sizeMix.last().bytes;
+    }
+
+    // 正文开头是发送时间，接收方据此计算延迟；同一进程内各线程共用单调时钟
+    void sendOne() {
+        int bytes = pickSize();
+        QString text = QString("LG %1 ").arg(monotonicNs());
+        text += QString(qMax(0, bytes - int(text.size())), QChar('x'));
+
+        EnvelopeWriter writer(MessageType::Text, text.size() + 64, profile.conversation);
+        writer.string16(QString("node%1").arg(index, 3, 10, QChar('0')));
+        writer.string32(text);
+        writer.bytes32(QByteArray());
+        network->send(writer);
+        ++stats.sent;
+        stats.sentBytes += text.size();
+    }
+
+    void onText(const Envelope &envelope) {
+        qint64 now = monotonicNs();
+        PayloadReader reader(envelope.payload);
+        reader.string16();
+        QString text = reader.string32();
+        if (!reader.ok() || !text.startsWith("LG ")) {
+            return;
+        }
+        qint64 sentAt = QStringView(text).mid(3, text.indexOf(' ', 3) - 3).toLongLong();
+        // 只统计测量窗口内发出的消息，预热和收尾阶段的不算
+        if (sentAt < measureFromNs || (measureUntilNs > 0 && sentAt > measureUntilNs)) {
+            return;
+        }
+        ++stats.received;
+        stats.receivedBytes += text.size();
+        stats.latenciesUs.push_back((now - sentAt) / 1000);
+    }
+
+    int index;
+    NetworkConfig config;
+    LoadProfile profile;
+    NetworkManager *network = nullptr;
+    int peersSeen = 0;
+    bool sending = true;
+    qint64 measureFromNs = 0;
+    qint64 measureUntilNs = 0;
+    qint64 cpuStartNs = 0;
+};
+
+// 在节点线程上执行并等待完成
+template <typename Function>
+void runOnNode(SimNode *node, Function function) {
+    QMetaObject::invokeMethod(node, function, Qt::BlockingQueuedConnection);
+}
+
+qint64 percentile(const std::vector<qint64> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = size_t(std::ceil(p / 100.0 * double(sorted.size())));
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// 等待事件循环处理，直到条件满足或超时
+bool waitUntil(const std::function<bool()> &done, int timeoutMs) {
+    QElapsedTimer timer;
+    timer.start();
+    while (!done()) {
+        if (timer.hasExpired(timeoutMs)) {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+        QThread::msleep(100);
+    }
+    return true;
+}
+
+void runEventsFor(int ms) {
+    waitUntil([]() { return false; }, ms);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("untitled10_loadgen");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("P2P 聊天室负载生成器：在本机回环地址上模拟多个节点");
+    parser.addHelpOption();
+    QCommandLineOption peersOption("peers", "模拟节点数", "n", "20");
+    QCommandLineOption baseAddressOption("base-address", "第一个节点的回环地址，之后依次加一", "ip", "127.0.0.2");
+    QCommandLineOption discoveryPortOption("discovery-port", "发现端口", "port", "12345");
+    QCommandLineOption chatPortOption("chat-port", "聊天端口", "port", "12346");
+    QCommandLineOption securePortOption("secure-port", "加密端口", "port", "12347");
+    QCommandLineOption rateOption("rate", "每个节点每秒发送的消息数（泊松到达）", "per-second", "0.2");
+    QCommandLineOption sizesOption("sizes", "正文大小分布，字节数:权重，逗号分隔", "mix", "64:80,1024:15,16384:5");
+    QCommandLineOption roomOption("room", "发到这个房间（所有节点都加入），默认发到大厅", "name");
+    QCommandLineOption keyOption("key", "启用加密会话的口令", "passphrase");
+    QCommandLineOption durationOption("duration", "测量时长（秒）", "seconds", "30");
+    QCommandLineOption discoveryTimeoutOption("discovery-timeout", "等待节点互相发现的最长时间（秒）", "seconds", "20");
+    QCommandLineOption drainOption("drain", "停止发送后等待在途消息的时间（秒）", "seconds", "5");
+    QCommandLineOption jsonOption("json", "把结果另外写成 JSON 文件", "path");
+    QCommandLineOption ioUringOption("io-uring", "明文端口用 io_uring 接收（需以 ENABLE_IO_URING 构建）");
+    QCommandLineOption verboseOption("verbose", "输出网络层的调试日志");
+    parser.addOptions({peersOption, baseAddressOption, discoveryPortOption, chatPortOption, securePortOption,
+                       rateOption, sizesOption, roomOption, keyOption, durationOption, discoveryTimeoutOption,
+                       drainOption, jsonOption, ioUringOption, verboseOption});
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    int peerCount = parser.value(peersOption).toInt();
+    QHostAddress baseAddress(parser.value(baseAddressOption));
+    LoadProfile profile;
+    profile.messagesPerSecond = parser.value(rateOption).toDouble();
+    profile.sizeMix = parseSizeMix(parser.value(sizesOption));
+    if (parser.isSet(roomOption)) {
+        profile.conversation = Conversation::room(parser.value(roomOption));
+    }
+    if (parser.isSet(keyOption)) {
+        profile.groupKey = SessionCrypto::deriveKey(parser.value(keyOption));
+    }
+    int durationSec = parser.value(durationOption).toInt();
+    if (peerCount < 2 || baseAddress.protocol() != QAbstractSocket::IPv4Protocol || profile.sizeMix.isEmpty() ||
+        durationSec <= 0) {
+        err << "参数无效，见 --help\n";
+        return 1;
+    }
+    if (!parser.isSet(verboseOption)) {
+        Logger::setLevel(LogLevel::Warning);
+    }
+
+    // 发件箱写到临时目录，结束后删除
+    QTemporaryDir outboxRoot;
+    QList<QHostAddress> addresses;
+    for (int i = 0; i < peerCount; ++i) {
+        addresses.append(QHostAddress(baseAddress.toIPv4Address() + quint32(i)));
+    }
+
+    qint64 rssBefore = processRssBytes();
+    QList<QThread *> threads;
+    QList<SimNode *> nodes;
+    for (int i = 0; i < peerCount; ++i) {
+        NetworkConfig config;
+        config.localIP = addresses[i].toString();
+        config.discoveryPort = parser.value(discoveryPortOption).toInt();
+        config.chatPort = parser.value(chatPortOption).toInt();
+        config.securePort = parser.value(securePortOption).toInt();
+        config.discoveryTargets = addresses;
+        config.outboxDir = QDir(outboxRoot.path()).filePath(config.localIP);
+        // 每个节点已在自己的线程上，发送线程各一个就够，节点多时不至于开出几百个线程
+        config.fanOutThreads = 1;
+        config.ioUring = parser.isSet(ioUringOption);
+
+        auto *thread = new QThread();
+        thread->setObjectName(QString("node-%1").arg(i));
+        auto *node = new SimNode(i, config, profile);
+        node->moveToThread(thread);
+        thread->start();
+        runOnNode(node, [node]() { node->start(); });
+        threads.append(thread);
+        nodes.append(node);
+    }
+    out << "已启动 " << peerCount << " 个节点：" << addresses.first().toString() << " - "
+        << addresses.last().toString() << "\n";
+    out.flush();
+
+    // 等所有节点互相发现，之后才开始计时
+    auto allDiscovered = [&]() {
+        for (SimNode *node : std::as_const(nodes)) {
+            int seen = 0;
+            runOnNode(node, [node, &seen]() { seen = node->discoveredPeers(); });
+            if (seen < peerCount - 1) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (!waitUntil(allDiscovered, parser.value(discoveryTimeoutOption).toInt() * 1000)) {
+        err << "警告：超时前没有完成全部互相发现，部分消息的接收者会少于 " << peerCount - 1 << "\n";
+    }
+    qint64 rssStarted = processRssBytes();
+
+    qint64 windowStart = monotonicNs();
+    for (SimNode *node : std::as_const(nodes)) {
+        runOnNode(node, [node, windowStart]() { node->beginMeasuring(windowStart); });
+    }
+    out << "开始发送，持续 " << durationSec << " 秒\n";
+    out.flush();
+
+    // 测量期间定时采样进程内存
+    qint64 rssPeak = rssStarted;
+    QTimer rssTimer;
+    QObject::connect(&rssTimer, &QTimer::timeout, [&]() { rssPeak = qMax(rssPeak, processRssBytes()); });
+    rssTimer.start(500);
+    waitUntil([&]() { return monotonicNs() - windowStart >= qint64(durationSec) * 1000000000; },
+              durationSec * 1000 + 1000);
+
+    qint64 windowEnd = monotonicNs();
+    for (SimNode *node : std::as_const(nodes)) {
+        runOnNode(node, [node, windowEnd]() { node->stopSending(windowEnd); });
+    }
+    runEventsFor(parser.value(drainOption).toInt() * 1000);
+    rssTimer.stop();
+    rssPeak = qMax(rssPeak, processRssBytes());
+
+    for (int i = 0; i < peerCount; ++i) {
+        SimNode *node = nodes[i];
+        runOnNode(node, [node]() { node->shutdown(); });
+        threads[i]->quit();
+        threads[i]->wait();
+    }
+
+    // 汇总
+    double windowSec = double(windowEnd - windowStart) / 1e9;
+    std::vector<qint64> latencies;
+    qint64 sent = 0;
+    qint64 sentBytes = 0;
+    qint64 received = 0;
+    qint64 receivedBytes = 0;
+    for (SimNode *node : std::as_const(nodes)) {
+        const NodeStats &stats = node->stats;
+        sent += stats.sent;
+        sentBytes += stats.sentBytes;
+        received += stats.received;
+        receivedBytes += stats.receivedBytes;
+        latencies.insert(latencies.end(), stats.latenciesUs.begin(), stats.latenciesUs.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    qint64 expected = sent * (peerCount - 1);
+    qint64 rssPerNode = (rssStarted - rssBefore) / peerCount;
+
+    out << "\n测量窗口 " << QString::number(windowSec, 'f', 1) << " 秒\n";
+    out << "发送 " << sent << " 条（" << QString::number(sent / windowSec, 'f', 1) << " 条/秒, "
+        << QString::number(sentBytes / windowSec / 1024, 'f', 1) << " KiB/秒）\n";
+    out << "投递 " << received << " / " << expected << "（"
+        << QString::number(expected > 0 ? 100.0 * received / expected : 0, 'f', 2) << "%, "
+        << QString::number(received / windowSec, 'f', 1) << " 条/秒, "
+        << QString::number(receivedBytes / windowSec / 1024, 'f', 1) << " KiB/秒）\n";
+    out << "投递延迟 (ms)  p50 " << percentile(latencies, 50) / 1000.0
+        << "  p90 " << percentile(latencies, 90) / 1000.0
+        << "  p99 " << percentile(latencies, 99) / 1000.0
+        << "  p99.9 " << percentile(latencies, 99.9) / 1000.0
+        << "  max " << (latencies.empty() ? 0 : latencies.back()) / 1000.0 << "\n";
+    out << "进程 RSS：启动前 " << rssBefore / 1024 << " KiB，节点就绪后 " << rssStarted / 1024
+        << " KiB，峰值 " << rssPeak / 1024 << " KiB，每节点约 " << rssPerNode / 1024 << " KiB\n";
+    out << "\n节点        发送    接收    CPU(ms)  CPU(%)\n";
+    for (SimNode *node : std::as_const(nodes)) {
+        const NodeStats &stats = node->stats;
+        out << qSetFieldWidth(10) << Qt::left << stats.ip << qSetFieldWidth(8) << Qt::right << stats.sent
+            << stats.received << QString::number(stats.cpuNs / 1e6, 'f', 0)
+            << QString::number(100.0 * stats.cpuNs / 1e9 / windowSec, 'f', 2) << qSetFieldWidth(0) << "\n";
+    }
+    out.flush();
+
+    if (parser.isSet(jsonOption)) {
+        QJsonObject result;
+        result["peers"] = peerCount;
+        result["rate_per_node"] = profile.messagesPerSecond;
+        result["sizes"] = parser.value(sizesOption);
+        result["conversation"] = profile.conversation;
+        result["encrypted"] = !profile.groupKey.isEmpty();
+        result["window_seconds"] = windowSec;
+        result["sent"] = sent;
+        result["expected_deliveries"] = expected;
+        result["delivered"] = received;
+        result["delivered_per_second"] = received / windowSec;
+        result["delivered_bytes_per_second"] = receivedBytes / windowSec;
+        QJsonObject latency;
+        latency["p50_us"] = percentile(latencies, 50);
+        latency["p90_us"] = percentile(latencies, 90);
+        latency["p99_us"] = percentile(latencies, 99);
+        latency["p999_us"] = percentile(latencies, 99.9);
+        latency["max_us"] = latencies.empty() ? 0 : latencies.back();
+        result["latency"] = latency;
+        QJsonObject memory;
+        memory["rss_before_bytes"] = rssBefore;
+        memory["rss_started_bytes"] = rssStarted;
+        memory["rss_peak_bytes"] = rssPeak;
+        memory["rss_per_node_bytes"] = rssPerNode;
+        result["memory"] = memory;
+        QJsonArray nodeArray;
+        for (SimNode *node : std::as_const(nodes)) {
+            const NodeStats &stats = node->stats;
+            QJsonObject entry;
+            entry["ip"] = stats.ip;
+            entry["sent"] = stats.sent;
+            entry["received"] = stats.received;
+            entry["cpu_ms"] = stats.cpuNs / 1e6;
+            entry["cpu_percent"] = 100.0 * stats.cpuNs / 1e9 / windowSec;
+            nodeArray.append(entry);
+        }
+        result["nodes"] = nodeArray;
+
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            err << "无法写入 " << file.fileName() << "\n";
+            return 1;
+        }
+        file.write(QJsonDocument(result).toJson());
+    }
+
+    qDeleteAll(nodes);
+    qDeleteAll(threads);
+    return 0;
+}
@@ -0,0 +1,329 @@
+#include "logger.h"
+#include "metrics.h"
+#include <QDateTime>
+#include <QFile>
+#include <QStringList>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+#ifdef NDEBUG
+const LogLevel defaultLevel = LogLevel::Info;
+#else
+const LogLevel defaultLevel = LogLevel::Debug;
+#endif
+
+const char *const categoryNames[] = {
+    "network", "discovery", "transport", "secure", "outbox", "sync", "files", "storage", "ui", "qt",
+};
+static_assert(std::size(categoryNames) == size_t(LogCategory::Count));
+
+const char levelLetters[] = {'D', 'I', 'W', 'E'};
+
+// 不超过 limit 字节、且不切断多字节字符的前缀长度
+qsizetype utf8Prefix(const QByteArray &utf8, qsizetype limit) {
+    if (utf8.size() <= limit) {
+        return utf8.size();
+    }
+    qsizetype size = limit;
+    while (size > 0 && (quint8(utf8[size]) & 0xC0) == 0x80) {
+        --size;
+    }
+    return size;
+}
+
+// 一条日志占一个定长槽位，写入时不分配内存
+struct LogSlot {
+    std::atomic<quint64> sequence{0};
+    qint64 timeMs = 0;
+    LogLevel level = LogLevel::Debug;
+    LogCategory category = LogCategory::Qt;
+    quint16 size = 0;
+    quint32 originalSize = 0;    // 截断前的 UTF-8 字节数
+    char text[Logger::maxLineBytes];
+};
+
+// 有界多生产者单消费者队列（Vyukov）：每个槽位的序号表示它当前可写还是可读，
+// 生产者之间只竞争一次 CAS，消费者只由后台线程访问
+class LogRing {
+public:
+    LogRing() : slots(new LogSlot[Logger::ringCapacity]) {
+        for (int i = 0; i < Logger::ringCapacity; ++i) {
+            slots[i].sequence.store(quint64(i), std::memory_order_relaxed);
+        }
+    }
+
+    bool push(LogCategory category, LogLevel level, qint64 timeMs, const QByteArray &utf8) {
+        quint64 position = head.load(std::memory_order_relaxed);
+        LogSlot *slot;
+        for (;;) {
+            slot = &slots[position & mask];
+            quint64 sequence = slot->sequence.load(std::memory_order_acquire);
+            qint64 diff = qint64(sequence) - qint64(position);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;    // 满了
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->timeMs = timeMs;
+        slot->level = level;
+        slot->category = category;
+        slot->originalSize = quint32(utf8.size());
+        slot->size = quint16(utf8Prefix(utf8, Logger::maxLineBytes));
+        std::memcpy(slot->text, utf8.constData(), slot->size);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 只在消费者线程调用
+    template <typename Consumer>
+    bool pop(Consumer consume) {
+        LogSlot &slot = slots[tail & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+            return false;
+        }
+        consume(slot);
+        slot.sequence.store(tail + Logger::ringCapacity, std::memory_order_release);
+        ++tail;
+        return true;
+    }
+
+private:
+    static constexpr quint64 mask = Logger::ringCapacity - 1;
+    static_assert((Logger::ringCapacity & (Logger::ringCapacity - 1)) == 0);
+
+    std::unique_ptr<LogSlot[]> slots;
+    alignas(64) std::atomic<quint64> head{0};
+    alignas(64) quint64 tail = 0;
+};
+
+struct LoggerState {
+    LogRing ring;
+    std::atomic<bool> running{false};
+    std::thread drainThread;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::FILE *file = nullptr;
+    QtMessageHandler previousHandler = nullptr;
+
+    ~LoggerState() {
+        // 忘了调用 Logger::stop() 时也不让 std::thread 在进程退出时终止程序
+        if (drainThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(wakeMutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            drainThread.join();
+        }
+    }
+};
+
+LoggerState &state() {
+    static LoggerState instance;
+    return instance;
+}
+
+const int drainIntervalMs = 50;
+
+qint64 nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void output(std::FILE *file, qint64 timeMs, LogCategory category, LogLevel level, const char *text, qsizetype size,
+            qsizetype originalSize) {
+    QByteArray line = QDateTime::fromMSecsSinceEpoch(timeMs).toString("HH:mm:ss.zzz").toLatin1();
+    line += ' ';
+    line += levelLetters[qMin(int(level), 3)];
+    line += ' ';
+    line += Logger::categoryName(category);
+    line += ": ";
+    line.append(text, size);
+    if (originalSize > size) {
+        line += QString("…（截断，共 %1 字节）").arg(originalSize).toUtf8();
+    }
+    line += '\n';
+    std::fwrite(line.constData(), 1, size_t(line.size()), stderr);
+    if (file) {
+        std::fwrite(line.constData(), 1, size_t(line.size()), file);
+    }
+}
+
+void drain(LoggerState &logger) {
+    bool stopping = false;
+    while (!stopping) {
+        {
+            std::unique_lock<std::mutex> lock(logger.wakeMutex);
+            logger.wake.wait_for(lock, std::chrono::milliseconds(drainIntervalMs));
+            stopping = logger.stopping;
+        }
+        bool wrote = false;
+        while (logger.ring.pop([&](const LogSlot &slot) {
+            output(logger.file, slot.timeMs, slot.category, slot.level, slot.text, slot.size, slot.originalSize);
+        })) {
+            wrote = true;
+        }
+        if (wrote) {
+            std::fflush(stderr);
+            if (logger.file) {
+                std::fflush(logger.file);
+            }
+        }
+    }
+}
+
+void qtMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message) {
+    if (type == QtFatalMsg) {
+        Logger::stop();
+        if (state().previousHandler) {
+            state().previousHandler(type, context, message);
+        }
+        std::abort();
+    }
+    LogLevel level = type == QtDebugMsg ? LogLevel::Debug
+                     : type == QtInfoMsg ? LogLevel::Info
+                     : type == QtWarningMsg ? LogLevel::Warning
+                                            : LogLevel::Error;
+    if (Logger::isEnabled(LogCategory::Qt, level)) {
+        Logger::write(LogCategory::Qt, level, message);
+    }
+}
+
+bool parseLevel(const QString &name, LogLevel *level) {
+    static const QStringList names = {"debug", "info", "warning", "error", "off"};
+    qsizetype index = names.indexOf(name.trimmed().toLower());
+    if (index < 0) {
+        return false;
+    }
+    *level = LogLevel(index);
+    return true;
+}
+
+}
+
+std::atomic<quint8> Logger::thresholds[int(LogCategory::Count)] = {
+    quint8(defaultLevel), quint8(defaultLevel), quint8(defaultLevel), quint8(defaultLevel), quint8(defaultLevel),
+    quint8(defaultLevel), quint8(defaultLevel), quint8(defaultLevel), quint8(defaultLevel), quint8(defaultLevel),
+};
+static_assert(int(LogCategory::Count) == 10);
+
+void Logger::setLevel(LogCategory category, LogLevel level) {
+    thresholds[int(category)].store(quint8(level), std::memory_order_relaxed);
+}
+
+void Logger::setLevel(LogLevel level) {
+    for (int i = 0; i < int(LogCategory::Count); ++i) {
+        setLevel(LogCategory(i), level);
+    }
+}
+
+bool Logger::configure(const QString &rules) {
+    bool valid = true;
+    for (const QString &rule : rules.split(',', Qt::SkipEmptyParts)) {
+        QString name = rule.section('=', 0, 0).trimmed().toLower();
+        LogLevel level;
+        if (!rule.contains('=') || !parseLevel(rule.section('=', 1), &level)) {
+            valid = false;
+            continue;
+        }
+        if (name == "*") {
+            setLevel(level);
+            continue;
+        }
+        bool found = false;
+        for (int i = 0; i < int(LogCategory::Count); ++i) {
+            if (name == QLatin1String(categoryNames[i])) {
+                setLevel(LogCategory(i), level);
+                found = true;
+            }
+        }
+        valid = valid && found;
+    }
+    return valid;
+}
+
+void Logger::start() {
+    LoggerState &logger = state();
+    if (logger.running.load()) {
+        return;
+    }
+    QString rules = qEnvironmentVariable("P2PCHAT_LOG");
+    if (!rules.isEmpty() && !configure(rules)) {
+        std::fprintf(stderr, "P2PCHAT_LOG 中有无法识别的规则: %s\n", rules.toLocal8Bit().constData());
+    }
+    QString filePath = qEnvironmentVariable("P2PCHAT_LOG_FILE");
+    if (!filePath.isEmpty()) {
+        logger.file = std::fopen(QFile::encodeName(filePath).constData(), "ab");
+    }
+
+    logger.stopping = false;
+    logger.drainThread = std::thread(drain, std::ref(logger));
+    logger.running.store(true);
+    logger.previousHandler = qInstallMessageHandler(qtMessageHandler);
+}
+
+void Logger::stop() {
+    LoggerState &logger = state();
+    if (!logger.running.exchange(false)) {
+        return;
+    }
+    qInstallMessageHandler(logger.previousHandler);
+    {
+        std::lock_guard<std::mutex> lock(logger.wakeMutex);
+        logger.stopping = true;
+    }
+    logger.wake.notify_one();
+    logger.drainThread.join();
+    if (logger.file) {
+        std::fclose(logger.file);
+        logger.file = nullptr;
+    }
+}
+
+void Logger::write(LogCategory category, LogLevel level, QStringView text) {
+    // QDebug 在每项后面补空格，最后一个不要
+    while (text.endsWith(u' ')) {
+        text.chop(1);
+    }
+    LoggerState &logger = state();
+    QByteArray utf8 = text.toUtf8();
+    if (!logger.running.load(std::memory_order_acquire)) {
+        output(nullptr, nowMs(), category, level, utf8.constData(), utf8Prefix(utf8, maxLineBytes), utf8.size());
+        return;
+    }
+    if (!logger.ring.push(category, level, nowMs(), utf8)) {
+        Metrics::process().logDropped.add();
+        return;
+    }
+    // 调试日志等定时批量写出，警告和错误尽快写出
+    if (level >= LogLevel::Warning) {
+        logger.wake.notify_one();
+    }
+}
+
+QString Logger::truncated(QStringView text, qsizetype maxChars) {
+    if (text.size() <= maxChars) {
+        return text.toString();
+    }
+    return QString("%1…（共 %2 字符）").arg(text.left(maxChars)).arg(text.size());
+}
+
+const char *Logger::categoryName(LogCategory category) {
+    return int(category) < int(LogCategory::Count) ? categoryNames[int(category)] : "?";
+}
@@ -0,0 +1,92 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <QString>
+#include <QStringView>
+#include <QDebug>
+#include <atomic>
+
+enum class LogLevel : quint8 {
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off,
+};
+
+enum class LogCategory : quint8 {
+    Network,     // NetworkManager 的发送、接收和分发
+    Discovery,   // UDP 发现
+    Transport,   // 明文 TCP 连接
+    Secure,      // 加密会话
+    Outbox,      // 发件箱和补发
+    Sync,        // 历史同步
+    Files,       // 文件共享
+    Storage,     // 聊天历史、搜索索引、指标文件
+    Ui,
+    Qt,          // 经 qDebug/qWarning 输出的其他日志（含 Qt 自身）
+    Count,
+};
+
+// 异步日志。调用方只做级别判断、格式化成一行文本并拷进无锁环形缓冲区，
+// 时间格式化和写 stderr/文件都在后台线程做，网络线程和 GUI 线程不会被 I/O 阻塞。
+// 级别低于阈值时宏展开后只剩一次原子读，参数表达式不会求值。
+// 每行最多保留 maxLineBytes 字节（UTF-8），超出部分截断并注明原长；
+// 缓冲区写满时丢弃新日志并计入 ProcessMetrics::logDropped。
+// 阈值默认调试构建为 Debug、发布构建为 Info，可以用环境变量 P2PCHAT_LOG 覆盖，
+// 格式同 configure()；P2PCHAT_LOG_FILE 指定时另外追加写到该文件。
+class Logger {
+public:
+    static constexpr int maxLineBytes = 480;
+    static constexpr int ringCapacity = 4096;    // 2 的幂
+
+    static bool isEnabled(LogCategory category, LogLevel level) {
+        return quint8(level) >= thresholds[int(category)].load(std::memory_order_relaxed);
+    }
+
+    static void setLevel(LogCategory category, LogLevel level);
+    static void setLevel(LogLevel level);
+
+    // 规则形如 "network=debug,secure=debug,*=warning"，后面的覆盖前面的；有无法识别的项时返回 false
+    static bool configure(const QString &rules);
+
+    // 启动后台线程并接管 qDebug 等输出；stop() 写完缓冲区中剩余的日志后返回。
+    // 未启动时 write() 直接同步写 stderr
+    static void start();
+    static void stop();
+
+    static void write(LogCategory category, LogLevel level, QStringView text);
+
+    // 日志里引用消息正文等可能很长的内容时用它，只保留开头
+    static QString truncated(QStringView text, qsizetype maxChars = 80);
+
+    static const char *categoryName(LogCategory category);
+
+private:
+    static std::atomic<quint8> thresholds[int(LogCategory::Count)];
+};
+
+// 一行日志：析构时写入，用法同 qDebug()
+class LogLine {
+public:
+    LogLine(LogCategory category, LogLevel level) : category(category), level(level), stream(&text) {}
+    ~LogLine() { Logger::write(category, level, text); }
+    QDebug &debug() { return stream; }
+
+private:
+    LogCategory category;
+    LogLevel level;
+    QString text;
+    QDebug stream;
+};
+
+#define P2P_LOG(category, level) \
+    if (!Logger::isEnabled(LogCategory::category, LogLevel::level)) {} \
+    else LogLine(LogCategory::category, LogLevel::level).debug()
+
+#define LOG_DEBUG(category) P2P_LOG(category, Debug)
+#define LOG_INFO(category) P2P_LOG(category, Info)
+#define LOG_WARNING(category) P2P_LOG(category, Warning)
+#define LOG_ERROR(category) P2P_LOG(category, Error)
+
+#endif // LOGGER_H
@@ -0,0 +1,161 @@
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+#include <QHash>
+#include <QList>
+#include <functional>
+#include <list>
+#include "metrics.h"
+
+// 按字节预算淘汰的 LRU 缓存。每个条目的大小由 cost 估算，总量超过预算时
+// 从最久未用的条目开始处理：给了 spill 时先尝试把内容转存到磁盘（条目保留，
+// 大小重新估算，通常变为 0），转存失败或没有 spill 时删除条目。大小为 0 的条目不参与淘汰。
+// 刚插入或访问的条目即使单独超过预算也保留，返回给调用方的指针在下一次插入前有效。
+// 只在一个线程使用。
+template <typename Key, typename Value>
+class LruCache {
+public:
+    using CostFunction = std::function<qint64(const Value &)>;
+    using SpillFunction = std::function<bool(const Key &, Value &)>;
+
+    explicit LruCache(CostFunction cost, SpillFunction spill = nullptr, CacheMetrics *metrics = nullptr)
+        : cost(std::move(cost)), spill(std::move(spill)), metrics(metrics) {
+        report();
+    }
+
+    // 小于等于 0 表示不限
+    void setBudget(qint64 bytes) {
+        budgetBytes = bytes;
+        trim(nullptr);
+        report();
+    }
+    qint64 budget() const { return budgetBytes; }
+    qint64 bytes() const { return totalBytes; }
+    qsizetype size() const { return index.size(); }
+
+    bool contains(const Key &key) const { return index.contains(key); }
+
+    // 插入或替换，标为最近使用
+    Value &insert(const Key &key, const Value &value) {
+        auto it = index.value(key, order.end());
+        if (it != order.end()) {
+            totalBytes -= it->cost;
+            it->value = value;
+            order.splice(order.begin(), order, it);
+        } else {
+            order.push_front(Node{key, value, 0});
+            index.insert(key, order.begin());
+        }
+        Node &node = order.front();
+        node.cost = cost(node.value);
+        totalBytes += node.cost;
+        trim(&node);
+        report();
+        return node.value;
+    }
+
+    // 查找并标为最近使用，不存在时返回 nullptr
+    Value *find(const Key &key) {
+        auto it = index.value(key, order.end());
+        if (it == order.end()) {
+            return nullptr;
+        }
+        order.splice(order.begin(), order, it);
+        return &it->value;
+    }
+
+    // 不改变使用顺序
+    Value *peek(const Key &key) {
+        auto it = index.value(key, order.end());
+        return it == order.end() ? nullptr : &it->value;
+    }
+
+    // 修改了 find()/peek() 返回的值后调用，重新估算大小
+    void updated(const Key &key) {
+        auto it = index.value(key, order.end());
+        if (it == order.end()) {
+            return;
+        }
+        qint64 newCost = cost(it->value);
+        totalBytes += newCost - it->cost;
+        it->cost = newCost;
+        trim(&*it);
+        report();
+    }
+
+    bool remove(const Key &key) {
+        auto it = index.value(key, order.end());
+        if (it == order.end()) {
+            return false;
+        }
+        totalBytes -= it->cost;
+        index.remove(key);
+        order.erase(it);
+        report();
+        return true;
+    }
+
+    // 从最近到最久
+    QList<Key> keys() const {
+        QList<Key> result;
+        result.reserve(index.size());
+        for (const Node &node : order) {
+            result.append(node.key);
+        }
+        return result;
+    }
+
+private:
+    struct Node {
+        Key key;
+        Value value;
+        qint64 cost;
+    };
+    using Iterator = typename std::list<Node>::iterator;
+
+    void trim(const Node *keep) {
+        if (budgetBytes <= 0) {
+            return;
+        }
+        auto it = order.end();
+        while (totalBytes > budgetBytes && it != order.begin()) {
+            --it;
+            if (&*it == keep || it->cost == 0) {
+                continue;
+            }
+            if (spill && spill(it->key, it->value)) {
+                qint64 newCost = cost(it->value);
+                totalBytes += newCost - it->cost;
+                it->cost = newCost;
+                if (metrics) {
+                    metrics->spills.add();
+                }
+                continue;
+            }
+            totalBytes -= it->cost;
+            index.remove(it->key);
+            it = order.erase(it);
+            if (metrics) {
+                metrics->evictions.add();
+            }
+        }
+    }
+
+    void report() {
+        if (metrics) {
+            metrics->bytes.set(totalBytes);
+            metrics->entries.set(index.size());
+            metrics->budget.set(budgetBytes);
+        }
+    }
+
+    CostFunction cost;
+    SpillFunction spill;
+    CacheMetrics *metrics;
+    qint64 budgetBytes = 0;
+    qint64 totalBytes = 0;
+    std::list<Node> order;            // 最近使用的在前
+    QHash<Key, Iterator> index;
+};
+
+#endif // LRUCACHE_H
@@ -1,9 +1,16 @@
 #include <QApplication>
 #include "loginwindow.h"
 #include "chatwindow.h"
+#include "startupprofiler.h"
+#include "logger.h"
+#include "stallwatchdog.h"
 
 int main(int argc, char *argv[]) {
+    StartupProfiler::start();
+    Logger::start();
     QApplication app(argc, argv);
+    StartupProfiler::mark("QApplication 创建");
+    StallWatchdog::start();
 
     // 设置应用程序信息
     app.setApplicationName("P2P Chat");
@@ -14,12 +21,16 @@ int main(int argc, char *argv[]) {
     // 创建登录窗口
     LoginWindow loginWindow;
     ChatWindow *chatWindow = nullptr;
+    StartupProfiler::mark("登录窗口构造");
 
     // 连接登录成功信号
     QObject::connect(&loginWindow, &LoginWindow::loginSuccess,
                     [&](const QString &username, const QString &avatarPath) {
+        StartupProfiler::mark("登录成功");
+
         // 创建聊天窗口，传入用户名和头像路径
         chatWindow = new ChatWindow(username, avatarPath);
+        StartupProfiler::mark("聊天窗口构造");
 
         // 显示聊天窗口
         chatWindow->show();
@@ -29,6 +40,7 @@ int main(int argc, char *argv[]) {
     });
 
     // 显示登录窗口
+    StartupProfiler::markAfterFirstPaint(&loginWindow, "登录窗口首帧");
     loginWindow.show();
 
     int result = app.exec();
@@ -37,6 +49,8 @@ int main(int argc, char *argv[]) {
     if (chatWindow) {
         delete chatWindow;
     }
+    StallWatchdog::stop();
+    Logger::stop();
 
     return result;
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include "memorybudget.h"
+#include <QFile>
+#include <QTextStream>
+
+qint64 MemoryBudget::parseSize(const QString &text, bool *ok) {
+    QString value = text.trimmed().toUpper();
+    int shift = 0;
+    if (value.endsWith('K')) {
+        shift = 10;
+    } else if (value.endsWith('M')) {
+        shift = 20;
+    } else if (value.endsWith('G')) {
+        shift = 30;
+    }
+    if (shift > 0) {
+        value.chop(1);
+    }
+    qint64 size = value.toLongLong(ok);
+    if (!*ok || size < 0 || size > (qint64(1) << (62 - shift))) {
+        *ok = false;
+        return 0;
+    }
+    return size << shift;
+}
+
+MemoryBudget MemoryBudget::load(const QString &path) {
+    MemoryBudget budget;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return budget;
+    }
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        QString line = in.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        QString key = line.section(' ', 0, 0);
+        bool ok = false;
+        qint64 size = parseSize(line.section(' ', 1), &ok);
+        if (!ok) {
+            continue;
+        }
+        if (key == "avatars") {
+            budget.avatarBytes = size;
+        } else if (key == "files") {
+            budget.fileBytes = size;
+        } else if (key == "chatview") {
+            budget.chatViewBytes = size;
+        }
+    }
+    return budget;
+}
@@ -0,0 +1,22 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QString>
+
+// 进程内缓存的内存预算。配置文件每行一项，# 开头为注释，大小可带 K/M/G 后缀，0 为不限：
+//   avatars <大小>     用户头像，超出时淘汰最久未用的
+//   files <大小>       随消息收到、尚未保存的文件内容，超出时转存到临时目录
+//   chatview <大小>    聊天视图的文档，超出时从历史重新加载最近一页
+struct MemoryBudget {
+    qint64 avatarBytes = qint64(16) << 20;
+    qint64 fileBytes = qint64(256) << 20;
+    qint64 chatViewBytes = qint64(64) << 20;
+
+    // 文件不存在或某项无效时用默认值
+    static MemoryBudget load(const QString &path);
+
+    // "512K"、"64M"、"1G" 或字节数
+    static qint64 parseSize(const QString &text, bool *ok);
+};
+
+#endif // MEMORYBUDGET_H
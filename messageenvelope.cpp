@@ -0,0 +1,211 @@
+#include "messageenvelope.h"
+#include "utf8codec.h"
+#include <QtEndian>
+
+namespace {
+
+template <typename T>
+T readLE(QByteArrayView data, qsizetype offset) {
+    return qFromLittleEndian<T>(data.data() + offset);
+}
+
+template <typename T>
+void writeLE(QByteArray &buffer, T value) {
+    char raw[sizeof(T)];
+    qToLittleEndian<T>(value, raw);
+    buffer.append(raw, sizeof(T));
+}
+
+// 预留长度字段后直接把 UTF-8 编码进 buffer，不经过临时 QByteArray。返回编码后的字节数
+qsizetype appendUtf8(QByteArray &buffer, const QString &value, qsizetype lengthField) {
+    qsizetype offset = buffer.size() + lengthField;
+    buffer.resize(offset + value.size() * 3);
+    qsizetype length = Utf8Codec::toUtf8(reinterpret_cast<const char16_t *>(value.constData()),
+                                         value.size(), buffer.data() + offset);
+    if (length < 0) {
+        QByteArray fallback = value.toUtf8();
+        length = fallback.size();
+        buffer.truncate(offset);
+        buffer.append(fallback);
+    }
+    buffer.truncate(offset + length);
+    return length;
+}
+
+}
+
+bool MessageEnvelope::hasMagic(QByteArrayView data) {
+    return data.size() >= 2 && readLE<quint16>(data, 0) == magic;
+}
+
+qsizetype MessageEnvelope::frameSize(QByteArrayView data) {
+    if (data.size() >= 2 && !hasMagic(data)) {
+        return -1;
+    }
+    if (data.size() < headerSize) {
+        return 0;
+    }
+
+    // 新版本可能加长头部，只要求固定偏移处的字段保持不变
+    quint16 declaredHeader = readLE<quint16>(data, 6);
+    quint32 payloadSize = readLE<quint32>(data, 32);
+    if (declaredHeader < headerSize || payloadSize > maxPayloadSize) {
+        return -1;
+    }
+
+    qsizetype total = qsizetype(declaredHeader) + payloadSize;
+    return data.size() >= total ? total : 0;
+}
+
+bool MessageEnvelope::parse(const QByteArray &frame, Envelope *out) {
+    qsizetype total = frameSize(frame);
+    if (total <= 0) {
+        return false;
+    }
+
+    QByteArrayView view(frame);
+    quint16 declaredHeader = readLE<quint16>(view, 6);
+    out->version = quint8(view[2]);
+    out->type = MessageType(quint8(view[3]));
+    out->flags = readLE<quint16>(view, 4);
+    out->messageId = readLE<quint64>(view, 8);
+    out->senderId = readLE<quint64>(view, 16);
+    out->timestamp = readLE<qint64>(view, 24);
+    out->frame = frame;
+    out->payload = QByteArrayView(out->frame).sliced(declaredHeader, total - declaredHeader);
+    out->conversation.clear();
+
+    if (out->flags & EnvelopeFlagConversation) {
+        PayloadReader reader(out->payload);
+        out->conversation = reader.string16();
+        out->payload = reader.rest();
+        if (!reader.ok()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+EnvelopeWriter::EnvelopeWriter(MessageType type, qsizetype payloadHint, const QString &conversation)
+    : messageType(type), conversationId(conversation) {
+    buffer.reserve(MessageEnvelope::headerSize + conversation.size() * 3 + 2 + payloadHint);
+    buffer.resize(MessageEnvelope::headerSize);
+    if (!conversationId.isEmpty()) {
+        string16(conversationId);
+    }
+}
+
+void EnvelopeWriter::u8(quint8 value) {
+    buffer.append(char(value));
+}
+
+void EnvelopeWriter::u16(quint16 value) {
+    writeLE(buffer, value);
+}
+
+void EnvelopeWriter::u32(quint32 value) {
+    writeLE(buffer, value);
+}
+
+void EnvelopeWriter::u64(quint64 value) {
+    writeLE(buffer, value);
+}
+
+void EnvelopeWriter::string16(const QString &value) {
+    qsizetype offset = buffer.size();
+    qsizetype length = appendUtf8(buffer, value, 2);
+    if (length > 0xffff) {
+        // 超长时截断，但不切开多字节序列
+        length = 0xffff;
+        while (length > 0 && (uchar(buffer.at(offset + 2 + length)) & 0xc0) == 0x80) {
+            --length;
+        }
+        buffer.truncate(offset + 2 + length);
+    }
+    qToLittleEndian<quint16>(quint16(length), buffer.data() + offset);
+}
+
+void EnvelopeWriter::string32(const QString &value) {
+    qsizetype offset = buffer.size();
+    qsizetype length = appendUtf8(buffer, value, 4);
+    qToLittleEndian<quint32>(quint32(length), buffer.data() + offset);
+}
+
+void EnvelopeWriter::bytes32(QByteArrayView value) {
+    u32(quint32(value.size()));
+    buffer.append(value);
+}
+
+void EnvelopeWriter::raw(QByteArrayView value) {
+    buffer.append(value);
+}
+
+QByteArray EnvelopeWriter::finish(quint64 messageId, quint64 senderId, qint64 timestamp, quint16 flags) {
+    if (!conversationId.isEmpty()) {
+        flags |= EnvelopeFlagConversation;
+    }
+    finishedMessageId = messageId;
+    finishedSenderId = senderId;
+
+    uchar *header = reinterpret_cast<uchar *>(buffer.data());
+    qToLittleEndian<quint16>(MessageEnvelope::magic, header);
+    header[2] = MessageEnvelope::currentVersion;
+    header[3] = quint8(messageType);
+    qToLittleEndian<quint16>(flags, header + 4);
+    qToLittleEndian<quint16>(MessageEnvelope::headerSize, header + 6);
+    qToLittleEndian<quint64>(messageId, header + 8);
+    qToLittleEndian<quint64>(senderId, header + 16);
+    qToLittleEndian<qint64>(timestamp, header + 24);
+    qToLittleEndian<quint32>(quint32(buffer.size() - MessageEnvelope::headerSize), header + 32);
+    qToLittleEndian<quint32>(0, header + 36);
+    return buffer;
+}
+
+quint8 PayloadReader::u8() {
+    QByteArrayView field = bytes(1);
+    return valid ? quint8(field[0]) : 0;
+}
+
+quint16 PayloadReader::u16() {
+    QByteArrayView field = bytes(2);
+    return valid ? qFromLittleEndian<quint16>(field.data()) : 0;
+}
+
+quint32 PayloadReader::u32() {
+    QByteArrayView field = bytes(4);
+    return valid ? qFromLittleEndian<quint32>(field.data()) : 0;
+}
+
+quint64 PayloadReader::u64() {
+    QByteArrayView field = bytes(8);
+    return valid ? qFromLittleEndian<quint64>(field.data()) : 0;
+}
+
+QByteArrayView PayloadReader::bytes(qsizetype length) {
+    if (!valid || length < 0 || length > data.size() - pos) {
+        valid = false;
+        return QByteArrayView();
+    }
+    QByteArrayView field = data.sliced(pos, length);
+    pos += length;
+    return field;
+}
+
+QByteArrayView PayloadReader::bytes32() {
+    quint32 length = u32();
+    return bytes(qsizetype(length));
+}
+
+QString PayloadReader::string16() {
+    quint16 length = u16();
+    return Utf8Codec::decode(bytes(length));
+}
+
+QString PayloadReader::string32() {
+    quint32 length = u32();
+    return Utf8Codec::decode(bytes(qsizetype(length)));
+}
+
+QByteArrayView PayloadReader::rest() {
+    return bytes(data.size() - pos);
+}
@@ -0,0 +1,136 @@
+#ifndef MESSAGEENVELOPE_H
+#define MESSAGEENVELOPE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QString>
+
+// 消息类型，决定负载的布局和分发到哪个处理函数
+enum class MessageType : quint8 {
+    Text = 1,
+    File = 2,
+    Sync = 3,      // 历史同步，见 HistorySync
+    FileOffer = 4,     // 文件信息和预览，内容按需拉取，见 FileShare
+    FileRequest = 5,
+    FileData = 6,
+    Trace = 7,     // 消息跟踪的时钟校准和时间报告，见 MessageTracer
+    FolderOffer = 8,   // 文件夹清单，内容通过 FileRequest 拉取，见 FolderManifest
+};
+
+// 文件消息中的文件类别
+enum FileKind : quint8 {
+    FileKindOther = 0,
+    FileKindImage = 1,
+    FileKindVideo = 2,
+};
+
+// 信封标志位
+enum EnvelopeFlag : quint16 {
+    EnvelopeFlagConversation = 0x0001,   // 负载以 string16 会话标识开头，见 Conversation
+};
+
+// 解析后的消息。payload 直接指向 frame 内部，frame 负责保持缓冲区有效，
+// 拷贝 Envelope 只增加 frame 的引用计数。
+struct Envelope {
+    quint8 version = 0;
+    MessageType type = MessageType::Text;
+    quint16 flags = 0;
+    quint64 messageId = 0;
+    quint64 senderId = 0;
+    qint64 timestamp = 0;      // 发送方的 HLC 时间戳，见 HybridClock
+    QString conversation;      // 空为大厅
+    QByteArrayView payload;    // 不含会话标识
+    QByteArray frame;
+};
+
+// 二进制信封格式（小端）：
+//   0  magic        u16  'P' 'C'
+//   2  version      u8
+//   3  type         u8
+//   4  flags        u16
+//   6  headerSize   u16  本版本为 40，新版本可追加字段
+//   8  messageId    u64
+//  16  senderId     u64
+//  24  timestamp    i64  HLC：高 48 位毫秒，低 16 位逻辑计数
+//  32  payloadSize  u32
+//  36  reserved     u32
+//  40  payload
+// TCP 流上按 headerSize + payloadSize 切帧，同一连接可以连续发送多帧。
+// (senderId, messageId) 唯一标识一条消息，接收方据此去重。
+class MessageEnvelope {
+public:
+    static constexpr quint16 magic = 0x4350;
+    static constexpr quint8 currentVersion = 1;
+    static constexpr int headerSize = 40;
+    // 最大的正常负载是文件区间回复（FileShare::maxRangeBytes，4 MiB）和文件夹清单
+    // （FolderManifest::maxBytes）；上限再大只会让对方用一个头部就让接收端缓存更多数据
+    static constexpr quint32 maxPayloadSize = 16u * 1024 * 1024;
+
+    // 数据开头是否是信封（否则按旧版文本协议处理）
+    static bool hasMagic(QByteArrayView data);
+
+    // 返回完整帧长度；数据不足返回 0；头部非法返回 -1
+    static qsizetype frameSize(QByteArrayView data);
+
+    // 解析一个完整帧，不复制负载；带会话标识时先取出它
+    static bool parse(const QByteArray &frame, Envelope *out);
+};
+
+// 负载写入器：先预留信封头，负载顺序追加，finish() 时回填头部，
+// 整个消息只在这一块缓冲区里构造一次。
+class EnvelopeWriter {
+public:
+    // conversation 非空时写在负载最前面，并在 finish() 时置上 EnvelopeFlagConversation
+    explicit EnvelopeWriter(MessageType type, qsizetype payloadHint = 0, const QString &conversation = QString());
+
+    MessageType type() const { return messageType; }
+    QString conversation() const { return conversationId; }
+
+    void u8(quint8 value);
+    void u16(quint16 value);
+    void u32(quint32 value);
+    void u64(quint64 value);
+    void string16(const QString &value);     // u16 长度 + UTF-8
+    void string32(const QString &value);     // u32 长度 + UTF-8
+    void bytes32(QByteArrayView value);      // u32 长度 + 原始字节
+    void raw(QByteArrayView value);          // 不带长度，放在负载末尾
+
+    QByteArray finish(quint64 messageId, quint64 senderId, qint64 timestamp, quint16 flags = 0);
+
+    // finish() 写入的标识，发送后本地记录历史时用
+    quint64 messageId() const { return finishedMessageId; }
+    quint64 senderId() const { return finishedSenderId; }
+
+private:
+    MessageType messageType;
+    quint64 finishedMessageId = 0;
+    quint64 finishedSenderId = 0;
+    QString conversationId;
+    QByteArray buffer;
+};
+
+// 负载读取器：按写入顺序读取字段，返回的字节视图指向原缓冲区。
+// 越界后 ok() 为 false，之后的读取都返回空值。
+class PayloadReader {
+public:
+    explicit PayloadReader(QByteArrayView data) : data(data) {}
+
+    bool ok() const { return valid; }
+
+    quint8 u8();
+    quint16 u16();
+    quint32 u32();
+    quint64 u64();
+    QByteArrayView bytes(qsizetype length);
+    QByteArrayView bytes32();
+    QString string16();
+    QString string32();
+    QByteArrayView rest();
+
+private:
+    QByteArrayView data;
+    qsizetype pos = 0;
+    bool valid = true;
+};
+
+#endif // MESSAGEENVELOPE_H
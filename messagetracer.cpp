@@ -0,0 +1,345 @@
+#include "messagetracer.h"
+#include "networkmanager.h"
+#include "conversation.h"
+#include "logger.h"
+#include <QTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <chrono>
+
+qint64 MessageTracer::nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+QString MessageTracer::hopName(Hop hop) {
+    switch (hop) {
+    case HopQueue: return "排队与连接";
+    case HopTransfer: return "传输";
+    case HopParse: return "解析";
+    case HopRender: return "显示";
+    case HopTotal: return "总计";
+    default: return QString();
+    }
+}
+
+MessageTracer::MessageTracer(NetworkManager *network, const QString &username, QObject *parent)
+    : QObject(parent), network(network), username(username) {
+    network->setHandler(MessageType::Trace, [this](const Envelope &envelope) {
+        onTraceEnvelope(envelope);
+    });
+    network->setTracer(this);
+
+    pingTimer = new QTimer(this);
+    pingTimer->setInterval(pingIntervalMs);
+    connect(pingTimer, &QTimer::timeout, this, [this]() {
+        sendPing();
+        expireTraces();
+    });
+
+    reportTimer = new QTimer(this);
+    reportTimer->setInterval(reportIntervalMs);
+    connect(reportTimer, &QTimer::timeout, this, &MessageTracer::flushReports);
+}
+
+void MessageTracer::setEnabled(bool enabled) {
+    if (this->enabled == enabled) {
+        return;
+    }
+    this->enabled = enabled;
+    if (enabled) {
+        sendPing();
+        pingTimer->start();
+    } else {
+        pingTimer->stop();
+        pending.clear();
+    }
+}
+
+bool MessageTracer::wantsReports(const QString &peerUsername) const {
+    return reportsWantedUntil.value(peerUsername) > nowUs();
+}
+
+void MessageTracer::messageWritten(const QString &peerUsername, quint64 messageId, qint64 sendUs, qint64 writeUs) {
+    pendingReports[peerUsername].append({messageId, sendUs, writeUs});
+}
+
+void MessageTracer::messageReceived(const Envelope &envelope, qint64 receiveUs, qint64 parseUs) {
+    if (!enabled || !isTraced(envelope.type)) {
+        return;
+    }
+    Pending &entry = pending[{envelope.senderId, envelope.messageId}];
+    entry.trace.senderId = envelope.senderId;
+    entry.trace.messageId = envelope.messageId;
+    entry.trace.receiveUs = receiveUs;
+    entry.trace.parseUs = parseUs;
+    if (entry.createdUs == 0) {
+        entry.createdUs = receiveUs;
+    }
+}
+
+void MessageTracer::messageAppended(quint64 senderId, quint64 messageId) {
+    Key key{senderId, messageId};
+    auto it = pending.find(key);
+    if (it == pending.end()) {
+        return;
+    }
+    it->trace.appendUs = nowUs();
+    tryComplete(key, false);
+}
+
+void MessageTracer::onTraceEnvelope(const Envelope &envelope) {
+    PayloadReader reader(envelope.payload);
+    QString sender = reader.string16();
+    quint8 op = reader.u8();
+    if (!reader.ok() || sender.isEmpty()) {
+        LOG_WARNING(Network) << "跟踪消息负载不完整";
+        return;
+    }
+
+    if (op == OpPing) {
+        qint64 t1 = nowUs();
+        qint64 t0 = qint64(reader.u64());
+        if (!reader.ok()) {
+            return;
+        }
+        // 对方在观察本节点发出的消息，接下来一段时间向它报告发送时刻
+        reportsWantedUntil.insert(sender, t1 + qint64(reportWindowMs) * 1000);
+        if (!reportTimer->isActive()) {
+            reportTimer->start();
+        }
+
+        EnvelopeWriter pong(MessageType::Trace, 64, Conversation::direct(sender));
+        pong.string16(username);
+        pong.u8(OpPong);
+        pong.u64(quint64(t0));
+        pong.u64(quint64(t1));
+        pong.u64(quint64(nowUs()));
+        network->send(pong, nullptr, NetworkManager::Delivery::Transient);
+    } else if (op == OpPong) {
+        qint64 t0 = qint64(reader.u64());
+        qint64 t1 = qint64(reader.u64());
+        qint64 t2 = qint64(reader.u64());
+        if (reader.ok()) {
+            onPong(envelope.senderId, t0, t1, t2);
+        }
+    } else if (op == OpReport) {
+        onReport(envelope.senderId, sender, reader);
+    }
+}
+
+void MessageTracer::onPong(quint64 senderId, qint64 t0, qint64 t1, qint64 t2) {
+    qint64 t3 = nowUs();
+    ClockSample sample;
+    sample.offsetUs = ((t1 - t0) + (t2 - t3)) / 2;
+    sample.rttUs = (t3 - t0) - (t2 - t1);
+    if (sample.rttUs < 0) {
+        return;
+    }
+    QList<ClockSample> &samples = clockSamples[senderId];
+    samples.append(sample);
+    if (samples.size() > clockSampleCount) {
+        samples.removeFirst();
+    }
+}
+
+bool MessageTracer::clockOffset(quint64 senderId, qint64 *offsetUs) const {
+    // 往返最快的样本受排队影响最小，偏差估计最准
+    const QList<ClockSample> samples = clockSamples.value(senderId);
+    if (samples.isEmpty()) {
+        return false;
+    }
+    const ClockSample *best = &samples.first();
+    for (const ClockSample &sample : samples) {
+        if (sample.rttUs < best->rttUs) {
+            best = &sample;
+        }
+    }
+    *offsetUs = best->offsetUs;
+    return true;
+}
+
+void MessageTracer::onReport(quint64 senderId, const QString &sender, PayloadReader &reader) {
+    if (!enabled) {
+        return;
+    }
+    quint32 count = reader.u32();
+    for (quint32 i = 0; i < count && reader.ok(); ++i) {
+        quint64 messageId = reader.u64();
+        qint64 sendUs = qint64(reader.u64());
+        qint64 writeUs = qint64(reader.u64());
+        if (!reader.ok()) {
+            break;
+        }
+        Key key{senderId, messageId};
+        auto it = pending.find(key);
+        if (it == pending.end()) {
+            // 报告比消息先到，先登记，等消息到达
+            it = pending.insert(key, Pending());
+            it->trace.senderId = senderId;
+            it->trace.messageId = messageId;
+            it->createdUs = nowUs();
+        }
+        it->trace.sender = sender;
+        it->peerSendUs = sendUs;
+        it->peerWriteUs = writeUs;
+        tryComplete(key, false);
+    }
+}
+
+void MessageTracer::tryComplete(const Key &key, bool force) {
+    auto it = pending.find(key);
+    if (it == pending.end()) {
+        return;
+    }
+    Pending &entry = it.value();
+    bool whole = entry.peerSendUs != 0 && entry.trace.receiveUs != 0 && entry.trace.appendUs != 0;
+    if (!whole && !force) {
+        return;
+    }
+    if (entry.trace.receiveUs == 0) {
+        // 只有报告，消息本身没收到（例如发给了别的会话或被丢弃）
+        pending.erase(it);
+        return;
+    }
+
+    Trace trace = entry.trace;
+    qint64 offset = 0;
+    if (entry.peerSendUs != 0 && clockOffset(trace.senderId, &offset)) {
+        trace.sendUs = entry.peerSendUs - offset;
+        trace.writeUs = entry.peerWriteUs - offset;
+    }
+    pending.erase(it);
+
+    if (trace.sendUs != 0) {
+        hops[HopQueue].record((trace.writeUs - trace.sendUs) * 1000);
+        hops[HopTransfer].record((trace.receiveUs - trace.writeUs) * 1000);
+    }
+    hops[HopParse].record((trace.parseUs - trace.receiveUs) * 1000);
+    if (trace.appendUs != 0) {
+        hops[HopRender].record((trace.appendUs - trace.parseUs) * 1000);
+        if (trace.sendUs != 0) {
+            hops[HopTotal].record((trace.appendUs - trace.sendUs) * 1000);
+        }
+    }
+
+    completed.append(trace);
+    if (completed.size() > maxCompletedTraces) {
+        completed.removeFirst();
+    }
+}
+
+void MessageTracer::expireTraces() {
+    qint64 cutoff = nowUs() - qint64(traceTimeoutMs) * 1000;
+    QList<Key> expired;
+    for (auto it = pending.cbegin(); it != pending.cend(); ++it) {
+        if (it->createdUs < cutoff) {
+            expired.append(it.key());
+        }
+    }
+    for (const Key &key : std::as_const(expired)) {
+        tryComplete(key, true);
+    }
+}
+
+void MessageTracer::sendPing() {
+    // 发到大厅，所有在线节点各回一个 pong。
+    // 跟踪消息都不进发件箱：晚到的往返时间对时钟偏差没有意义，积压还会挡在正常消息前面
+    EnvelopeWriter ping(MessageType::Trace, 32);
+    ping.string16(username);
+    ping.u8(OpPing);
+    ping.u64(quint64(nowUs()));
+    network->send(ping, nullptr, NetworkManager::Delivery::Transient);
+}
+
+void MessageTracer::flushReports() {
+    qint64 now = nowUs();
+    for (auto it = reportsWantedUntil.begin(); it != reportsWantedUntil.end();) {
+        if (it.value() <= now) {
+            pendingReports.remove(it.key());
+            it = reportsWantedUntil.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (reportsWantedUntil.isEmpty()) {
+        reportTimer->stop();
+    }
+
+    for (auto it = pendingReports.begin(); it != pendingReports.end(); ++it) {
+        const QList<ReportEntry> &entries = it.value();
+        if (entries.isEmpty()) {
+            continue;
+        }
+        EnvelopeWriter report(MessageType::Trace, 32 + entries.size() * 24, Conversation::direct(it.key()));
+        report.string16(username);
+        report.u8(OpReport);
+        report.u32(quint32(entries.size()));
+        for (const ReportEntry &entry : entries) {
+            report.u64(entry.messageId);
+            report.u64(quint64(entry.sendUs));
+            report.u64(quint64(entry.writeUs));
+        }
+        network->send(report, nullptr, NetworkManager::Delivery::Transient);
+    }
+    pendingReports.clear();
+}
+
+QByteArray MessageTracer::chromeTraceJson() const {
+    // 每个发送者一个进程轨道，每一段一个线程轨道，时间戳为本机时钟的微秒
+    QJsonArray events;
+    QHash<quint64, int> pids;
+    auto pidFor = [&](const Trace &trace) {
+        auto it = pids.constFind(trace.senderId);
+        if (it != pids.constEnd()) {
+            return it.value();
+        }
+        int pid = int(pids.size()) + 1;
+        pids.insert(trace.senderId, pid);
+        QJsonObject name;
+        name["name"] = "process_name";
+        name["ph"] = "M";
+        name["pid"] = pid;
+        name["args"] = QJsonObject{{"name", trace.sender.isEmpty() ? QString::number(trace.senderId, 16)
+                                                                   : trace.sender}};
+        events.append(name);
+        for (int hop = HopQueue; hop < HopTotal; ++hop) {
+            QJsonObject thread;
+            thread["name"] = "thread_name";
+            thread["ph"] = "M";
+            thread["pid"] = pid;
+            thread["tid"] = hop;
+            thread["args"] = QJsonObject{{"name", hopName(Hop(hop))}};
+            events.append(thread);
+        }
+        return pid;
+    };
+
+    for (const Trace &trace : completed) {
+        int pid = pidFor(trace);
+        const qint64 stamps[] = {trace.sendUs, trace.writeUs, trace.receiveUs, trace.parseUs, trace.appendUs};
+        for (int hop = HopQueue; hop < HopTotal; ++hop) {
+            qint64 begin = stamps[hop];
+            qint64 end = stamps[hop + 1];
+            if (begin == 0 || end == 0) {
+                continue;
+            }
+            QJsonObject event;
+            event["name"] = hopName(Hop(hop));
+            event["cat"] = "message";
+            event["ph"] = "X";
+            event["pid"] = pid;
+            event["tid"] = hop;
+            event["ts"] = double(begin);
+            event["dur"] = double(qMax<qint64>(0, end - begin));
+            event["args"] = QJsonObject{{"messageId", QString::number(trace.messageId, 16)}};
+            events.append(event);
+        }
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
@@ -0,0 +1,137 @@
+#ifndef MESSAGETRACER_H
+#define MESSAGETRACER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include "messageenvelope.h"
+#include "metrics.h"
+
+class NetworkManager;
+class QTimer;
+
+// 端到端消息跟踪（可选）。开启后记录每条收到的消息经过的各个时刻：
+//   发送：发送方调用 NetworkManager::send；
+//   写出：发送方把数据写进到本节点的连接（明文写完或被 TLS 层写出）；
+//   接收：本节点收齐整个消息帧；
+//   解析：信封解析和去重完成；
+//   显示：消息追加到聊天视图。
+// 前两个时刻在发送方，由发送方定期用 Trace 消息报告给开启了跟踪的接收方；
+// 发送方的时钟通过类似 NTP 的 ping 交换估算偏差，取往返时间最小的样本校正。
+// 只有观察的一方需要开启：对方收到 ping 后会在一段时间内向它报告。
+//   Trace：string16 用户名，u8 操作，之后按操作不同：
+//     Ping   u64 t0
+//     Pong   u64 t0，u64 t1（收到 ping），u64 t2（回复 pong）
+//     Report u32 条数，每条 u64 messageId，u64 发送时刻，u64 写出时刻
+// 时间均为各自墙上时钟的微秒数。
+class MessageTracer : public QObject {
+    Q_OBJECT
+
+public:
+    enum Hop { HopQueue, HopTransfer, HopParse, HopRender, HopTotal, HopCount };
+
+    static const int pingIntervalMs = 5000;
+    static const int reportIntervalMs = 1000;
+    static const int reportWindowMs = 30000;      // 收到 ping 后持续报告的时间
+    static const int traceTimeoutMs = 15000;      // 等不齐的跟踪超时后按已有的部分结束
+    static const int maxCompletedTraces = 5000;
+    static const int clockSampleCount = 8;
+
+    // 一条完成的跟踪，时间都换算到本机时钟（微秒），0 表示缺失
+    struct Trace {
+        quint64 senderId = 0;
+        quint64 messageId = 0;
+        QString sender;
+        qint64 sendUs = 0;
+        qint64 writeUs = 0;
+        qint64 receiveUs = 0;
+        qint64 parseUs = 0;
+        qint64 appendUs = 0;
+    };
+
+    static qint64 nowUs();
+    static QString hopName(Hop hop);
+
+    // 只跟踪会显示在聊天视图里的消息
+    static bool isTraced(MessageType type) {
+        return type == MessageType::Text || type == MessageType::File || type == MessageType::FileOffer;
+    }
+
+    MessageTracer(NetworkManager *network, const QString &username, QObject *parent = nullptr);
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled; }
+
+    // 发送方：对方是否在等本节点的报告
+    bool wantsReports(const QString &peerUsername) const;
+    void messageWritten(const QString &peerUsername, quint64 messageId, qint64 sendUs, qint64 writeUs);
+
+    // 接收方
+    void messageReceived(const Envelope &envelope, qint64 receiveUs, qint64 parseUs);
+    void messageAppended(quint64 senderId, quint64 messageId);
+
+    const LatencyHistogram &hopHistogram(Hop hop) const { return hops[hop]; }
+    QList<Trace> completedTraces() const { return completed; }
+
+    // Chrome trace-event 格式（chrome://tracing 或 Perfetto 可以打开）
+    QByteArray chromeTraceJson() const;
+
+private:
+    enum Op : quint8 { OpPing = 1, OpPong = 2, OpReport = 3 };
+
+    struct Key {
+        quint64 senderId;
+        quint64 messageId;
+        bool operator==(const Key &other) const {
+            return senderId == other.senderId && messageId == other.messageId;
+        }
+    };
+    friend size_t qHash(const Key &key, size_t seed) { return qHashMulti(seed, key.senderId, key.messageId); }
+
+    // 发送方的时刻先按对方时钟保存，结束时再用当时最好的偏差估计换算
+    struct Pending {
+        Trace trace;
+        qint64 peerSendUs = 0;
+        qint64 peerWriteUs = 0;
+        qint64 createdUs = 0;
+    };
+
+    struct ClockSample {
+        qint64 offsetUs = 0;    // 对方时钟 - 本机时钟
+        qint64 rttUs = 0;
+    };
+
+    struct ReportEntry {
+        quint64 messageId;
+        qint64 sendUs;
+        qint64 writeUs;
+    };
+
+    void onTraceEnvelope(const Envelope &envelope);
+    void onPong(quint64 senderId, qint64 t0, qint64 t1, qint64 t2);
+    void onReport(quint64 senderId, const QString &sender, PayloadReader &reader);
+    bool clockOffset(quint64 senderId, qint64 *offsetUs) const;
+    void sendPing();
+    void flushReports();
+    void expireTraces();
+    void tryComplete(const Key &key, bool force);
+
+    NetworkManager *network;
+    QString username;
+    bool enabled = false;
+    QTimer *pingTimer;
+    QTimer *reportTimer;
+
+    // 发送方
+    QHash<QString, qint64> reportsWantedUntil;        // 用户名 -> 截止时刻
+    QHash<QString, QList<ReportEntry>> pendingReports;
+
+    // 接收方
+    QHash<quint64, QList<ClockSample>> clockSamples;  // senderId -> 最近的样本
+    QHash<Key, Pending> pending;
+    QList<Trace> completed;
+    LatencyHistogram hops[HopCount];
+};
+
+#endif // MESSAGETRACER_H
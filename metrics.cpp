@@ -0,0 +1,239 @@
+#include "metrics.h"
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <memory>
+
+namespace {
+
+QMutex peersMutex;
+QHash<QString, std::shared_ptr<PeerMetrics>> peerTable;
+
+// 导出的累计桶边界：2^10 ns（约 1 微秒）到 2^40 ns（约 18 分钟），每 4 倍一档
+const int exportFirstMagnitude = 10;
+const int exportMagnitudeStep = 2;
+
+QString escapeLabel(const QString &value) {
+    QString escaped = value;
+    escaped.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+    return escaped;
+}
+
+void writeHeader(QTextStream &out, const char *name, const char *type, const char *help) {
+    out << "# HELP " << name << ' ' << help << '\n';
+    out << "# TYPE " << name << ' ' << type << '\n';
+}
+
+void writeHistogram(QTextStream &out, const char *name, const QString &labels, const LatencyHistogram &histogram) {
+    QString prefix = labels.isEmpty() ? QString() : labels + QLatin1Char(',');
+    for (int magnitude = exportFirstMagnitude; magnitude <= LatencyHistogram::maxMagnitude;
+         magnitude += exportMagnitudeStep) {
+        double bound = std::ldexp(1.0, magnitude) / 1e9;
+        out << name << "_bucket{" << prefix << "le=\"" << QString::number(bound, 'g', 6) << "\"} "
+            << histogram.countBelowPowerOfTwo(magnitude) << '\n';
+    }
+    out << name << "_bucket{" << prefix << "le=\"+Inf\"} " << histogram.count() << '\n';
+    QString braces = labels.isEmpty() ? QString() : QString("{%1}").arg(labels);
+    out << name << "_sum" << braces << ' ' << QString::number(histogram.sumNs() / 1e9, 'g', 12) << '\n';
+    out << name << "_count" << braces << ' ' << histogram.count() << '\n';
+}
+
+}
+
+int LatencyHistogram::bucketIndex(quint64 value) {
+    value = qMin<quint64>(value, quint64(maxValueNs));
+    if (value < quint64(subBuckets)) {
+        return int(value);
+    }
+    int magnitude = std::bit_width(value) - 1;
+    int shift = magnitude - subBucketBits;
+    return (shift + 1) * subBuckets + int((value >> shift) & (subBuckets - 1));
+}
+
+qint64 LatencyHistogram::bucketUpper(int index) {
+    if (index < subBuckets) {
+        return index;
+    }
+    int shift = index / subBuckets - 1;
+    qint64 lower = qint64(subBuckets + index % subBuckets) << shift;
+    return lower + (qint64(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(qint64 ns) {
+    ns = qMax<qint64>(ns, 0);
+    buckets[bucketIndex(quint64(ns))].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+}
+
+qint64 LatencyHistogram::percentileNs(double p) const {
+    quint64 samples = count();
+    if (samples == 0) {
+        return 0;
+    }
+    quint64 target = qMax<quint64>(1, quint64(std::ceil(qBound(0.0, p, 100.0) / 100.0 * double(samples))));
+    quint64 seen = 0;
+    for (int i = 0; i < bucketCount; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return bucketUpper(i);
+        }
+    }
+    // 读取期间有新样本进来，总数比各格之和大
+    return bucketUpper(bucketCount - 1);
+}
+
+quint64 LatencyHistogram::countBelowPowerOfTwo(int magnitude) const {
+    int end = magnitude <= subBucketBits ? (1 << qMax(magnitude, 0))
+                                         : (magnitude - subBucketBits + 1) * subBuckets;
+    end = qMin(end, bucketCount);
+    quint64 below = 0;
+    for (int i = 0; i < end; ++i) {
+        below += buckets[i].load(std::memory_order_relaxed);
+    }
+    return below;
+}
+
+PeerMetrics &Metrics::peer(const QString &ip) {
+    QMutexLocker locker(&peersMutex);
+    std::shared_ptr<PeerMetrics> &entry = peerTable[ip];
+    if (!entry) {
+        entry = std::make_shared<PeerMetrics>();
+    }
+    return *entry;
+}
+
+PeerMetrics &Metrics::incoming(const QHostAddress &address) {
+    QString key = peerKey(address);
+    QMutexLocker locker(&peersMutex);
+    std::shared_ptr<PeerMetrics> entry = peerTable.value(key);
+    if (!entry) {
+        std::shared_ptr<PeerMetrics> &unknown = peerTable[QString(unknownPeer)];
+        if (!unknown) {
+            unknown = std::make_shared<PeerMetrics>();
+        }
+        entry = unknown;
+    }
+    return *entry;
+}
+
+ProcessMetrics &Metrics::process() {
+    static ProcessMetrics metrics;
+    return metrics;
+}
+
+QString Metrics::peerKey(const QHostAddress &address) {
+    bool isV4 = false;
+    quint32 v4 = address.toIPv4Address(&isV4);
+    return isV4 ? QHostAddress(v4).toString() : address.toString();
+}
+
+QList<QPair<QString, const PeerMetrics *>> Metrics::peers() {
+    QList<QPair<QString, const PeerMetrics *>> result;
+    {
+        QMutexLocker locker(&peersMutex);
+        for (auto it = peerTable.cbegin(); it != peerTable.cend(); ++it) {
+            result.append({it.key(), it.value().get()});
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    return result;
+}
+
+QString Metrics::prometheusText() {
+    QString text;
+    QTextStream out(&text);
+    const auto peerList = peers();
+
+    struct PeerCounter {
+        const char *name;
+        const char *help;
+        const MetricCounter PeerMetrics::*member;
+    };
+    const PeerCounter counters[] = {
+        {"p2pchat_messages_sent_total", "Messages written to a peer, including outbox retries.",
+         &PeerMetrics::messagesSent},
+        {"p2pchat_bytes_sent_total", "Bytes written to a peer.", &PeerMetrics::bytesSent},
+        {"p2pchat_messages_received_total", "Frames received from a peer address.", &PeerMetrics::messagesReceived},
+        {"p2pchat_bytes_received_total", "Bytes received from a peer address.", &PeerMetrics::bytesReceived},
+        {"p2pchat_connect_failures_total", "Failed connections or writes to a peer.", &PeerMetrics::connectFailures},
+    };
+    for (const PeerCounter &counter : counters) {
+        writeHeader(out, counter.name, "counter", counter.help);
+        for (const auto &[ip, metrics] : peerList) {
+            out << counter.name << "{peer=\"" << escapeLabel(ip) << "\"} " << (metrics->*counter.member).get() << '\n';
+        }
+    }
+
+    struct PeerGauge {
+        const char *name;
+        const char *help;
+        const MetricGauge PeerMetrics::*member;
+    };
+    const PeerGauge gauges[] = {
+        {"p2pchat_outbox_messages", "Messages queued in the outbox for a peer.", &PeerMetrics::outboxMessages},
+        {"p2pchat_outbox_bytes", "Bytes queued in the outbox for a peer.", &PeerMetrics::outboxBytes},
+        {"p2pchat_session_pending", "Unacknowledged writes on the encrypted session to a peer.",
+         &PeerMetrics::sessionPending},
+    };
+    for (const PeerGauge &gauge : gauges) {
+        writeHeader(out, gauge.name, "gauge", gauge.help);
+        for (const auto &[ip, metrics] : peerList) {
+            out << gauge.name << "{peer=\"" << escapeLabel(ip) << "\"} " << (metrics->*gauge.member).get() << '\n';
+        }
+    }
+
+    writeHeader(out, "p2pchat_send_latency_seconds", "histogram",
+                "Time from sending to a peer until the data is written out.");
+    for (const auto &[ip, metrics] : peerList) {
+        writeHistogram(out, "p2pchat_send_latency_seconds", QString("peer=\"%1\"").arg(escapeLabel(ip)),
+                       metrics->sendLatency);
+    }
+
+    const ProcessMetrics &process = Metrics::process();
+    writeHeader(out, "p2pchat_discovery_beacons_total", "counter", "Discovery beacons processed.");
+    out << "p2pchat_discovery_beacons_total " << process.discoveryBeacons.get() << '\n';
+    writeHeader(out, "p2pchat_discovery_invalid_total", "counter", "Discovery datagrams that could not be parsed.");
+    out << "p2pchat_discovery_invalid_total " << process.discoveryInvalid.get() << '\n';
+    writeHeader(out, "p2pchat_frames_dropped_total", "counter",
+                "Frames dropped as malformed, duplicate or for a room not joined.");
+    out << "p2pchat_frames_dropped_total " << process.framesDropped.get() << '\n';
+    writeHeader(out, "p2pchat_frame_handling_seconds", "histogram", "Time to dispatch a received frame.");
+    writeHistogram(out, "p2pchat_frame_handling_seconds", QString(), process.frameHandling);
+    writeHeader(out, "p2pchat_gui_append_seconds", "histogram",
+                "Time to store, index and render one message in the chat view.");
+    writeHistogram(out, "p2pchat_gui_append_seconds", QString(), process.guiAppend);
+    writeHeader(out, "p2pchat_gui_stalls_total", "counter", "GUI event loop stalls over the watchdog threshold.");
+    out << "p2pchat_gui_stalls_total " << process.guiStalls.get() << '\n';
+    writeHeader(out, "p2pchat_gui_stall_seconds", "histogram", "Duration of each GUI event loop stall.");
+    writeHistogram(out, "p2pchat_gui_stall_seconds", QString(), process.guiStallDuration);
+    writeHeader(out, "p2pchat_log_dropped_total", "counter", "Log lines dropped because the log buffer was full.");
+    out << "p2pchat_log_dropped_total " << process.logDropped.get() << '\n';
+
+    const QPair<const char *, const CacheMetrics *> caches[] = {
+        {"avatars", &process.avatarCache},
+        {"files", &process.fileCache},
+        {"chat_view", &process.chatView},
+    };
+    auto writeCaches = [&](const char *name, const char *type, const char *help, auto member) {
+        writeHeader(out, name, type, help);
+        for (const auto &[label, cache] : caches) {
+            out << name << "{cache=\"" << label << "\"} " << (cache->*member).get() << '\n';
+        }
+    };
+    writeCaches("p2pchat_cache_bytes", "gauge", "Estimated memory held by an in-process cache.", &CacheMetrics::bytes);
+    writeCaches("p2pchat_cache_budget_bytes", "gauge", "Configured memory budget of an in-process cache.",
+                &CacheMetrics::budget);
+    writeCaches("p2pchat_cache_entries", "gauge", "Entries held by an in-process cache.", &CacheMetrics::entries);
+    writeCaches("p2pchat_cache_evictions_total", "counter", "Cache entries dropped to stay within the budget.",
+                &CacheMetrics::evictions);
+    writeCaches("p2pchat_cache_spills_total", "counter", "Cache entries moved to disk to stay within the budget.",
+                &CacheMetrics::spills);
+
+    out.flush();
+    return text;
+}
@@ -0,0 +1,121 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QString>
+#include <QList>
+#include <QPair>
+#include <QHostAddress>
+#include <array>
+#include <atomic>
+
+// 计数器，只增不减。所有指标都可以在任意线程更新，读取时不加锁
+class MetricCounter {
+public:
+    void add(quint64 n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    quint64 get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> value{0};
+};
+
+class MetricGauge {
+public:
+    void set(qint64 v) { value.store(v, std::memory_order_relaxed); }
+    void add(qint64 n) { value.fetch_add(n, std::memory_order_relaxed); }
+    qint64 get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> value{0};
+};
+
+// 延迟直方图（HDR 风格）：按 2 的幂分段，每段再等分 8 格，
+// 任意量级上的相对误差都不超过 12.5%。记录只是一次原子加，不分配内存。
+// 单位为纳秒，超过 maxValueNs（约 18 分钟）的记在最后一格。
+class LatencyHistogram {
+public:
+    static constexpr int subBucketBits = 3;
+    static constexpr int subBuckets = 1 << subBucketBits;
+    static constexpr int maxMagnitude = 40;
+    static constexpr qint64 maxValueNs = (qint64(1) << maxMagnitude) - 1;
+    static constexpr int bucketCount = (maxMagnitude - subBucketBits + 1) * subBuckets;
+
+    void record(qint64 ns);
+
+    quint64 count() const { return total.load(std::memory_order_relaxed); }
+    qint64 sumNs() const { return sum.load(std::memory_order_relaxed); }
+
+    // p 为 0-100，返回所在格的上界；没有数据时返回 0
+    qint64 percentileNs(double p) const;
+
+    // 小于 2^magnitude 纳秒的样本数，导出为 Prometheus 的累计桶
+    quint64 countBelowPowerOfTwo(int magnitude) const;
+
+private:
+    static int bucketIndex(quint64 value);
+    static qint64 bucketUpper(int index);
+
+    std::array<std::atomic<quint64>, bucketCount> buckets{};
+    std::atomic<quint64> total{0};
+    std::atomic<qint64> sum{0};
+};
+
+// 每个节点（按 IP）的指标
+struct PeerMetrics {
+    MetricCounter messagesSent;
+    MetricCounter bytesSent;
+    MetricCounter messagesReceived;
+    MetricCounter bytesReceived;
+    MetricCounter connectFailures;
+    MetricGauge outboxMessages;        // 发件箱中等待补发的消息
+    MetricGauge outboxBytes;
+    MetricGauge sessionPending;        // 加密长连接上已写入、尚未确认的数据块
+    LatencyHistogram sendLatency;      // 从发出到数据写完（明文）或被 TLS 层写出（加密）
+};
+
+// 进程内缓存的占用，见 LruCache
+struct CacheMetrics {
+    MetricGauge bytes;
+    MetricGauge entries;
+    MetricGauge budget;
+    MetricCounter evictions;           // 超出预算被删除的条目
+    MetricCounter spills;              // 超出预算转存到磁盘的条目
+};
+
+// 与节点无关的全局指标
+struct ProcessMetrics {
+    MetricCounter discoveryBeacons;    // 处理过的发现广播（含自己的）
+    MetricCounter discoveryInvalid;    // 无法解析的广播
+    MetricCounter framesDropped;       // 解析失败、重复或不属于已加入房间的消息帧
+    LatencyHistogram frameHandling;    // 收到一帧到处理函数返回
+    LatencyHistogram guiAppend;        // 一条消息写入历史、索引并渲染
+    MetricCounter guiStalls;           // GUI 事件循环卡顿次数，见 StallWatchdog
+    LatencyHistogram guiStallDuration; // 每次卡顿的持续时间
+    MetricCounter logDropped;          // 日志缓冲区写满时丢弃的日志行
+    CacheMetrics avatarCache;          // 用户头像
+    CacheMetrics fileCache;            // 随消息收到、尚未保存的文件内容
+    CacheMetrics chatView;             // 聊天视图的文档（估算）
+};
+
+// 指标注册表。节点的指标第一次用到时创建，地址在进程内不变，
+// 热路径上的调用方应当保存返回的引用，不必每次查表。
+class Metrics {
+public:
+    // 不是已知节点的来源地址（扫描端口的、中继转来的）合计在这一项下
+    static constexpr const char *unknownPeer = "unknown";
+
+    // 只对发现或发送过的节点调用，表的大小随节点数而不是连接来源增长
+    static PeerMetrics &peer(const QString &ip);
+    // 接收端按连接的对方地址取指标：已有该节点的项时用它，否则记在 unknownPeer 下，不新建
+    static PeerMetrics &incoming(const QHostAddress &address);
+    static ProcessMetrics &process();
+
+    // 监听 Any 时对方地址可能是 IPv4 映射的 IPv6 地址，统一成点分十进制
+    static QString peerKey(const QHostAddress &address);
+
+    static QList<QPair<QString, const PeerMetrics *>> peers();
+
+    // Prometheus 文本格式（0.0.4）
+    static QString prometheusText();
+};
+
+#endif // METRICS_H
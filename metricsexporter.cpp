@@ -0,0 +1,107 @@
+#include "metricsexporter.h"
+#include "metrics.h"
+#include "logger.h"
+#include <QTimer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QSaveFile>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+
+MetricsExporter::Settings MetricsExporter::loadSettings(const QString &path, const Settings &defaults) {
+    Settings settings = defaults;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return settings;
+    }
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        QString line = in.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        QString key = line.section(' ', 0, 0);
+        QString value = line.section(' ', 1).trimmed();
+        bool ok = false;
+        if (key == "file") {
+            settings.filePath = value;
+        } else if (key == "port") {
+            int port = value.toInt(&ok);
+            if (ok && port >= 0 && port <= 65535) {
+                settings.port = port;
+            }
+        } else if (key == "interval") {
+            int seconds = value.toInt(&ok);
+            if (ok && seconds > 0) {
+                settings.intervalSec = seconds;
+            }
+        }
+    }
+    return settings;
+}
+
+MetricsExporter::MetricsExporter(const Settings &settings, QObject *parent)
+    : QObject(parent), settings(settings) {
+    if (!settings.filePath.isEmpty()) {
+        QDir().mkpath(QFileInfo(settings.filePath).absolutePath());
+        timer = new QTimer(this);
+        connect(timer, &QTimer::timeout, this, &MetricsExporter::writeFile);
+        timer->start(settings.intervalSec * 1000);
+    }
+
+    if (settings.port > 0) {
+        // 只监听回环地址，指标里有对方 IP，不对局域网公开
+        server = new QTcpServer(this);
+        if (!server->listen(QHostAddress::LocalHost, quint16(settings.port))) {
+            LOG_WARNING(Storage) << "无法启动指标端口:" << settings.port << server->errorString();
+        } else {
+            connect(server, &QTcpServer::newConnection, this, &MetricsExporter::onConnection);
+            LOG_DEBUG(Storage) << "指标导出: http://127.0.0.1:" << settings.port << "/metrics";
+        }
+    }
+}
+
+void MetricsExporter::writeFile() {
+    QSaveFile file(settings.filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        LOG_WARNING(Storage) << "无法写入指标文件:" << settings.filePath;
+        return;
+    }
+    file.write(Metrics::prometheusText().toUtf8());
+    file.commit();
+}
+
+void MetricsExporter::onConnection() {
+    while (QTcpSocket *socket = server->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, socket, [socket]() {
+            // 只需要请求行，读到头部结束就回复；不是 GET 的一律 405
+            if (!socket->canReadLine() || !socket->peek(8192).contains("\r\n\r\n")) {
+                if (socket->bytesAvailable() > 8192) {
+                    socket->abort();
+                }
+                return;
+            }
+            QByteArray requestLine = socket->readLine().trimmed();
+            socket->readAll();
+
+            QByteArray status = "200 OK";
+            QByteArray body;
+            if (!requestLine.startsWith("GET ")) {
+                status = "405 Method Not Allowed";
+            } else if (!requestLine.startsWith("GET /metrics ") && !requestLine.startsWith("GET / ")) {
+                status = "404 Not Found";
+            } else {
+                body = Metrics::prometheusText().toUtf8();
+            }
+            QByteArray response = "HTTP/1.0 " + status + "\r\n"
+                                  "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                  "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                                  "Connection: close\r\n\r\n" + body;
+            socket->write(response);
+            socket->disconnectFromHost();
+        });
+    }
+}
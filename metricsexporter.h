@@ -0,0 +1,40 @@
+#ifndef METRICSEXPORTER_H
+#define METRICSEXPORTER_H
+
+#include <QObject>
+#include <QString>
+
+class QTimer;
+class QTcpServer;
+
+// 定期把 Metrics 以 Prometheus 文本格式导出：写到本地文件（原子替换，
+// 可配合 node_exporter 的 textfile 收集器），和/或在本机回环端口上提供 GET /metrics。
+// 配置文件每行一项，# 开头为注释：
+//   file <路径>       为空则不写文件
+//   port <端口>       0 为不监听
+//   interval <秒>
+class MetricsExporter : public QObject {
+    Q_OBJECT
+
+public:
+    struct Settings {
+        QString filePath;
+        int port = 0;
+        int intervalSec = 15;
+    };
+
+    // 文件不存在时使用 defaults
+    static Settings loadSettings(const QString &path, const Settings &defaults);
+
+    explicit MetricsExporter(const Settings &settings, QObject *parent = nullptr);
+
+private:
+    void writeFile();
+    void onConnection();
+
+    Settings settings;
+    QTimer *timer = nullptr;
+    QTcpServer *server = nullptr;
+};
+
+#endif // METRICSEXPORTER_H
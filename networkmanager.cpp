@@ -1,100 +1,462 @@
 #include "networkmanager.h"
+#include "utf8codec.h"
+#include "conversation.h"
+#include "metrics.h"
+#include "messagetracer.h"
+#include "logger.h"
+#ifdef P2PCHAT_IO_URING
+#include "uringserver.h"
+#endif
 #include <QHostAddress>
 #include <QNetworkInterface>
-#include <QDebug>
+#include <QRandomGenerator>
+#include <QDateTime>
+#include <QElapsedTimer>
 
-NetworkManager::NetworkManager(QObject *parent, const QString &username)
-    : QObject(parent), localUsername(username) {
+NetworkManager::NetworkManager(QObject *parent, const QString &username, const NetworkConfig &config)
+    : QObject(parent), localUsername(username), config(config) {
+    // 节点标识每次启动随机生成，消息编号从随机值开始递增
+    senderId = QRandomGenerator::global()->generate64();
+    nextMessageId = QRandomGenerator::global()->generate64();
 
-    // 获取本地IP
+    // 构造只保存参数，接口枚举和套接字绑定推迟到 start()，不阻塞窗口首帧
     localIP = QHostAddress(QHostAddress::LocalHost).toString();
-    auto interfaces = QNetworkInterface::allInterfaces();
+}
+
+void NetworkManager::start() {
+    if (udpDiscovery) {
+        return;
+    }
 
-    qDebug() << "=== 网络接口信息 ===";
+    // 获取本地IP：已启用、非回环接口上的 IPv4 地址（多个时取最后一个）；
+    // 指定了地址时直接使用，并且只在这个地址上监听
+    QString interfaceName;
+    const auto interfaces = config.localIP.isEmpty() ? QNetworkInterface::allInterfaces()
+                                                     : QList<QNetworkInterface>();
+    if (!config.localIP.isEmpty()) {
+        localIP = config.localIP;
+        bindAddress = QHostAddress(localIP);
+    }
     for (const auto &interface : interfaces) {
-        qDebug() << "接口:" << interface.humanReadableName();
-        qDebug() << "  状态: 上线" << interface.flags().testFlag(QNetworkInterface::IsUp)
-                 << "运行中" << interface.flags().testFlag(QNetworkInterface::IsRunning)
-                 << "回环" << interface.flags().testFlag(QNetworkInterface::IsLoopBack);
-
-        if (interface.flags().testFlag(QNetworkInterface::IsUp) &&
-            interface.flags().testFlag(QNetworkInterface::IsRunning) &&
-            !interface.flags().testFlag(QNetworkInterface::IsLoopBack)) {
-            for (const auto &addressEntry : interface.addressEntries()) {
-                QHostAddress addr = addressEntry.ip();
-                if (addr.protocol() == QAbstractSocket::IPv4Protocol && !addr.isLoopback()) {
-                    localIP = addr.toString();
-                    qDebug() << "  使用IP:" << localIP;
-                    qDebug() << "  广播地址:" << addressEntry.broadcast().toString();
-                    break;
-                }
+        if (!interface.flags().testFlag(QNetworkInterface::IsUp) ||
+            !interface.flags().testFlag(QNetworkInterface::IsRunning) ||
+            interface.flags().testFlag(QNetworkInterface::IsLoopBack)) {
+            continue;
+        }
+
+        for (const auto &addressEntry : interface.addressEntries()) {
+            QHostAddress addr = addressEntry.ip();
+            if (addr.protocol() == QAbstractSocket::IPv4Protocol && !addr.isLoopback()) {
+                localIP = addr.toString();
+                interfaceName = interface.humanReadableName();
+                break;
             }
         }
     }
-    qDebug() << "最终本地IP:" << localIP;
+    LOG_DEBUG(Network) << "本地IP:" << localIP << "接口:" << interfaceName;
+
+    fanOut = new FanOut(config.fanOutThreads, this);
+
+    // 发件箱先于发现服务创建，节点一出现就能补发上次没送达的消息
+    outbox = new Outbox(config.outboxDir.isEmpty() ? Outbox::storagePath(localUsername) : config.outboxDir, this);
+    connect(outbox, &Outbox::retryDue, this, &NetworkManager::flushOutbox);
 
     // 初始化UDP发现
-    udpDiscovery = new UDPDiscovery(this, localIP, localUsername);
+    DiscoverySettings discovery;
+    discovery.bindAddress = bindAddress;
+    discovery.port = config.discoveryPort;
+    discovery.targets = config.discoveryTargets;
+    discovery.chatPort = config.chatPort;
+    udpDiscovery = new UDPDiscovery(this, localIP, localUsername, joinedRooms, discovery);
     connect(udpDiscovery, &UDPDiscovery::packetReceived, this, &NetworkManager::onUDPPacketReceived);
 
     // 初始化TCP服务器
-    tcpServer = new TCPServer(this, chatPort);
-    connect(tcpServer, &TCPServer::messageReceived, this, &NetworkManager::onTCPMessageReceived);
+    startPlainServer();
+
+    startSecureServer();
+
+    LOG_DEBUG(Network) << "NetworkManager初始化完成";
+    LOG_DEBUG(Network) << "用户名:" << localUsername;
+    LOG_DEBUG(Network) << "聊天端口:" << config.chatPort;
+}
+
+void NetworkManager::startPlainServer() {
+#ifdef P2PCHAT_IO_URING
+    if (config.ioUring) {
+        if (UringServer::isSupported()) {
+            uringServer = new UringServer(this, config.chatPort, bindAddress);
+            connect(uringServer, &UringServer::frameReceived, this, &NetworkManager::onPlainFrameReceived);
+            connect(uringServer, &UringServer::legacyMessageReceived, this, &NetworkManager::onLegacyMessageReceived);
+            connect(uringServer, &UringServer::failed, this, &NetworkManager::onUringServerFailed);
+            if (!uringServer->isListening()) {
+                // 原因已由 UringServer 记录；端口不能因此没人监听
+                LOG_WARNING(Transport) << "io_uring 服务器启动失败，改用 Qt 套接字";
+                delete uringServer;
+                uringServer = nullptr;
+            }
+        } else {
+            LOG_WARNING(Transport) << "内核不支持 io_uring 多发接收，改用 Qt 套接字";
+        }
+    }
+#else
+    if (config.ioUring) {
+        LOG_WARNING(Transport) << "未以 ENABLE_IO_URING 构建，改用 Qt 套接字";
+    }
+#endif
+    if (!uringServer) {
+        tcpServer = new TCPServer(this, config.chatPort, bindAddress);
+        connect(tcpServer, &TCPServer::frameReceived, this, &NetworkManager::onPlainFrameReceived);
+        connect(tcpServer, &TCPServer::legacyMessageReceived, this, &NetworkManager::onLegacyMessageReceived);
+    }
+}
+
+void NetworkManager::onUringServerFailed() {
+#ifdef P2PCHAT_IO_URING
+    // 启动时已经换掉的服务器也可能发来排队的信号
+    if (!uringServer || uringServer->isListening()) {
+        return;
+    }
+    LOG_WARNING(Transport) << "io_uring 服务器出错停止，改用 Qt 套接字";
+    delete uringServer;
+    uringServer = nullptr;
+    config.ioUring = false;
+    startPlainServer();
+#endif
+}
+
+QList<Qt::HANDLE> NetworkManager::workerThreadIds() const {
+    QList<Qt::HANDLE> ids;
+    if (fanOut) {
+        ids = fanOut->threadIds();
+    }
+#ifdef P2PCHAT_IO_URING
+    if (uringServer) {
+        ids.append(uringServer->threadId());
+    }
+#endif
+    return ids;
+}
 
-    qDebug() << "NetworkManager初始化完成";
-    qDebug() << "用户名:" << localUsername;
-    qDebug() << "聊天端口:" << chatPort;
+void NetworkManager::setHandler(MessageType type, EnvelopeHandler handler) {
+    handlers[type] = std::move(handler);
 }
 
-void NetworkManager::sendMessageToAllPeers(const QString &message) {
-    if (peers.isEmpty()) {
-        qDebug() << "警告: 没有在线用户，消息未发送";
+void NetworkManager::setGroupKey(const QByteArray &key) {
+    if (key == groupKey) {
         return;
     }
+    groupKey = key;
+
+    // 旧会话用的是旧密钥，全部断开；其上未确认的数据以失败回调，回到发件箱，换用新密钥的会话重发
+    if (fanOut) {
+        fanOut->resetSessions();
+    }
+    if (udpDiscovery) {
+        startSecureServer();
+    }
+}
+
+void NetworkManager::startSecureServer() {
+    delete secureServer;
+    secureServer = nullptr;
+
+    if (!groupKey.isEmpty()) {
+        secureServer = new SecureServer(groupKey, this, config.securePort, bindAddress);
+        connect(secureServer, &SecureServer::frameReceived, this, &NetworkManager::onFrameReceived);
+    }
+    udpDiscovery->setSecurePort(secureServer && secureServer->isListening() ? config.securePort : 0);
+    LOG_DEBUG(Network) << "加密:" << (secureServer ? "已启用" : "未启用")
+             << "AES 硬件加速:" << SessionCrypto::hasAesHardware();
+}
+
+void NetworkManager::setRooms(const QStringList &rooms) {
+    joinedRooms = rooms;
+    if (udpDiscovery) {
+        udpDiscovery->setRooms(joinedRooms);
+    }
+}
+
+bool NetworkManager::isSubscriber(const PeerInfo &peer, const QString &conversation) const {
+    if (Conversation::isRoom(conversation)) {
+        // 旧版节点不会声明房间，自然收不到房间消息
+        return peer.rooms.contains(Conversation::target(conversation));
+    }
+    if (Conversation::isDirect(conversation)) {
+        return peer.username == Conversation::target(conversation);
+    }
+    return true;
+}
 
-    QString fullMessage = QString("[%1]: %2").arg(localUsername).arg(message);
-    qDebug() << "发送消息到" << peers.size() << "个用户";
+bool NetworkManager::isDeduplicated(MessageType type) {
+    // 过滤器每代只记 generationCapacity 条，一次大文件夹下载的上万个分段就会把它轮换掉，
+    // 之后发件箱和历史同步重发的聊天消息认不出来。其余类型重复到达时由各自的处理者忽略：
+    // 分段应答按请求编号只认第一份，同步和跟踪消息重复处理最多多一次往返，
+    // 同步带回的聊天消息经 deliverFrame 仍会去重
+    switch (type) {
+    case MessageType::Text:
+    case MessageType::File:
+    case MessageType::FileOffer:
+    case MessageType::FolderOffer:
+        return true;
+    default:
+        return false;
+    }
+}
 
-    for (auto it = peers.begin(); it != peers.end(); ++it) {
-        QString peerIP = it.value().ip;
-        QString peerName = it.value().username;
+quint64 NetworkManager::send(EnvelopeWriter &message, const std::function<QString()> &legacyText,
+                             Delivery delivery) {
+    quint64 stamp = clock.now();
+    qint64 sendUs = tracer && MessageTracer::isTraced(message.type()) ? MessageTracer::nowUs() : 0;
+    QString conversation = message.conversation();
 
-        if (peerIP == localIP) {
-            qDebug() << "跳过自己:" << peerName;
+    // 帧只序列化一次，所有接收者共用这块内容，按节点的加密和写入在 FanOut 的工作线程上并行。
+    // 没有接收者时也要写好标识：本地历史按它参与同步，以后上线的节点才能补到这条消息
+    QByteArray frame = message.finish(nextMessageId++, senderId, qint64(stamp));
+
+    QList<PeerInfo> recipients;
+    for (const PeerInfo &peer : std::as_const(peers)) {
+        if (peer.ip == localIP || !isSubscriber(peer, conversation)) {
+            continue;
+        }
+        if (isEncryptionEnabled() && peer.securePort == 0) {
+            LOG_DEBUG(Network) << "对方未启用加密，跳过:" << peer.username;
             continue;
         }
+        recipients.append(peer);
+    }
+    if (recipients.isEmpty()) {
+        LOG_DEBUG(Network) << "警告: 没有接收者，消息未发送:" << Conversation::displayName(conversation);
+        return stamp;
+    }
+
+    QByteArray legacyData;
+    LOG_DEBUG(Network) << "发送消息到" << Conversation::displayName(conversation) << "的" << recipients.size()
+             << "个用户, 帧大小" << frame.size();
+
+    for (const PeerInfo &peer : std::as_const(recipients)) {
+        // 旧版节点只认识文本协议，按需生成一次，所有旧版节点共用
+        QByteArray data = frame;
+        if (peer.protocolVersion == 0) {
+            if (legacyData.isEmpty() && legacyText) {
+                legacyData = Utf8Codec::encode(legacyText());
+            }
+            if (legacyData.isEmpty()) {
+                continue;
+            }
+            data = legacyData;
+        }
 
-        qDebug() << "  发送给:" << peerName << "(" << peerIP << ")";
-        TCPClient *client = new TCPClient(this);
-        connect(client, &TCPClient::destroyed, client, &QObject::deleteLater);
-        client->sendMessage(peerIP, chatPort, fullMessage);
+        LOG_DEBUG(Network) << "  发送给:" << peer.username << "(" << peer.ip << ")";
+        bool framed = peer.protocolVersion > 0;
+        sendToPeer(peer.ip, data, framed, delivery, framed && sendUs != 0 ? message.messageId() : 0, sendUs);
     }
+    return stamp;
 }
 
+void NetworkManager::sendToPeer(const QString &ip, const QByteArray &data, bool framed, Delivery delivery,
+                                quint64 traceId, qint64 sendUs) {
+    // 前面还有没补发完的消息时排到队尾，保证对方收到的顺序
+    bool queued = delivery == Delivery::Queued;
+    if (queued && outbox->hasPending(ip)) {
+        outbox->enqueue(ip, data, framed);
+        flushOutbox(ip);
+        return;
+    }
+
+    PeerMetrics &metrics = Metrics::peer(ip);
+    QElapsedTimer timer;
+    timer.start();
+
+    // 只有对方在跟踪本节点的消息时才报告，否则不保留任何记录
+    auto reportWritten = [this, ip, traceId, sendUs]() {
+        QString peerUsername = peers.value(ip).username;
+        if (traceId != 0 && tracer && tracer->wantsReports(peerUsername)) {
+            tracer->messageWritten(peerUsername, traceId, sendUs, MessageTracer::nowUs());
+        }
+    };
+
+    // 加密时走到该节点的长连接，多条消息共用一次握手
+    if (isEncryptionEnabled()) {
+        metrics.sessionPending.add(1);
+        fanOut->sendSecure(ip, peers.value(ip).securePort, groupKey, data,
+                           [this, ip, data, queued, &metrics, timer, reportWritten](bool delivered) {
+            metrics.sessionPending.add(-1);
+            recordSend(metrics, timer.nsecsElapsed(), data.size(), 1, delivered);
+            if (delivered) {
+                reportWritten();
+            } else if (queued) {
+                outbox->enqueue(ip, data, true);
+            }
+        });
+        return;
+    }
+
+    fanOut->sendPlain(ip, peers.value(ip).port, data,
+                      [this, ip, data, framed, queued, &metrics, timer, reportWritten](bool delivered) {
+        recordSend(metrics, timer.nsecsElapsed(), data.size(), 1, delivered);
+        if (delivered) {
+            reportWritten();
+        } else if (queued) {
+            outbox->enqueue(ip, data, framed);
+        }
+    });
+}
+
+void NetworkManager::recordSend(PeerMetrics &metrics, qint64 elapsedNs, qsizetype bytes, int messages,
+                                bool delivered) {
+    if (!delivered) {
+        metrics.connectFailures.add();
+        return;
+    }
+    metrics.messagesSent.add(quint64(messages));
+    metrics.bytesSent.add(quint64(bytes));
+    metrics.sendLatency.record(elapsedNs);
+}
+
+void NetworkManager::flushOutbox(const QString &ip) {
+    if (!peers.contains(ip)) {
+        return;
+    }
+
+    Outbox::Batch batch;
+    if (!outbox->takeBatch(ip, &batch)) {
+        return;
+    }
 
-void NetworkManager::onUDPPacketReceived(const QString &ip, const QString &username) {
-    qDebug() << "UDP发现新节点: IP =" << ip << "用户名 =" << username;
+    // 排队的帧拼成一块，在一个连接上一次写完
+    LOG_DEBUG(Outbox) << "补发" << batch.entries << "条消息给" << ip << ", 共" << batch.data.size() << "字节";
+    PeerMetrics &metrics = Metrics::peer(ip);
+    QElapsedTimer timer;
+    timer.start();
+    if (isEncryptionEnabled()) {
+        if (!batch.framed) {
+            LOG_DEBUG(Outbox) << "已启用加密，丢弃排队的明文旧版消息:" << ip;
+            outbox->confirm(ip);
+        } else if (peers.value(ip).securePort == 0) {
+            outbox->fail(ip);
+        } else {
+            metrics.sessionPending.add(1);
+            fanOut->sendSecure(ip, peers.value(ip).securePort, groupKey, batch.data,
+                               [this, ip, &metrics, timer, batch](bool delivered) {
+                metrics.sessionPending.add(-1);
+                recordSend(metrics, timer.nsecsElapsed(), batch.data.size(), batch.entries, delivered);
+                if (delivered) {
+                    outbox->confirm(ip);
+                } else {
+                    outbox->fail(ip);
+                }
+            });
+        }
+        return;
+    }
+
+    fanOut->sendPlain(ip, peers.value(ip).port, batch.data, [this, ip, &metrics, timer, batch](bool delivered) {
+        recordSend(metrics, timer.nsecsElapsed(), batch.data.size(), batch.entries, delivered);
+        if (delivered) {
+            outbox->confirm(ip);
+        } else {
+            outbox->fail(ip);
+        }
+    });
+}
+
+void NetworkManager::onUDPPacketReceived(const QString &ip, const QString &username, int protocolVersion,
+                                         const QStringList &rooms, int chatPort, int securePort) {
+    LOG_DEBUG(Discovery) << "UDP发现新节点: IP =" << ip << "用户名 =" << username << "协议版本 =" << protocolVersion;
 
     if (ip == localIP) {
-        qDebug() << "忽略自己的广播";
+        LOG_DEBUG(Discovery) << "忽略自己的广播";
         return;
     }
 
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    bool rediscovered = !peers.contains(ip) || now - peers[ip].lastSeenMs > peerSilenceMs;
+
     if (!peers.contains(ip)) {
         PeerInfo peer;
         peer.ip = ip;
         peer.username = username;
-        peer.port = chatPort;
+        peer.protocolVersion = protocolVersion;
         peers[ip] = peer;
+        // 指标表只为发现的节点建项，之后从这个地址收到的数据才单独统计
+        Metrics::peer(ip);
 
-        qDebug() << "新用户加入列表:" << username << "(" << ip << ")";
+        LOG_DEBUG(Discovery) << "新用户加入列表:" << username << "(" << ip << ")";
         emit peerDiscovered(ip, username);
     } else {
-        qDebug() << "用户已存在:" << username;
+        // 对方可能升级了客户端
+        peers[ip].protocolVersion = protocolVersion;
+        LOG_DEBUG(Discovery) << "用户已存在:" << username;
     }
+    peers[ip].lastSeenMs = now;
+    peers[ip].port = chatPort;
+    peers[ip].rooms = QSet<QString>(rooms.begin(), rooms.end());
+    peers[ip].securePort = securePort;
+
+    // 节点刚上线或重新出现时不必等退避到期
+    if (rediscovered) {
+        outbox->peerSeen(ip);
+    }
+    flushOutbox(ip);
 }
 
-void NetworkManager::onTCPMessageReceived(const QString &message) {
-    qDebug() << "收到TCP消息:" << message;
-    emit messageReceived(message);
+void NetworkManager::onFrameReceived(const QByteArray &frame) {
+    ProcessMetrics &metrics = Metrics::process();
+    QElapsedTimer timer;
+    timer.start();
+    qint64 receiveUs = tracer && tracer->isEnabled() ? MessageTracer::nowUs() : 0;
+
+    Envelope envelope;
+    if (!MessageEnvelope::parse(frame, &envelope)) {
+        LOG_WARNING(Network) << "无法解析消息帧，大小" << frame.size();
+        metrics.framesDropped.add();
+        return;
+    }
+
+    // 发送方按订阅过滤过，这里再挡一次刚退出的房间。
+    // 要在去重之前：丢掉的消息不能记为已收到，否则重新加入后历史同步和发件箱重发都会被当成重复
+    if (Conversation::isRoom(envelope.conversation) &&
+        !joinedRooms.contains(Conversation::target(envelope.conversation))) {
+        LOG_DEBUG(Network) << "忽略未加入房间的消息:" << envelope.conversation;
+        metrics.framesDropped.add();
+        return;
+    }
+
+    // 重传或经多条路径到达的同一条消息只处理一次
+    if (envelope.senderId == senderId ||
+        (isDeduplicated(envelope.type) && recentMessages.testAndInsert(envelope.senderId, envelope.messageId))) {
+        LOG_DEBUG(Network) << "忽略重复消息:" << envelope.messageId;
+        metrics.framesDropped.add();
+        return;
+    }
+    clock.observe(quint64(envelope.timestamp));
+
+    auto it = handlers.constFind(envelope.type);
+    if (it == handlers.constEnd()) {
+        LOG_DEBUG(Network) << "忽略未知类型的消息:" << int(envelope.type);
+        metrics.framesDropped.add();
+        return;
+    }
+    if (receiveUs != 0 && MessageTracer::isTraced(envelope.type)) {
+        tracer->messageReceived(envelope, receiveUs, MessageTracer::nowUs());
+    }
+    it.value()(envelope);
+    metrics.frameHandling.record(timer.nsecsElapsed());
+}
+
+void NetworkManager::onPlainFrameReceived(const QByteArray &frame) {
+    if (isEncryptionEnabled()) {
+        LOG_DEBUG(Network) << "已启用加密，丢弃明文消息帧，大小" << frame.size();
+        return;
+    }
+    onFrameReceived(frame);
+}
+
+void NetworkManager::onLegacyMessageReceived(const QString &message) {
+    if (isEncryptionEnabled()) {
+        LOG_DEBUG(Network) << "已启用加密，丢弃明文旧版消息";
+        return;
+    }
+    LOG_DEBUG(Network) << "收到旧版文本消息, 长度" << message.size() << Logger::truncated(message);
+    emit legacyMessageReceived(message, clock.now());
 }
\ No newline at end of file
@@ -4,42 +4,141 @@
 #include <QObject>
 #include <QString>
 #include <QMap>
+#include <QSet>
 #include <QTcpSocket>
 #include <QThread>
+#include <functional>
 #include "udpdiscovery.h"
 #include "tcpserver.h"
 #include "tcpclient.h"
+#include "messageenvelope.h"
+#include "hybridclock.h"
+#include "recentmessagefilter.h"
+#include "outbox.h"
+#include "securesession.h"
+#include "fanout.h"
 
 struct PeerInfo {
     QString ip;
     QString username;
     int port;
+    int protocolVersion = 0;   // 0 表示只支持旧版文本协议
+    qint64 lastSeenMs = 0;     // 最近一次收到它的广播
+    QSet<QString> rooms;       // 广播中声明加入的房间
+    int securePort = 0;        // 加密端口，0 表示对方未启用加密
 };
 
+// 网络参数。默认值即正常客户端：自动选择本机地址，监听所有接口，使用固定端口。
+// 负载测试在一台机器上模拟多个节点时，给每个节点指定自己的回环地址、端口和发现目标
+struct NetworkConfig {
+    QString localIP;                   // 为空时取非回环接口的地址；指定时所有端口只绑定在这个地址上
+    int discoveryPort = DiscoverySettings::defaultPort;
+    int chatPort = 12346;
+    int securePort = 12347;
+    QList<QHostAddress> discoveryTargets;   // 发现广播发往的地址，为空表示子网广播
+    QString outboxDir;                 // 为空时为 Outbox::storagePath(username)
+    int fanOutThreads = 0;             // 发送工作线程数，0 表示按 CPU 核数，见 FanOut
+    bool ioUring = false;              // 明文端口用 io_uring 接收（UringServer）；构建时未开启或内核不支持时仍用 TCPServer
+};
+
+struct PeerMetrics;
+class MessageTracer;
+class UringServer;
+
 class NetworkManager : public QObject {
     Q_OBJECT
 
 
 public:
-    explicit NetworkManager(QObject *parent = nullptr, const QString &username = "");
-    void sendMessageToAllPeers(const QString &message);
+    using EnvelopeHandler = std::function<void(const Envelope &)>;
+
+    // 发送失败时的处理：Queued 进入发件箱，对方上线后按顺序补发；
+    // Transient 只尝试一次，失败即丢弃，也不排在发件箱里的消息后面，
+    // 用于过一会儿就没用的消息（文件分段请求和应答、跟踪探测）
+    enum class Delivery { Queued, Transient };
+
+    explicit NetworkManager(QObject *parent = nullptr, const QString &username = "",
+                            const NetworkConfig &config = NetworkConfig());
+    void start();
+
+    // 按消息类型注册处理函数
+    void setHandler(MessageType type, EnvelopeHandler handler);
+
+    // 消息只序列化一次，按 message.conversation() 发给订阅者：大厅发给所有节点，
+    // 房间只发给加入了该房间的节点，私聊只发给对方。
+    // 旧版节点改发 legacyText() 生成的文本，没有旧版接收者时不会调用 legacyText。
+    // 返回这条消息的 HLC 时间戳，本地显示用它排序；没有接收者时同样分配时间戳和 message 的标识
+    quint64 send(EnvelopeWriter &message, const std::function<QString()> &legacyText = nullptr,
+                 Delivery delivery = Delivery::Queued);
+
+    // 本节点加入的房间（不带 # 前缀），通过发现广播告知其他节点
+    void setRooms(const QStringList &rooms);
+    QStringList rooms() const { return joinedRooms; }
+
+    // 组密钥（SessionCrypto::deriveKey 生成）。设置后只通过加密会话收发信封帧，
+    // 不再向未启用加密的节点发送明文，也丢弃明文端口收到的消息；空值关闭加密
+    void setGroupKey(const QByteArray &key);
+    bool isEncryptionEnabled() const { return !groupKey.isEmpty(); }
+
+    // 替本节点发送和接收的工作线程（FanOut 和 UringServer 的线程），负载测试把它们的 CPU 时间算到节点上
+    QList<Qt::HANDLE> workerThreadIds() const;
+
+    // 开启消息跟踪时，发送和接收路径上的时刻交给它记录
+    void setTracer(MessageTracer *tracer) { this->tracer = tracer; }
+
+    // 历史同步取回的消息帧，按收到的消息处理（同样去重和按房间过滤）
+    void deliverFrame(const QByteArray &frame) { onFrameReceived(frame); }
 
 signals:
-    void messageReceived(const QString &message);
+    // 旧版消息没有时钟，clock 为收到时的本地 HLC 时间戳
+    void legacyMessageReceived(const QString &message, quint64 clock);
     void peerDiscovered(const QString &ip, const QString &username);
 
 private slots:
-    void onUDPPacketReceived(const QString &ip, const QString &username);
-    void onTCPMessageReceived(const QString &message);
+    void onUDPPacketReceived(const QString &ip, const QString &username, int protocolVersion,
+                             const QStringList &rooms, int chatPort, int securePort);
+    void onPlainFrameReceived(const QByteArray &frame);
+    void onFrameReceived(const QByteArray &frame);
+    void onLegacyMessageReceived(const QString &message);
+    void flushOutbox(const QString &ip);
+    void onUringServerFailed();
 
 private:
+    // 直接发送，失败时进入发件箱；发件箱里已有消息时直接排队。Transient 的消息不经过发件箱
+    // traceId 非 0 时，写出后把发送和写出时刻报告给跟踪者
+    void sendToPeer(const QString &ip, const QByteArray &data, bool framed, Delivery delivery,
+                    quint64 traceId = 0, qint64 sendUs = 0);
+    static void recordSend(PeerMetrics &metrics, qint64 elapsedNs, qsizetype bytes, int messages, bool delivered);
+    bool isSubscriber(const PeerInfo &peer, const QString &conversation) const;
+    // 用户能看到的消息才记入去重过滤器，文件数据、同步和跟踪流量不占它的容量
+    static bool isDeduplicated(MessageType type);
+    void startSecureServer();
+    // 明文端口的接收端：按配置用 UringServer，不可用或启动失败时用 TCPServer
+    void startPlainServer();
+
     QString localIP;
     QString localUsername;
-    int chatPort = 12346;
+    NetworkConfig config;
+    QHostAddress bindAddress = QHostAddress::Any;
+    static const int peerSilenceMs = 15000;   // 超过这么久没有广播，再出现时视为重新上线
 
-    UDPDiscovery *udpDiscovery;
-    TCPServer *tcpServer;
+    UDPDiscovery *udpDiscovery = nullptr;
+    TCPServer *tcpServer = nullptr;
+    UringServer *uringServer = nullptr;   // 启用 NetworkConfig::ioUring 时代替 tcpServer
+    Outbox *outbox = nullptr;
+    SecureServer *secureServer = nullptr;
+    FanOut *fanOut = nullptr;   // 各节点的连接和加密会话，分布在工作线程上
+    QByteArray groupKey;
     QMap<QString, PeerInfo> peers;
+    QStringList joinedRooms;
+
+    quint64 senderId;
+    quint64 nextMessageId;
+    QMap<MessageType, EnvelopeHandler> handlers;
+    MessageTracer *tracer = nullptr;
+
+    HybridClock clock;
+    RecentMessageFilter recentMessages;
 };
 
 #endif // NETWORKMANAGER_H
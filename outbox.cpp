@@ -0,0 +1,281 @@
+#include "outbox.h"
+#include "metrics.h"
+#include "logger.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QRegularExpression>
+#include <QRandomGenerator>
+#include <QTimer>
+
+namespace {
+
+const QString queueSuffix = QStringLiteral(".queue");
+
+void writeEntry(QDataStream &out, qint64 enqueuedAt, bool framed, const QByteArray &data) {
+    out << enqueuedAt << framed << data;
+}
+
+}
+
+Outbox::Outbox(const QString &directory, QObject *parent)
+    : QObject(parent), outboxDir(directory) {
+    QDir dir(outboxDir);
+    if (!dir.exists()) {
+        dir.mkpath(".");
+    }
+
+    retryTimer = new QTimer(this);
+    retryTimer->setSingleShot(true);
+    connect(retryTimer, &QTimer::timeout, this, &Outbox::onRetryTimer);
+
+    load();
+}
+
+QString Outbox::fileFor(const QString &peer) const {
+    QString safeName = peer;
+    safeName.replace(QRegularExpression("[\\\\/:*?\"<>|]"), "_");
+    return QDir(outboxDir).filePath(safeName + queueSuffix);
+}
+
+void Outbox::load() {
+    const QStringList files = QDir(outboxDir).entryList({"*" + queueSuffix}, QDir::Files);
+    for (const QString &fileName : files) {
+        QFile file(QDir(outboxDir).filePath(fileName));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+
+        QString peer = fileName.chopped(queueSuffix.size());
+        Queue queue;
+        QDataStream in(&file);
+        in.setVersion(QDataStream::Qt_6_0);
+        while (!in.atEnd()) {
+            Entry entry;
+            in >> entry.enqueuedAt >> entry.framed >> entry.data;
+            if (in.status() != QDataStream::Ok) {
+                break;   // 上次写了一半的条目
+            }
+            queue.bytes += entry.data.size();
+            queue.entries.append(entry);
+        }
+        file.close();
+
+        trim(queue);
+        if (queue.entries.isEmpty()) {
+            QFile::remove(file.fileName());
+            continue;
+        }
+        rewrite(peer, queue);
+        LOG_DEBUG(Outbox) << "发件箱中有" << queue.entries.size() << "条待补发消息:" << peer;
+        queues.insert(peer, queue);
+    }
+}
+
+void Outbox::reportDepth(const QString &peer, const Queue &queue) {
+    PeerMetrics &metrics = Metrics::peer(peer);
+    metrics.outboxMessages.set(queue.entries.size());
+    metrics.outboxBytes.set(queue.bytes);
+}
+
+void Outbox::rewrite(const QString &peer, const Queue &queue) {
+    reportDepth(peer, queue);
+    if (queue.entries.isEmpty()) {
+        QFile::remove(fileFor(peer));
+        return;
+    }
+
+    QSaveFile file(fileFor(peer));
+    if (!file.open(QIODevice::WriteOnly)) {
+        LOG_WARNING(Outbox) << "无法写入发件箱:" << file.fileName();
+        return;
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    for (const Entry &entry : queue.entries) {
+        writeEntry(out, entry.enqueuedAt, entry.framed, entry.data);
+    }
+    file.commit();
+}
+
+bool Outbox::trim(Queue &queue) {
+    // 正在补发的条目不动，结果回来之前它们的位置不能变
+    qint64 cutoff = QDateTime::currentMSecsSinceEpoch() - maxAgeMs;
+    bool changed = false;
+    while (queue.entries.size() > queue.inFlight &&
+           (queue.entries.at(queue.inFlight).enqueuedAt < cutoff || queue.bytes > maxBytesPerPeer)) {
+        queue.bytes -= queue.entries.at(queue.inFlight).data.size();
+        queue.entries.removeAt(queue.inFlight);
+        changed = true;
+    }
+    return changed;
+}
+
+bool Outbox::hasPending(const QString &peer) const {
+    auto it = queues.constFind(peer);
+    return it != queues.constEnd() && !it->entries.isEmpty();
+}
+
+void Outbox::enqueue(const QString &peer, const QByteArray &data, bool framed) {
+    Queue &queue = queues[peer];
+    Entry entry;
+    entry.enqueuedAt = QDateTime::currentMSecsSinceEpoch();
+    entry.framed = framed;
+    entry.data = data;
+    queue.entries.append(entry);
+    queue.bytes += data.size();
+
+    if (trim(queue)) {
+        rewrite(peer, queue);
+    } else {
+        reportDepth(peer, queue);
+        QFile file(fileFor(peer));
+        if (file.open(QIODevice::Append)) {
+            QDataStream out(&file);
+            out.setVersion(QDataStream::Qt_6_0);
+            writeEntry(out, entry.enqueuedAt, entry.framed, entry.data);
+        }
+    }
+
+    // 新进队列的节点先按失败一次处理，等退避到期或收到它的广播再补发
+    if (queue.attempts == 0 && queue.inFlight == 0) {
+        queue.attempts = 1;
+        queue.nextAttemptAt = QDateTime::currentMSecsSinceEpoch() + initialBackoffMs;
+        scheduleRetry();
+    }
+}
+
+bool Outbox::takeBatch(const QString &peer, Batch *batch) {
+    auto it = queues.find(peer);
+    if (it == queues.end() || it->entries.isEmpty() || it->inFlight > 0) {
+        return false;
+    }
+    if (it->attempts > 0 && QDateTime::currentMSecsSinceEpoch() < it->nextAttemptAt) {
+        return false;
+    }
+    if (trim(*it)) {
+        rewrite(peer, *it);
+        if (it->entries.isEmpty()) {
+            queues.erase(it);
+            return false;
+        }
+    }
+
+    // 取出同一协议的最长前缀；旧版协议一次只取一条
+    batch->framed = it->entries.first().framed;
+    batch->data.clear();
+    batch->entries = 0;
+    qsizetype size = 0;
+    for (const Entry &entry : std::as_const(it->entries)) {
+        if (entry.framed != batch->framed) {
+            break;
+        }
+        size += entry.data.size();
+        ++batch->entries;
+        if (!batch->framed) {
+            break;
+        }
+    }
+    if (batch->entries == 1) {
+        batch->data = it->entries.first().data;
+    } else {
+        batch->data.reserve(size);
+        for (int i = 0; i < batch->entries; ++i) {
+            batch->data.append(it->entries.at(i).data);
+        }
+    }
+    it->inFlight = batch->entries;
+    return true;
+}
+
+void Outbox::confirm(const QString &peer) {
+    auto it = queues.find(peer);
+    if (it == queues.end()) {
+        return;
+    }
+
+    for (int i = 0; i < it->inFlight; ++i) {
+        it->bytes -= it->entries.takeFirst().data.size();
+    }
+    it->inFlight = 0;
+    it->attempts = 0;
+    rewrite(peer, *it);
+
+    if (it->entries.isEmpty()) {
+        queues.erase(it);
+        return;
+    }
+    // 补发期间又有新消息进来，接着发下一批
+    emit retryDue(peer);
+}
+
+void Outbox::fail(const QString &peer) {
+    auto it = queues.find(peer);
+    if (it == queues.end()) {
+        return;
+    }
+
+    it->inFlight = 0;
+    it->attempts += 1;
+    // 2s、4s、8s……封顶 5 分钟，加 ±20% 抖动，避免多个节点同时重试
+    qint64 backoff = qMin<qint64>(qint64(initialBackoffMs) << qMin(it->attempts - 1, 16), maxBackoffMs);
+    backoff += qint64(backoff * (QRandomGenerator::global()->bounded(40) - 20) / 100);
+    it->nextAttemptAt = QDateTime::currentMSecsSinceEpoch() + backoff;
+    LOG_DEBUG(Outbox) << "补发失败:" << peer << "第" << it->attempts << "次，" << backoff << "ms 后重试";
+    scheduleRetry();
+}
+
+void Outbox::peerSeen(const QString &peer) {
+    auto it = queues.find(peer);
+    if (it == queues.end() || it->inFlight > 0) {
+        return;
+    }
+    it->nextAttemptAt = 0;
+}
+
+void Outbox::scheduleRetry() {
+    qint64 earliest = -1;
+    for (const Queue &queue : std::as_const(queues)) {
+        if (queue.entries.isEmpty() || queue.inFlight > 0) {
+            continue;
+        }
+        if (earliest < 0 || queue.nextAttemptAt < earliest) {
+            earliest = queue.nextAttemptAt;
+        }
+    }
+    if (earliest < 0) {
+        retryTimer->stop();
+        return;
+    }
+    qint64 delay = qMax<qint64>(0, earliest - QDateTime::currentMSecsSinceEpoch());
+    retryTimer->start(int(qMin<qint64>(delay, maxBackoffMs)));
+}
+
+void Outbox::onRetryTimer() {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QStringList due;
+    for (auto it = queues.cbegin(); it != queues.cend(); ++it) {
+        if (!it->entries.isEmpty() && it->inFlight == 0 && it->nextAttemptAt <= now) {
+            due.append(it.key());
+        }
+    }
+    for (const QString &peer : due) {
+        emit retryDue(peer);
+        // 没有被取走说明节点当前不在线，等它的广播（peerSeen）或下一个周期
+        auto it = queues.find(peer);
+        if (it != queues.end() && it->inFlight == 0) {
+            it->nextAttemptAt = now + maxBackoffMs;
+        }
+    }
+    scheduleRetry();
+}
+
+QString Outbox::storagePath(const QString &username) {
+    QString configPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QString safeName = username;
+    safeName.replace(QRegularExpression("[\\\\/:*?\"<>|]"), "_");
+    return QDir(configPath).filePath("outbox/" + safeName);
+}
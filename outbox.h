@@ -0,0 +1,79 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QByteArray>
+#include <QString>
+
+class QTimer;
+
+// 发件箱：发送失败的消息按节点排队并落盘，节点恢复后合并成一次写入补发。
+// 每个节点一个 <ip>.queue 文件（QDataStream 追加写入），重启后仍会补发。
+// 失败后按指数退避重试；超过 maxAgeMs 或超出 maxBytesPerPeer 的旧消息丢弃。
+class Outbox : public QObject {
+    Q_OBJECT
+
+public:
+    static constexpr qint64 maxAgeMs = 24LL * 60 * 60 * 1000;
+    static constexpr qint64 maxBytesPerPeer = 64LL * 1024 * 1024;
+    static const int initialBackoffMs = 2000;
+    static const int maxBackoffMs = 5 * 60 * 1000;
+
+    // 一次补发的内容：信封帧可以在同一连接上连续发送，拼成一块；
+    // 旧版文本协议一个连接只能发一条
+    struct Batch {
+        QByteArray data;
+        int entries = 0;
+        bool framed = true;
+    };
+
+    explicit Outbox(const QString &directory, QObject *parent = nullptr);
+
+    // 有排队（或正在补发）的消息时，新消息也要排在后面，保证顺序
+    bool hasPending(const QString &peer) const;
+    void enqueue(const QString &peer, const QByteArray &data, bool framed);
+
+    // 取出下一批待发消息；队列为空、正在补发或退避未到期时返回 false
+    bool takeBatch(const QString &peer, Batch *batch);
+    void confirm(const QString &peer);   // 上一批已送达
+    void fail(const QString &peer);      // 上一批失败，进入退避
+
+    // 收到节点的广播，说明它在线：清除退避，允许立即补发
+    void peerSeen(const QString &peer);
+
+    static QString storagePath(const QString &username);
+
+signals:
+    void retryDue(const QString &peer);
+
+private:
+    struct Entry {
+        qint64 enqueuedAt = 0;
+        bool framed = true;
+        QByteArray data;
+    };
+
+    struct Queue {
+        QList<Entry> entries;
+        qint64 bytes = 0;
+        int inFlight = 0;          // 已取出、等待结果的条目数
+        int attempts = 0;
+        qint64 nextAttemptAt = 0;
+    };
+
+    QString fileFor(const QString &peer) const;
+    void load();
+    void rewrite(const QString &peer, const Queue &queue);
+    static void reportDepth(const QString &peer, const Queue &queue);
+    bool trim(Queue &queue);
+    void scheduleRetry();
+    void onRetryTimer();
+
+    QString outboxDir;
+    QHash<QString, Queue> queues;
+    QTimer *retryTimer;
+};
+
+#endif // OUTBOX_H
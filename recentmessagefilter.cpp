@@ -0,0 +1,51 @@
+#include "recentmessagefilter.h"
+
+namespace {
+
+quint64 mix64(quint64 x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+}
+
+RecentMessageFilter::RecentMessageFilter()
+    : current((1 << bitsLog2) / 64, 0), previous((1 << bitsLog2) / 64, 0) {
+}
+
+bool RecentMessageFilter::contains(const QList<quint64> &bits, quint64 h1, quint64 h2) const {
+    for (int i = 0; i < hashCount; ++i) {
+        quint64 bit = (h1 + quint64(i) * h2) & bitMask;
+        if (!(bits[bit >> 6] & (quint64(1) << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RecentMessageFilter::testAndInsert(quint64 senderId, quint64 messageId) {
+    // 双重哈希：h1 + i * h2 生成 k 个位置，h2 取奇数保证各位置不同
+    quint64 h1 = mix64(senderId ^ mix64(messageId));
+    quint64 h2 = mix64(h1) | 1;
+
+    if (contains(current, h1, h2) || contains(previous, h1, h2)) {
+        return true;
+    }
+
+    if (currentCount >= generationCapacity) {
+        previous.swap(current);
+        current.fill(0);
+        currentCount = 0;
+    }
+
+    for (int i = 0; i < hashCount; ++i) {
+        quint64 bit = (h1 + quint64(i) * h2) & bitMask;
+        current[bit >> 6] |= quint64(1) << (bit & 63);
+    }
+    ++currentCount;
+    return false;
+}
@@ -0,0 +1,32 @@
+#ifndef RECENTMESSAGEFILTER_H
+#define RECENTMESSAGEFILTER_H
+
+#include <QtGlobal>
+#include <QList>
+
+// 最近收到的消息集合，用于去重（重传、多路径到达）。
+// 两代轮换的布隆过滤器：当前代写满 generationCapacity 条后，
+// 上一代被清空并成为新的当前代，内存固定，记住最近 1~2 代的消息。
+// 每代 2^20 位、7 个哈希，满载时两代合计误判率约 3e-9。
+class RecentMessageFilter {
+public:
+    static constexpr int generationCapacity = 8192;
+
+    RecentMessageFilter();
+
+    // 如果消息可能已经见过返回 true；否则记录下来并返回 false
+    bool testAndInsert(quint64 senderId, quint64 messageId);
+
+private:
+    static constexpr int bitsLog2 = 20;
+    static constexpr int hashCount = 7;
+    static constexpr quint64 bitMask = (quint64(1) << bitsLog2) - 1;
+
+    bool contains(const QList<quint64> &bits, quint64 h1, quint64 h2) const;
+
+    QList<quint64> current;
+    QList<quint64> previous;
+    int currentCount = 0;
+};
+
+#endif // RECENTMESSAGEFILTER_H
@@ -0,0 +1,86 @@
+#include "searchdialog.h"
+#include <QVBoxLayout>
+#include <QDateTime>
+#include <QElapsedTimer>
+
+SearchDialog::SearchDialog(SearchIndex *index, QWidget *parent)
+    : QDialog(parent), index(index) {
+    setWindowTitle("搜索聊天记录");
+    resize(560, 480);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setSpacing(8);
+    layout->setContentsMargins(10, 10, 10, 10);
+
+    queryInput = new QLineEdit(this);
+    queryInput->setPlaceholderText("输入关键词，多个词用空格分隔；from:用户名 可按发送者过滤");
+    queryInput->setClearButtonEnabled(true);
+    queryInput->setStyleSheet("QLineEdit { "
+                              "padding: 8px; "
+                              "border: 1px solid #ccc; "
+                              "border-radius: 8px; "
+                              "font-size: 14px; "
+                              "}"
+                              "QLineEdit:focus { "
+                              "border-color: #4CAF50; "
+                              "}");
+    layout->addWidget(queryInput);
+
+    summaryLabel = new QLabel(this);
+    summaryLabel->setStyleSheet("color: #666; font-size: 12px;");
+    layout->addWidget(summaryLabel);
+
+    resultView = new QTextBrowser(this);
+    resultView->setFont(QFont("Microsoft YaHei", 10));
+    resultView->setStyleSheet("QTextBrowser { "
+                              "background-color: #f9f9f9; "
+                              "border: 1px solid #ccc; "
+                              "border-radius: 8px; "
+                              "padding: 8px; "
+                              "}");
+    layout->addWidget(resultView, 1);
+
+    // 输入停顿后再查询，避免每个按键都触发一次
+    debounceTimer = new QTimer(this);
+    debounceTimer->setSingleShot(true);
+    debounceTimer->setInterval(150);
+    connect(debounceTimer, &QTimer::timeout, this, &SearchDialog::runSearch);
+    connect(queryInput, &QLineEdit::textChanged, debounceTimer, qOverload<>(&QTimer::start));
+    connect(queryInput, &QLineEdit::returnPressed, this, &SearchDialog::runSearch);
+
+    summaryLabel->setText(QString("已索引 %1 条消息").arg(index->indexedCount()));
+}
+
+void SearchDialog::runSearch() {
+    debounceTimer->stop();
+    QString query = queryInput->text().trimmed();
+    if (query.isEmpty()) {
+        resultView->clear();
+        summaryLabel->setText(QString("已索引 %1 条消息").arg(index->indexedCount()));
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const QList<SearchHit> hits = index->search(query);
+    double elapsedMs = timer.nsecsElapsed() / 1e6;
+
+    QString html;
+    for (const SearchHit &hit : hits) {
+        QString time = QDateTime::fromMSecsSinceEpoch(hit.record.timestamp).toString("yyyy-MM-dd hh:mm:ss");
+        html += QString("<div style='margin: 6px 0;'>"
+                        "<span style='color: %1; font-weight: bold;'>%2</span>"
+                        "<span style='color: #999; font-size: 11px; margin-left: 8px;'>%3</span>"
+                        "<div style='color: #333; margin-top: 2px;'>%4</div>"
+                        "</div><hr>")
+                    .arg(hit.record.outgoing ? "#2196F3" : "#4CAF50")
+                    .arg(hit.record.sender.toHtmlEscaped())
+                    .arg(time)
+                    .arg(hit.snippetHtml);
+    }
+    resultView->setHtml(html);
+
+    summaryLabel->setText(QString("找到 %1 条结果（最多显示 50 条），用时 %2 ms")
+                          .arg(hits.size())
+                          .arg(elapsedMs, 0, 'f', 2));
+}
@@ -0,0 +1,28 @@
+#ifndef SEARCHDIALOG_H
+#define SEARCHDIALOG_H
+
+#include <QDialog>
+#include <QLineEdit>
+#include <QTextBrowser>
+#include <QLabel>
+#include <QTimer>
+#include "searchindex.h"
+
+class SearchDialog : public QDialog {
+    Q_OBJECT
+
+public:
+    explicit SearchDialog(SearchIndex *index, QWidget *parent = nullptr);
+
+private slots:
+    void runSearch();
+
+private:
+    SearchIndex *index;
+    QLineEdit *queryInput;
+    QTextBrowser *resultView;
+    QLabel *summaryLabel;
+    QTimer *debounceTimer;
+};
+
+#endif // SEARCHDIALOG_H
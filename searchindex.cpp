@@ -0,0 +1,413 @@
+#include "searchindex.h"
+#include "logger.h"
+#include <QDataStream>
+#include <QDir>
+#include <QSaveFile>
+#include <QSet>
+#include <QRegularExpression>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+#include <algorithm>
+
+namespace {
+
+const quint32 snapshotMagic = 0x53494458;   // "SIDX"
+const quint32 snapshotVersion = 1;
+const quint32 snapshotInterval = 2000;      // 每新增多少条记录保存一次快照
+const int maxWordLength = 32;               // 过长的"单词"（如 base64）只取前缀
+
+bool isCjk(char32_t ucs4) {
+    switch (QChar::script(ucs4)) {
+    case QChar::Script_Han:
+    case QChar::Script_Hiragana:
+    case QChar::Script_Katakana:
+    case QChar::Script_Hangul:
+    case QChar::Script_Bopomofo:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void appendVarint(QByteArray &data, quint32 value) {
+    while (value >= 0x80) {
+        data.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    data.append(char(value));
+}
+
+}
+
+SearchIndex::SearchIndex(ChatHistory *history)
+    : history(history), snapshotPath(QDir(history->directory()).filePath("search.idx")) {
+    // 记录数在本线程读取，后台只读这之前的记录，不与追加写入竞争
+    quint32 total = history->count();
+    pendingLoad = QtConcurrent::run([this, total]() { load(total); });
+}
+
+void SearchIndex::load(quint32 total) {
+    QElapsedTimer timer;
+    timer.start();
+
+    loadSnapshot();
+
+    // 快照之后新增的记录从历史中补建
+    quint32 caughtUp = 0;
+    while (nextId < total) {
+        QList<ChatRecord> page = history->records(nextId, int(qMin<quint32>(1000, total - nextId)));
+        if (page.isEmpty()) {
+            break;
+        }
+        for (const ChatRecord &record : page) {
+            index(nextId, record);
+            ++caughtUp;
+        }
+    }
+
+    LOG_DEBUG(Storage) << "搜索索引加载完成:" << nextId << "条记录," << postings.size() << "个词项,"
+             << "补建" << caughtUp << "条, 用时" << timer.elapsed() << "ms";
+}
+
+void SearchIndex::catchUp() {
+    pendingLoad.waitForFinished();
+    if (ready) {
+        return;
+    }
+    // 后台加载期间追加的记录通常只有几条
+    quint32 total = history->count();
+    while (nextId < total) {
+        QList<ChatRecord> page = history->records(nextId, 1000);
+        if (page.isEmpty()) {
+            break;
+        }
+        for (const ChatRecord &record : page) {
+            index(nextId, record);
+        }
+    }
+    ready = true;
+}
+
+SearchIndex::~SearchIndex() {
+    pendingLoad.waitForFinished();
+    if (nextId != snapshotId) {
+        saveSnapshot(true);
+    } else {
+        pendingSave.waitForFinished();
+    }
+}
+
+QStringList SearchIndex::tokenize(const QString &text, bool forQuery) {
+    QStringList tokens;
+    QString word;
+    QStringList cjkRun;
+
+    auto flushWord = [&]() {
+        if (!word.isEmpty()) {
+            tokens.append(word.left(maxWordLength));
+            word.clear();
+        }
+    };
+
+    // 中日韩文字没有空格分词：索引时存单字和相邻二元组，
+    // 查询时多字词只用二元组（更有区分度），单字查询才用单字
+    auto flushCjk = [&]() {
+        if (cjkRun.isEmpty()) {
+            return;
+        }
+        if (!forQuery || cjkRun.size() == 1) {
+            tokens.append(cjkRun);
+        }
+        for (int i = 0; i + 1 < cjkRun.size(); ++i) {
+            tokens.append(cjkRun[i] + cjkRun[i + 1]);
+        }
+        cjkRun.clear();
+    };
+
+    for (qsizetype i = 0; i < text.size(); ++i) {
+        char32_t ucs4 = text.at(i).unicode();
+        qsizetype length = 1;
+        if (text.at(i).isHighSurrogate() && i + 1 < text.size() && text.at(i + 1).isLowSurrogate()) {
+            ucs4 = QChar::surrogateToUcs4(text.at(i), text.at(i + 1));
+            length = 2;
+        }
+
+        if (isCjk(ucs4)) {
+            flushWord();
+            cjkRun.append(text.mid(i, length));
+        } else if (QChar::isLetterOrNumber(ucs4)) {
+            flushCjk();
+            word += text.mid(i, length).toCaseFolded();
+        } else {
+            flushWord();
+            flushCjk();
+        }
+        i += length - 1;
+    }
+    flushWord();
+    flushCjk();
+
+    return tokens;
+}
+
+QString SearchIndex::senderTerm(const QString &sender) {
+    // 普通词项不含冒号，加前缀后不会与正文词项冲突
+    return "from:" + sender.toCaseFolded();
+}
+
+void SearchIndex::addTerm(const QString &term, quint32 id) {
+    Posting &posting = postings[term];
+    appendVarint(posting.data, posting.count == 0 ? id : id - posting.last);
+    posting.last = id;
+    ++posting.count;
+}
+
+void SearchIndex::addDocument(quint32 id, const ChatRecord &record) {
+    if (ready) {
+        index(id, record);
+    }
+}
+
+void SearchIndex::index(quint32 id, const ChatRecord &record) {
+    if (id < nextId) {
+        return;   // 已经索引过
+    }
+
+    const QStringList tokens = tokenize(record.text);
+    QSet<QString> terms(tokens.begin(), tokens.end());
+    terms.insert(senderTerm(record.sender));
+    for (const QString &term : terms) {
+        addTerm(term, id);
+    }
+
+    nextId = id + 1;
+    if (nextId - snapshotId >= snapshotInterval) {
+        saveSnapshot();
+    }
+}
+
+QList<quint32> SearchIndex::decode(const Posting &posting) const {
+    QList<quint32> ids;
+    ids.reserve(posting.count);
+
+    const uchar *p = reinterpret_cast<const uchar *>(posting.data.constData());
+    const uchar *end = p + posting.data.size();
+    quint32 current = 0;
+    while (p < end) {
+        quint32 delta = 0;
+        int shift = 0;
+        while (p < end) {
+            uchar byte = *p++;
+            delta |= quint32(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+            shift += 7;
+        }
+        current += delta;
+        ids.append(current);
+    }
+    return ids;
+}
+
+QList<SearchHit> SearchIndex::search(const QString &query, int limit) const {
+    QList<SearchHit> hits;
+    if (!ready) {
+        return hits;
+    }
+    QStringList keywords;
+    QStringList terms;
+
+    const QStringList parts = query.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+    for (const QString &part : parts) {
+        if (part.startsWith("from:") && part.size() > 5) {
+            terms.append(senderTerm(part.mid(5)));
+            continue;
+        }
+        keywords.append(part);
+        terms.append(tokenize(part, true));
+    }
+    terms.removeDuplicates();
+    if (terms.isEmpty()) {
+        return hits;
+    }
+
+    QList<const Posting *> lists;
+    for (const QString &term : terms) {
+        auto it = postings.constFind(term);
+        if (it == postings.constEnd()) {
+            return hits;   // 有词项不存在，交集必为空
+        }
+        lists.append(&it.value());
+    }
+
+    // 从最短的倒排表开始求交集，候选集只会越来越小
+    std::sort(lists.begin(), lists.end(), [](const Posting *a, const Posting *b) {
+        return a->count < b->count;
+    });
+
+    QList<quint32> candidates = decode(*lists.first());
+    for (int i = 1; i < lists.size() && !candidates.isEmpty(); ++i) {
+        const QList<quint32> other = decode(*lists[i]);
+        QList<quint32> merged;
+        std::set_intersection(candidates.cbegin(), candidates.cend(),
+                              other.cbegin(), other.cend(),
+                              std::back_inserter(merged));
+        candidates = merged;
+    }
+
+    // 二元组交集可能有假阳性，从最新的候选开始读取原文校验，够数即停
+    for (auto it = candidates.crbegin(); it != candidates.crend() && hits.size() < limit; ++it) {
+        ChatRecord record;
+        if (!history->record(*it, &record)) {
+            continue;
+        }
+
+        bool matched = true;
+        for (const QString &keyword : keywords) {
+            if (!record.text.contains(keyword, Qt::CaseInsensitive)) {
+                matched = false;
+                break;
+            }
+        }
+        if (!matched) {
+            continue;
+        }
+
+        SearchHit hit;
+        hit.recordId = *it;
+        hit.record = record;
+        hit.snippetHtml = highlight(record.text, keywords);
+        hits.append(hit);
+    }
+
+    return hits;
+}
+
+QString SearchIndex::highlight(const QString &text, const QStringList &keywords) {
+    QList<QPair<qsizetype, qsizetype>> ranges;
+    for (const QString &keyword : keywords) {
+        qsizetype from = 0;
+        qsizetype pos;
+        while ((pos = text.indexOf(keyword, from, Qt::CaseInsensitive)) >= 0) {
+            ranges.append(qMakePair(pos, pos + keyword.size()));
+            from = pos + keyword.size();
+        }
+    }
+    std::sort(ranges.begin(), ranges.end());
+
+    // 合并重叠的命中区间
+    QList<QPair<qsizetype, qsizetype>> merged;
+    for (const auto &range : ranges) {
+        if (!merged.isEmpty() && range.first <= merged.last().second) {
+            merged.last().second = qMax(merged.last().second, range.second);
+        } else {
+            merged.append(range);
+        }
+    }
+
+    // 摘要：第一处命中前保留少量上下文
+    const qsizetype context = 40;
+    const qsizetype snippetLength = 160;
+    qsizetype begin = merged.isEmpty() ? 0 : qMax<qsizetype>(0, merged.first().first - context);
+    qsizetype end = qMin(text.size(), begin + snippetLength);
+    if (!merged.isEmpty()) {
+        end = qMin(text.size(), qMax(end, merged.first().second));
+    }
+
+    QString html;
+    if (begin > 0) {
+        html += "…";
+    }
+    qsizetype pos = begin;
+    for (const auto &range : merged) {
+        if (range.first >= end) {
+            break;
+        }
+        qsizetype start = qMax(range.first, pos);
+        qsizetype stop = qMin(range.second, end);
+        if (start < stop) {
+            html += text.mid(pos, start - pos).toHtmlEscaped();
+            html += "<span style='background-color: #ffeb3b;'>" + text.mid(start, stop - start).toHtmlEscaped() + "</span>";
+            pos = stop;
+        }
+    }
+    html += text.mid(pos, end - pos).toHtmlEscaped();
+    if (end < text.size()) {
+        html += "…";
+    }
+    return html;
+}
+
+bool SearchIndex::loadSnapshot() {
+    QFile file(snapshotPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0, version = 0, indexed = 0, termCount = 0;
+    in >> magic >> version >> indexed >> termCount;
+    if (magic != snapshotMagic || version != snapshotVersion || indexed > history->count()) {
+        LOG_WARNING(Storage) << "搜索索引快照无效，将重建";
+        return false;
+    }
+
+    QHash<QString, Posting> loaded;
+    loaded.reserve(termCount);
+    for (quint32 i = 0; i < termCount && in.status() == QDataStream::Ok; ++i) {
+        QString term;
+        Posting posting;
+        in >> term >> posting.last >> posting.count >> posting.data;
+        loaded.insert(term, posting);
+    }
+    if (in.status() != QDataStream::Ok) {
+        LOG_WARNING(Storage) << "搜索索引快照损坏，将重建";
+        return false;
+    }
+
+    postings = loaded;
+    nextId = indexed;
+    snapshotId = indexed;
+    return true;
+}
+
+void SearchIndex::saveSnapshot(bool wait) {
+    if (pendingSave.isRunning()) {
+        if (!wait) {
+            return;   // 上一次快照还没写完，下个周期再写
+        }
+        pendingSave.waitForFinished();
+    }
+
+    // 逐项复制词项和倒排表（都是隐式共享，只增加引用计数），写盘在后台线程完成。
+    // 不直接共享整个 QHash：那样下一次 addTerm 会把整张表深拷贝一遍
+    QList<QPair<QString, Posting>> snapshot;
+    snapshot.reserve(postings.size());
+    for (auto it = postings.constBegin(); it != postings.constEnd(); ++it) {
+        snapshot.append(qMakePair(it.key(), it.value()));
+    }
+    quint32 indexed = nextId;
+    QString path = snapshotPath;
+    snapshotId = indexed;
+
+    pendingSave = QtConcurrent::run([snapshot, indexed, path]() {
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly)) {
+            LOG_WARNING(Storage) << "无法写入搜索索引:" << path;
+            return;
+        }
+        QDataStream out(&file);
+        out.setVersion(QDataStream::Qt_6_0);
+        out << snapshotMagic << snapshotVersion << indexed << quint32(snapshot.size());
+        for (const auto &entry : snapshot) {
+            out << entry.first << entry.second.last << entry.second.count << entry.second.data;
+        }
+        file.commit();
+    });
+
+    if (wait) {
+        pendingSave.waitForFinished();
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QByteArray>
+#include <QList>
+#include <QFuture>
+#include "chathistory.h"
+
+struct SearchHit {
+    quint32 recordId = 0;
+    ChatRecord record;
+    QString snippetHtml;   // 已转义并高亮命中词的摘要
+};
+
+// 聊天历史的增量倒排索引。
+// 英文/数字按词切分并折叠大小写；中日韩文字按单字 + 相邻二元组切分，
+// 查询时多字词只用二元组求交集，最后对少量候选记录做原文校验和高亮。
+// 倒排表以差值 varint 压缩存放在内存中，定期在后台快照到 search.idx；
+// 启动时在后台线程加载快照并补建快照之后的记录，不占用窗口首帧时间；
+// 加载完成后由调用方在本线程调用 catchUp() 补上加载期间新增的记录，之后才可查询和增量更新。
+class SearchIndex {
+public:
+    explicit SearchIndex(ChatHistory *history);
+    ~SearchIndex();
+
+    // 后台加载的进度，完成后调用 catchUp()
+    QFuture<void> loading() const { return pendingLoad; }
+    void catchUp();
+    bool isReady() const { return ready; }
+
+    // 索引未就绪时忽略，记录由 catchUp() 从历史中补建
+    void addDocument(quint32 id, const ChatRecord &record);
+
+    // 查询语法：空格分隔的关键词取交集，"from:用户名" 过滤发送者。结果按时间倒序。
+    QList<SearchHit> search(const QString &query, int limit = 50) const;
+
+    quint32 indexedCount() const { return nextId; }
+    void saveSnapshot(bool wait = false);
+
+    static QStringList tokenize(const QString &text, bool forQuery = false);
+
+private:
+    struct Posting {
+        QByteArray data;   // 递增记录编号的差值 varint
+        quint32 last = 0;
+        quint32 count = 0;
+    };
+
+    void load(quint32 total);
+    void index(quint32 id, const ChatRecord &record);
+    void addTerm(const QString &term, quint32 id);
+    QList<quint32> decode(const Posting &posting) const;
+    bool loadSnapshot();
+    static QString senderTerm(const QString &sender);
+    static QString highlight(const QString &text, const QStringList &keywords);
+
+    ChatHistory *history;
+    QString snapshotPath;
+    QHash<QString, Posting> postings;
+    quint32 nextId = 0;
+    quint32 snapshotId = 0;
+    bool ready = false;
+    QFuture<void> pendingLoad;
+    QFuture<void> pendingSave;
+};
+
+#endif // SEARCHINDEX_H
@@ -0,0 +1,251 @@
+#include "securesession.h"
+#include "tcpserver.h"
+#include "logger.h"
+#include <QSslCipher>
+#include <QSslPreSharedKeyAuthenticator>
+#include <QPasswordDigestor>
+#include <QTimer>
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+namespace {
+
+const QByteArray pskIdentity = QByteArrayLiteral("untitled10-group");
+
+QList<QSslCipher> preferredCiphers() {
+    // 都是 AEAD；TLS 1.2 的 PSK 套件里只有 ChaCha20 带 ECDHE 前向安全
+    QStringList names;
+    if (SessionCrypto::hasAesHardware()) {
+        names << "PSK-AES128-GCM-SHA256" << "ECDHE-PSK-CHACHA20-POLY1305"
+              << "PSK-AES256-GCM-SHA384" << "PSK-CHACHA20-POLY1305";
+    } else {
+        names << "ECDHE-PSK-CHACHA20-POLY1305" << "PSK-CHACHA20-POLY1305"
+              << "PSK-AES128-GCM-SHA256" << "PSK-AES256-GCM-SHA384";
+    }
+
+    QList<QSslCipher> ciphers;
+    for (const QString &name : std::as_const(names)) {
+        QSslCipher cipher(name);
+        if (!cipher.isNull()) {
+            ciphers.append(cipher);
+        }
+    }
+    return ciphers;
+}
+
+}
+
+QByteArray SessionCrypto::deriveKey(const QString &passphrase) {
+    if (passphrase.isEmpty()) {
+        return QByteArray();
+    }
+    return QPasswordDigestor::deriveKeyPbkdf2(QCryptographicHash::Sha256, passphrase.toUtf8(),
+                                              QByteArrayLiteral("untitled10-psk-v1"), 100000, 32);
+}
+
+bool SessionCrypto::hasAesHardware() {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES);
+#elif defined(_M_X64) || defined(_M_IX86)
+    int info[4];
+    __cpuid(info, 1);
+    return info[2] & (1 << 25);
+#elif defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)
+    return true;
+#else
+    return false;
+#endif
+}
+
+QSslConfiguration SessionCrypto::configuration(QSslSocket::SslMode mode) {
+    static const QList<QSslCipher> ciphers = preferredCiphers();
+
+    QSslConfiguration config = QSslConfiguration::defaultConfiguration();
+    config.setProtocol(QSsl::TlsV1_2);
+    config.setCiphers(ciphers);
+    // PSK 本身就是双向认证，不使用证书
+    config.setPeerVerifyMode(QSslSocket::VerifyNone);
+    if (mode == QSslSocket::SslClientMode) {
+        config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    }
+    return config;
+}
+
+void SessionCrypto::attachKey(QSslSocket *socket, const QByteArray &groupKey) {
+    QObject::connect(socket, &QSslSocket::preSharedKeyAuthenticationRequired, socket,
+                     [groupKey](QSslPreSharedKeyAuthenticator *authenticator) {
+        authenticator->setIdentity(pskIdentity);
+        authenticator->setPreSharedKey(groupKey);
+    });
+}
+
+SecureServer::SecureServer(const QByteArray &groupKey, QObject *parent, int port, const QHostAddress &address)
+    : QTcpServer(parent), groupKey(groupKey) {
+    if (!listen(address, port)) {
+        LOG_ERROR(Secure) << "无法启动加密服务器:" << errorString();
+    } else {
+        LOG_DEBUG(Secure) << "加密服务器启动在端口:" << port;
+    }
+}
+
+void SecureServer::incomingConnection(qintptr socketDescriptor) {
+    QSslSocket *socket = new QSslSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return;
+    }
+    socket->setSslConfiguration(SessionCrypto::configuration(QSslSocket::SslServerMode));
+    SessionCrypto::attachKey(socket, groupKey);
+    connect(socket, &QSslSocket::sslErrors, socket, [socket](const QList<QSslError> &errors) {
+        LOG_WARNING(Secure) << "加密握手失败:" << socket->peerAddress().toString() << errors;
+    });
+
+    TCPConnectionHandler *handler = new TCPConnectionHandler(socket, this);
+    connect(handler, &TCPConnectionHandler::frameReceived, this, &SecureServer::frameReceived);
+    socket->startServerEncryption();
+}
+
+PeerSession::PeerSession(const QString &ip, int port, const QByteArray &groupKey, QObject *parent)
+    : QObject(parent), ip(ip), port(port), groupKey(groupKey) {
+    idleTimer = new QTimer(this);
+    idleTimer->setSingleShot(true);
+    connect(idleTimer, &QTimer::timeout, this, [this]() {
+        if (pending.isEmpty()) {
+            disconnectFromPeer();
+        } else {
+            idleTimer->start(idleTimeoutMs);
+        }
+    });
+}
+
+PeerSession::~PeerSession() {
+    // 未确认的数据一律报告失败，发件箱才会把它们留待重发，计数也能归零。
+    // FanOut 的回调经排队调用回到它自己的线程，FanOut 已释放时自然丢弃
+    failAll();
+}
+
+bool PeerSession::isEncrypted() const {
+    return socket && socket->isEncrypted();
+}
+
+void PeerSession::send(const QByteArray &data, Completion done) {
+    Pending entry;
+    entry.data = data;
+    queuedBytes += data.size();
+    entry.end = queuedBytes;
+    entry.done = std::move(done);
+    pending.append(std::move(entry));
+
+    if (!socket) {
+        connectToPeer();
+    } else if (socket->isEncrypted()) {
+        writePending();
+    }
+}
+
+void PeerSession::connectToPeer() {
+    socket = new QSslSocket(this);
+    QSslConfiguration config = SessionCrypto::configuration(QSslSocket::SslClientMode);
+    if (!sessionTicket.isEmpty()) {
+        config.setSessionTicket(sessionTicket);
+    }
+    socket->setSslConfiguration(config);
+    SessionCrypto::attachKey(socket, groupKey);
+
+    connect(socket, &QSslSocket::encrypted, this, &PeerSession::onEncrypted);
+    connect(socket, &QSslSocket::bytesWritten, this, &PeerSession::onBytesWritten);
+    connect(socket, &QSslSocket::errorOccurred, this, &PeerSession::onError);
+    connect(socket, &QSslSocket::disconnected, this, &PeerSession::onError);
+
+    // 写入位置按连接计，重连后从头开始
+    queuedBytes = 0;
+    writtenBytes = 0;
+    for (Pending &entry : pending) {
+        queuedBytes += entry.data.size();
+        entry.end = queuedBytes;
+        entry.written = false;
+    }
+
+    socket->connectToHostEncrypted(ip, quint16(port));
+
+    QSslSocket *attempt = socket;
+    QTimer::singleShot(connectTimeoutMs, this, [this, attempt]() {
+        if (socket == attempt && !socket->isEncrypted()) {
+            LOG_DEBUG(Secure) << "加密连接超时:" << ip << ":" << port;
+            onError();
+        }
+    });
+}
+
+void PeerSession::onEncrypted() {
+    // 缓存票据，空闲断开或重连时用它恢复会话
+    QByteArray ticket = socket->sslConfiguration().sessionTicket();
+    if (!ticket.isEmpty()) {
+        sessionTicket = ticket;
+    }
+    LOG_DEBUG(Secure) << "加密会话建立:" << ip << socket->sessionCipher().name();
+    writePending();
+    emit encrypted();
+}
+
+void PeerSession::writePending() {
+    for (Pending &entry : pending) {
+        if (!entry.written) {
+            socket->write(entry.data);
+            entry.written = true;
+        }
+    }
+    idleTimer->start(idleTimeoutMs);
+}
+
+void PeerSession::onBytesWritten(qint64 bytes) {
+    writtenBytes += bytes;
+    while (!pending.isEmpty() && pending.first().end <= writtenBytes) {
+        Pending entry = pending.takeFirst();
+        if (entry.done) {
+            entry.done(true);
+        }
+    }
+}
+
+void PeerSession::onError() {
+    if (!socket) {
+        return;
+    }
+    LOG_DEBUG(Secure) << "加密会话断开:" << ip << socket->errorString();
+    QSslSocket *closed = socket;
+    socket = nullptr;
+    closed->disconnect(this);
+    closed->abort();
+    closed->deleteLater();
+    idleTimer->stop();
+    failAll();
+}
+
+void PeerSession::disconnectFromPeer() {
+    if (!socket) {
+        return;
+    }
+    QSslSocket *closed = socket;
+    socket = nullptr;
+    closed->disconnect(this);
+    closed->disconnectFromHost();
+    closed->deleteLater();
+    failAll();
+}
+
+void PeerSession::failAll() {
+    QList<Pending> failed;
+    failed.swap(pending);
+    queuedBytes = 0;
+    writtenBytes = 0;
+    for (const Pending &entry : std::as_const(failed)) {
+        if (entry.done) {
+            entry.done(false);
+        }
+    }
+}
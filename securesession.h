@@ -0,0 +1,101 @@
+#ifndef SECURESESSION_H
+#define SECURESESSION_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QSslSocket>
+#include <QSslConfiguration>
+#include <QList>
+#include <functional>
+
+class QTimer;
+
+// 节点间加密会话。认证使用组密钥（由口令派生的 TLS-PSK），不需要证书。
+// 每个节点一条长连接，多条消息复用同一次握手；连接空闲断开后，
+// 下次连接用缓存的会话票据恢复，只做简化握手。
+// CPU 支持 AES 指令时优先 AES-GCM，否则优先 ChaCha20-Poly1305。
+class SessionCrypto {
+public:
+    static QByteArray deriveKey(const QString &passphrase);
+    static bool hasAesHardware();
+    static QSslConfiguration configuration(QSslSocket::SslMode mode);
+
+    // 在握手时提供组密钥
+    static void attachKey(QSslSocket *socket, const QByteArray &groupKey);
+};
+
+// 加密端口的服务端：完成握手后交给 TCPConnectionHandler 按帧接收
+class SecureServer : public QTcpServer {
+    Q_OBJECT
+
+public:
+    SecureServer(const QByteArray &groupKey, QObject *parent = nullptr, int port = 0,
+                 const QHostAddress &address = QHostAddress::Any);
+
+signals:
+    void frameReceived(const QByteArray &frame);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    QByteArray groupKey;
+};
+
+// 到某个节点的长连接客户端。send() 的数据按顺序写入同一连接，
+// 数据被 TLS 层写出后回调 done(true)；连接失败或中途断开时，
+// 尚未确认的数据都回调 done(false)，由调用方交给发件箱。
+class PeerSession : public QObject {
+    Q_OBJECT
+
+public:
+    using Completion = std::function<void(bool delivered)>;
+
+    static const int connectTimeoutMs = 5000;
+    static const int idleTimeoutMs = 2 * 60 * 1000;
+
+    PeerSession(const QString &ip, int port, const QByteArray &groupKey, QObject *parent = nullptr);
+    ~PeerSession();
+
+    void send(const QByteArray &data, Completion done = nullptr);
+
+    bool isEncrypted() const;
+    bool hasSessionTicket() const { return !sessionTicket.isEmpty(); }
+
+    // 主动断开，保留会话票据（基准测试用来测量恢复握手）
+    void disconnectFromPeer();
+
+    // 所有未确认的数据以失败回调，不断开连接
+    void failAll();
+
+signals:
+    void encrypted();
+
+private slots:
+    void onEncrypted();
+    void onBytesWritten(qint64 bytes);
+    void onError();
+
+private:
+    struct Pending {
+        QByteArray data;
+        qint64 end = 0;          // 在本连接写入流中的结束位置
+        bool written = false;
+        Completion done;
+    };
+
+    void connectToPeer();
+    void writePending();
+
+    QString ip;
+    int port;
+    QByteArray groupKey;
+    QSslSocket *socket = nullptr;
+    QTimer *idleTimer;
+    QList<Pending> pending;
+    qint64 queuedBytes = 0;
+    qint64 writtenBytes = 0;
+    QByteArray sessionTicket;
+};
+
+#endif // SECURESESSION_H
@@ -0,0 +1,176 @@
+#include "stallwatchdog.h"
+#include "metrics.h"
+#include "logger.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QMutex>
+#include <QStringList>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+qint64 nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// GUI 线程上正在执行的操作。只有 GUI 线程写，看门狗线程读；
+// 名称都是字面量，读到刚弹出的一项也不会失效，只是记录稍有偏差
+struct OperationStack {
+    std::atomic<const char *> names[StallWatchdog::maxDepth] = {};
+    std::atomic<int> depth{0};
+
+    QString describe() const {
+        int count = qMin(depth.load(std::memory_order_acquire), StallWatchdog::maxDepth);
+        QStringList parts;
+        for (int i = 0; i < count; ++i) {
+            if (const char *name = names[i].load(std::memory_order_acquire)) {
+                parts.append(QString::fromUtf8(name));
+            }
+        }
+        return parts.join(" > ");
+    }
+};
+
+struct WatchdogState {
+    OperationStack operations;
+    std::atomic<quint64> answered{0};
+    std::atomic<qint64> answeredNs{0};
+    std::thread thread;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    QMutex recordsMutex;
+    QList<StallWatchdog::Stall> records;   // 按持续时间从长到短
+
+    ~WatchdogState() {
+        // 忘了调用 stop() 时也不让 std::thread 在进程退出时终止程序
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(wakeMutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            thread.join();
+        }
+    }
+};
+
+WatchdogState &state() {
+    static WatchdogState instance;
+    return instance;
+}
+
+void record(WatchdogState &watchdog, const StallWatchdog::Stall &stall) {
+    ProcessMetrics &process = Metrics::process();
+    process.guiStalls.add();
+    process.guiStallDuration.record(stall.durationNs);
+    LOG_WARNING(Ui) << "界面卡顿" << stall.durationNs / 1000000 << "ms，正在执行:"
+                    << (stall.operation.isEmpty() ? QString("未标记的操作") : stall.operation);
+
+    // 只保留最长的几次，比已满列表中最短的还短就不记
+    QMutexLocker locker(&watchdog.recordsMutex);
+    auto position = std::upper_bound(watchdog.records.begin(), watchdog.records.end(), stall,
+                                     [](const StallWatchdog::Stall &a, const StallWatchdog::Stall &b) {
+                                         return a.durationNs > b.durationNs;
+                                     });
+    if (watchdog.records.size() >= StallWatchdog::maxRecords && position == watchdog.records.end()) {
+        return;
+    }
+    watchdog.records.insert(position, stall);
+    if (watchdog.records.size() > StallWatchdog::maxRecords) {
+        watchdog.records.removeLast();
+    }
+}
+
+void run(WatchdogState &watchdog, QObject *gui, qint64 thresholdNs) {
+    quint64 sent = 0;
+    qint64 sentNs = 0;
+    qint64 sentMs = 0;
+    QString operation;
+
+    std::unique_lock<std::mutex> lock(watchdog.wakeMutex);
+    while (!watchdog.wake.wait_for(lock, std::chrono::milliseconds(StallWatchdog::pingIntervalMs),
+                                   [&watchdog]() { return watchdog.stopping; })) {
+        if (sent != 0 && watchdog.answered.load(std::memory_order_acquire) != sent) {
+            // 上一个 ping 还没有回应。超过阈值时 GUI 线程多半还卡在同一个操作里，趁现在记下
+            if (operation.isEmpty() && nowNs() - sentNs >= thresholdNs) {
+                operation = watchdog.operations.describe();
+            }
+            continue;
+        }
+        if (sent != 0) {
+            qint64 durationNs = watchdog.answeredNs.load(std::memory_order_relaxed) - sentNs;
+            if (durationNs >= thresholdNs) {
+                record(watchdog, StallWatchdog::Stall{sentMs, durationNs, operation});
+            }
+        }
+
+        operation.clear();
+        quint64 sequence = ++sent;
+        sentNs = nowNs();
+        sentMs = QDateTime::currentMSecsSinceEpoch();
+        QMetaObject::invokeMethod(gui, [&watchdog, sequence]() {
+            watchdog.answeredNs.store(nowNs(), std::memory_order_relaxed);
+            watchdog.answered.store(sequence, std::memory_order_release);
+        }, Qt::QueuedConnection);
+    }
+}
+
+}
+
+void StallWatchdog::start(int thresholdMs) {
+    WatchdogState &watchdog = state();
+    if (watchdog.thread.joinable()) {
+        return;
+    }
+    watchdog.stopping = false;
+    watchdog.answered.store(0);
+    watchdog.thread = std::thread(run, std::ref(watchdog), QCoreApplication::instance(),
+                                  qint64(thresholdMs) * 1000000);
+}
+
+void StallWatchdog::stop() {
+    WatchdogState &watchdog = state();
+    if (!watchdog.thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(watchdog.wakeMutex);
+        watchdog.stopping = true;
+    }
+    watchdog.wake.notify_one();
+    watchdog.thread.join();
+}
+
+QList<StallWatchdog::Stall> StallWatchdog::worstStalls() {
+    WatchdogState &watchdog = state();
+    QMutexLocker locker(&watchdog.recordsMutex);
+    return watchdog.records;
+}
+
+void StallWatchdog::clear() {
+    WatchdogState &watchdog = state();
+    QMutexLocker locker(&watchdog.recordsMutex);
+    watchdog.records.clear();
+}
+
+StallWatchdog::Operation::Operation(const char *name) {
+    OperationStack &operations = state().operations;
+    int depth = operations.depth.load(std::memory_order_relaxed);
+    if (depth < maxDepth) {
+        operations.names[depth].store(name, std::memory_order_release);
+    }
+    operations.depth.store(depth + 1, std::memory_order_release);
+}
+
+StallWatchdog::Operation::~Operation() {
+    OperationStack &operations = state().operations;
+    operations.depth.store(operations.depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+}
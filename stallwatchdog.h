@@ -0,0 +1,44 @@
+#ifndef STALLWATCHDOG_H
+#define STALLWATCHDOG_H
+
+#include <QString>
+#include <QList>
+
+// GUI 事件循环卡顿检测。后台线程每隔 pingIntervalMs 向 GUI 线程投递一次 ping，
+// 回应晚于阈值即算一次卡顿，记下持续时间和期间 GUI 线程上正在执行的操作。
+// 操作用 STALL_OPERATION("名称") 在作用域内标出，可以嵌套；标记只是两次原子写，热路径上也可以用。
+// 最严重的 maxRecords 次保留在内存中供诊断面板查看，次数和时长另计入 ProcessMetrics。
+class StallWatchdog {
+public:
+    struct Stall {
+        qint64 startedMs = 0;     // 发出 ping 的墙钟时间
+        qint64 durationNs = 0;    // 从发出 ping 到 GUI 线程回应
+        QString operation;        // 外层到内层，如 "handleFileMessage > 聊天追加"；没有标出的操作时为空
+    };
+
+    static constexpr int maxRecords = 32;
+    static constexpr int maxDepth = 8;
+    static const int pingIntervalMs = 50;
+    static const int defaultThresholdMs = 200;
+
+    // 在 GUI 线程、QApplication 创建之后调用
+    static void start(int thresholdMs = defaultThresholdMs);
+    static void stop();
+
+    // 按持续时间从长到短
+    static QList<Stall> worstStalls();
+    static void clear();
+
+    // 标出 GUI 线程上正在执行的操作。name 只保存指针，必须是字符串字面量
+    class Operation {
+    public:
+        explicit Operation(const char *name);
+        ~Operation();
+        Operation(const Operation &) = delete;
+        Operation &operator=(const Operation &) = delete;
+    };
+};
+
+#define STALL_OPERATION(name) StallWatchdog::Operation stallOperation(name)
+
+#endif // STALLWATCHDOG_H
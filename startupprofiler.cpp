@@ -0,0 +1,77 @@
+#include "startupprofiler.h"
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QTimer>
+#include <QDebug>
+
+namespace {
+
+QElapsedTimer startupTimer;
+QList<StartupProfiler::Phase> recordedPhases;
+
+class FirstPaintFilter : public QObject {
+public:
+    FirstPaintFilter(const QString &phase, std::function<void()> callback, QObject *parent)
+        : QObject(parent), phase(phase), callback(std::move(callback)) {}
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override {
+        if (event->type() == QEvent::Paint) {
+            watched->removeEventFilter(this);
+            // 绘制事件处理完之后才算首帧完成，投递到下一轮事件循环再记录
+            QString name = phase;
+            std::function<void()> done = callback;
+            QTimer::singleShot(0, watched, [name, done]() {
+                StartupProfiler::mark(name);
+                if (done) {
+                    done();
+                }
+            });
+            deleteLater();
+        }
+        return false;
+    }
+
+private:
+    QString phase;
+    std::function<void()> callback;
+};
+
+}
+
+void StartupProfiler::start() {
+    recordedPhases.clear();
+    startupTimer.start();
+    mark("进入 main");
+}
+
+void StartupProfiler::mark(const QString &phase) {
+    if (!startupTimer.isValid()) {
+        return;
+    }
+    Phase entry;
+    entry.name = phase;
+    entry.elapsedNs = startupTimer.nsecsElapsed();
+    recordedPhases.append(entry);
+}
+
+QList<StartupProfiler::Phase> StartupProfiler::phases() {
+    return recordedPhases;
+}
+
+void StartupProfiler::report() {
+    qInfo() << "=== 启动时间线 ===";
+    qint64 previous = 0;
+    for (const Phase &entry : recordedPhases) {
+        qInfo().noquote() << QString("  %1  +%2 ms  (累计 %3 ms)")
+                             .arg(entry.name, -16)
+                             .arg((entry.elapsedNs - previous) / 1e6, 8, 'f', 2)
+                             .arg(entry.elapsedNs / 1e6, 8, 'f', 2);
+        previous = entry.elapsedNs;
+    }
+}
+
+void StartupProfiler::markAfterFirstPaint(QWidget *widget, const QString &phase,
+                                          std::function<void()> callback) {
+    widget->installEventFilter(new FirstPaintFilter(phase, std::move(callback), widget));
+}
@@ -0,0 +1,28 @@
+#ifndef STARTUPPROFILER_H
+#define STARTUPPROFILER_H
+
+#include <QString>
+#include <QList>
+#include <QWidget>
+#include <functional>
+
+// 启动时间线：记录 main → LoginWindow → ChatWindow 各阶段的耗时，
+// 用于度量冷启动和首帧时间。所有调用都在 GUI 线程。
+class StartupProfiler {
+public:
+    struct Phase {
+        QString name;
+        qint64 elapsedNs = 0;   // 自 start() 起的累计时间
+    };
+
+    static void start();
+    static void mark(const QString &phase);
+    static QList<Phase> phases();
+    static void report();
+
+    // 在 widget 第一次绘制完成后记录阶段，并执行回调
+    static void markAfterFirstPaint(QWidget *widget, const QString &phase,
+                                    std::function<void()> callback = nullptr);
+};
+
+#endif // STARTUPPROFILER_H
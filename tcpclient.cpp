@@ -1,4 +1,5 @@
 #include "tcpclient.h"
+#include "logger.h"
 #include <QTcpSocket>
 #include <QTimer>
 
@@ -6,23 +7,55 @@ TCPClient::TCPClient(QObject *parent) : QObject(parent) {
     socket = new QTcpSocket(this);
     connect(socket, &QTcpSocket::connected, this, &TCPClient::onConnected);
     connect(socket, &QTcpSocket::errorOccurred, this, &TCPClient::onError);
+    // 一次性连接：数据写完断开后释放自己
+    connect(socket, &QTcpSocket::disconnected, this, &TCPClient::onDisconnected);
 }
 
 
-void TCPClient::sendMessage(const QString &ip, int port, const QString &message) {
+void TCPClient::sendMessage(const QString &ip, int port, const QByteArray &data) {
     targetIP = ip;
     targetPort = port;
-    messageToSend = message;
+    dataToSend = data;
 
     socket->connectToHost(ip, port);
+
+    // 对方离线时 SYN 重试可能要几十秒，超时按失败处理，交给发件箱重试
+    QTimer::singleShot(connectTimeoutMs, this, [this]() {
+        if (!written && !finished) {
+            LOG_DEBUG(Transport) << "连接超时:" << targetIP << ":" << targetPort;
+            socket->abort();
+            finish(false);
+        }
+    });
 }
 
 void TCPClient::onConnected() {
-    socket->write(messageToSend.toUtf8());
+    // 保留数据直到确认送达，中途出错时还要交回给调用方
+    socket->write(dataToSend);
+    written = true;
     socket->disconnectFromHost();
 }
 
+void TCPClient::onDisconnected() {
+    finish(written);
+}
+
 void TCPClient::onError() {
-    qDebug() << "发送消息失败到" << targetIP << ":" << targetPort << "-" << socket->errorString();
+    LOG_DEBUG(Transport) << "发送消息失败到" << targetIP << ":" << targetPort << "-" << socket->errorString();
+    finish(false);
     socket->disconnectFromHost();
-}
\ No newline at end of file
+}
+
+void TCPClient::finish(bool ok) {
+    if (finished) {
+        return;
+    }
+    finished = true;
+    if (ok) {
+        emit delivered();
+    } else {
+        emit failed(dataToSend);
+    }
+    dataToSend.clear();
+    deleteLater();
+}
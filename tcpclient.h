@@ -9,18 +9,29 @@ class TCPClient : public QObject {
 
 public:
     explicit TCPClient(QObject *parent = nullptr);
-    void sendMessage(const QString &ip, int port, const QString &message);
+    void sendMessage(const QString &ip, int port, const QByteArray &data);
 
+    static const int connectTimeoutMs = 5000;
+
+signals:
+    // 二者只会发出一个，之后对象自行释放
+    void delivered();
+    void failed(const QByteArray &data);
 
 private slots:
     void onConnected();
+    void onDisconnected();
     void onError();
 
 private:
+    void finish(bool ok);
+
     QTcpSocket *socket;
     QString targetIP;
     int targetPort;
-    QString messageToSend;
+    QByteArray dataToSend;
+    bool written = false;
+    bool finished = false;
 };
 
-#endif // TCPCLIENT_H
\ No newline at end of file
+#endif // TCPCLIENT_H
@@ -1,37 +1,123 @@
 #include "tcpserver.h"
+#include "messageenvelope.h"
+#include "utf8codec.h"
+#include "metrics.h"
+#include "logger.h"
 #include <QTcpSocket>
 #include <QDataStream>
 
-TCPServer::TCPServer(QObject *parent, int port)
-    : QTcpServer(parent), serverPort(port) {
-    if (!this->listen(QHostAddress::Any, serverPort)) {
-        qCritical() << "无法启动TCP服务器:" << this->errorString();
+TCPServer::TCPServer(QObject *parent, int port, const QHostAddress &address)
+    : QTcpServer(parent), listenPort(port) {
+    if (!this->listen(address, listenPort)) {
+        LOG_ERROR(Transport) << "无法启动TCP服务器:" << this->errorString();
     } else {
-        qDebug() << "TCP服务器启动在端口:" << serverPort;
+        LOG_DEBUG(Transport) << "TCP服务器启动在端口:" << this->serverPort();
     }
 }
 
 
 void TCPServer::incomingConnection(qintptr socketDescriptor) {
     TCPConnectionHandler *handler = new TCPConnectionHandler(socketDescriptor, this);
-    connect(handler, &TCPConnectionHandler::messageReceived, this, &TCPServer::messageReceived);
+    connect(handler, &TCPConnectionHandler::frameReceived, this, &TCPServer::frameReceived);
+    connect(handler, &TCPConnectionHandler::legacyMessageReceived, this, &TCPServer::legacyMessageReceived);
 }
 
 TCPConnectionHandler::TCPConnectionHandler(qintptr socketDescriptor, QObject *parent)
     : QObject(parent) {
     socket = new QTcpSocket(this);
     socket->setSocketDescriptor(socketDescriptor);
+    attach();
+}
+
+TCPConnectionHandler::TCPConnectionHandler(QTcpSocket *socket, QObject *parent)
+    : QObject(parent), socket(socket) {
+    socket->setParent(this);
+    attach();
+}
 
+void TCPConnectionHandler::attach() {
+    metrics = &Metrics::incoming(socket->peerAddress());
     connect(socket, &QTcpSocket::readyRead, this, &TCPConnectionHandler::onReadyRead);
     connect(socket, &QTcpSocket::disconnected, this, &TCPConnectionHandler::onDisconnected);
 }
 
+bool FrameStream::append(const QByteArray &data, QList<QByteArray> *frames) {
+    // 缓冲区为空时直接共享收到的数据，不复制
+    if (buffer.isEmpty()) {
+        buffer = data;
+    } else {
+        buffer.append(data);
+    }
+
+    // 根据开头两个字节判断是信封还是旧版文本协议
+    if (mode == StreamMode::Unknown && buffer.size() >= 2) {
+        mode = MessageEnvelope::hasMagic(buffer) ? StreamMode::Framed : StreamMode::Legacy;
+    }
+
+    // 旧版协议一个连接只发一条消息，等对方断开后整体交付
+    if (mode != StreamMode::Framed) {
+        return true;
+    }
+
+    // 不按头部声明的长度预先分配：头部未经认证，空闲连接只发一个头就能占住整帧大小的内存。
+    // 不完整的帧随数据到达按倍数增长
+    qsizetype offset = 0;
+    while (offset < buffer.size()) {
+        qsizetype size = MessageEnvelope::frameSize(QByteArrayView(buffer).sliced(offset));
+        if (size < 0) {
+            buffer.clear();
+            return false;
+        }
+        if (size == 0) {
+            break;
+        }
+
+        // 常见情况是缓冲区恰好是一整帧，直接交出缓冲区，不做拷贝
+        if (offset == 0 && size == buffer.size()) {
+            frames->append(buffer);
+            buffer = QByteArray();
+            return true;
+        }
+        frames->append(buffer.mid(offset, size));
+        offset += size;
+    }
+
+    // 一批小帧全部切出后才移动一次剩余数据，避免每帧移动一次
+    if (offset == buffer.size()) {
+        buffer = QByteArray();
+    } else if (offset > 0) {
+        buffer.remove(0, offset);
+    }
+    return true;
+}
+
+QByteArray FrameStream::finish() {
+    QByteArray message = mode == StreamMode::Legacy ? buffer : QByteArray();
+    buffer = QByteArray();
+    return message;
+}
+
 void TCPConnectionHandler::onReadyRead() {
-    QByteArray data = socket->readAll();
-    QString message = QString::fromUtf8(data);
-    emit messageReceived(message);
+    QList<QByteArray> frames;
+    bool valid = stream.append(socket->readAll(), &frames);
+    for (const QByteArray &frame : std::as_const(frames)) {
+        metrics->messagesReceived.add();
+        metrics->bytesReceived.add(quint64(frame.size()));
+        emit frameReceived(frame);
+    }
+    if (!valid) {
+        LOG_WARNING(Transport) << "收到非法消息帧，断开连接:" << socket->peerAddress().toString();
+        socket->abort();
+    }
 }
 
 void TCPConnectionHandler::onDisconnected() {
+    QByteArray message = stream.finish();
+    if (!message.isEmpty()) {
+        metrics->messagesReceived.add();
+        metrics->bytesReceived.add(quint64(message.size()));
+        emit legacyMessageReceived(Utf8Codec::decode(message));
+    }
     socket->deleteLater();
+    deleteLater();
 }
\ No newline at end of file
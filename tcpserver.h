@@ -6,21 +6,43 @@
 #include <QTcpSocket>
 #include <QList>
 
+struct PeerMetrics;
+
+// 一条连接上收到的字节流：根据开头两个字节判断是信封帧还是旧版文本协议，信封帧按长度切开。
+// 旧版协议一个连接只发一条消息，等对方断开后由 finish() 整体交出。
+// TCPConnectionHandler 和 UringServer 共用
+class FrameStream {
+public:
+    // 追加收到的数据，完整的帧追加到 frames；数据不是合法的帧时返回 false，调用方应断开连接
+    bool append(const QByteArray &data, QList<QByteArray> *frames);
+
+    // 连接断开时调用：旧版协议返回整条消息，否则为空
+    QByteArray finish();
+
+private:
+    enum class StreamMode { Unknown, Framed, Legacy };
+
+    QByteArray buffer;
+    StreamMode mode = StreamMode::Unknown;
+};
+
 class TCPServer : public QTcpServer {
     Q_OBJECT
 
 
 public:
-    explicit TCPServer(QObject *parent = nullptr, int port = 0);
+    // address 为空（Any）时监听所有接口；在一台机器上模拟多个节点时各自绑定一个回环地址
+    explicit TCPServer(QObject *parent = nullptr, int port = 0, const QHostAddress &address = QHostAddress::Any);
 
     signals:
-        void messageReceived(const QString &message);
+        void frameReceived(const QByteArray &frame);
+        void legacyMessageReceived(const QString &message);
 
 protected:
     void incomingConnection(qintptr socketDescriptor) override;
 
 private:
-    int serverPort;
+    int listenPort;
 };
 
 class TCPConnectionHandler : public QObject {
@@ -28,16 +50,23 @@ class TCPConnectionHandler : public QObject {
 
 public:
     explicit TCPConnectionHandler(qintptr socketDescriptor, QObject *parent = nullptr);
+    // 接管已建立的连接（例如完成 TLS 握手的 QSslSocket），连接可以长期保持、连续收帧
+    explicit TCPConnectionHandler(QTcpSocket *socket, QObject *parent = nullptr);
 
     signals:
-        void messageReceived(const QString &message);
+        void frameReceived(const QByteArray &frame);
+        void legacyMessageReceived(const QString &message);
 
 private slots:
     void onReadyRead();
     void onDisconnected();
 
 private:
+    void attach();
+
     QTcpSocket *socket;
+    PeerMetrics *metrics = nullptr;   // 按对方地址统计接收量
+    FrameStream stream;
 };
 
 #endif // TCPSERVER_H
\ No newline at end of file
@@ -1,13 +1,22 @@
 #include "udpdiscovery.h"
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QJsonArray>
 #include <QTimer>
+#include "messageenvelope.h"
+#include "metrics.h"
 
-UDPDiscovery::UDPDiscovery(QObject *parent, const QString &localIP, const QString &username)
-    : QObject(parent), localIP(localIP), username(username) {
+UDPDiscovery::UDPDiscovery(QObject *parent, const QString &localIP, const QString &username,
+                           const QStringList &rooms, const DiscoverySettings &settings)
+    : QObject(parent), localIP(localIP), username(username), rooms(rooms), settings(settings) {
+
+    if (this->settings.targets.isEmpty()) {
+        this->settings.targets.append(QHostAddress("192.168.3.255"));
+    }
 
     udpSocket = new QUdpSocket(this);
-    udpSocket->bind(QHostAddress::Any, broadcastPort, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint);
+    udpSocket->bind(settings.bindAddress, quint16(settings.port),
+                    QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint);
 
     connect(udpSocket, &QUdpSocket::readyRead, this, &UDPDiscovery::onReadyRead);
 
@@ -19,6 +28,16 @@ UDPDiscovery::UDPDiscovery(QObject *parent, const QString &localIP, const QStrin
     onBroadcastTimeout();
 }
 
+void UDPDiscovery::setRooms(const QStringList &rooms) {
+    this->rooms = rooms;
+    onBroadcastTimeout();
+}
+
+void UDPDiscovery::setSecurePort(int port) {
+    securePort = port;
+    onBroadcastTimeout();
+}
+
 void UDPDiscovery::onReadyRead() {
     while (udpSocket->hasPendingDatagrams()) {
         QByteArray datagram;
@@ -30,13 +49,23 @@ void UDPDiscovery::onReadyRead() {
 
         QJsonParseError error;
         QJsonDocument doc = QJsonDocument::fromJson(datagram, &error);
-        if (error.error == QJsonParseError::NoError) {
+        if (error.error != QJsonParseError::NoError) {
+            Metrics::process().discoveryInvalid.add();
+        } else {
             QJsonObject obj = doc.object();
             if (obj["type"].toString() == "online") {
+                Metrics::process().discoveryBeacons.add();
                 QString ip = obj["ip"].toString();
                 QString username = obj["username"].toString();
+                int protocolVersion = obj["proto"].toInt(0);   // 旧版客户端不带该字段
+                QStringList peerRooms;
+                for (const QJsonValue &room : obj["rooms"].toArray()) {
+                    peerRooms.append(room.toString());
+                }
+                int peerChatPort = obj["port"].toInt(DiscoverySettings().chatPort);
+                int peerSecurePort = obj["tls"].toInt(0);
                 if (ip != this->localIP) { // 不接收自己的广播
-                    emit packetReceived(ip, username);
+                    emit packetReceived(ip, username, protocolVersion, peerRooms, peerChatPort, peerSecurePort);
                 }
             }
         }
@@ -49,7 +78,19 @@ void UDPDiscovery::onBroadcastTimeout() {
     obj["type"] = "online";
     obj["ip"] = localIP;
     obj["username"] = username;
+    obj["proto"] = MessageEnvelope::currentVersion;
+    if (settings.chatPort != DiscoverySettings().chatPort) {
+        obj["port"] = settings.chatPort;
+    }
+    if (!rooms.isEmpty()) {
+        obj["rooms"] = QJsonArray::fromStringList(rooms);
+    }
+    if (securePort > 0) {
+        obj["tls"] = securePort;
+    }
     QJsonDocument doc(obj);
     QByteArray data = doc.toJson(QJsonDocument::Compact);
-    udpSocket->writeDatagram(data,  QHostAddress("192.168.3.255"), broadcastPort);
+    for (const QHostAddress &target : std::as_const(settings.targets)) {
+        udpSocket->writeDatagram(data, target, quint16(settings.port));
+    }
 }
\ No newline at end of file
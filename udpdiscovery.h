@@ -6,16 +6,38 @@
 #include <QTimer>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QHostAddress>
+#include <QList>
+
+// 发现服务的地址和端口。默认值即正常客户端的行为：监听所有接口，向子网广播
+struct DiscoverySettings {
+    static constexpr int defaultPort = 12345;
+
+    QHostAddress bindAddress = QHostAddress::Any;
+    int port = defaultPort;
+    QList<QHostAddress> targets;   // 广播发往的地址（端口同 port），空表示子网广播地址
+    int chatPort = 12346;          // 写进广播，对方按它连接本节点
+};
 
 class UDPDiscovery : public QObject {
     Q_OBJECT
 
 public:
-    explicit UDPDiscovery(QObject *parent = nullptr, const QString &localIP = "", const QString &username = "");
+    explicit UDPDiscovery(QObject *parent = nullptr, const QString &localIP = "", const QString &username = "",
+                          const QStringList &rooms = QStringList(),
+                          const DiscoverySettings &settings = DiscoverySettings());
+
+    // 更新本节点加入的房间，立即广播一次，其他节点据此决定房间消息发给谁
+    void setRooms(const QStringList &rooms);
+
+    // 加密端口，0 表示未启用加密
+    void setSecurePort(int port);
 
     signals:
 
-    void packetReceived(const QString &ip, const QString &username);
+    // chatPort：对方的聊天端口，旧版客户端不带时为默认端口
+    void packetReceived(const QString &ip, const QString &username, int protocolVersion, const QStringList &rooms,
+                        int chatPort, int securePort);
 
 private slots:
     void onReadyRead();
@@ -26,7 +48,9 @@ private:
     QTimer *broadcastTimer;
     QString localIP;
     QString username;
-    static const int broadcastPort = 12345;
+    QStringList rooms;
+    int securePort = 0;
+    DiscoverySettings settings;
 };
 
 #endif // UDPDISCOVERY_H
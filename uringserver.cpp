@@ -0,0 +1,585 @@
+#include "uringserver.h"
+#include "tcpserver.h"
+#include "utf8codec.h"
+#include "metrics.h"
+#include "logger.h"
+#include <QHash>
+#include <QList>
+#include <QThread>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// 系统调用直接发，不依赖 liburing
+int ioUringSetup(unsigned entries, io_uring_params *params) {
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned count) {
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+template <typename T>
+T loadAcquire(const T *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void storeRelease(T *p, T value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+// 与内核共享的提交队列、完成队列和接收缓冲区环
+class Ring {
+public:
+    Ring() = default;
+    Ring(const Ring &) = delete;
+    Ring &operator=(const Ring &) = delete;
+    ~Ring();
+
+    // 环先以禁用状态建立，由处理完成事件的线程调用 enable() 启用，
+    // 这样可以声明只有这一个线程提交（SINGLE_ISSUER），内核省去锁和跨线程唤醒。
+    // 失败时返回 -errno
+    int open(unsigned entries, unsigned bufferCount, unsigned bufferSize);
+    int enable();
+
+    // 取一个空的提交项，填好后由下一次 submitAndWait 提交
+    io_uring_sqe *nextSqe();
+    // 提交全部待提交项并等到至少 minComplete 个完成事件
+    int submitAndWait(unsigned minComplete);
+
+    // 依次处理已到达的完成事件
+    template <typename Handler>
+    void reap(Handler handle) {
+        unsigned head = *cqHead;
+        unsigned tail = loadAcquire(cqTail);
+        for (; head != tail; ++head) {
+            handle(cqes[head & cqMask]);
+        }
+        storeRelease(cqHead, head);
+    }
+
+    static const quint16 bufferGroup = 0;
+    const char *buffer(quint16 id) const { return buffers + size_t(id) * bufferSize; }
+    // 内核用完的缓冲区还给缓冲区环，下一次提交前统一发布
+    void recycle(quint16 id);
+
+private:
+    void publishBuffers() { storeRelease(&bufferRing->tail, bufferTail); }
+
+    int fd = -1;
+    void *sqMap = MAP_FAILED;
+    size_t sqMapBytes = 0;
+    void *cqMap = MAP_FAILED;
+    size_t cqMapBytes = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqesBytes = 0;
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned toSubmit = 0;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+
+    io_uring_buf_ring *bufferRing = static_cast<io_uring_buf_ring *>(MAP_FAILED);
+    size_t bufferRingBytes = 0;
+    char *buffers = static_cast<char *>(MAP_FAILED);
+    size_t buffersBytes = 0;
+    unsigned bufferSize = 0;
+    quint16 bufferMask = 0;
+    quint16 bufferTail = 0;
+};
+
+Ring::~Ring() {
+    // 关闭环会取消其上所有未完成的请求
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesBytes);
+    }
+    if (cqMap != MAP_FAILED && cqMap != sqMap) {
+        munmap(cqMap, cqMapBytes);
+    }
+    if (sqMap != MAP_FAILED) {
+        munmap(sqMap, sqMapBytes);
+    }
+    if (bufferRing != MAP_FAILED) {
+        munmap(bufferRing, bufferRingBytes);
+    }
+    if (buffers != MAP_FAILED) {
+        munmap(buffers, buffersBytes);
+    }
+}
+
+int Ring::open(unsigned entries, unsigned bufferCount, unsigned bufferSize) {
+    // 多发请求一次提交产生很多完成事件，完成队列开得比提交队列大。
+    // 新内核上完成事件只在本线程等待时处理（DEFER_TASKRUN），老一些的退到 COOP_TASKRUN，再不行用默认方式
+    const unsigned preferred[] = {
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_COOP_TASKRUN,
+        0,
+    };
+    io_uring_params params;
+    for (unsigned flags : preferred) {
+        memset(&params, 0, sizeof(params));
+        params.flags = flags | IORING_SETUP_R_DISABLED | IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+        params.cq_entries = entries * 16;
+        fd = ioUringSetup(entries, &params);
+        if (fd >= 0 || errno != EINVAL) {
+            break;
+        }
+    }
+    if (fd < 0) {
+        return -errno;
+    }
+
+    sqMapBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap) {
+        sqMapBytes = cqMapBytes = qMax(sqMapBytes, cqMapBytes);
+    }
+    sqMap = mmap(nullptr, sqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED) {
+        return -errno;
+    }
+    cqMap = singleMap ? sqMap
+                      : mmap(nullptr, cqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                             IORING_OFF_CQ_RING);
+    if (cqMap == MAP_FAILED) {
+        return -errno;
+    }
+    sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                            fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) {
+        return -errno;
+    }
+
+    char *sq = static_cast<char *>(sqMap);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sqEntries = params.sq_entries;
+    char *cq = static_cast<char *>(cqMap);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // 接收缓冲区一次分配好并注册给内核，多发 recv 从中取用，省去每次读取时的缓冲区地址校验
+    this->bufferSize = bufferSize;
+    buffersBytes = size_t(bufferCount) * bufferSize;
+    buffers = static_cast<char *>(mmap(nullptr, buffersBytes, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0));
+    if (buffers == MAP_FAILED) {
+        return -errno;
+    }
+    bufferRingBytes = bufferCount * sizeof(io_uring_buf);
+    bufferRing = static_cast<io_uring_buf_ring *>(mmap(nullptr, bufferRingBytes, PROT_READ | PROT_WRITE,
+                                                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0));
+    if (bufferRing == MAP_FAILED) {
+        return -errno;
+    }
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<quint64>(bufferRing);
+    registration.ring_entries = bufferCount;
+    registration.bgid = bufferGroup;
+    if (ioUringRegister(fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        return -errno;
+    }
+    bufferMask = quint16(bufferCount - 1);
+    for (unsigned i = 0; i < bufferCount; ++i) {
+        recycle(quint16(i));
+    }
+    publishBuffers();
+    return 0;
+}
+
+int Ring::enable() {
+    return ioUringRegister(fd, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) < 0 ? -errno : 0;
+}
+
+io_uring_sqe *Ring::nextSqe() {
+    unsigned tail = *sqTail;
+    if (tail - loadAcquire(sqHead) >= sqEntries) {
+        // 提交队列满了，先把已填好的交给内核，不等待完成
+        publishBuffers();
+        int submitted = ioUringEnter(fd, toSubmit, 0, 0);
+        if (submitted > 0) {
+            toSubmit -= unsigned(submitted);
+        }
+        if (tail - loadAcquire(sqHead) >= sqEntries) {
+            return nullptr;
+        }
+    }
+    unsigned index = tail & sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    storeRelease(sqTail, tail + 1);
+    ++toSubmit;
+    return sqe;
+}
+
+int Ring::submitAndWait(unsigned minComplete) {
+    publishBuffers();
+    int submitted = ioUringEnter(fd, toSubmit, minComplete, IORING_ENTER_GETEVENTS);
+    if (submitted < 0) {
+        return -errno;
+    }
+    toSubmit -= unsigned(submitted);
+    return submitted;
+}
+
+void Ring::recycle(quint16 id) {
+    // 不用 bufferRing->bufs：头文件里的柔性数组在 C++ 下前面多出一个占位的空结构体，偏移与内核不一致
+    io_uring_buf *entry = reinterpret_cast<io_uring_buf *>(bufferRing) + (bufferTail & bufferMask);
+    entry->addr = reinterpret_cast<quint64>(buffers + size_t(id) * bufferSize);
+    entry->len = bufferSize;
+    entry->bid = id;
+    ++bufferTail;
+}
+
+// 与 QTcpServer 一样：Any 时双栈监听，端口可立即重用
+int openListenSocket(const QHostAddress &address, int port, quint16 *boundPort) {
+    sockaddr_storage storage;
+    memset(&storage, 0, sizeof(storage));
+    socklen_t length = 0;
+    int fd = -1;
+    if (address.protocol() == QAbstractSocket::IPv4Protocol) {
+        auto *v4 = reinterpret_cast<sockaddr_in *>(&storage);
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons(quint16(port));
+        v4->sin_addr.s_addr = htonl(address.toIPv4Address());
+        length = sizeof(sockaddr_in);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    } else {
+        auto *v6 = reinterpret_cast<sockaddr_in6 *>(&storage);
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons(quint16(port));
+        Q_IPV6ADDR bytes = address.toIPv6Address();
+        memcpy(&v6->sin6_addr, bytes.c, sizeof(bytes.c));
+        length = sizeof(sockaddr_in6);
+        fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && address == QHostAddress::Any) {
+            int v6Only = 0;
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof(v6Only));
+        }
+    }
+    if (fd < 0) {
+        return -errno;
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&storage), length) < 0 || listen(fd, SOMAXCONN) < 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr *>(&storage), &length) < 0) {
+        int error = errno;
+        ::close(fd);
+        return -error;
+    }
+    *boundPort = storage.ss_family == AF_INET ? ntohs(reinterpret_cast<sockaddr_in *>(&storage)->sin_port)
+                                              : ntohs(reinterpret_cast<sockaddr_in6 *>(&storage)->sin6_port);
+    return fd;
+}
+
+// user_data 高 8 位是操作，低 32 位是连接编号
+enum Operation : quint64 {
+    Accept = 1,
+    AcceptRetry = 2,
+    Receive = 3,
+    Wake = 4,
+};
+
+quint64 userData(Operation operation, quint32 id = 0) {
+    return (quint64(operation) << 56) | id;
+}
+
+QString errorString(int error) {
+    return QString::fromLocal8Bit(strerror(-error));
+}
+
+}
+
+struct UringServer::Loop {
+    struct Connection {
+        int fd = -1;
+        bool closing = false;   // 已决定断开，等内核结束 recv 后再关闭
+        PeerMetrics *metrics = nullptr;
+        FrameStream stream;
+    };
+
+    Ring ring;
+    int listenFd = -1;
+    int wakeFd = -1;
+    quint64 wakeValue = 0;
+    __kernel_timespec acceptRetryDelay{0, 100 * 1000 * 1000};
+    QHash<quint32, Connection> connections;
+    quint32 nextId = 1;
+
+    ~Loop() {
+        closeSockets();
+        if (wakeFd >= 0) {
+            ::close(wakeFd);
+        }
+    }
+
+    // 对方随后的写入会失败并进入发件箱，而不是写进没人读的接收缓冲区
+    void closeSockets() {
+        for (const Connection &connection : std::as_const(connections)) {
+            ::close(connection.fd);
+        }
+        connections.clear();
+        if (listenFd >= 0) {
+            ::close(listenFd);
+            listenFd = -1;
+        }
+    }
+
+    // 提交队列满时 nextSqe 会先提交已填好的项，只有内核拒绝接收时才返回空
+    void armAccept() {
+        if (io_uring_sqe *sqe = ring.nextSqe()) {
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = listenFd;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            sqe->user_data = userData(Accept);
+        }
+    }
+
+    // accept 出错（多半是文件描述符用完）时隔一会儿再挂，不空转
+    void armAcceptLater() {
+        if (io_uring_sqe *sqe = ring.nextSqe()) {
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<quint64>(&acceptRetryDelay);
+            sqe->len = 1;
+            sqe->user_data = userData(AcceptRetry);
+        }
+    }
+
+    void armReceive(quint32 id, int fd) {
+        if (io_uring_sqe *sqe = ring.nextSqe()) {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = fd;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = Ring::bufferGroup;
+            sqe->user_data = userData(Receive, id);
+        }
+    }
+
+    void armWake() {
+        if (io_uring_sqe *sqe = ring.nextSqe()) {
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = wakeFd;
+            sqe->addr = reinterpret_cast<quint64>(&wakeValue);
+            sqe->len = sizeof(wakeValue);
+            sqe->user_data = userData(Wake);
+        }
+    }
+};
+
+bool UringServer::isSupported() {
+    // 多发 recv 从 6.0 开始才有，老内核上的请求会直接失败
+    utsname system;
+    int major = 0;
+    int minor = 0;
+    if (uname(&system) != 0 || sscanf(system.release, "%d.%d", &major, &minor) != 2 || major < 6) {
+        return false;
+    }
+    // io_uring 可能被 sysctl kernel.io_uring_disabled 或容器的 seccomp 策略禁用
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = ioUringSetup(4, &params);
+    if (fd < 0) {
+        return false;
+    }
+    ::close(fd);
+    return true;
+}
+
+UringServer::UringServer(QObject *parent, int port, const QHostAddress &address) : QObject(parent) {
+    auto state = std::make_unique<Loop>();
+    int result = openListenSocket(address, port, &this->port);
+    if (result < 0) {
+        LOG_ERROR(Transport) << "无法启动 io_uring 服务器:" << errorString(result);
+        return;
+    }
+    state->listenFd = result;
+    state->wakeFd = eventfd(0, EFD_CLOEXEC);
+    result = state->wakeFd < 0 ? -errno : state->ring.open(queueDepth, bufferCount, bufferSize);
+    if (result < 0) {
+        LOG_ERROR(Transport) << "无法创建 io_uring:" << errorString(result);
+        return;
+    }
+
+    // 环只能在循环线程上启用，等它的结果：失败时监听套接字随 loop 一起关闭，使用者改用 TCPServer
+    std::promise<int> enabled;
+    std::future<int> enableResult = enabled.get_future();
+    loop = std::move(state);
+    thread = std::thread(&UringServer::run, this, std::move(enabled));
+    result = enableResult.get();
+    if (result < 0) {
+        LOG_ERROR(Transport) << "无法启用 io_uring:" << errorString(result);
+        thread.join();
+        loop.reset();
+        return;
+    }
+    LOG_DEBUG(Transport) << "io_uring 服务器启动在端口:" << this->port;
+}
+
+UringServer::~UringServer() {
+    if (thread.joinable()) {
+        eventfd_write(loop->wakeFd, 1);
+        thread.join();
+    }
+}
+
+void UringServer::run(std::promise<int> enabled) {
+    Loop &state = *loop;
+    loopThreadId = QThread::currentThreadId();
+    int result = state.ring.enable();
+    if (result == 0) {
+        listening.store(true, std::memory_order_release);
+    }
+    enabled.set_value(result);
+    if (result < 0) {
+        return;
+    }
+    state.armWake();
+    state.armAccept();
+
+    auto closeConnection = [this, &state](QHash<quint32, Loop::Connection>::iterator it) {
+        QByteArray message = it->stream.finish();
+        if (!message.isEmpty() && !it->closing) {
+            it->metrics->messagesReceived.add();
+            it->metrics->bytesReceived.add(quint64(message.size()));
+            emit legacyMessageReceived(Utf8Codec::decode(message));
+        }
+        ::close(it->fd);
+        state.connections.erase(it);
+    };
+
+    auto onAccept = [&state](const io_uring_cqe &cqe) {
+        if (cqe.res >= 0) {
+            Loop::Connection connection;
+            connection.fd = cqe.res;
+            sockaddr_storage peer;
+            socklen_t length = sizeof(peer);
+            QHostAddress address;
+            if (getpeername(connection.fd, reinterpret_cast<sockaddr *>(&peer), &length) == 0) {
+                address = QHostAddress(reinterpret_cast<sockaddr *>(&peer));
+            }
+            connection.metrics = &Metrics::incoming(address);
+            quint32 id = state.nextId++;
+            state.connections.insert(id, connection);
+            state.armReceive(id, connection.fd);
+        } else {
+            LOG_WARNING(Transport) << "io_uring accept 失败:" << errorString(cqe.res);
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            if (cqe.res < 0) {
+                state.armAcceptLater();
+            } else {
+                state.armAccept();
+            }
+        }
+    };
+
+    QList<QByteArray> frames;
+    auto onReceive = [this, &state, &frames, &closeConnection](const io_uring_cqe &cqe) {
+        quint32 id = quint32(cqe.user_data);
+        bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+        quint16 bufferId = quint16(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        auto it = state.connections.find(id);
+        if (it == state.connections.end()) {
+            if (hasBuffer) {
+                state.ring.recycle(bufferId);
+            }
+            return;
+        }
+
+        if (cqe.res > 0 && hasBuffer) {
+            // 帧要交给其他线程，从缓冲区复制出来后立刻还给内核
+            QByteArray data(state.ring.buffer(bufferId), cqe.res);
+            state.ring.recycle(bufferId);
+            if (!it->closing) {
+                frames.clear();
+                bool valid = it->stream.append(data, &frames);
+                for (const QByteArray &frame : std::as_const(frames)) {
+                    it->metrics->messagesReceived.add();
+                    it->metrics->bytesReceived.add(quint64(frame.size()));
+                    emit frameReceived(frame);
+                }
+                if (!valid) {
+                    LOG_WARNING(Transport) << "收到非法消息帧，断开连接";
+                    it->closing = true;
+                    // 不直接关闭：recv 还挂在套接字上，关掉读方向后它会以 0 结束，再走正常的关闭流程
+                    shutdown(it->fd, SHUT_RDWR);
+                }
+            }
+        } else if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+            closeConnection(it);
+            return;
+        }
+
+        // 多发 recv 结束了（缓冲区用完时 -ENOBUFS，或完成队列溢出），重新挂上
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            state.armReceive(id, it->fd);
+        }
+    };
+
+    bool stopping = false;
+    while (!stopping) {
+        result = state.ring.submitAndWait(1);
+        if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY) {
+            LOG_ERROR(Transport) << "io_uring_enter 失败:" << errorString(result);
+            break;
+        }
+        state.ring.reap([&](const io_uring_cqe &cqe) {
+            switch (Operation(cqe.user_data >> 56)) {
+            case Accept:
+                onAccept(cqe);
+                break;
+            case AcceptRetry:
+                state.armAccept();
+                break;
+            case Receive:
+                onReceive(cqe);
+                break;
+            case Wake:
+                stopping = true;
+                break;
+            }
+        });
+    }
+    LOG_DEBUG(Transport) << "io_uring 服务器停止，关闭" << state.connections.size() << "个连接";
+    if (!stopping) {
+        state.closeSockets();
+        listening.store(false, std::memory_order_release);
+        emit failed();
+    }
+}
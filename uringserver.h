@@ -0,0 +1,58 @@
+#ifndef URINGSERVER_H
+#define URINGSERVER_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+
+// 基于 io_uring 的明文端口接收端，只在 Linux 上、以 ENABLE_IO_URING 构建时可用，
+// 接口与 TCPServer 相同，NetworkManager 按 NetworkConfig::ioUring 二选一。
+// 所有连接都在一个线程上处理：监听套接字挂一个多发 accept，每个连接挂一个多发 recv，
+// 数据由内核直接写进预先注册的缓冲区环（bufferCount 个 bufferSize 字节），
+// 每轮循环把新请求和归还的缓冲区一次 io_uring_enter 提交并取回全部完成事件，
+// 连接再多也不需要逐个套接字的系统调用和 Qt 事件。
+// 帧的切分与 TCPConnectionHandler 相同（FrameStream），信号从 io_uring 线程发出，接收方按排队连接处理。
+// 循环出错退出时关闭监听套接字和全部连接并发出 failed()，使用者可以在同一端口改用 TCPServer。
+// 发送仍走 FanOut / TCPClient
+class UringServer : public QObject {
+    Q_OBJECT
+
+public:
+    static const unsigned queueDepth = 256;
+    static const unsigned bufferCount = 512;   // 必须是 2 的幂
+    static const unsigned bufferSize = 16 << 10;
+
+    // 内核支持多发 recv 和缓冲区环（6.0 起）且 io_uring 未被禁用
+    static bool isSupported();
+
+    explicit UringServer(QObject *parent = nullptr, int port = 0, const QHostAddress &address = QHostAddress::Any);
+    ~UringServer();
+
+    bool isListening() const { return listening.load(std::memory_order_acquire); }
+    quint16 serverPort() const { return port; }
+    // io_uring 线程的 QThread::currentThreadId()，构造成功后有效
+    Qt::HANDLE threadId() const { return loopThreadId; }
+
+signals:
+    void frameReceived(const QByteArray &frame);
+    void legacyMessageReceived(const QString &message);
+    // 循环出错停止，端口已释放；从 io_uring 线程发出
+    void failed();
+
+private:
+    struct Loop;
+
+    // 启用环的结果经 enabled 交回构造函数，构造函数返回时 isListening() 已经确定
+    void run(std::promise<int> enabled);
+
+    std::unique_ptr<Loop> loop;
+    std::thread thread;
+    std::atomic<bool> listening{false};
+    Qt::HANDLE loopThreadId = nullptr;
+    quint16 port = 0;
+};
+
+#endif // URINGSERVER_H
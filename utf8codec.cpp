@@ -0,0 +1,399 @@
+#include "utf8codec.h"
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define UTF8CODEC_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define UTF8CODEC_TARGET_SSE2
+#define UTF8CODEC_TARGET_AVX2
+#else
+#define UTF8CODEC_TARGET_SSE2 __attribute__((target("sse2")))
+#define UTF8CODEC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+// 返回写出/跳过的单元数。ASCII 段结束（或数据结束）时返回
+using WidenFn = qsizetype (*)(const uchar *src, qsizetype len, char16_t *dst);
+using NarrowFn = qsizetype (*)(const char16_t *src, qsizetype len, uchar *dst);
+using SkipFn = qsizetype (*)(const uchar *src, qsizetype len);
+
+qsizetype widenAsciiScalar(const uchar *src, qsizetype len, char16_t *dst) {
+    qsizetype i = 0;
+    while (i < len && src[i] < 0x80) {
+        dst[i] = src[i];
+        ++i;
+    }
+    return i;
+}
+
+qsizetype narrowAsciiScalar(const char16_t *src, qsizetype len, uchar *dst) {
+    qsizetype i = 0;
+    while (i < len && src[i] < 0x80) {
+        dst[i] = uchar(src[i]);
+        ++i;
+    }
+    return i;
+}
+
+qsizetype skipAsciiScalar(const uchar *src, qsizetype len) {
+    qsizetype i = 0;
+    while (i < len && src[i] < 0x80) {
+        ++i;
+    }
+    return i;
+}
+
+#ifdef UTF8CODEC_X86
+
+// 加宽时整块写出，即使块内有非 ASCII 字节：dst 的容量不小于剩余输入长度，
+// 多写的部分会被调用方从返回位置开始覆盖
+UTF8CODEC_TARGET_SSE2 qsizetype widenAsciiSse2(const uchar *src, qsizetype len, char16_t *dst) {
+    const __m128i zero = _mm_setzero_si128();
+    qsizetype i = 0;
+    while (i + 16 <= len) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        unsigned mask = unsigned(_mm_movemask_epi8(bytes));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi8(bytes, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_unpackhi_epi8(bytes, zero));
+        if (mask) {
+            return i + std::countr_zero(mask);
+        }
+        i += 16;
+    }
+    return i + widenAsciiScalar(src + i, len - i, dst + i);
+}
+
+UTF8CODEC_TARGET_SSE2 qsizetype narrowAsciiSse2(const char16_t *src, qsizetype len, uchar *dst) {
+    const __m128i highBits = _mm_set1_epi16(short(0xff80));
+    const __m128i zero = _mm_setzero_si128();
+    qsizetype i = 0;
+    while (i + 16 <= len) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+        __m128i high = _mm_and_si128(_mm_or_si128(a, b), highBits);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xffff) {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(a, b));
+        i += 16;
+    }
+    return i + narrowAsciiScalar(src + i, len - i, dst + i);
+}
+
+UTF8CODEC_TARGET_SSE2 qsizetype skipAsciiSse2(const uchar *src, qsizetype len) {
+    qsizetype i = 0;
+    while (i + 16 <= len) {
+        unsigned mask = unsigned(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i))));
+        if (mask) {
+            return i + std::countr_zero(mask);
+        }
+        i += 16;
+    }
+    return i + skipAsciiScalar(src + i, len - i);
+}
+
+UTF8CODEC_TARGET_AVX2 qsizetype widenAsciiAvx2(const uchar *src, qsizetype len, char16_t *dst) {
+    qsizetype i = 0;
+    while (i + 32 <= len) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        unsigned mask = unsigned(_mm256_movemask_epi8(bytes));
+        __m256i low = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes));
+        __m256i high = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 16), high);
+        if (mask) {
+            return i + std::countr_zero(mask);
+        }
+        i += 32;
+    }
+    return i + widenAsciiSse2(src + i, len - i, dst + i);
+}
+
+UTF8CODEC_TARGET_AVX2 qsizetype narrowAsciiAvx2(const char16_t *src, qsizetype len, uchar *dst) {
+    const __m256i highBits = _mm256_set1_epi16(short(0xff80));
+    qsizetype i = 0;
+    while (i + 32 <= len) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 16));
+        if (!_mm256_testz_si256(_mm256_or_si256(a, b), highBits)) {
+            break;
+        }
+        // packus 按 128 位通道交错，需要再把四个 64 位块排回顺序
+        __m256i packed = _mm256_packus_epi16(a, b);
+        packed = _mm256_permute4x64_epi64(packed, 0xd8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), packed);
+        i += 32;
+    }
+    return i + narrowAsciiSse2(src + i, len - i, dst + i);
+}
+
+UTF8CODEC_TARGET_AVX2 qsizetype skipAsciiAvx2(const uchar *src, qsizetype len) {
+    qsizetype i = 0;
+    while (i + 32 <= len) {
+        unsigned mask = unsigned(_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i))));
+        if (mask) {
+            return i + std::countr_zero(mask);
+        }
+        i += 32;
+    }
+    return i + skipAsciiSse2(src + i, len - i);
+}
+
+#endif // UTF8CODEC_X86
+
+// 校验以 src[0]（非 ASCII）开头的多字节序列，返回其长度，非法时返回 0
+inline int sequenceLength(const uchar *src, qsizetype remaining) {
+    uchar b0 = src[0];
+    if (b0 < 0xc2) {
+        return 0;   // 孤立的续字节，或过长的两字节编码
+    }
+    if (b0 < 0xe0) {
+        return remaining >= 2 && (src[1] & 0xc0) == 0x80 ? 2 : 0;
+    }
+    if (b0 < 0xf0) {
+        if (remaining < 3 || (src[1] & 0xc0) != 0x80 || (src[2] & 0xc0) != 0x80) {
+            return 0;
+        }
+        if ((b0 == 0xe0 && src[1] < 0xa0) || (b0 == 0xed && src[1] >= 0xa0)) {
+            return 0;   // 过长编码或代理项
+        }
+        return 3;
+    }
+    if (b0 < 0xf5) {
+        if (remaining < 4 || (src[1] & 0xc0) != 0x80 || (src[2] & 0xc0) != 0x80 || (src[3] & 0xc0) != 0x80) {
+            return 0;
+        }
+        if ((b0 == 0xf0 && src[1] < 0x90) || (b0 == 0xf4 && src[1] >= 0x90)) {
+            return 0;   // 过长编码或超出 U+10FFFF
+        }
+        return 4;
+    }
+    return 0;
+}
+
+qsizetype decodeUtf8(const uchar *src, qsizetype len, char16_t *dst, WidenFn widen) {
+    qsizetype in = 0;
+    qsizetype out = 0;
+    while (in < len) {
+        if (src[in] < 0x80) {
+            qsizetype count = widen(src + in, len - in, dst + out);
+            in += count;
+            out += count;
+            continue;
+        }
+
+        const uchar *s = src + in;
+        switch (sequenceLength(s, len - in)) {
+        case 2:
+            dst[out++] = char16_t(((s[0] & 0x1f) << 6) | (s[1] & 0x3f));
+            in += 2;
+            break;
+        case 3:
+            dst[out++] = char16_t(((s[0] & 0x0f) << 12) | ((s[1] & 0x3f) << 6) | (s[2] & 0x3f));
+            in += 3;
+            break;
+        case 4: {
+            char32_t ucs4 = (char32_t(s[0] & 0x07) << 18) | (char32_t(s[1] & 0x3f) << 12) |
+                            (char32_t(s[2] & 0x3f) << 6) | char32_t(s[3] & 0x3f);
+            dst[out++] = char16_t(0xd7c0 + (ucs4 >> 10));
+            dst[out++] = char16_t(0xdc00 | (ucs4 & 0x3ff));
+            in += 4;
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+    return out;
+}
+
+qsizetype encodeUtf8(const char16_t *src, qsizetype len, uchar *dst, NarrowFn narrow) {
+    qsizetype in = 0;
+    qsizetype out = 0;
+    while (in < len) {
+        char16_t c = src[in];
+        if (c < 0x80) {
+            qsizetype count = narrow(src + in, len - in, dst + out);
+            in += count;
+            out += count;
+            continue;
+        }
+
+        if (c < 0x800) {
+            dst[out++] = uchar(0xc0 | (c >> 6));
+            dst[out++] = uchar(0x80 | (c & 0x3f));
+            in += 1;
+        } else if (c >= 0xd800 && c < 0xdc00) {
+            if (in + 1 >= len || src[in + 1] < 0xdc00 || src[in + 1] >= 0xe000) {
+                return -1;   // 孤立的高代理项
+            }
+            char32_t ucs4 = 0x10000 + ((char32_t(c) - 0xd800) << 10) + (char32_t(src[in + 1]) - 0xdc00);
+            dst[out++] = uchar(0xf0 | (ucs4 >> 18));
+            dst[out++] = uchar(0x80 | ((ucs4 >> 12) & 0x3f));
+            dst[out++] = uchar(0x80 | ((ucs4 >> 6) & 0x3f));
+            dst[out++] = uchar(0x80 | (ucs4 & 0x3f));
+            in += 2;
+        } else if (c >= 0xdc00 && c < 0xe000) {
+            return -1;   // 孤立的低代理项
+        } else {
+            dst[out++] = uchar(0xe0 | (c >> 12));
+            dst[out++] = uchar(0x80 | ((c >> 6) & 0x3f));
+            dst[out++] = uchar(0x80 | (c & 0x3f));
+            in += 1;
+        }
+    }
+    return out;
+}
+
+bool validateUtf8(const uchar *src, qsizetype len, SkipFn skip) {
+    qsizetype in = 0;
+    while (in < len) {
+        if (src[in] < 0x80) {
+            in += skip(src + in, len - in);
+            continue;
+        }
+        int length = sequenceLength(src + in, len - in);
+        if (length == 0) {
+            return false;
+        }
+        in += length;
+    }
+    return true;
+}
+
+struct Kernels {
+    Utf8Codec::Isa isa;
+    WidenFn widen;
+    NarrowFn narrow;
+    SkipFn skip;
+};
+
+bool cpuHasAvx2() {
+#if defined(UTF8CODEC_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(UTF8CODEC_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = info[2] & (1 << 27);
+    bool avx = info[2] & (1 << 28);
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return false;
+#endif
+}
+
+bool cpuHasSse2() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;   // x86-64 基线指令集
+#elif defined(UTF8CODEC_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#elif defined(UTF8CODEC_X86)
+    return true;
+#else
+    return false;
+#endif
+}
+
+Kernels kernelsFor(Utf8Codec::Isa isa) {
+#ifdef UTF8CODEC_X86
+    if (isa == Utf8Codec::Isa::Avx2 && cpuHasAvx2()) {
+        return {Utf8Codec::Isa::Avx2, widenAsciiAvx2, narrowAsciiAvx2, skipAsciiAvx2};
+    }
+    if (isa != Utf8Codec::Isa::Scalar && cpuHasSse2()) {
+        return {Utf8Codec::Isa::Sse2, widenAsciiSse2, narrowAsciiSse2, skipAsciiSse2};
+    }
+#else
+    Q_UNUSED(isa);
+#endif
+    return {Utf8Codec::Isa::Scalar, widenAsciiScalar, narrowAsciiScalar, skipAsciiScalar};
+}
+
+// 首次使用时按 CPU 选择一次
+Kernels &activeKernels() {
+    static Kernels kernels = kernelsFor(Utf8Codec::Isa::Avx2);
+    return kernels;
+}
+
+}
+
+Utf8Codec::Isa Utf8Codec::activeIsa() {
+    return activeKernels().isa;
+}
+
+const char *Utf8Codec::isaName(Isa isa) {
+    switch (isa) {
+    case Isa::Avx2:
+        return "AVX2";
+    case Isa::Sse2:
+        return "SSE2";
+    default:
+        return "Scalar";
+    }
+}
+
+void Utf8Codec::setIsa(Isa isa) {
+    activeKernels() = kernelsFor(isa);
+}
+
+qsizetype Utf8Codec::toUtf16(const char *src, qsizetype len, char16_t *dst) {
+    return decodeUtf8(reinterpret_cast<const uchar *>(src), len, dst, activeKernels().widen);
+}
+
+qsizetype Utf8Codec::toUtf8(const char16_t *src, qsizetype len, char *dst) {
+    return encodeUtf8(src, len, reinterpret_cast<uchar *>(dst), activeKernels().narrow);
+}
+
+bool Utf8Codec::validate(QByteArrayView utf8) {
+    return validateUtf8(reinterpret_cast<const uchar *>(utf8.data()), utf8.size(), activeKernels().skip);
+}
+
+QString Utf8Codec::decode(QByteArrayView utf8) {
+    if (utf8.isEmpty()) {
+        return QString();
+    }
+
+    // UTF-16 单元数不会超过 UTF-8 字节数，按上限分配后一次写完
+    QString result(utf8.size(), Qt::Uninitialized);
+    qsizetype length = toUtf16(utf8.data(), utf8.size(), reinterpret_cast<char16_t *>(result.data()));
+    if (length < 0) {
+        return QString::fromUtf8(utf8);   // 非法序列交给 Qt 按它的规则替换
+    }
+    result.truncate(length);
+    if (length < utf8.size() / 2) {
+        result.squeeze();   // 中文为主时多分配了约三分之二，释放掉
+    }
+    return result;
+}
+
+QByteArray Utf8Codec::encode(QStringView utf16) {
+    if (utf16.isEmpty()) {
+        return QByteArray();
+    }
+
+    QByteArray result(utf16.size() * 3, Qt::Uninitialized);
+    qsizetype length = toUtf8(utf16.utf16(), utf16.size(), result.data());
+    if (length < 0) {
+        return utf16.toUtf8();   // 孤立代理项交给 Qt 处理
+    }
+    result.truncate(length);
+    // 按最坏情况每个 UTF-16 单元 3 字节分配；实际用了不到一半（ASCII 为主时只用三分之一）就释放多余部分，
+    // 否则大消息在发送队列里一直占着三倍内存
+    if (length < result.capacity() / 2) {
+        result.squeeze();
+    }
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef UTF8CODEC_H
+#define UTF8CODEC_H
+
+#include <QString>
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QStringView>
+
+// UTF-8 ⇄ UTF-16 转换。ASCII 段用 SSE2/AVX2 成块处理（运行时按 CPU 选择），
+// 多字节序列走一次遍历同时校验和转换的标量路径。
+// 遇到非法 UTF-8 或孤立代理项时退回 Qt 的实现，保证替换字符的行为与 Qt 一致。
+class Utf8Codec {
+public:
+    enum class Isa { Scalar, Sse2, Avx2 };
+
+    static Isa activeIsa();
+    static const char *isaName(Isa isa);
+
+    // 强制使用某一实现（基准测试对比用）；CPU 不支持时退到可用的最高级别
+    static void setIsa(Isa isa);
+
+    static bool validate(QByteArrayView utf8);
+    static QString decode(QByteArrayView utf8);
+    static QByteArray encode(QStringView utf16);
+
+    // 底层接口：dst 至少要有 len（转 UTF-16）或 len * 3（转 UTF-8）个单元。
+    // 返回写出的单元数；输入非法时返回 -1
+    static qsizetype toUtf16(const char *src, qsizetype len, char16_t *dst);
+    static qsizetype toUtf8(const char16_t *src, qsizetype len, char *dst);
+};
+
+#endif // UTF8CODEC_H